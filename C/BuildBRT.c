@@ -116,13 +116,12 @@ void BuildBinaryRadixTree( __global BrtNode *I, __global BigUnsigned* mpoints, i
     } else {
       const int lcp_min = (d == -1) ? compute_lcp_length(&current, &right, mbits) : compute_lcp_length(&current, &left, mbits);//1ms
       int l_max = 2;
-      temp = mpoints[gid + l_max*d];
       while ( gid + l_max * d >= 0 &&
-              gid + l_max * d <= size - 1 && 
-              compute_lcp_length( &current, &temp, mbits) > lcp_min) 
+              gid + l_max * d <= size - 1)
       {
         temp = mpoints[gid + l_max*d];
-        l_max = l_max << 1; //Not sure if this should be before or after...
+        if (compute_lcp_length( &current, &temp, mbits) <= lcp_min) break;
+        l_max = l_max << 1;
       }
       // Find the other end using binary search.
       // In some cases, the search can go right off the end of the array.
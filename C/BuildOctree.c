@@ -105,7 +105,8 @@ void brt2octree( const int brt_i, __global BrtNode* I, __global volatile OctNode
     }
     int oct_parent;
     if (brt_parent == 0) {
-      oct_parent = 0;
+      // Deepest node of the root's chain. See brt2octree_root.
+      oct_parent = local_splits[0] - 1;
     }
     else {
       oct_parent = prefix_sums[brt_parent-1];
@@ -131,6 +132,19 @@ void brt2octree( const int brt_i, __global BrtNode* I, __global volatile OctNode
   }
 }
 
+// If all points share a prefix, the root of the BRT makes a chain of
+// octree nodes. Unlike the other chains it is stored from the top down so
+// that the root of the octree is always node 0.
+void brt2octree_root(__global BrtNode* I, __global volatile OctNode* octree, __global unsigned int* local_splits) {
+  const int numSplits = local_splits[0];
+  BrtNode brt_node = I[0];
+  for (int i = 0; i < numSplits - 1; ++i) {
+    const int onode = quadrantInLcp(&brt_node, numSplits - 2 - i);
+    octree[i].children[onode] = i + 1;
+    octree[i].leaf &= ~leaf_masks[onode];
+  }
+}
+
 void brt2octree_init(const int brt_i, __global OctNode* octree ) {
   octree[brt_i].leaf = 15;
   for (int i = 0; i < (1 << DIM); ++i) {
@@ -142,12 +156,337 @@ void brt2octree_kernel(__global BrtNode* I, __global OctNode* octree, __global u
   // Initialize octree - needs to be done in parallel
   for (int i = 0; i < octree_size; ++i)
     brt2octree_init( i, octree);
+  brt2octree_root(I, octree, local_splits);
   for (int brt_i = 1; brt_i < n-1; ++brt_i)
     brt2octree( brt_i, I, octree, local_splits, prefix_sums, n, octree_size);
 }
 
+/*
+  Octree to compact octree
+
+  The internal children of node i are given the contiguous block of
+  indices starting at 1 + (exclusive scan of the child counts)[i]. The root
+  keeps index 0. Nodes that aren't reachable from the root get no index.
+*/
+
+void CountInternalChildren(__global OctNode* octree, __global unsigned int* counts, const int gid) {
+  const OctNode node = octree[gid];
+  counts[gid] = popcount_mask(~node.leaf & OCTANT_MASK);
+}
+
+// compact_index must be initialized to -1. scanned_counts is the inclusive
+// scan of the counts from CountInternalChildren.
+void ComputeCompactIndices(__global OctNode* octree, __global unsigned int* scanned_counts, __global int* compact_index, const int gid) {
+  if (gid == 0) {
+    compact_index[0] = 0;
+  }
+  OctNode node = octree[gid];
+  int next = 1 + ((gid == 0) ? 0 : scanned_counts[gid-1]);
+  for (int i = 0; i < (1 << DIM); ++i) {
+    if (!is_leaf(&node, i)) {
+      compact_index[node.children[i]] = next++;
+    }
+  }
+}
+
+void octree2compact(__global OctNode* octree, __global unsigned int* scanned_counts, __global int* compact_index, __global CompactNode* compact, const int gid) {
+  const int index = compact_index[gid];
+  if (index < 0) return;
+  const OctNode node = octree[gid];
+  CompactNode c;
+  c.first_child = 1 + ((gid == 0) ? 0 : scanned_counts[gid-1]);
+  c.child_mask = (unsigned char)(~node.leaf & OCTANT_MASK);
+  c.leaf_mask = (unsigned char)(node.leaf & OCTANT_MASK);
+  compact[index] = c;
+}
+
+/*
+  Octree to linear octree
+
+  The prefix key and level of every octree node are read from the BRT node
+  that created it. Each leaf octant then becomes a cell whose key is the
+  node's key extended by the octant. Once the cell keys are sorted, the
+  level of each cell follows from the distance to the next key, since the
+  leaves tile the domain.
+*/
+
+// node_levels must be initialized to -1 so that octree nodes that aren't
+// created by any BRT node can be skipped.
+void ComputeNodeKeys(__global BrtNode* I, __global unsigned int* local_splits, __global unsigned int* prefix_sums, __global BigUnsigned* node_keys, __global int* node_levels, const int gid) {
+  const int numSplits = local_splits[gid];
+  if (numSplits == 0) return;
+
+  BrtNode brt_node = I[gid];
+  const int level = brt_node.lcp_length / DIM;
+  const int rem = brt_node.lcp_length % DIM;
+  // The deepest node of the chain comes first, except for the root's
+  // chain, which starts at the octree's root. See brt2octree and
+  // brt2octree_root.
+  const int first = (gid == 0) ? 0 : prefix_sums[gid-1];
+  BigUnsigned key;
+  for (int i = 0; i < numSplits; ++i) {
+    const int node = (gid == 0) ? numSplits - 1 - i : first + i;
+    shiftBURight(&key, &brt_node.lcp, rem + i*DIM);
+    zapLeadingZeros(&key);
+    node_keys[node] = key;
+    node_levels[node] = level - i;
+  }
+}
+
+void CountLeaves(__global OctNode* octree, __global int* node_levels, __global unsigned int* counts, const int gid) {
+  if (node_levels[gid] < 0) {
+    counts[gid] = 0;
+    return;
+  }
+  const OctNode node = octree[gid];
+  counts[gid] = popcount_mask(node.leaf & OCTANT_MASK);
+}
+
+// Writes the unsorted full resolution keys of the leaf cells. scanned_counts
+// is the inclusive scan of the counts from CountLeaves.
+void octree2linear(__global OctNode* octree, __global BigUnsigned* node_keys, __global int* node_levels, __global unsigned int* scanned_counts, __global BigUnsigned* keys, const int mbits, const int gid) {
+  const int level = node_levels[gid];
+  if (level < 0) return;
+  OctNode node = octree[gid];
+  BigUnsigned node_key = node_keys[gid];
+  BigUnsigned prefix, octant, temp;
+  int next = (gid == 0) ? 0 : scanned_counts[gid-1];
+  for (int i = 0; i < (1 << DIM); ++i) {
+    if (is_leaf(&node, i)) {
+      shiftBULeft(&temp, &node_key, DIM);
+      initBlkBU(&octant, i);
+      orBU(&prefix, &temp, &octant);
+      shiftBULeft(&temp, &prefix, mbits - DIM*(level+1));
+      // shiftBULeft leaves leading zero blocks when the prefix is zero
+      zapLeadingZeros(&temp);
+      keys[next++] = temp;
+    }
+  }
+}
+
+// keys must be sorted. The level of cell i is given by the number of
+// trailing zeros in keys[i+1] - keys[i].
+void ComputeLinearLevels(__global BigUnsigned* keys, __global LinearCell* cells, const int size, const int mbits, const int gid) {
+  BigUnsigned key = keys[gid];
+  BigUnsigned next, diff;
+  if (gid == size-1) {
+    BigUnsigned one;
+    initBlkBU(&one, 1);
+    shiftBULeft(&next, &one, mbits);
+  } else {
+    next = keys[gid+1];
+  }
+  subtractBU(&diff, &next, &key);
+  int zeros = 0;
+  while (zeros < mbits && !getBUBit(&diff, zeros)) {
+    ++zeros;
+  }
+  LinearCell cell;
+  cell.key = key;
+  cell.level = (mbits - zeros) / DIM;
+  cells[gid] = cell;
+}
+
+/*
+  Breadth-first reorder
+
+  order[i] is the original index of the i'th node in breadth-first order.
+  Levels are processed one at a time: the internal children of the nodes
+  in [level_begin, level_end) are counted, scanned, and then appended to
+  order starting at level_end. Siblings end up contiguous and in octant
+  order.
+*/
+
+void BFSCountChildren(__global OctNode* octree, __global int* order, __global unsigned int* counts, const int level_begin, const int gid) {
+  const OctNode node = octree[order[level_begin + gid]];
+  counts[gid] = popcount_mask(~node.leaf & OCTANT_MASK);
+}
+
+// scanned_counts is the inclusive scan of the counts from BFSCountChildren.
+void BFSScatterChildren(__global OctNode* octree, __global int* order, __global unsigned int* scanned_counts, const int level_begin, const int level_end, const int gid) {
+  OctNode node = octree[order[level_begin + gid]];
+  int next = level_end + ((gid == 0) ? 0 : scanned_counts[gid-1]);
+  for (int i = 0; i < (1 << DIM); ++i) {
+    if (!is_leaf(&node, i)) {
+      order[next++] = node.children[i];
+    }
+  }
+}
+
+void BFSInverse(__global int* order, __global int* new_index, const int gid) {
+  new_index[order[gid]] = gid;
+}
+
+// Leaf octants keep their data.
+void BFSRemap(__global OctNode* octree, __global int* order, __global int* new_index, __global OctNode* result, const int gid) {
+  OctNode node = octree[order[gid]];
+  for (int i = 0; i < (1 << DIM); ++i) {
+    if (!is_leaf(&node, i)) {
+      node.children[i] = new_index[node.children[i]];
+    }
+  }
+  result[gid] = node;
+}
+
+/*
+  Parent and face-neighbor links
+
+  Cells are addressed as in OctreeLinks.h. Each node records the cell it
+  occupies in its parent, from which its level and the same size or larger
+  neighbor of every cell across every face are found.
+*/
+
+// parents must be initialized to -1.
+void ComputeParents(__global OctNode* octree, __global int* parents, const int gid) {
+  OctNode node = octree[gid];
+  for (int i = 0; i < (1 << DIM); ++i) {
+    if (!is_leaf(&node, i)) {
+      parents[node.children[i]] = make_cell_index(gid, i);
+    }
+  }
+}
+
+// Nodes that can't be reached from the root get level -1.
+void ComputeNodeLevels(__global int* parents, __global int* levels, const int gid) {
+  int node = gid;
+  int level = 0;
+  while (parents[node] != -1) {
+    node = cell_node(parents[node]);
+    ++level;
+  }
+  levels[gid] = (node == 0) ? level : -1;
+}
+
+// Returns the same size or larger neighbor of cell across face. The cell's
+// ancestors are climbed until one has a sibling across the face, then the
+// mirrored path is followed back down for as long as the octree allows.
+// path[d] holds the d'th coordinate bit of each octant climbed, lowest
+// level in bit 0.
+int FaceNeighbor(__global OctNode* octree, __global int* parents, const int cell, const int face) {
+  const int bit = 1 << face_axis(face);
+  const int high = face_high(face);
+  int node = cell_node(cell);
+  int octant = cell_octant(cell);
+  int path[DIM];
+  for (int d = 0; d < DIM; ++d) {
+    path[d] = 0;
+  }
+
+  int steps = 0;
+  while (((octant & bit) != 0) == high) {
+    for (int d = 0; d < DIM; ++d) {
+      path[d] |= ((octant >> d) & 1) << steps;
+    }
+    ++steps;
+    const int parent = parents[node];
+    if (parent == -1) return -1;
+    node = cell_node(parent);
+    octant = cell_octant(parent);
+  }
+  octant ^= bit;
+
+  while (steps > 0) {
+    OctNode n = octree[node];
+    if (is_leaf(&n, octant)) break;
+    node = n.children[octant];
+    --steps;
+    octant = 0;
+    for (int d = 0; d < DIM; ++d) {
+      octant |= ((path[d] >> steps) & 1) << d;
+    }
+    octant ^= bit;
+  }
+  return make_cell_index(node, octant);
+}
+
+// One work item per cell. neighbors holds NUM_FACES entries per cell.
+void ComputeFaceNeighbors(__global OctNode* octree, __global int* parents, __global int* neighbors, const int gid) {
+  for (int face = 0; face < NUM_FACES; ++face) {
+    neighbors[gid * NUM_FACES + face] = FaceNeighbor(octree, parents, gid, face);
+  }
+}
+
+/*
+  2:1 balance
+
+  Linear octrees are balanced by rebuilding them from points. A cell is
+  created by the Karras construction exactly when its parent holds points
+  in two different children, so a cell that must exist is represented by
+  its origin and the origin of a sibling. These origins are the corners of
+  required cells, so they never force a split that some required cell
+  doesn't already need.
+
+  A leaf of level l requires itself and, for balance, the face-neighbors of
+  its parent at level l-1. Rebuilding can create new leaves that are out of
+  balance, so the rebuild is repeated until the number of leaves stops
+  changing.
+*/
+
+static inline intn cell_sibling_origin(intn origin, const int width) {
+  origin.x ^= width;
+  return origin;
+}
+
+static inline bool cell_in_domain(const intn origin, const int bits) {
+  const int width = 1 << bits;
+  bool inside = origin.x >= 0 && origin.x < width
+      && origin.y >= 0 && origin.y < width;
+#if DIM == 3
+  inside = inside && origin.z >= 0 && origin.z < width;
+#endif
+  return inside;
+}
+
+static inline intn cell_face_origin(intn origin, const int width, const int face) {
+  const int d = face_high(face) ? width : -width;
+  const int axis = face_axis(face);
+  if (axis == 0) origin.x += d;
+  if (axis == 1) origin.y += d;
+#if DIM == 3
+  if (axis == 2) origin.z += d;
+#endif
+  return origin;
+}
+
+// Writes the LEAF_POINTS_PER_CELL points that recreate cell. The root has
+// no siblings, so its origin is written twice.
+void LeafPoints(__global LinearCell* cells, __global intn* points, const int bits, const int gid) {
+  LinearCell cell = cells[gid];
+  const int width = linear_cell_width(&cell, bits);
+  const intn origin = linear_cell_origin(&cell, bits);
+  points[gid * LEAF_POINTS_PER_CELL] = origin;
+  points[gid * LEAF_POINTS_PER_CELL + 1] =
+      (cell.level > 0) ? cell_sibling_origin(origin, width) : origin;
+}
+
+// Writes BALANCE_POINTS_PER_CELL points: the cell's own points followed by
+// two for each face-neighbor of its parent. Neighbors outside of the domain
+// are replaced by the cell's origin, which is removed when the points are
+// uniqued.
+void BalancePoints(__global LinearCell* cells, __global intn* points, const int bits, const int gid) {
+  LinearCell cell = cells[gid];
+  const int width = linear_cell_width(&cell, bits);
+  const intn origin = linear_cell_origin(&cell, bits);
+  const int first = gid * BALANCE_POINTS_PER_CELL;
+  points[first] = origin;
+  points[first + 1] = (cell.level > 0) ? cell_sibling_origin(origin, width) : origin;
+
+  const int pwidth = width << 1;
+  intn porigin = origin;
+  porigin.x &= ~(pwidth - 1);
+  porigin.y &= ~(pwidth - 1);
+#if DIM == 3
+  porigin.z &= ~(pwidth - 1);
+#endif
+  for (int face = 0; face < NUM_FACES; ++face) {
+    const intn n = cell_face_origin(porigin, pwidth, face);
+    const bool required = cell.level > 1 && cell_in_domain(n, bits);
+    points[first + 2 + 2*face] = required ? n : origin;
+    points[first + 3 + 2*face] = required ? cell_sibling_origin(n, pwidth) : origin;
+  }
+}
+
 #ifndef __OPENCL_VERSION__
 #undef __local
 #undef __global
 #endif
-
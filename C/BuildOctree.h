@@ -5,10 +5,16 @@
     #include ".\opencl\C\BuildBRT.h"
     #include ".\opencl\C\OctNode.h"
     #include ".\opencl\C\BrtNode.h"
+    #include ".\opencl\C\CompactNode.h"
+    #include ".\opencl\C\LinearCell.h"
+    #include ".\opencl\C\OctreeLinks.h"
   #else
     #include "BuildBRT.h"
     #include "OctNode.h"
     #include "BrtNode.h"
+    #include "CompactNode.h"
+    #include "LinearCell.h"
+    #include "OctreeLinks.h"
   #endif
 
   #ifndef __OPENCL_VERSION__
@@ -21,9 +27,34 @@
   void ComputeLocalSplits(__global unsigned int* local_splits, __global BrtNode* I, const int gid );
 
   void brt2octree_init( const int brt_i, __global OctNode* octree );
+  void brt2octree_root(__global BrtNode* I, __global volatile OctNode* octree, __global unsigned int* local_splits);
   void brt2octree( const int brt_i, __global BrtNode* I, __global volatile OctNode* octree, __global unsigned int* local_splits, __global unsigned int* prefix_sums, const int n, const int octree_size);
   void brt2octree_kernel(__global BrtNode* I, __global OctNode* octree, __global unsigned int* local_splits, __global unsigned int* prefix_sums, const int n);
 
+  void CountInternalChildren(__global OctNode* octree, __global unsigned int* counts, const int gid);
+  void ComputeCompactIndices(__global OctNode* octree, __global unsigned int* scanned_counts, __global int* compact_index, const int gid);
+  void octree2compact(__global OctNode* octree, __global unsigned int* scanned_counts, __global int* compact_index, __global CompactNode* compact, const int gid);
+
+  void ComputeNodeKeys(__global BrtNode* I, __global unsigned int* local_splits, __global unsigned int* prefix_sums, __global BigUnsigned* node_keys, __global int* node_levels, const int gid);
+  void CountLeaves(__global OctNode* octree, __global int* node_levels, __global unsigned int* counts, const int gid);
+  void octree2linear(__global OctNode* octree, __global BigUnsigned* node_keys, __global int* node_levels, __global unsigned int* scanned_counts, __global BigUnsigned* keys, const int mbits, const int gid);
+  void ComputeLinearLevels(__global BigUnsigned* keys, __global LinearCell* cells, const int size, const int mbits, const int gid);
+
+  void BFSCountChildren(__global OctNode* octree, __global int* order, __global unsigned int* counts, const int level_begin, const int gid);
+  void BFSScatterChildren(__global OctNode* octree, __global int* order, __global unsigned int* scanned_counts, const int level_begin, const int level_end, const int gid);
+  void BFSInverse(__global int* order, __global int* new_index, const int gid);
+  void BFSRemap(__global OctNode* octree, __global int* order, __global int* new_index, __global OctNode* result, const int gid);
+
+  void ComputeParents(__global OctNode* octree, __global int* parents, const int gid);
+  void ComputeNodeLevels(__global int* parents, __global int* levels, const int gid);
+  int FaceNeighbor(__global OctNode* octree, __global int* parents, const int cell, const int face);
+  void ComputeFaceNeighbors(__global OctNode* octree, __global int* parents, __global int* neighbors, const int gid);
+
+  #define LEAF_POINTS_PER_CELL 2
+  #define BALANCE_POINTS_PER_CELL (2 + 2*NUM_FACES)
+  void LeafPoints(__global LinearCell* cells, __global intn* points, const int bits, const int gid);
+  void BalancePoints(__global LinearCell* cells, __global intn* points, const int bits, const int gid);
+
   #ifndef __OPENCL_VERSION__
   #undef __local
   #undef __global
@@ -0,0 +1,293 @@
+#ifdef  __OPENCL_VERSION__
+  #include ".\opencl\C\CellWalk.h"
+#else
+  #include <stdbool.h>
+  #include <math.h>
+  #include "CellWalk.h"
+#endif
+
+#ifndef __OPENCL_VERSION__
+#define __local
+#define __global
+#endif
+
+/*
+  Cell walk
+
+  The leaves of an octree that a segment ab passes through are visited by
+  starting at the leaf that holds a and repeatedly stepping across the face
+  through which ab leaves the current leaf. Points are in octree space,
+  i.e., [0, 2^bits) on each axis.
+*/
+
+// Finds the leaf cell that contains p, addressed as in OctreeLinks.h, by
+// reading the octant at each level from the bits of p.
+int FindLeafCell(__global OctNode* octree, const intn p, const int bits, intn* origin, int* width) {
+  int node = 0;
+  for (int level = bits-1; level >= 0; --level) {
+    int octant = ((p.x >> level) & 1) | (((p.y >> level) & 1) << 1);
+#if DIM == 3
+    octant |= ((p.z >> level) & 1) << 2;
+#endif
+    // is_leaf takes a private pointer
+    const struct OctNode n = octree[node];
+    if (is_leaf(&n, octant)) {
+      const int mask = ~((1 << level) - 1);
+      origin->x = p.x & mask;
+      origin->y = p.y & mask;
+#if DIM == 3
+      origin->z = p.z & mask;
+#endif
+      *width = 1 << level;
+      return make_cell_index(node, octant);
+    }
+    node = n.children[octant];
+  }
+  return -1;
+}
+
+// One work item per point. Writes the index of the leaf cell that holds
+// each point and the leaf's width.
+void FindLeafCells(__global OctNode* octree, __global intn* points, __global int* cells, __global int* widths, const int bits, const int gid) {
+  intn origin;
+  int width;
+  cells[gid] = FindLeafCell(octree, points[gid], bits, &origin, &width);
+  widths[gid] = width;
+}
+
+static inline float exit_t(const float a, const float b, const int lo, const int width) {
+  if (b > a) return (lo + width - a) / (b - a);
+  if (b < a) return (lo - a) / (b - a);
+  return 2;
+}
+
+static inline int clamp_to_cell(const float v, const int lo, const int width) {
+  const int i = (int)floor(v);
+  return (i < lo) ? lo : ((i >= lo + width) ? lo + width - 1 : i);
+}
+
+// Parameter along ab at which ab leaves the leaf (origin, width), and the
+// axis of the face it leaves through.
+static float ExitParam(const floatn a, const floatn b, const intn origin, const int width, int* axis) {
+  float t[DIM];
+  t[0] = exit_t(a.x, b.x, origin.x, width);
+  t[1] = exit_t(a.y, b.y, origin.y, width);
+#if DIM == 3
+  t[2] = exit_t(a.z, b.z, origin.z, width);
+#endif
+  *axis = 0;
+  for (int i = 1; i < DIM; ++i) {
+    if (t[i] < t[*axis]) *axis = i;
+  }
+  return t[*axis];
+}
+
+// Given the leaf (origin, width) that ab is currently in, writes an integer
+// point in the next leaf along ab. Returns false if b is in the leaf or ab
+// leaves the domain.
+bool NextCellPoint(const floatn a, const floatn b, const intn origin, const int width, const int bits, intn* next) {
+  int axis;
+  const float s = ExitParam(a, b, origin, width, &axis);
+  // Cells are half open, so b on the high face of the cell is in the next
+  // cell.
+  float ha = a.x, hb = b.x;
+  if (axis == 1) {
+    ha = a.y;
+    hb = b.y;
+  }
+#if DIM == 3
+  if (axis == 2) {
+    ha = a.z;
+    hb = b.z;
+  }
+#endif
+  if (s > 1 || (s == 1 && hb < ha)) return false;
+
+  next->x = clamp_to_cell(a.x + (b.x - a.x) * s, origin.x, width);
+  next->y = clamp_to_cell(a.y + (b.y - a.y) * s, origin.y, width);
+#if DIM == 3
+  next->z = clamp_to_cell(a.z + (b.z - a.z) * s, origin.z, width);
+#endif
+  int q = 0;
+  if (axis == 0) {
+    q = next->x = (b.x > a.x) ? origin.x + width : origin.x - 1;
+  }
+  if (axis == 1) {
+    q = next->y = (b.y > a.y) ? origin.y + width : origin.y - 1;
+  }
+#if DIM == 3
+  if (axis == 2) {
+    q = next->z = (b.z > a.z) ? origin.z + width : origin.z - 1;
+  }
+#endif
+  return q >= 0 && q < (1 << bits);
+}
+
+static inline floatn SegmentPoint(const floatn a, const floatn b, const float t) {
+  floatn p;
+  p.x = a.x + (b.x - a.x) * t;
+  p.y = a.y + (b.y - a.y) * t;
+#if DIM == 3
+  p.z = a.z + (b.z - a.z) * t;
+#endif
+  return p;
+}
+
+// Walks ab and returns the number of leaves it passes through. If cells
+// isn't null, the leaves are also written to it in order along ab.
+static int WalkSegment(__global OctNode* octree, const floatn a, const floatn b, const int segment, const int bits, __global SegmentCell* cells) {
+  const int domain = 1 << bits;
+  intn p;
+  p.x = clamp_to_cell(a.x, 0, domain);
+  p.y = clamp_to_cell(a.y, 0, domain);
+#if DIM == 3
+  p.z = clamp_to_cell(a.z, 0, domain);
+#endif
+
+  int count = 0;
+  floatn entry = a;
+  const int max_steps = DIM << (bits+1);
+  for (int i = 0; i < max_steps; ++i) {
+    intn origin;
+    int width;
+    const int cell = FindLeafCell(octree, p, bits, &origin, &width);
+    const bool more = NextCellPoint(a, b, origin, width, bits, &p);
+    if (cells) {
+      int axis;
+      const float t = ExitParam(a, b, origin, width, &axis);
+      SegmentCell c;
+      c.entry = entry;
+      c.exit = (t < 1) ? SegmentPoint(a, b, t) : b;
+      c.cell = cell;
+      c.segment = segment;
+      cells[count] = c;
+      entry = c.exit;
+    }
+    ++count;
+    if (!more) break;
+  }
+  return count;
+}
+
+/*
+  Segment cells
+
+  The leaves that each segment passes through are found in two passes with
+  one work item per segment. The first pass counts the leaves, and after
+  an inclusive scan of the counts the second pass walks again and writes
+  them to a compacted array, grouped by segment.
+*/
+
+void CountSegmentCells(__global OctNode* octree, __global floatn* segments, __global unsigned int* counts, const int bits, const int gid) {
+  counts[gid] = WalkSegment(octree, segments[2*gid], segments[2*gid+1], gid, bits, 0);
+}
+
+void WriteSegmentCells(__global OctNode* octree, __global floatn* segments, __global unsigned int* scanned_counts, __global SegmentCell* cells, const int bits, const int gid) {
+  const int offset = (gid == 0) ? 0 : scanned_counts[gid-1];
+  WalkSegment(octree, segments[2*gid], segments[2*gid+1], gid, bits, cells + offset);
+}
+
+/*
+  Refinement
+
+  A leaf that segments of two different labels pass through is refined by
+  adding sample points at its origin and its center, which lie in
+  different children, and the samples of the boxes that FitBoxes.c fits
+  between the two segments, which lie between them. cell_labels holds the
+  first label seen in each cell and conflicts is set for cells that see a
+  second label and can still be split. cell_segments holds the first
+  segment of each cell and the segment of the second label. One work item
+  walks each segment, so the first label is claimed atomically on the
+  device.
+*/
+
+void InitCellLabels(__global int* cell_labels, __global unsigned int* conflicts, const int gid) {
+  cell_labels[gid] = -1;
+  conflicts[gid] = 0;
+}
+
+static void MarkCell(__global int* cell_labels, __global unsigned int* conflicts, __global intn* cell_origins, __global int* cell_widths, __global int* cell_segments, const int cell, const int label, const int segment, const intn origin, const int width) {
+#ifdef __OPENCL_VERSION__
+  const int old = atomic_cmpxchg(&cell_labels[cell], -1, label);
+#else
+  const int old = cell_labels[cell];
+  if (old == -1) cell_labels[cell] = label;
+#endif
+  if (old == -1) {
+    cell_segments[2*cell] = segment;
+  } else if (old != label && width > 1) {
+    conflicts[cell] = 1;
+    cell_origins[cell] = origin;
+    cell_widths[cell] = width;
+    cell_segments[2*cell+1] = segment;
+  }
+}
+
+// segments holds the two endpoints of each segment.
+void MarkSegmentCells(__global OctNode* octree, __global floatn* segments, __global int* labels, __global int* cell_labels, __global unsigned int* conflicts, __global intn* cell_origins, __global int* cell_widths, __global int* cell_segments, const int bits, const int gid) {
+  const floatn a = segments[2*gid];
+  const floatn b = segments[2*gid+1];
+  const int label = labels[gid];
+  const int domain = 1 << bits;
+  intn p;
+  p.x = clamp_to_cell(a.x, 0, domain);
+  p.y = clamp_to_cell(a.y, 0, domain);
+#if DIM == 3
+  p.z = clamp_to_cell(a.z, 0, domain);
+#endif
+
+  // A segment can't visit more cells than there are smallest cells along
+  // its path.
+  const int max_steps = DIM << (bits+1);
+  for (int i = 0; i < max_steps; ++i) {
+    intn origin;
+    int width;
+    const int cell = FindLeafCell(octree, p, bits, &origin, &width);
+    MarkCell(cell_labels, conflicts, cell_origins, cell_widths, cell_segments, cell, label, gid, origin, width);
+    if (!NextCellPoint(a, b, origin, width, bits, &p)) break;
+  }
+}
+
+// One work item per cell. The samples of the conflicting cells are written
+// after the num_points existing points, and the endpoints of their two
+// segments to pairs, as FitBoxes.c takes them.
+void RefineSamples(__global unsigned int* conflicts, __global unsigned int* scanned_conflicts, __global intn* cell_origins, __global int* cell_widths, __global int* cell_segments, __global floatn* segments, __global intn* points, __global floatn* pairs, const int num_points, const int gid) {
+  if (!conflicts[gid]) return;
+  const int conflict = scanned_conflicts[gid] - 1;
+  const int idx = num_points + 2 * conflict;
+  const intn origin = cell_origins[gid];
+  const int half = cell_widths[gid] / 2;
+  intn center = origin;
+  center.x += half;
+  center.y += half;
+#if DIM == 3
+  center.z += half;
+#endif
+  points[idx] = origin;
+  points[idx+1] = center;
+
+  const int a = cell_segments[2*gid];
+  const int b = cell_segments[2*gid+1];
+  pairs[4*conflict] = segments[2*a];
+  pairs[4*conflict+1] = segments[2*a+1];
+  pairs[4*conflict+2] = segments[2*b];
+  pairs[4*conflict+3] = segments[2*b+1];
+}
+
+// One work item per box. Both samples of each box are written after the
+// num_points existing points, clamped to the domain. A box with one sample
+// writes it twice. Boxes are 2D, as in FitBoxes.c.
+void FitBoxSamples(__global FitBox* boxes, __global intn* points, const int num_points, const int bits, const int gid) {
+  const FitBox box = boxes[gid];
+  const int domain = 1 << bits;
+  for (int i = 0; i < 2; ++i) {
+    const floatn s = box.samples[(i < box.num_samples) ? i : 0];
+    intn p;
+    p.x = clamp_to_cell(s.x, 0, domain);
+    p.y = clamp_to_cell(s.y, 0, domain);
+#if DIM == 3
+    p.z = 0;
+#endif
+    points[num_points + 2*gid + i] = p;
+  }
+}
@@ -0,0 +1,41 @@
+#ifndef __CELL_WALK_H__
+#define __CELL_WALK_H__
+
+  #ifdef __OPENCL_VERSION__
+    #include ".\opencl\C\OctNode.h"
+    #include ".\opencl\C\OctreeLinks.h"
+    #include ".\opencl\C\vec_cl.h"
+    #include ".\opencl\C\FitBoxes.h"
+  #else
+    #include "OctNode.h"
+    #include "OctreeLinks.h"
+    #include "vec_cl.h"
+    #include "FitBoxes.h"
+  #endif
+
+  #ifndef __OPENCL_VERSION__
+  #define __local
+  #define __global
+  #endif
+
+  // A leaf that a segment passes through, with the points at which the
+  // segment enters and leaves it. cell is addressed as in OctreeLinks.h.
+  typedef struct SegmentCell {
+    floatn entry;
+    floatn exit;
+    int cell;
+    int segment;
+  } SegmentCell;
+
+  int FindLeafCell(__global OctNode* octree, const intn p, const int bits, intn* origin, int* width);
+  void FindLeafCells(__global OctNode* octree, __global intn* points, __global int* cells, __global int* widths, const int bits, const int gid);
+  bool NextCellPoint(const floatn a, const floatn b, const intn origin, const int width, const int bits, intn* next);
+
+  void CountSegmentCells(__global OctNode* octree, __global floatn* segments, __global unsigned int* counts, const int bits, const int gid);
+  void WriteSegmentCells(__global OctNode* octree, __global floatn* segments, __global unsigned int* scanned_counts, __global SegmentCell* cells, const int bits, const int gid);
+
+  void InitCellLabels(__global int* cell_labels, __global unsigned int* conflicts, const int gid);
+  void MarkSegmentCells(__global OctNode* octree, __global floatn* segments, __global int* labels, __global int* cell_labels, __global unsigned int* conflicts, __global intn* cell_origins, __global int* cell_widths, __global int* cell_segments, const int bits, const int gid);
+  void RefineSamples(__global unsigned int* conflicts, __global unsigned int* scanned_conflicts, __global intn* cell_origins, __global int* cell_widths, __global int* cell_segments, __global floatn* segments, __global intn* points, __global floatn* pairs, const int num_points, const int gid);
+  void FitBoxSamples(__global FitBox* boxes, __global intn* points, const int num_points, const int bits, const int gid);
+#endif
@@ -0,0 +1,65 @@
+#ifndef __COMPACT_NODE_H__
+#define __COMPACT_NODE_H__
+// A CompactNode is a cache-friendly encoding of an OctNode. Rather than
+// storing 2^DIM absolute child indices, the internal children of a node
+// are stored contiguously, in octant order, starting at first_child. The
+// index of the child in a given octant is found by counting the internal
+// children in the lower octants:
+//
+//   child = first_child + popcount(child_mask & ((1 << octant) - 1))
+//
+// A CompactNode is 8 bytes, compared to 20 (2D) or 36 (3D) bytes for an
+// OctNode.
+
+#ifndef  __OPENCL_VERSION__
+#include "dim.h"
+#else
+#include "./opencl/C/dim.h"
+#endif
+
+typedef struct CompactNode {
+  // Index of the first internal child. Meaningless if child_mask is 0.
+  int first_child;
+  // Bit i is set if octant i is an internal node
+  unsigned char child_mask;
+  // Bit i is set if octant i is a leaf
+  unsigned char leaf_mask;
+} CompactNode;
+
+// Mask with one bit set for each octant
+#define OCTANT_MASK ((1 << (1 << DIM)) - 1)
+
+static inline int popcount_mask(const unsigned int x) {
+#ifdef __OPENCL_VERSION__
+  return popcount(x);
+#else
+  unsigned int v = x - ((x >> 1) & 0x55555555);
+  v = (v & 0x33333333) + ((v >> 2) & 0x33333333);
+  return (((v + (v >> 4)) & 0x0F0F0F0F) * 0x01010101) >> 24;
+#endif
+}
+
+static inline bool compact_is_leaf(const CompactNode* node, const int octant) {
+  return node->leaf_mask & (1 << octant);
+}
+
+static inline int compact_num_children(const CompactNode* node) {
+  return popcount_mask(node->child_mask);
+}
+
+// Index of the internal child in the given octant. The octant must not
+// be a leaf.
+static inline int compact_child(const CompactNode* node, const int octant) {
+  return node->first_child +
+      popcount_mask(node->child_mask & ((1 << octant) - 1));
+}
+
+inline bool compareCompactNode(CompactNode* first, CompactNode* second) {
+  if (first->child_mask != second->child_mask) return false;
+  if (first->leaf_mask != second->leaf_mask) return false;
+  if (first->child_mask != 0 && first->first_child != second->first_child)
+    return false;
+  return true;
+}
+
+#endif
@@ -0,0 +1,452 @@
+#ifdef  __OPENCL_VERSION__
+  #include ".\opencl\C\FitBoxes.h"
+#else
+  #include <stdbool.h>
+  #include <math.h>
+  #include "FitBoxes.h"
+#endif
+
+#ifndef __OPENCL_VERSION__
+#define __local
+#define __global
+#endif
+
+/*
+  Box fitting
+
+  A port of Geom::FitBoxes. Boxes are fit between two segments starting at
+  their closest points and working outward until the segments diverge.
+  Each work item fits one pair of segments twice: once to count its boxes
+  and, after an inclusive scan of the counts, once to write them to a
+  compacted array. The device has no doubles, so line intersections are
+  computed in single precision. Pairs that Geom::FitBoxes throws on are
+  flagged in errors and get no boxes. Points are 2D.
+*/
+
+typedef struct FitSegment {
+  floatn a;
+  floatn b;
+} FitSegment;
+
+static inline floatn fb_make(const float x, const float y) {
+  floatn p;
+  p.x = x;
+  p.y = y;
+  return p;
+}
+
+static inline floatn fb_add(const floatn a, const floatn b) {
+  return fb_make(a.x + b.x, a.y + b.y);
+}
+
+static inline floatn fb_sub(const floatn a, const floatn b) {
+  return fb_make(a.x - b.x, a.y - b.y);
+}
+
+static inline floatn fb_scale(const floatn a, const float s) {
+  return fb_make(a.x * s, a.y * s);
+}
+
+static inline floatn fb_div(const floatn a, const float s) {
+  return fb_make(a.x / s, a.y / s);
+}
+
+static inline float fb_dot(const floatn a, const floatn b) {
+  return a.x * b.x + a.y * b.y;
+}
+
+static inline float fb_length(const floatn a) {
+  return sqrt(fb_dot(a, a));
+}
+
+static inline float fb_dist(const floatn a, const floatn b) {
+  return fb_length(fb_sub(a, b));
+}
+
+static inline bool fb_equal(const floatn a, const floatn b) {
+  return a.x == b.x && a.y == b.y;
+}
+
+static inline floatn fb_unit(const floatn a) {
+  return fb_div(a, fb_length(a));
+}
+
+static inline int fb_sgn(const float f) {
+  return (f < 0) ? -1 : ((f > 0) ? 1 : 0);
+}
+
+static inline FitSegment fb_segment(const floatn a, const floatn b) {
+  FitSegment s;
+  s.a = a;
+  s.b = b;
+  return s;
+}
+
+static inline FitSegment fb_reverse(const FitSegment s) {
+  return fb_segment(s.b, s.a);
+}
+
+static inline floatn fb_seg_unit(const FitSegment s) {
+  return fb_unit(fb_sub(s.b, s.a));
+}
+
+// Point on s closest to p. See Geom::closest.
+static floatn ClosestPoint(const floatn p, const FitSegment s) {
+  if (fb_equal(s.a, s.b))
+    return s.a;
+  const float eps = 1e-6f;
+  const floatn v = fb_unit(fb_sub(s.b, s.a));
+  const float len = fb_length(fb_sub(s.b, s.a));
+  const float t = fb_dot(fb_sub(p, s.a), v);
+  floatn q = fb_add(s.a, fb_scale(v, t));
+  if (t < 0 || fb_dist(q, s.a) < eps)
+    q = s.a;
+  else if (t > len || fb_dist(q, s.b) < eps)
+    q = s.b;
+  return q;
+}
+
+// See Geom::line_intersection
+static floatn LineIntersection(const FitSegment s, const FitSegment r, bool* lines_intersect, bool* segs_intersect) {
+  const float x1 = s.a.x, x2 = s.b.x, x3 = r.a.x, x4 = r.b.x;
+  const float y1 = s.a.y, y2 = s.b.y, y3 = r.a.y, y4 = r.b.y;
+  const float d = (x1 - x2) * (y3 - y4) - (y1 - y2) * (x3 - x4);
+  if (d == 0) {
+    *lines_intersect = false;
+    *segs_intersect = false;
+    return fb_make(0, 0);
+  }
+  *lines_intersect = true;
+  // Geom::line_intersection works in double precision. Solving for the
+  // intersection relative to s.a keeps the single precision result close
+  // to it.
+  const float t = ((x1 - x3) * (y3 - y4) - (y1 - y3) * (x3 - x4)) / d;
+  const float x = x1 + t * (x2 - x1);
+  const float y = y1 + t * (y2 - y1);
+  *segs_intersect = true;
+  if (x < fmin(x1, x2) || x > fmax(x1, x2) ||
+      x < fmin(x3, x4) || x > fmax(x3, x4)) {
+    *segs_intersect = false;
+  }
+  if (y < fmin(y1, y2) || y > fmax(y1, y2) ||
+      y < fmin(y3, y4) || y > fmax(y3, y4)) {
+    *segs_intersect = false;
+  }
+  return fb_make(x, y);
+}
+
+// Closest points between two segments. See Geom::closest.
+static void ClosestPoints(const FitSegment a, const FitSegment b, floatn* ca, floatn* cb, bool* ca_end, bool* cb_end) {
+  bool lines_intersect, segs_intersect;
+  const floatn l_intersection = LineIntersection(a, b, &lines_intersect, &segs_intersect);
+  if (segs_intersect) {
+    *ca = *cb = l_intersection;
+    *ca_end = *cb_end = false;
+    return;
+  }
+  const floatn as[2] = { a.a, a.b };
+  const floatn bs[2] = { b.a, b.b };
+  float dist = -1;
+  for (int i = 0; i < 2; ++i) {
+    const floatn c = ClosestPoint(as[i], b);
+    const float d = fb_dist(as[i], c);
+    if (dist < 0 || d < dist) {
+      *ca = as[i];
+      *cb = c;
+      *ca_end = true;
+      *cb_end = (fb_equal(c, b.a) || fb_equal(c, b.b));
+      dist = d;
+    }
+  }
+  for (int j = 0; j < 2; ++j) {
+    const floatn c = ClosestPoint(bs[j], a);
+    const float d = fb_dist(bs[j], c);
+    if (d < dist) {
+      *ca = c;
+      *cb = bs[j];
+      *ca_end = (fb_equal(c, a.a) || fb_equal(c, a.b));
+      *cb_end = true;
+      dist = d;
+    }
+  }
+  // Endpoints that share an x or y value and whose segments leave in
+  // opposite directions.
+  for (int i = 0; i < 2; ++i) {
+    for (int j = 0; j < 2; ++j) {
+      const floatn a0 = as[i];
+      const floatn a1 = as[(i+1)%2];
+      const floatn b0 = bs[j];
+      const floatn b1 = bs[(j+1)%2];
+      if (a0.x == b0.x) {
+        const int dir_ay = fb_sgn(a1.y - a0.y);
+        const int dir_by = fb_sgn(b1.y - b0.y);
+        const int dir_aby = fb_sgn(b0.y - a0.y);
+        if (dir_ay != dir_by && dir_ay != dir_aby) {
+          *ca = a0;
+          *cb = b0;
+          *ca_end = *cb_end = true;
+        }
+      } else if (a0.y == b0.y) {
+        const int dir_ax = fb_sgn(a1.x - a0.x);
+        const int dir_bx = fb_sgn(b1.x - b0.x);
+        const int dir_abx = fb_sgn(b0.x - a0.x);
+        if (dir_ax != dir_bx && dir_ax != dir_abx) {
+          *ca = a0;
+          *cb = b0;
+          *ca_end = *cb_end = true;
+        }
+      }
+    }
+  }
+}
+
+static bool XGivenY(const FitSegment s, const float y, float* x) {
+  const floatn v = fb_sub(s.b, s.a);
+  const float t = (y - s.a.y) / v.y;
+  *x = s.a.x + t * v.x;
+  return t <= 1;
+}
+
+static bool YGivenX(const FitSegment s, const float x, float* y) {
+  const floatn v = fb_sub(s.b, s.a);
+  const float t = (x - s.a.x) / v.x;
+  *y = s.a.y + t * v.y;
+  return t <= 1;
+}
+
+// See Geom::clip_to_box
+static bool ClipToBox(const FitSegment s, const float d, FitSegment* new_s) {
+  const floatn c = s.a;
+  const float d2 = d/2;
+  const floatn v = fb_sub(s.b, s.a);
+  bool valid;
+  float x, y;
+  if (fabs(v.x) > fabs(v.y)) {
+    x = (v.x < 0) ? c.x - d2 : c.x + d2;
+    valid = YGivenX(s, x, &y);
+  } else {
+    y = (v.y < 0) ? c.y - d2 : c.y + d2;
+    valid = XGivenY(s, y, &x);
+  }
+  if (valid)
+    *new_s = fb_segment(fb_make(x, y), s.b);
+  return valid;
+}
+
+// True if the segments overlap along a line. See Geom::multi_intersection.
+static bool MultiIntersection(const FitSegment s, const FitSegment r) {
+  const float x1 = s.a.x, x2 = s.b.x, x3 = r.a.x, x4 = r.b.x;
+  const float y1 = s.a.y, y2 = s.b.y, y3 = r.a.y, y4 = r.b.y;
+  const float d = (x1 - x2) * (y3 - y4) - (y1 - y2) * (x3 - x4);
+  if (d != 0) return false;
+  if (x2-x1 != 0) {
+    const float m = (y2-y1)/(x2-x1);
+    if (y1-y3 == m * (x1-x3)) {
+      const float len =
+          fmax(x1, fmax(x2, fmax(x3, x4))) - fmin(x1, fmin(x2, fmin(x3, x4)));
+      return len < fabs(x2-x1) + fabs(x4-x3);
+    }
+  } else if (x1 == x3) {
+    const float len =
+        fmax(y1, fmax(y2, fmax(y3, y4))) - fmin(y1, fmin(y2, fmin(y3, y4)));
+    return len < fabs(y2-y1) + fabs(y4-y3);
+  }
+  return false;
+}
+
+// See Geom::FitBoxesNoIntersection. Boxes are written to boxes[*count],
+// boxes[*count+1], ... if boxes isn't null, and *count is advanced.
+// Returns false where Geom::FitBoxesNoIntersection throws.
+static bool FitNoIntersection(FitSegment A, FitSegment B, const float min_d, __global FitBox* boxes, int* count) {
+  const float OFFSET_FACTOR = 4;
+  bool done = false;
+  while (!done) {
+    floatn ca, cb, c_cb;
+    bool ca_end, cb_end, c_cb_end;
+    ClosestPoints(A, B, &ca, &cb, &ca_end, &cb_end);
+    if (fb_equal(ca, cb)) return false;
+    if (!ca_end && !cb_end) return false;
+    // Make A the segment with the end intersection
+    if (cb_end) {
+      const floatn p = ca;
+      ca = cb;
+      cb = p;
+      const bool e = ca_end;
+      ca_end = cb_end;
+      cb_end = e;
+      const FitSegment s = A;
+      A = B;
+      B = s;
+    }
+    if (!ca_end) return false;
+    if (!fb_equal(A.a, ca))
+      A = fb_reverse(A);
+    if (cb_end && !fb_equal(B.a, cb))
+      B = fb_reverse(B);
+
+    float d;
+    floatn o;
+    floatn sample_offset = fb_make(0, 0);
+    if (fb_dist(ca, cb) < min_d) {
+      o = fb_sub(fb_div(fb_add(ca, cb), 2), fb_make(min_d/2, min_d/2));
+      d = min_d;
+      c_cb = cb;
+      c_cb_end = cb_end;
+    } else if (cb_end && (A.a.x == B.a.x || A.a.y == B.a.y)) {
+      // Closest points are axis aligned
+      d = fb_dist(A.a, B.a);
+      o = fb_make(fmin(A.a.x, B.a.x), fmin(A.a.y, B.a.y));
+      if (A.a.x == B.a.x) {
+        sample_offset = fb_make(d/OFFSET_FACTOR, 0);
+        if (A.b.x - A.a.x < 0) {
+          o = fb_sub(o, fb_make(d, 0));
+          sample_offset = fb_scale(sample_offset, -1);
+        }
+      } else if (A.a.y == B.a.y) {
+        sample_offset = fb_make(0, d/16);
+        if (A.b.y - A.a.y < 0) {
+          o = fb_sub(o, fb_make(0, d));
+          sample_offset = fb_scale(sample_offset, -1);
+        }
+      }
+      c_cb = cb;
+      c_cb_end = true;
+    } else {
+      // Best fit for a square between the closest points
+      const floatn v = fb_sub(cb, ca);
+      d = fb_length(v);
+      const float cx_dir = (v.x >= 0) ? 2*d : -2*d;
+      const float cy_dir = (v.y >= 0) ? 2*d : -2*d;
+      const FitSegment C = fb_segment(ca, fb_add(ca, fb_make(cx_dir, cy_dir)));
+      floatn c_cc;
+      bool c_cc_end;
+      ClosestPoints(B, C, &c_cb, &c_cc, &c_cb_end, &c_cc_end);
+      float d_ = fb_dist(ca, c_cb) / sqrt(2.0f);
+      if (!fb_equal(c_cb, c_cc)) {
+        d_ = fmax(fabs(c_cb.x-ca.x), fabs(c_cb.y-ca.y));
+      }
+      if (d_ < d) {
+        d = d_;
+      }
+      o = fb_add(ca, fb_make((v.x >= 0) ? 0 : -d, (v.y >= 0) ? 0 : -d));
+    }
+    if (boxes) {
+      FitBox box;
+      box.origin = o;
+      box.length = d;
+      box.num_samples = 2;
+      box.samples[0] = fb_add(fb_add(ca, fb_div(fb_sub(cb, ca), OFFSET_FACTOR)), sample_offset);
+      box.samples[1] = fb_add(fb_add(cb, fb_div(fb_sub(ca, cb), OFFSET_FACTOR)), sample_offset);
+      boxes[*count] = box;
+    }
+    ++*count;
+
+    // Split B at c_cb and keep the part that goes the way A does
+    if (c_cb_end) {
+      if (!fb_equal(B.a, c_cb))
+        B = fb_reverse(B);
+    } else {
+      const FitSegment B0 = fb_segment(c_cb, B.a);
+      const FitSegment B1 = fb_segment(c_cb, B.b);
+      B = (fb_dot(fb_seg_unit(A), fb_seg_unit(B0)) > 0) ? B0 : B1;
+    }
+
+    if (fb_dot(fb_seg_unit(A), fb_seg_unit(B)) <= 0) {
+      done = true;
+    } else {
+      const floatn bisect = fb_unit(fb_add(fb_seg_unit(A), fb_seg_unit(B)));
+      bool horizontal;
+      if (A.a.x == B.a.x) {
+        horizontal = true;
+      } else if (A.a.y == B.a.y) {
+        horizontal = false;
+      } else {
+        horizontal = (fabs(bisect.x) > fabs(bisect.y));
+      }
+      float A_x, A_y, B_x, B_y;
+      bool A_intersects, B_intersects;
+      if (horizontal) {
+        A_x = B_x = (bisect.x < 0) ? o.x : o.x + d;
+        A_intersects = YGivenX(A, A_x, &A_y);
+        B_intersects = YGivenX(B, B_x, &B_y);
+      } else {
+        A_y = B_y = (bisect.y < 0) ? o.y : o.y + d;
+        A_intersects = XGivenY(A, A_y, &A_x);
+        B_intersects = XGivenY(B, B_y, &B_x);
+      }
+      done = (!A_intersects || !B_intersects);
+      if (fb_equal(A.a, fb_make(A_x, A_y)) && fb_equal(B.a, fb_make(B_x, B_y))) {
+        done = true;
+      }
+      A = fb_segment(fb_make(A_x, A_y), A.b);
+      B = fb_segment(fb_make(B_x, B_y), B.b);
+    }
+  }
+  return true;
+}
+
+// See Geom::FitBoxes. Segments that overlap along a line get no boxes.
+static bool FitPair(FitSegment A, FitSegment B, const float min_d, __global FitBox* boxes, int* count) {
+  if (MultiIntersection(A, B)) return true;
+  floatn ca, cb;
+  bool ca_end, cb_end;
+  ClosestPoints(A, B, &ca, &cb, &ca_end, &cb_end);
+  if (!fb_equal(ca, cb)) {
+    return FitNoIntersection(A, B, min_d, boxes, count);
+  }
+
+  // Intersection: one box around it, and boxes along each side
+  if (boxes) {
+    FitBox box;
+    box.origin = fb_sub(ca, fb_make(min_d/2, min_d/2));
+    box.length = min_d;
+    box.num_samples = 1;
+    box.samples[0] = box.samples[1] = ca;
+    boxes[*count] = box;
+  }
+  ++*count;
+  if (A.a.x > A.b.x)
+    A = fb_reverse(A);
+  if (B.a.x > B.b.x)
+    B = fb_reverse(B);
+  FitSegment A0 = fb_segment(ca, A.a);
+  FitSegment A1 = fb_segment(ca, A.b);
+  FitSegment B0 = fb_segment(cb, B.a);
+  FitSegment B1 = fb_segment(cb, B.b);
+  bool A0_valid = ClipToBox(A0, min_d, &A0);
+  bool A1_valid = ClipToBox(A1, min_d, &A1);
+  const bool B0_valid = ClipToBox(B0, min_d, &B0);
+  const bool B1_valid = ClipToBox(B1, min_d, &B1);
+  if (fb_dot(fb_seg_unit(A0), fb_seg_unit(B0)) < 0) {
+    const FitSegment s = A0;
+    A0 = A1;
+    A1 = s;
+    const bool v = A0_valid;
+    A0_valid = A1_valid;
+    A1_valid = v;
+  }
+  if (A0_valid && B0_valid && !FitNoIntersection(A0, B0, min_d, boxes, count))
+    return false;
+  if (A1_valid && B1_valid && !FitNoIntersection(A1, B1, min_d, boxes, count))
+    return false;
+  return true;
+}
+
+static inline FitSegment PairSegment(__global floatn* pairs, const int pair, const int i) {
+  return fb_segment(pairs[4*pair+2*i], pairs[4*pair+2*i+1]);
+}
+
+void CountFitBoxes(__global floatn* pairs, __global unsigned int* counts, __global int* errors, const float min_d, const int gid) {
+  int count = 0;
+  const bool ok = FitPair(PairSegment(pairs, gid, 0), PairSegment(pairs, gid, 1), min_d, 0, &count);
+  counts[gid] = ok ? count : 0;
+  errors[gid] = ok ? 0 : 1;
+}
+
+void WriteFitBoxes(__global floatn* pairs, __global unsigned int* scanned_counts, __global FitBox* boxes, const float min_d, const int gid) {
+  const unsigned int offset = (gid == 0) ? 0 : scanned_counts[gid-1];
+  // Pairs that failed were counted as having no boxes
+  if (scanned_counts[gid] == offset) return;
+  int count = 0;
+  FitPair(PairSegment(pairs, gid, 0), PairSegment(pairs, gid, 1), min_d, boxes + offset, &count);
+}
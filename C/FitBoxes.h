@@ -0,0 +1,28 @@
+#ifndef __FIT_BOXES_H__
+#define __FIT_BOXES_H__
+
+  #ifdef __OPENCL_VERSION__
+    #include ".\opencl\C\vec_cl.h"
+  #else
+    #include "vec_cl.h"
+  #endif
+
+  #ifndef __OPENCL_VERSION__
+  #define __local
+  #define __global
+  #endif
+
+  // A square box fit between two segments of different labels, and the
+  // samples that go with it: one where the segments cross, two between
+  // the closest points of the segments otherwise.
+  typedef struct FitBox {
+    floatn origin;
+    floatn samples[2];
+    float length;
+    int num_samples;
+  } FitBox;
+
+  // pairs holds the four endpoints A.a, A.b, B.a, B.b of each pair.
+  void CountFitBoxes(__global floatn* pairs, __global unsigned int* counts, __global int* errors, const float min_d, const int gid);
+  void WriteFitBoxes(__global floatn* pairs, __global unsigned int* scanned_counts, __global FitBox* boxes, const float min_d, const int gid);
+#endif
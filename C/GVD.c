@@ -0,0 +1,236 @@
+#ifdef  __OPENCL_VERSION__
+  #include ".\opencl\C\GVD.h"
+  #include ".\opencl\C\CellWalk.h"
+#else
+  #include <stdbool.h>
+  #include <math.h>
+  #include "GVD.h"
+  #include "CellWalk.h"
+#endif
+
+#ifndef __OPENCL_VERSION__
+#define __local
+#define __global
+#endif
+
+/*
+  Generalized Voronoi diagram
+
+  Each leaf is given the segment nearest to its center, from which its
+  label and distance follow. Leaves that segments pass through are seeded
+  with the nearest of their segments. Seeds are then spread by jump
+  flooding: with step halving from the domain width down to 1, each leaf
+  looks at the leaves that hold the points step away from it in each
+  direction and keeps the nearest of their seeds. A final pass with step 1
+  fixes most of the errors jump flooding leaves. Leaves whose label differs
+  from a face neighbor's are GVD cells. seeds, labels and distances are
+  indexed by cell, and only the leaves' entries are used.
+*/
+
+static inline floatn LeafCenter(const GVDLeaf leaf) {
+  const float half = leaf.width / 2.0f;
+  floatn c;
+  c.x = leaf.origin.x + half;
+  c.y = leaf.origin.y + half;
+#if DIM == 3
+  c.z = leaf.origin.z + half;
+#endif
+  return c;
+}
+
+// Squared distance from p to the segment with endpoints a and b
+static float SegmentDist2(const floatn p, const floatn a, const floatn b) {
+  float vv = 0, uv = 0;
+  float v[DIM], u[DIM];
+  v[0] = b.x - a.x;
+  v[1] = b.y - a.y;
+  u[0] = p.x - a.x;
+  u[1] = p.y - a.y;
+#if DIM == 3
+  v[2] = b.z - a.z;
+  u[2] = p.z - a.z;
+#endif
+  for (int i = 0; i < DIM; ++i) {
+    vv += v[i] * v[i];
+    uv += u[i] * v[i];
+  }
+  float t = (vv > 0) ? uv / vv : 0;
+  t = (t < 0) ? 0 : ((t > 1) ? 1 : t);
+  float d2 = 0;
+  for (int i = 0; i < DIM; ++i) {
+    const float d = u[i] - v[i] * t;
+    d2 += d * d;
+  }
+  return d2;
+}
+
+static inline float SeedDist2(__global floatn* segments, const int seed, const floatn p) {
+  return SegmentDist2(p, segments[2*seed], segments[2*seed+1]);
+}
+
+// One work item per leaf. The segments that pass through each cell are
+// seg_ids[seg_start[c]], ..., as built by Karras::BuildLeafSegments.
+void SeedGVDLeaves(__global GVDLeaf* leaves, __global floatn* segments, __global int* seg_start, __global int* seg_count, __global int* seg_ids, __global int* seeds, const int gid) {
+  const GVDLeaf leaf = leaves[gid];
+  const floatn center = LeafCenter(leaf);
+  const int start = seg_start[leaf.cell];
+  int best = -1;
+  float best_d2 = 0;
+  for (int i = start; i < start + seg_count[leaf.cell]; ++i) {
+    const int s = seg_ids[i];
+    const float d2 = SeedDist2(segments, s, center);
+    if (best == -1 || d2 < best_d2 || (d2 == best_d2 && s < best)) {
+      best = s;
+      best_d2 = d2;
+    }
+  }
+  seeds[leaf.cell] = best;
+}
+
+// One work item per leaf
+void JumpFloodGVD(__global OctNode* octree, __global GVDLeaf* leaves, __global floatn* segments, __global int* seeds_in, __global int* seeds_out, const int step, const int bits, const int gid) {
+  const GVDLeaf leaf = leaves[gid];
+  const floatn center = LeafCenter(leaf);
+  const int domain = 1 << bits;
+  int best = seeds_in[leaf.cell];
+  float best_d2 = (best == -1) ? 0 : SeedDist2(segments, best, center);
+
+  // The 3^DIM - 1 directions, each component in {-1, 0, 1}
+  int num_directions = 1;
+  for (int i = 0; i < DIM; ++i) {
+    num_directions *= 3;
+  }
+  for (int d = 0; d < num_directions; ++d) {
+    int o = d;
+    intn p;
+    p.x = leaf.origin.x + leaf.width / 2 + step * (o % 3 - 1);
+    o /= 3;
+    p.y = leaf.origin.y + leaf.width / 2 + step * (o % 3 - 1);
+#if DIM == 3
+    o /= 3;
+    p.z = leaf.origin.z + leaf.width / 2 + step * (o % 3 - 1);
+#endif
+    bool inside = p.x >= 0 && p.x < domain && p.y >= 0 && p.y < domain;
+#if DIM == 3
+    inside = inside && p.z >= 0 && p.z < domain;
+#endif
+    if (!inside) continue;
+
+    intn origin;
+    int width;
+    const int cell = FindLeafCell(octree, p, bits, &origin, &width);
+    const int seed = seeds_in[cell];
+    if (seed == -1 || seed == best) continue;
+    const float d2 = SeedDist2(segments, seed, center);
+    if (best == -1 || d2 < best_d2 || (d2 == best_d2 && seed < best)) {
+      best = seed;
+      best_d2 = d2;
+    }
+  }
+  seeds_out[leaf.cell] = best;
+}
+
+// One work item per leaf. A leaf is a GVD cell if the leaf just across one
+// of its faces, at the face's center, has a different label. A smaller
+// neighbor may be missed from the larger side, but is found from its own.
+void LabelGVDLeaves(__global OctNode* octree, __global GVDLeaf* leaves, __global floatn* segments, __global int* labels, __global int* seeds, __global int* cell_labels, __global float* cell_dists, __global int* gvd, const int bits, const int gid) {
+  const GVDLeaf leaf = leaves[gid];
+  const int seed = seeds[leaf.cell];
+  const int label = (seed == -1) ? -1 : labels[seed];
+  cell_labels[leaf.cell] = label;
+  cell_dists[leaf.cell] = (seed == -1) ? -1 : sqrt(SeedDist2(segments, seed, LeafCenter(leaf)));
+
+  const int domain = 1 << bits;
+  int is_gvd = 0;
+  for (int face = 0; face < NUM_FACES; ++face) {
+    intn p = leaf.origin;
+    p.x += leaf.width / 2;
+    p.y += leaf.width / 2;
+#if DIM == 3
+    p.z += leaf.width / 2;
+#endif
+    // Just across the face
+    const int high = face_high(face);
+    int c = 0;
+    if (face_axis(face) == 0) {
+      c = p.x = high ? leaf.origin.x + leaf.width : leaf.origin.x - 1;
+    }
+    if (face_axis(face) == 1) {
+      c = p.y = high ? leaf.origin.y + leaf.width : leaf.origin.y - 1;
+    }
+#if DIM == 3
+    if (face_axis(face) == 2) {
+      c = p.z = high ? leaf.origin.z + leaf.width : leaf.origin.z - 1;
+    }
+#endif
+    if (c < 0 || c >= domain) continue;
+
+    intn origin;
+    int width;
+    const int cell = FindLeafCell(octree, p, bits, &origin, &width);
+    const int other = seeds[cell];
+    if (other != -1 && labels[other] != label) {
+      is_gvd = 1;
+    }
+  }
+  gvd[leaf.cell] = is_gvd;
+}
+
+// One work item per grid point. Point (i, j), i = gid % nx, is at
+// origin + spacing * (i, j), in the xy plane. It is tested against the
+// candidate segments of its tile, tile_ids[tile_start[t]], ..., where t is
+// (j / tile) * tiles_x + i / tile. Ties between segments at the same
+// distance, e.g., at a shared vertex, go to the segment whose line is
+// farthest from the point, so the sign is that of the vertex's side.
+void SampleDistanceField(__global floatn* segments, __global int* labels, __global int* tile_start, __global int* tile_count, __global int* tile_ids, const floatn origin, const float spacing, const int nx, const int tile, const int tiles_x, const int signed_dist, __global float* dists, __global int* point_labels, const int gid) {
+  const int i = gid % nx;
+  const int j = gid / nx;
+  floatn p = origin;
+  p.x = origin.x + spacing * i;
+  p.y = origin.y + spacing * j;
+  const int t = (j / tile) * tiles_x + i / tile;
+  const int start = tile_start[t];
+  int best = -1;
+  float best_d2 = 0;
+  float best_side = 0;
+  for (int k = start; k < start + tile_count[t]; ++k) {
+    const int s = tile_ids[k];
+    const floatn a = segments[2*s];
+    const floatn b = segments[2*s+1];
+    const float d2 = SegmentDist2(p, a, b);
+    // Signed distance from p to the line through a and b, positive on the
+    // left
+    const float vx = b.x - a.x;
+    const float vy = b.y - a.y;
+    const float len = sqrt(vx * vx + vy * vy);
+    const float side = (len > 0) ? (vx * (p.y - a.y) - vy * (p.x - a.x)) / len : 0;
+    if (best == -1 || d2 < best_d2 || (d2 == best_d2 && fabs(side) > fabs(best_side))) {
+      best = s;
+      best_d2 = d2;
+      best_side = side;
+    }
+  }
+  if (best == -1) {
+    dists[gid] = -1;
+    point_labels[gid] = -1;
+    return;
+  }
+  const float d = sqrt(best_d2);
+  dists[gid] = (signed_dist && best_side > 0) ? -d : d;
+  point_labels[gid] = labels[best];
+}
+
+// One work item per point of each tile, with the tiles taken in
+// tile_order, so that a work group of tile * tile items samples one tile.
+// Work item gid samples point gid % (tile * tile), in row order, of tile
+// tile_order[gid / (tile * tile)]. Items past the edge of the grid do
+// nothing.
+void SampleDistanceFieldTiles(__global floatn* segments, __global int* labels, __global int* tile_start, __global int* tile_count, __global int* tile_ids, __global int* tile_order, const floatn origin, const float spacing, const int nx, const int ny, const int tile, const int tiles_x, const int signed_dist, __global float* dists, __global int* point_labels, const int gid) {
+  const int area = tile * tile;
+  const int t = tile_order[gid / area];
+  const int r = gid % area;
+  const int i = (t % tiles_x) * tile + r % tile;
+  const int j = (t / tiles_x) * tile + r / tile;
+  if (i >= nx || j >= ny) return;
+  SampleDistanceField(segments, labels, tile_start, tile_count, tile_ids, origin, spacing, nx, tile, tiles_x, signed_dist, dists, point_labels, j * nx + i);
+}
@@ -0,0 +1,31 @@
+#ifndef __GVD_H__
+#define __GVD_H__
+
+  #ifdef __OPENCL_VERSION__
+    #include ".\opencl\C\OctNode.h"
+    #include ".\opencl\C\OctreeLinks.h"
+    #include ".\opencl\C\vec_cl.h"
+  #else
+    #include "OctNode.h"
+    #include "OctreeLinks.h"
+    #include "vec_cl.h"
+  #endif
+
+  #ifndef __OPENCL_VERSION__
+  #define __local
+  #define __global
+  #endif
+
+  // A leaf of a pointer-based octree. cell is addressed as in OctreeLinks.h.
+  typedef struct GVDLeaf {
+    intn origin;
+    int width;
+    int cell;
+  } GVDLeaf;
+
+  void SeedGVDLeaves(__global GVDLeaf* leaves, __global floatn* segments, __global int* seg_start, __global int* seg_count, __global int* seg_ids, __global int* seeds, const int gid);
+  void JumpFloodGVD(__global OctNode* octree, __global GVDLeaf* leaves, __global floatn* segments, __global int* seeds_in, __global int* seeds_out, const int step, const int bits, const int gid);
+  void LabelGVDLeaves(__global OctNode* octree, __global GVDLeaf* leaves, __global floatn* segments, __global int* labels, __global int* seeds, __global int* cell_labels, __global float* cell_dists, __global int* gvd, const int bits, const int gid);
+  void SampleDistanceField(__global floatn* segments, __global int* labels, __global int* tile_start, __global int* tile_count, __global int* tile_ids, const floatn origin, const float spacing, const int nx, const int tile, const int tiles_x, const int signed_dist, __global float* dists, __global int* point_labels, const int gid);
+  void SampleDistanceFieldTiles(__global floatn* segments, __global int* labels, __global int* tile_start, __global int* tile_count, __global int* tile_ids, __global int* tile_order, const floatn origin, const float spacing, const int nx, const int ny, const int tile, const int tiles_x, const int signed_dist, __global float* dists, __global int* point_labels, const int gid);
+#endif
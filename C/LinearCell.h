@@ -0,0 +1,30 @@
+#ifndef __LINEAR_CELL_H__
+#define __LINEAR_CELL_H__
+// A linear octree is the sorted array of the octree's leaf cells. Each
+// leaf is identified by its morton prefix and level; there are no child
+// pointers. Because the leaves tile the domain, sorting them by key puts
+// them in z-order and the key of cell i+1 is exactly the end of cell i.
+
+#ifdef __OPENCL_VERSION__
+#include "./opencl/C/z_order.h"
+#else
+#include "z_order.h"
+#endif
+
+typedef struct LinearCell {
+  // Morton code of the minimum corner of the cell at full resolution,
+  // i.e., the cell's prefix key shifted left by DIM*(bits-level).
+  BigUnsigned key;
+  // Level of the cell. The root is level 0.
+  int level;
+} LinearCell;
+
+static inline int linear_cell_width(const LinearCell* cell, const int bits) {
+  return 1 << (bits - cell->level);
+}
+
+static inline intn linear_cell_origin(LinearCell* cell, const int bits) {
+  return z2xyz(&cell->key, bits);
+}
+
+#endif
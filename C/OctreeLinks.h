@@ -0,0 +1,37 @@
+#ifndef __OCTREE_LINKS_H__
+#define __OCTREE_LINKS_H__
+// Parent and face-neighbor links of a pointer-based octree. A cell is
+// addressed by the node that contains it and its octant, packed as
+// (node << DIM) | octant. Faces are numbered 2*axis for the low side of
+// the cell and 2*axis+1 for the high side. -1 is used for "no cell": the
+// parent of the root, or a neighbor outside of the domain.
+
+#ifndef  __OPENCL_VERSION__
+#include "dim.h"
+#else
+#include "./opencl/C/dim.h"
+#endif
+
+#define NUM_FACES (2*DIM)
+
+static inline int make_cell_index(const int node, const int octant) {
+  return (node << DIM) | octant;
+}
+
+static inline int cell_node(const int cell) {
+  return cell >> DIM;
+}
+
+static inline int cell_octant(const int cell) {
+  return cell & ((1 << DIM) - 1);
+}
+
+static inline int face_axis(const int face) {
+  return face >> 1;
+}
+
+static inline int face_high(const int face) {
+  return face & 1;
+}
+
+#endif
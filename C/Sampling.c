@@ -0,0 +1,58 @@
+#ifdef  __OPENCL_VERSION__
+  #include ".\opencl\C\Sampling.h"
+#else
+  #include <math.h>
+  #include "Sampling.h"
+#endif
+
+#ifndef __OPENCL_VERSION__
+#define __local
+#define __global
+#endif
+
+/*
+  Segment sampling
+
+  Points are placed evenly along each segment, both endpoints included, so
+  that no two consecutive samples are farther apart than the segment's
+  spacing. Each work item handles one segment twice: once to count its
+  samples and, after an inclusive scan of the counts, once to write them
+  to a compacted array.
+*/
+
+// Number of intervals the segment is split into
+static int NumIntervals(__global floatn* segments, __global float* spacings, const int gid) {
+  const floatn a = segments[2*gid];
+  const floatn b = segments[2*gid+1];
+  float len2 = (b.x - a.x) * (b.x - a.x) + (b.y - a.y) * (b.y - a.y);
+#if DIM == 3
+  len2 += (b.z - a.z) * (b.z - a.z);
+#endif
+  const float spacing = spacings[gid];
+  if (spacing <= 0) return 1;
+  const int n = (int)ceil(sqrt(len2) / spacing);
+  return (n < 1) ? 1 : n;
+}
+
+// One work item per segment
+void CountSegmentSamples(__global floatn* segments, __global float* spacings, __global unsigned int* counts, const int gid) {
+  counts[gid] = NumIntervals(segments, spacings, gid) + 1;
+}
+
+// One work item per segment
+void WriteSegmentSamples(__global floatn* segments, __global float* spacings, __global unsigned int* scanned_counts, __global floatn* samples, const int gid) {
+  const floatn a = segments[2*gid];
+  const floatn b = segments[2*gid+1];
+  const int n = NumIntervals(segments, spacings, gid);
+  const unsigned int first = (gid == 0) ? 0 : scanned_counts[gid-1];
+  for (int k = 0; k <= n; ++k) {
+    const float t = k / (float)n;
+    floatn p = a;
+    p.x = a.x + (b.x - a.x) * t;
+    p.y = a.y + (b.y - a.y) * t;
+#if DIM == 3
+    p.z = a.z + (b.z - a.z) * t;
+#endif
+    samples[first + k] = p;
+  }
+}
@@ -0,0 +1,19 @@
+#ifndef __SAMPLING_H__
+#define __SAMPLING_H__
+
+  #ifdef __OPENCL_VERSION__
+    #include ".\opencl\C\vec_cl.h"
+  #else
+    #include "vec_cl.h"
+  #endif
+
+  #ifndef __OPENCL_VERSION__
+  #define __local
+  #define __global
+  #endif
+
+  // segments holds the two endpoints of each segment and spacings the
+  // largest distance between consecutive samples of each segment.
+  void CountSegmentSamples(__global floatn* segments, __global float* spacings, __global unsigned int* counts, const int gid);
+  void WriteSegmentSamples(__global floatn* segments, __global float* spacings, __global unsigned int* scanned_counts, __global floatn* samples, const int gid);
+#endif
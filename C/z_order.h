@@ -45,3 +45,24 @@ inline BigUnsigned* xyz2z(BigUnsigned *result, intn p, int bits) {
   }
   return result;
 }
+
+// Inverse of xyz2z.
+static inline intn z2xyz(BigUnsigned *z, int bits) {
+  intn p;
+  p.x = 0;
+  p.y = 0;
+#if DIM == 3
+  p.z = 0;
+#endif
+  for (int i = 0; i < bits; ++i) {
+    if (getBUBit(z, i*DIM + 0))
+      p.x |= (1 << i);
+    if (getBUBit(z, i*DIM + 1))
+      p.y |= (1 << i);
+#if DIM == 3
+    if (getBUBit(z, i*DIM + 2))
+      p.z |= (1 << i);
+#endif
+  }
+  return p;
+}
@@ -0,0 +1,82 @@
+#include "./Parallel.h"
+#include "./CellLabels.h"
+
+using std::vector;
+
+CellLabels::CellLabels(const vector<CellLabel>& records, const int num_cells)
+    : start(num_cells+1, 0) {
+  const int n = records.size();
+  if (n == 0) return;
+
+  vector<int> grouped, totals;
+  GroupByCell(records, num_cells, grouped, totals);
+
+  // Keep the longest record of each label in each cell. The kept records
+  // are moved to the front of the cell's group.
+  vector<int> unique(num_cells);
+  Parallel::For(0, num_cells, [&](const int cell) {
+    const int first = (cell == 0) ? 0 : totals[cell-1];
+    int k = 0;
+    for (int i = first; i < totals[cell]; ++i) {
+      const CellLabel& r = records[grouped[i]];
+      int j = 0;
+      while (j < k && records[grouped[first+j]].label != r.label) ++j;
+      if (j == k) {
+        grouped[first + k++] = grouped[i];
+      } else if (r.seg.length2() > records[grouped[first+j]].seg.length2()) {
+        grouped[first+j] = grouped[i];
+      }
+    }
+    unique[cell] = k;
+  });
+  Parallel::InclusiveScan(unique.data(), &start[1], num_cells);
+
+  labels.resize(start[num_cells]);
+  segs.resize(start[num_cells]);
+  Parallel::For(0, num_cells, [&](const int cell) {
+    const int first = (cell == 0) ? 0 : totals[cell-1];
+    for (int j = 0; j < num_labels(cell); ++j) {
+      const CellLabel& r = records[grouped[first+j]];
+      labels[start[cell]+j] = r.label;
+      segs[start[cell]+j] = r.seg;
+    }
+  });
+}
+
+TriangleLabels::TriangleLabels(
+    const vector<TriangleLabel>& records, const int num_cells)
+    : start(num_cells+1, 0) {
+  const int n = records.size();
+  if (n == 0) return;
+
+  vector<int> grouped, totals;
+  GroupByCell(records, num_cells, grouped, totals);
+
+  // Keep the first record of each label in each cell
+  vector<int> unique(num_cells);
+  Parallel::For(0, num_cells, [&](const int cell) {
+    const int first = (cell == 0) ? 0 : totals[cell-1];
+    int k = 0;
+    for (int i = first; i < totals[cell]; ++i) {
+      const int label = records[grouped[i]].label;
+      int j = 0;
+      while (j < k && records[grouped[first+j]].label != label) ++j;
+      if (j == k) {
+        grouped[first + k++] = grouped[i];
+      }
+    }
+    unique[cell] = k;
+  });
+  Parallel::InclusiveScan(unique.data(), &start[1], num_cells);
+
+  labels.resize(start[num_cells]);
+  triangles.resize(start[num_cells]);
+  Parallel::For(0, num_cells, [&](const int cell) {
+    const int first = (cell == 0) ? 0 : totals[cell-1];
+    for (int j = 0; j < num_labels(cell); ++j) {
+      const TriangleLabel& r = records[grouped[first+j]];
+      labels[start[cell]+j] = r.label;
+      triangles[start[cell]+j] = r.triangle;
+    }
+  });
+}
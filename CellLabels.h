@@ -0,0 +1,139 @@
+#ifndef __CELL_LABELS_H__
+#define __CELL_LABELS_H__
+
+#include <iostream>
+#include <vector>
+
+#include "./Parallel.h"
+#include "./opencl/defs.h"
+#include "./opencl/FloatSegment.h"
+
+// Groups records, anything with a cell member, by cell. The records of
+// cell c are records[grouped[i]] for ends[c-1] <= i < ends[c] (0 for c = 0)
+// in the order they were given. Each chunk of records is counted per cell,
+// the counts are scanned cell by cell and chunk by chunk within a cell, and
+// each chunk then places its records at its offsets.
+template <typename Record>
+void GroupByCell(
+    const std::vector<Record>& records, const int num_cells,
+    std::vector<int>& grouped, std::vector<int>& ends) {
+  const int n = records.size();
+  grouped.resize(n);
+  ends.assign(num_cells, 0);
+  if (n == 0) return;
+
+  const int num_chunks = Parallel::NumChunks(n);
+  std::vector<int> offsets(num_chunks * num_cells, 0);
+  Parallel::ForChunks(0, n, [&](const int begin, const int end, const int c) {
+    int* counts = &offsets[c * num_cells];
+    for (int i = begin; i < end; ++i) {
+      ++counts[records[i].cell];
+    }
+  }, num_chunks);
+  Parallel::For(0, num_cells, [&](const int cell) {
+    int sum = 0;
+    for (int c = 0; c < num_chunks; ++c) {
+      sum += offsets[c * num_cells + cell];
+    }
+    ends[cell] = sum;
+  });
+  Parallel::InclusiveScan(ends.data(), ends.data(), num_cells);
+  Parallel::For(0, num_cells, [&](const int cell) {
+    int offset = (cell == 0) ? 0 : ends[cell-1];
+    for (int c = 0; c < num_chunks; ++c) {
+      const int count = offsets[c * num_cells + cell];
+      offsets[c * num_cells + cell] = offset;
+      offset += count;
+    }
+  });
+  Parallel::ForChunks(0, n, [&](const int begin, const int end, const int c) {
+    int* next = &offsets[c * num_cells];
+    for (int i = begin; i < end; ++i) {
+      grouped[next[records[i].cell]++] = i;
+    }
+  }, num_chunks);
+}
+
+// A labeled segment that passes through a cell (see OctreeLinks.h).
+struct CellLabel {
+  CellLabel() {}
+  CellLabel(const int cell_, const int label_, const FloatSegment& seg_)
+      : cell(cell_), label(label_), seg(seg_) {}
+  int cell;
+  int label;
+  FloatSegment seg;
+};
+
+// The labels of the segments that pass through each cell, in compressed
+// sparse row form. Cell c has labels label(0, c), ..., label(n-1, c), where
+// n = num_labels(c), in the order they were first seen. seg(i, c) is the
+// longest segment of label(i, c) in the cell. A cell can have any number of
+// labels, and memory is proportional to the number of distinct (cell,
+// label) pairs plus one offset per cell.
+class CellLabels {
+ public:
+  CellLabels() : start(1, 0) {}
+
+  // Builds the structure from records in any order, in two parallel passes
+  // of count, scan and fill: the first groups the records by cell (see
+  // GroupByCell), and the second keeps one record per label of each cell.
+  CellLabels(const std::vector<CellLabel>& records, const int num_cells);
+
+  // Number of cells
+  int size() const { return start.size() - 1; }
+  int num_labels(const int cell) const {
+    return start[cell+1] - start[cell];
+  }
+  bool is_multi(const int cell) const { return num_labels(cell) > 1; }
+  int label(const int i, const int cell) const {
+    return labels[start[cell]+i];
+  }
+  const FloatSegment& seg(const int i, const int cell) const {
+    return segs[start[cell]+i];
+  }
+
+ private:
+  std::vector<int> start;
+  std::vector<int> labels;
+  std::vector<FloatSegment> segs;
+};
+
+// A labeled triangle that overlaps a leaf of a 3D octree. cell is
+// (parent << 3) | octant. See OctreeUtils::TriangleCells.
+struct TriangleLabel {
+  TriangleLabel() {}
+  TriangleLabel(const int cell_, const int label_, const int triangle_)
+      : cell(cell_), label(label_), triangle(triangle_) {}
+  int cell;
+  int label;
+  int triangle;
+};
+
+// The 3D counterpart of CellLabels: the labels of the triangles that
+// overlap each cell, in compressed sparse row form, in the order they were
+// first seen. triangle(i, c) is the first triangle of label(i, c) given for
+// the cell.
+class TriangleLabels {
+ public:
+  TriangleLabels() : start(1, 0) {}
+  TriangleLabels(const std::vector<TriangleLabel>& records, const int num_cells);
+
+  int size() const { return start.size() - 1; }
+  int num_labels(const int cell) const {
+    return start[cell+1] - start[cell];
+  }
+  bool is_multi(const int cell) const { return num_labels(cell) > 1; }
+  int label(const int i, const int cell) const {
+    return labels[start[cell]+i];
+  }
+  int triangle(const int i, const int cell) const {
+    return triangles[start[cell]+i];
+  }
+
+ private:
+  std::vector<int> start;
+  std::vector<int> labels;
+  std::vector<int> triangles;
+};
+
+#endif
@@ -2,12 +2,15 @@
 
 #include <iostream>
 #include <algorithm>
+#include <limits>
 #include <memory>
 #include <string>
 
 #include "BoundingBox.h"
 #include "clfw.hpp"
 #include "Kernels.h"
+#include "OctreeUtils.h"
+#include "opencl/Geom.h"
 #include "timer.h"
 
 using std::cout;
@@ -37,6 +40,10 @@ bool equalsBigUnsigned(BigUnsigned& a, BigUnsigned &b) {
 	return 0;
 }
 
+intn z2xyz(BigUnsigned *z, const Resln* resln) {
+  return ::z2xyz(z, resln->bits);
+}
+
 // dwidth is passed in for performance reasons. It is equal to
 //   float dwidth = bb.max_size();
 intn Quantize(
@@ -69,15 +76,21 @@ intn Quantize(
 vector<intn> Quantize(
     const vector<floatn>& points, const Resln& resln,
     const BoundingBox<floatn>* customBB, const bool clamped) {
-  if (points.empty())
+  return Quantize(points.data(), points.size(), resln, customBB, clamped);
+}
+
+vector<intn> Quantize(
+    const floatn* points, const int n, const Resln& resln,
+    const BoundingBox<floatn>* customBB, const bool clamped) {
+  if (n == 0)
     return vector<intn>();
 
   BoundingBox<floatn> bb;
   if (customBB) {
     bb = *customBB;
   } else {
-    for (const floatn& p : points) {
-      bb(p);
+    for (int i = 0; i < n; ++i) {
+      bb(points[i]);
     }
   }
   const float dwidth = bb.max_size();
@@ -88,12 +101,10 @@ vector<intn> Quantize(
   }
 
   // Quantize points to integers
-  vector<intn> qpoints(points.size());
-  for (int i = 0; i < points.size(); ++i) {
-    const floatn& p = points[i];
-    const intn q = Quantize(p, resln, bb, dwidth, clamped);
-    qpoints[i] = q;
-  }
+  vector<intn> qpoints(n);
+  Parallel::For(0, n, [&](const int i) {
+    qpoints[i] = Quantize(points[i], resln, bb, dwidth, clamped);
+  });
   
   return qpoints;
 }
@@ -125,6 +136,249 @@ vector<OctNode> BuildOctreeInSerial( const vector<intn>& points, const Resln& re
   return octree;
 }
 
+vector<OctNode> BuildOctreeInParallel( const vector<intn>& points, const Resln& resln, vector<int>& levelOffsets, const bool verbose) {
+  vector<OctNode> octree;
+  Kernels::BuildOctree_p(points, octree, levelOffsets, resln.bits, resln.mbits);
+  return octree;
+}
+
+vector<OctNode> BuildBalancedOctreeInParallel( const vector<intn>& points, const Resln& resln, vector<int>& levelOffsets, const bool verbose) {
+  vector<OctNode> octree;
+  Kernels::BuildBalancedOctree_p(points, octree, levelOffsets, resln.bits, resln.mbits);
+  return octree;
+}
+
+vector<OctNode> BuildRefinedOctreeInParallel( const vector<intn>& points, const vector<floatn>& segments, const vector<int>& labels, const Resln& resln, const int maxIterations, vector<int>& levelOffsets, const bool verbose) {
+  vector<OctNode> octree;
+  Kernels::BuildRefinedOctree_p(points, segments, labels, octree, levelOffsets, resln.bits, resln.mbits, maxIterations);
+  return octree;
+}
+
+void ReorderBreadthFirst(vector<OctNode>& octree, vector<int>& levelOffsets) {
+  if (octree.empty()) {
+    levelOffsets.clear();
+    return;
+  }
+  vector<OctNode> result;
+  Kernels::ReorderBreadthFirst_s(octree, result, levelOffsets);
+  octree.swap(result);
+}
+
+void BuildOctreeLinks(const vector<OctNode>& octree, OctreeUtils::OctreeLinks& links) {
+  Kernels::ComputeOctreeLinks_s(octree, links.parents, links.levels, links.neighbors);
+}
+
+void MapPointsToCells(const vector<intn>& points, const vector<OctNode>& octree, const Resln& resln, vector<int>& cellPoints) {
+  cellPoints.assign(octree.size() << DIM, -1);
+  if (octree.empty()) return;
+  // Each leaf holds at most one distinct point. Duplicate points may
+  // overwrite each other, so the writes need no ordering.
+  vector<OctCell> cells;
+  OctreeUtils::FindLeaves(points, octree, resln, cells);
+  Parallel::For(0, points.size(), [&](const int i) {
+    cellPoints[make_cell_index(cells[i].get_parent_idx(), cells[i].get_octant())] = i;
+  });
+}
+
+static bool SameKey(const KeyIndex& a, const KeyIndex& b) {
+  return a.first == b.first;
+}
+
+void SortPermutation(const vector<intn>& points, const Resln& resln, vector<int>& permutation) {
+  const int n = points.size();
+  vector<KeyIndex> keys(n);
+  Parallel::For(0, n, [&](const int i) {
+    keys[i] = KeyIndex(OctreeUtils::MortonKey(points[i], resln.bits), i);
+  });
+  std::sort(keys.begin(), keys.end());
+  permutation.resize(n);
+  Parallel::For(0, n, [&](const int i) {
+    permutation[i] = keys[i].second;
+  });
+}
+
+void SortedKeys(const vector<intn>& points, const Resln& resln, vector<KeyIndex>& keys) {
+  const int n = points.size();
+  keys.resize(n);
+  Parallel::For(0, n, [&](const int i) {
+    keys[i] = KeyIndex(OctreeUtils::MortonKey(points[i], resln.bits), i);
+  });
+  std::sort(keys.begin(), keys.end());
+  keys.erase(std::unique(keys.begin(), keys.end(), SameKey), keys.end());
+}
+
+BoundingBox<floatn> PaddedFrame(const BoundingBox<floatn>& bb) {
+  return bb.CenteredSquare() * 2;
+}
+
+void MapOctreePoints(const vector<intn>& qpoints, const BoundingBox<floatn>& bb, const vector<OctNode>& octree, const Resln& resln, OctreePoints& op) {
+  op.bb = bb;
+  op.qpoints = qpoints;
+  SortedKeys(qpoints, resln, op.keys);
+  MapPointsToCells(qpoints, octree, resln, op.cellPoints);
+}
+
+// Appends a node that subdivides cell, or a root if cell is -1, and links
+// it. The neighbors of the new cells are either siblings or found one
+// level below the neighbors of cell.
+static int AddNode(const int cell, vector<OctNode>& octree, OctreeUtils::OctreeLinks& links, vector<int>& cellPoints) {
+  const int idx = octree.size();
+  OctNode node;
+  init_OctNode(&node);
+  octree.push_back(node);
+  cellPoints.resize(octree.size() << DIM, -1);
+  links.parents.push_back(cell);
+  links.neighbors.resize((octree.size() << DIM) * NUM_FACES, -1);
+  if (cell == -1) {
+    links.levels.push_back(0);
+  } else {
+    const int parent = cell_node(cell);
+    set_child(&octree[parent], cell_octant(cell), idx);
+    cellPoints[cell] = -1;
+    links.levels.push_back(links.levels[parent] + 1);
+  }
+
+  for (int octant = 0; octant < (1 << DIM); ++octant) {
+    const int child = make_cell_index(idx, octant);
+    for (int face = 0; face < NUM_FACES; ++face) {
+      const int bit = 1 << face_axis(face);
+      int neighbor = -1;
+      if (((octant & bit) != 0) != face_high(face)) {
+        neighbor = make_cell_index(idx, octant ^ bit);
+      } else if (cell != -1) {
+        neighbor = links.neighbors[cell * NUM_FACES + face];
+        if (neighbor != -1) {
+          const int n = cell_node(neighbor);
+          const int o = cell_octant(neighbor);
+          if (links.levels[n] == links.levels[cell_node(cell)]
+              && !is_leaf(&octree[n], o)) {
+            neighbor = make_cell_index(octree[n][o], octant ^ bit);
+          }
+        }
+      }
+      links.neighbors[child * NUM_FACES + face] = neighbor;
+    }
+  }
+  return idx;
+}
+
+// Subdivides cell, or makes a root if cell is -1, until each leaf holds one
+// of keys[lo, hi), which are the keys under the cell. level is the level of
+// the node that subdivides the cell. Each octant gets the contiguous run of
+// keys whose digit at level is the octant, so the keys are split where they
+// diverge, as in the binary radix tree.
+static void BuildSubtree(const vector<KeyIndex>& keys, const int lo, const int hi, const int cell, const int level, vector<OctNode>& octree, OctreeUtils::OctreeLinks& links, vector<int>& cellPoints, const Resln& resln) {
+  if (hi - lo == 1) {
+    cellPoints[cell] = keys[lo].second;
+    return;
+  }
+  const int node = AddNode(cell, octree, links, cellPoints);
+  const int shift = DIM * (resln.bits - 1 - level);
+  int begin = lo;
+  for (int octant = 0; octant < (1 << DIM); ++octant) {
+    const int end = std::partition_point(
+        keys.begin() + begin, keys.begin() + hi, [&](const KeyIndex& k) {
+          return static_cast<int>((k.first >> shift) & ((1 << DIM) - 1)) == octant;
+        }) - keys.begin();
+    if (end > begin) {
+      BuildSubtree(keys, begin, end, make_cell_index(node, octant), level + 1, octree, links, cellPoints, resln);
+    }
+    begin = end;
+  }
+}
+
+int InsertPoints(const vector<intn>& qpoints, OctreePoints& op, vector<OctNode>& octree, OctreeUtils::OctreeLinks& links, const Resln& resln) {
+  const int size = octree.size();
+  const int first = op.qpoints.size();
+  op.qpoints.insert(op.qpoints.end(), qpoints.begin(), qpoints.end());
+  vector<KeyIndex> added;
+  SortedKeys(qpoints, resln, added);
+  for (KeyIndex& k : added) {
+    k.second += first;
+  }
+
+  // Existing points have smaller indices, so a repeated key keeps its
+  // existing point.
+  vector<KeyIndex> merged(op.keys.size() + added.size());
+  std::merge(op.keys.begin(), op.keys.end(), added.begin(), added.end(), merged.begin());
+  merged.erase(std::unique(merged.begin(), merged.end(), SameKey), merged.end());
+  op.keys.swap(merged);
+  const vector<KeyIndex>& keys = op.keys;
+  const int n = keys.size();
+  if (octree.empty()) {
+    // Too few points were built from for a root, so links and cellPoints
+    // hold nothing of use.
+    links = OctreeUtils::OctreeLinks();
+    op.cellPoints.clear();
+    if (n > 1) {
+      BuildSubtree(keys, 0, n, -1, 0, octree, links, op.cellPoints, resln);
+    }
+    return octree.size() - size;
+  }
+
+  // Rebuild the leaf of each new key from the keys under its cell. The
+  // leaves are disjoint, so each range is rebuilt once.
+  int i = 0;
+  while (i < n) {
+    if (keys[i].second < first) {
+      ++i;
+      continue;
+    }
+    const OctCell leaf = OctreeUtils::FindLeaf(op.qpoints[keys[i].second], octree, resln);
+    const int node = leaf.get_parent_idx();
+    const int level = links.levels[node];
+    const int shift = DIM * (resln.bits - 1 - level);
+    const uint64_t prefix = keys[i].first >> shift;
+    const int lo = std::partition_point(keys.begin(), keys.begin() + i, [&](const KeyIndex& k) {
+      return (k.first >> shift) < prefix;
+    }) - keys.begin();
+    const int hi = std::partition_point(keys.begin() + i, keys.end(), [&](const KeyIndex& k) {
+      return (k.first >> shift) == prefix;
+    }) - keys.begin();
+    BuildSubtree(keys, lo, hi, make_cell_index(node, leaf.get_octant()), level + 1, octree, links, op.cellPoints, resln);
+    i = hi;
+  }
+  return octree.size() - size;
+}
+
+bool InsertPoints(const vector<floatn>& points, OctreePoints& op, vector<OctNode>& octree, OctreeUtils::OctreeLinks& links, const Resln& resln) {
+  const float dwidth = op.bb.max_size();
+  if (dwidth == 0) return false;
+  for (const floatn& p : points) {
+    if (!op.bb.in_closed(p)) return false;
+  }
+  vector<intn> qpoints(points.size());
+  Parallel::For(0, points.size(), [&](const int i) {
+    qpoints[i] = Quantize(points[i], resln, op.bb, dwidth, false);
+  });
+  InsertPoints(qpoints, op, octree, links, resln);
+  return true;
+}
+
+vector<CompactNode> BuildCompactOctreeInParallel( const vector<intn>& points, const Resln& resln, const bool verbose) {
+  vector<CompactNode> octree;
+  Kernels::BuildCompactOctree_p(points, octree, resln.bits, resln.mbits);
+  return octree;
+}
+
+vector<CompactNode> BuildCompactOctreeInSerial( const vector<intn>& points, const Resln& resln, const bool verbose) {
+  vector<CompactNode> octree;
+  Kernels::BuildCompactOctree_s(points, octree, resln.bits, resln.mbits);
+  return octree;
+}
+
+vector<LinearCell> BuildLinearOctreeInParallel( const vector<intn>& points, const Resln& resln, const bool verbose) {
+  vector<LinearCell> cells;
+  Kernels::BuildLinearOctree_p(points, cells, resln.bits, resln.mbits);
+  return cells;
+}
+
+vector<LinearCell> BuildLinearOctreeInSerial( const vector<intn>& points, const Resln& resln, const bool verbose) {
+  vector<LinearCell> cells;
+  Kernels::BuildLinearOctree_s(points, cells, resln.bits, resln.mbits);
+  return cells;
+}
+
 // Debug output
 // void OutputOctreeNode(
 //     const int node, const std::vector<OctNode>& octree, vector<int> path) {
@@ -3,6 +3,7 @@
 
 #include <vector>
 #include <stdexcept>
+#include <utility>
 
 // #include "./opencl/defs.h"
 #include "./opencl/vec.h"
@@ -11,8 +12,16 @@ extern "C" {
 }
 #include "C/z_order.h"
 #include "./OctNode.h"
+#include "./CompactNode.h"
+extern "C" {
+  #include "./LinearCell.h"
+}
 #include "./BoundingBox.h"
 
+namespace OctreeUtils {
+  struct OctreeLinks;
+}
+
 namespace Karras {
 
 intn z2xyz(BigUnsigned *z, const Resln* resln);
@@ -28,6 +37,12 @@ std::vector<intn> Quantize(
     const std::vector<floatn>& points, const Resln& r,
     const BoundingBox<floatn>* customBB = 0, const bool clamped = false);
 
+// Same as above for n points that needn't be in a vector, e.g., the points
+// of a MappedPointFile. Points are quantized in parallel.
+std::vector<intn> Quantize(
+    const floatn* points, const int n, const Resln& r,
+    const BoundingBox<floatn>* customBB = 0, const bool clamped = false);
+
 void sort_points(BigUnsigned* mpoints, const int n);
 
 std::vector<OctNode> BuildOctreeInParallel(
@@ -35,6 +50,124 @@ std::vector<OctNode> BuildOctreeInParallel(
 std::vector<OctNode> BuildOctreeInSerial(
   const std::vector<intn>& opoints, const Resln& r, const bool verbose = false);
 
+// Same as BuildOctreeInParallel and BuildOctreeInSerial, but the result is
+// in the compact encoding. See CompactNode.h.
+std::vector<CompactNode> BuildCompactOctreeInParallel(
+    const std::vector<intn>& opoints, const Resln& r, const bool verbose=false);
+std::vector<CompactNode> BuildCompactOctreeInSerial(
+    const std::vector<intn>& opoints, const Resln& r, const bool verbose=false);
+
+// Builds a linear octree: the leaf cells sorted in z-order. See
+// LinearCell.h.
+std::vector<LinearCell> BuildLinearOctreeInParallel(
+    const std::vector<intn>& opoints, const Resln& r, const bool verbose=false);
+std::vector<LinearCell> BuildLinearOctreeInSerial(
+    const std::vector<intn>& opoints, const Resln& r, const bool verbose=false);
+
+// Same as BuildOctreeInParallel, but the octree is reordered breadth first
+// on the device. See ReorderBreadthFirst.
+std::vector<OctNode> BuildOctreeInParallel(
+    const std::vector<intn>& opoints, const Resln& r,
+    std::vector<int>& levelOffsets, const bool verbose=false);
+
+// Same as above, but the octree is refined until it is 2:1 balanced
+// across faces. See Kernels::BalanceLinearOctree_p.
+std::vector<OctNode> BuildBalancedOctreeInParallel(
+    const std::vector<intn>& opoints, const Resln& r,
+    std::vector<int>& levelOffsets, const bool verbose=false);
+
+// Same as BuildOctreeInParallel, but the octree is refined until no leaf
+// that can still be split is crossed by segments of two different labels,
+// or until maxIterations octrees have been built. segments holds the two
+// endpoints of each segment in octree space and labels one label per
+// segment. The refinement stays on the device. See
+// Kernels::RefineOctree_p.
+std::vector<OctNode> BuildRefinedOctreeInParallel(
+    const std::vector<intn>& opoints, const std::vector<floatn>& segments,
+    const std::vector<int>& labels, const Resln& r, const int maxIterations,
+    std::vector<int>& levelOffsets, const bool verbose=false);
+
+// Reorders an octree breadth first using host threads. The nodes of each
+// level are contiguous, as are the children of each node. levelOffsets[l]
+// is the index of the first node on level l and levelOffsets.back() is the
+// number of nodes.
+void ReorderBreadthFirst(
+    std::vector<OctNode>& octree, std::vector<int>& levelOffsets);
+
+// Computes the parent of every node and the same size or larger
+// face-neighbor of every cell using host threads. The links are used by
+// OctreeUtils::FindNeighbor.
+void BuildOctreeLinks(
+    const std::vector<OctNode>& octree, OctreeUtils::OctreeLinks& links);
+
+// Records the index of the point in each leaf cell of an octree built from
+// points, with cells addressed as in OctreeLinks.h. Empty leaves and
+// internal cells hold -1. See InsertPoints.
+void MapPointsToCells(
+    const std::vector<intn>& points, const std::vector<OctNode>& octree,
+    const Resln& r, std::vector<int>& cellPoints);
+
+// The z-order of quantized points: permutation[i] is the index of the
+// point with the i-th smallest morton code, with ties in input order. This
+// is the order in which the octree builds see the points.
+void SortPermutation(
+    const std::vector<intn>& points, const Resln& r,
+    std::vector<int>& permutation);
+
+// A morton code (see OctreeUtils::MortonKey) and the index of its point
+typedef std::pair<uint64_t, int> KeyIndex;
+
+// The distinct morton codes of points in sorted order, each with the index
+// of the first point that has it.
+void SortedKeys(
+    const std::vector<intn>& points, const Resln& r,
+    std::vector<KeyIndex>& keys);
+
+// The points of an octree, and what InsertPoints needs to add more of them
+// without a rebuild.
+struct OctreePoints {
+  // Frame that the points are quantized in. See PaddedFrame.
+  BoundingBox<floatn> bb;
+  std::vector<intn> qpoints;
+  // See SortedKeys
+  std::vector<KeyIndex> keys;
+  // See MapPointsToCells
+  std::vector<int> cellPoints;
+};
+
+// A square frame twice as wide as bb and centered on it. Points drawn near
+// the points in bb can be quantized in the same frame, so they can be
+// inserted without requantizing the rest.
+BoundingBox<floatn> PaddedFrame(const BoundingBox<floatn>& bb);
+
+// Records the points that octree was built from, quantized in bb.
+void MapOctreePoints(
+    const std::vector<intn>& qpoints, const BoundingBox<floatn>& bb,
+    const std::vector<OctNode>& octree, const Resln& r, OctreePoints& op);
+
+// Inserts quantized points into an octree of op.qpoints. Their sorted keys
+// are merged into op.keys, and each leaf that a new key lands in is rebuilt
+// from the range of keys under its cell, which holds the leaf's old point
+// and the new ones. The range is split where its keys diverge, as in the
+// binary radix tree, and the new nodes are appended after the existing
+// ones, so no node moves and links only grow. Apart from the merge, an
+// insert costs O(depth) rather than a rebuild, but the octree is no longer
+// breadth first. Links of existing cells may then name a cell that has
+// since been subdivided, which FindNeighbor handles. Returns the number of
+// nodes added.
+int InsertPoints(
+    const std::vector<intn>& qpoints, OctreePoints& op,
+    std::vector<OctNode>& octree, OctreeUtils::OctreeLinks& links,
+    const Resln& r);
+
+// Same as above for points in object space, which are quantized in op.bb.
+// Returns false, and changes nothing, if a point is outside op.bb or op.bb
+// is empty, in which case the octree has to be rebuilt in a larger frame.
+bool InsertPoints(
+    const std::vector<floatn>& points, OctreePoints& op,
+    std::vector<OctNode>& octree, OctreeUtils::OctreeLinks& links,
+    const Resln& r);
+
 // Debug output
 // void OutputOctree(const std::vector<OctNode>& octree);
 void OutputOctree(const OctNode* octree, const int n);
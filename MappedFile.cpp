@@ -0,0 +1,64 @@
+#include "./MappedFile.h"
+
+#include <stdexcept>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using std::string;
+using std::logic_error;
+
+MappedFile::MappedFile(const string& filename) : data_(0), size_(0) {
+#ifdef _WIN32
+  file_ = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+                      OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (file_ == INVALID_HANDLE_VALUE)
+    throw logic_error("Can't open " + filename);
+  LARGE_INTEGER size;
+  GetFileSizeEx(file_, &size);
+  size_ = size.QuadPart;
+  mapping_ = (size_ > 0)
+      ? CreateFileMappingA(file_, NULL, PAGE_READONLY, 0, 0, NULL) : NULL;
+  if (mapping_) {
+    data_ = static_cast<const char*>(
+        MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0));
+  }
+  if (!data_) {
+    if (mapping_) CloseHandle(mapping_);
+    CloseHandle(file_);
+    throw logic_error("Can't map " + filename);
+  }
+#else
+  const int fd = open(filename.c_str(), O_RDONLY);
+  if (fd == -1)
+    throw logic_error("Can't open " + filename);
+  struct stat st;
+  if (fstat(fd, &st) == -1 || st.st_size == 0) {
+    close(fd);
+    throw logic_error("Can't map " + filename);
+  }
+  size_ = st.st_size;
+  void* p = mmap(0, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+  // The mapping stays valid after the descriptor is closed
+  close(fd);
+  if (p == MAP_FAILED)
+    throw logic_error("Can't map " + filename);
+  data_ = static_cast<const char*>(p);
+#endif
+}
+
+MappedFile::~MappedFile() {
+#ifdef _WIN32
+  UnmapViewOfFile(data_);
+  CloseHandle(mapping_);
+  CloseHandle(file_);
+#else
+  munmap(const_cast<char*>(data_), size_);
+#endif
+}
@@ -0,0 +1,287 @@
+#include "./ObjFile.h"
+
+#include <climits>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+#include "./Parallel.h"
+
+using std::string;
+using std::vector;
+using std::logic_error;
+
+namespace ObjFile {
+
+namespace {
+
+// Number of records of each kind in one chunk, and afterwards the offsets
+// of the chunk's records in the mesh arrays
+struct Counts {
+  int vertices;
+  int triangles;
+  int segments;
+};
+
+inline bool IsSpace(const char c) {
+  return c == ' ' || c == '\t' || c == '\r';
+}
+
+inline const char* SkipSpace(const char* p, const char* end) {
+  while (p < end && IsSpace(*p)) ++p;
+  return p;
+}
+
+inline const char* SkipToken(const char* p, const char* end) {
+  while (p < end && !IsSpace(*p)) ++p;
+  return p;
+}
+
+inline const char* LineEnd(const char* p, const char* end) {
+  const char* n = static_cast<const char*>(memchr(p, '\n', end - p));
+  return n ? n : end;
+}
+
+// The kind of record on the line starting at p, or 0 if it isn't geometry
+// that we read. On return p is past the record tag.
+inline char RecordType(const char*& p, const char* end) {
+  p = SkipSpace(p, end);
+  if (end - p < 2 || !IsSpace(p[1])) return 0;
+  const char c = p[0];
+  if (c != 'v' && c != 'f' && c != 'l') return 0;
+  p += 2;
+  return c;
+}
+
+// Number of whitespace separated tokens up to a comment
+inline int NumTokens(const char* p, const char* end) {
+  int n = 0;
+  for (p = SkipSpace(p, end); p < end && *p != '#';
+       p = SkipSpace(SkipToken(p, end), end)) {
+    ++n;
+  }
+  return n;
+}
+
+// Start of the first line that begins in [p, end) of the text [begin, end)
+inline const char* LineStart(const char* begin, const char* p,
+                             const char* end) {
+  if (p == begin || p == end) return p;
+  const char* n = static_cast<const char*>(memchr(p-1, '\n', end - (p-1)));
+  return n ? n+1 : end;
+}
+
+// Powers of ten that are exact in a double
+static const double kPow10[] = {
+  1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+// Parses a decimal float such as -1.5e-3. The first 19 significant digits
+// are accumulated in an integer and scaled once, which rounds correctly for
+// the short numbers written by modelling tools and is many times faster
+// than strtod. Returns the end of the number, or 0 if there is none.
+const char* ParseFloat(const char* p, const char* end, float& value) {
+  bool negative = false;
+  if (p < end && (*p == '-' || *p == '+')) {
+    negative = (*p == '-');
+    ++p;
+  }
+  uint64_t mantissa = 0;
+  int digits = 0;
+  int exponent = 0;
+  bool any = false;
+  for (; p < end && *p >= '0' && *p <= '9'; ++p, any = true) {
+    if (digits < 19) {
+      mantissa = mantissa * 10 + (*p - '0');
+      if (mantissa > 0) ++digits;
+    } else {
+      ++exponent;
+    }
+  }
+  if (p < end && *p == '.') {
+    for (++p; p < end && *p >= '0' && *p <= '9'; ++p, any = true) {
+      if (digits < 19) {
+        mantissa = mantissa * 10 + (*p - '0');
+        if (mantissa > 0) ++digits;
+        --exponent;
+      }
+    }
+  }
+  if (!any) return 0;
+  if (p < end && (*p == 'e' || *p == 'E')) {
+    const char* q = p+1;
+    bool negativeExp = false;
+    if (q < end && (*q == '-' || *q == '+')) {
+      negativeExp = (*q == '-');
+      ++q;
+    }
+    if (q < end && *q >= '0' && *q <= '9') {
+      int e = 0;
+      for (; q < end && *q >= '0' && *q <= '9'; ++q) {
+        if (e < 10000) e = e * 10 + (*q - '0');
+      }
+      exponent += negativeExp ? -e : e;
+      p = q;
+    }
+  }
+  double d = static_cast<double>(mantissa);
+  if (mantissa != 0) {
+    if (exponent >= 0 && exponent <= 22) {
+      d *= kPow10[exponent];
+    } else if (exponent < 0 && exponent >= -22) {
+      d /= kPow10[-exponent];
+    } else {
+      d *= std::pow(10.0, exponent);
+    }
+  }
+  value = static_cast<float>(negative ? -d : d);
+  return p;
+}
+
+// Parses a vertex reference such as 12, -3, 12/4 or 12//7 and returns the
+// zero-based vertex index. numBefore is the number of vertices before the
+// record, against which negative indices are resolved.
+const char* ParseIndex(const char* p, const char* end, const int numBefore,
+                       const int numVertices, int& index) {
+  bool negative = false;
+  if (p < end && (*p == '-' || *p == '+')) {
+    negative = (*p == '-');
+    ++p;
+  }
+  if (p == end || *p < '0' || *p > '9') return 0;
+  int64_t i = 0;
+  for (; p < end && *p >= '0' && *p <= '9'; ++p) {
+    if (i <= INT_MAX) i = i * 10 + (*p - '0');
+  }
+  if (i == 0) return 0;
+  i = negative ? numBefore - i : i - 1;
+  if (i < 0 || i >= numVertices) return 0;
+  index = static_cast<int>(i);
+  // Texture and normal indices
+  return SkipToken(p, end);
+}
+
+void CountChunk(const char* p, const char* end, Counts& counts) {
+  counts.vertices = counts.triangles = counts.segments = 0;
+  while (p < end) {
+    const char* lineEnd = LineEnd(p, end);
+    switch (RecordType(p, lineEnd)) {
+      case 'v':
+        ++counts.vertices;
+        break;
+      case 'f':
+        counts.triangles += std::max(0, NumTokens(p, lineEnd) - 2);
+        break;
+      case 'l':
+        counts.segments += std::max(0, NumTokens(p, lineEnd) - 1);
+        break;
+    }
+    p = lineEnd + 1;
+  }
+}
+
+// Parses a chunk into the mesh arrays starting at the chunk's offsets.
+// Returns the start of the first malformed line, or 0.
+const char* ParseChunk(const char* p, const char* end, const Counts& offsets,
+                       const int numVertices, Mesh& mesh) {
+  float3* vertex = mesh.vertices.data() + offsets.vertices;
+  int* triangle = mesh.triangles.data() + 3 * offsets.triangles;
+  int* segment = mesh.segments.data() + 2 * offsets.segments;
+  int numBefore = offsets.vertices;
+  for (; p < end; p = LineEnd(p, end) + 1) {
+    const char* line = p;
+    const char* lineEnd = LineEnd(p, end);
+    const char type = RecordType(p, lineEnd);
+    if (type == 'v') {
+      float3 v = make_float3();
+      for (int i = 0; i < 3; ++i) {
+        p = ParseFloat(SkipSpace(p, lineEnd), lineEnd, v.s[i]);
+        if (!p || (p < lineEnd && !IsSpace(*p))) return line;
+      }
+      *vertex++ = v;
+      ++numBefore;
+    } else if (type == 'f' || type == 'l') {
+      // Faces are split into a fan of triangles about the first vertex
+      int first = -1, prev = -1, k = 0;
+      for (p = SkipSpace(p, lineEnd); p < lineEnd && *p != '#';
+           p = SkipSpace(p, lineEnd), ++k) {
+        int index;
+        p = ParseIndex(p, lineEnd, numBefore, numVertices, index);
+        if (!p) return line;
+        if (type == 'l' && k > 0) {
+          *segment++ = prev;
+          *segment++ = index;
+        } else if (type == 'f' && k > 1) {
+          *triangle++ = first;
+          *triangle++ = prev;
+          *triangle++ = index;
+        }
+        if (k == 0) first = index;
+        prev = index;
+      }
+    }
+  }
+  return 0;
+}
+
+} // namespace
+
+void Parse(const char* begin, const char* end, Mesh& mesh,
+           const int numThreads) {
+  if (end - begin > INT_MAX)
+    throw logic_error("OBJ text is too large");
+  const int n = end - begin;
+  // Byte ranges are moved to line boundaries, so a line belongs to the
+  // chunk it starts in. Both passes split the text into the same chunks.
+  const int numChunks = Parallel::NumChunks(n, numThreads);
+  vector<Counts> offsets(numChunks+1);
+  memset(offsets.data(), 0, sizeof(Counts) * offsets.size());
+  Parallel::ForChunks(0, n, [&](const int first, const int last, const int c) {
+    CountChunk(LineStart(begin, begin+first, end),
+               LineStart(begin, begin+last, end), offsets[c+1]);
+  }, numChunks);
+  for (int c = 0; c < numChunks; ++c) {
+    offsets[c+1].vertices += offsets[c].vertices;
+    offsets[c+1].triangles += offsets[c].triangles;
+    offsets[c+1].segments += offsets[c].segments;
+  }
+
+  const Counts& total = offsets[numChunks];
+  mesh.vertices.resize(total.vertices);
+  mesh.triangles.resize(3 * total.triangles);
+  mesh.segments.resize(2 * total.segments);
+  vector<const char*> errors(numChunks, 0);
+  Parallel::ForChunks(0, n, [&](const int first, const int last, const int c) {
+    errors[c] = ParseChunk(LineStart(begin, begin+first, end),
+                           LineStart(begin, begin+last, end), offsets[c],
+                           total.vertices, mesh);
+  }, numChunks);
+  for (const char* e : errors) {
+    if (e) {
+      throw logic_error(
+          "Malformed OBJ record \"" + string(e, LineEnd(e, end)) + "\"");
+    }
+  }
+}
+
+void Read(const string& filename, Mesh& mesh, const int numThreads) {
+  std::ifstream in(filename.c_str(), std::ios::binary);
+  if (!in)
+    throw logic_error("Can't open " + filename);
+  in.seekg(0, std::ios::end);
+  const std::streamoff size = in.tellg();
+  in.seekg(0, std::ios::beg);
+  vector<char> text(size);
+  if (size > 0 && !in.read(text.data(), size))
+    throw logic_error("Failed reading " + filename);
+  try {
+    Parse(text.data(), text.data() + text.size(), mesh, numThreads);
+  } catch (const logic_error& e) {
+    throw logic_error(filename + ": " + e.what());
+  }
+}
+
+} // namespace
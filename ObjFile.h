@@ -0,0 +1,41 @@
+#ifndef __OBJ_FILE_H__
+#define __OBJ_FILE_H__
+
+#include <string>
+#include <vector>
+
+#include "./opencl/vec.h"
+
+// Multithreaded reading of Wavefront OBJ files, e.g., the meshes in data3/.
+// Only geometry is read: v records give vertices, f records triangles (fans
+// for larger polygons) and l records polyline segments. Texture and normal
+// indices (f 1/2/3 or f 1//3) and all other records are skipped.
+namespace ObjFile {
+
+struct Mesh {
+  std::vector<float3> vertices;
+  // Zero-based vertex indices, three per triangle
+  std::vector<int> triangles;
+  // Zero-based vertex indices, two per segment
+  std::vector<int> segments;
+
+  int numTriangles() const { return triangles.size() / 3; }
+  int numSegments() const { return segments.size() / 2; }
+};
+
+// Parses the OBJ text in [begin, end). The text is split into one chunk per
+// thread at line boundaries. A first pass counts the records in each chunk,
+// the counts are scanned and a second pass parses each chunk straight into
+// its place in the mesh arrays, so nothing is merged or copied afterwards.
+// Negative (relative) indices are resolved against the vertices before the
+// record. Throws logic_error on a malformed number or an index out of range.
+void Parse(const char* begin, const char* end, Mesh& mesh,
+           const int numThreads = 0);
+
+// Reads the whole file with a single read and parses it with Parse.
+void Read(const std::string& filename, Mesh& mesh,
+          const int numThreads = 0);
+
+} // namespace
+
+#endif
@@ -6,23 +6,32 @@ extern "C" {
 }
 #include "./BoundingBox.h"
 #include "./OctNode.h"
+#include "./CompactNode.h"
 
 struct OctCell {
-  OctCell() : parent(0) {}
+  OctCell() : parent(0), leaf(false) {}
   OctCell(const intn origin_, const int width_,
           const int parent_idx_,
           OctNode const* parent_, int octant_,
           OctNode const* node_, int data_)
       : origin(origin_), width(width_),
         parent_idx(parent_idx_), parent(parent_), octant(octant_),
-        node(node_), data(data_) {}
+        node(node_), data(data_), leaf(::is_leaf(parent_, octant_)) {}
+  // Cell in a compact octree. Compact octrees don't carry an OctNode
+  // parent or leaf data, so get_parent() is null and get_data() is -1.
+  OctCell(const intn origin_, const int width_,
+          const int parent_idx_,
+          const CompactNode& parent_, int octant_)
+      : origin(origin_), width(width_),
+        parent_idx(parent_idx_), parent(0), octant(octant_),
+        node(0), data(-1), leaf(compact_is_leaf(&parent_, octant_)) {}
 
   intn get_origin() const { return origin; }
   int get_width() const { return width; }
   int get_parent_idx() const { return parent_idx; }
   OctNode const* get_parent() const { return parent; }
   int get_octant() const { return octant; }
-  bool is_leaf() const { return ::is_leaf(parent, octant); }
+  bool is_leaf() const { return leaf; }
   OctNode const* get_node() const {
     if (is_leaf()) {
       throw std::logic_error("Cannot get node from a non-leaf cell");
@@ -33,7 +42,7 @@ struct OctCell {
     if (!is_leaf()) {
       throw std::logic_error("Cannot get data from a non-leaf cell");
     }
-    return (*parent)[octant];
+    return data;
   }
   int get_level(const Resln& resln) {
     int level = 0;
@@ -63,6 +72,7 @@ struct OctCell {
   int octant;
   OctNode const* node;
   int data;
+  bool leaf;
 };
 
 inline std::ostream& operator<<(std::ostream& out, const OctCell& cell) {
@@ -0,0 +1,145 @@
+#include "./OctreeFile.h"
+
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+using std::string;
+using std::vector;
+using std::logic_error;
+
+static const char kMagic[8] = { 'P', 'G', 'V', 'D', 'O', 'C', 'T', 0 };
+static const uint32_t kVersion = 1;
+// Sections start on a boundary of this many bytes
+static const uint64_t kAlignment = 64;
+
+static uint64_t Align(const uint64_t offset) {
+  return (offset + kAlignment - 1) / kAlignment * kAlignment;
+}
+
+// Places a section of count entries of size bytes after end
+static uint64_t Section(
+    const uint64_t count, const uint64_t size, uint64_t& end) {
+  if (count == 0) return 0;
+  const uint64_t offset = Align(end);
+  end = offset + count * size;
+  return offset;
+}
+
+void WriteOctreeFile(
+    const string& filename, const OctreeFileFormat format,
+    const size_t nodeSize, const void* nodes, const size_t numNodes,
+    const Resln& resln, const BoundingBox<floatn>& bb,
+    const OctreePayload& payload, const vector<int>& permutation) {
+  OctreeFileHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.version = kVersion;
+  header.dim = DIM;
+  header.node_format = format;
+  header.node_size = nodeSize;
+  header.width = resln.width;
+  header.volume = resln.volume;
+  header.bits = resln.bits;
+  header.mbits = resln.mbits;
+  for (int d = 0; d < DIM; ++d) {
+    header.bb_min[d] = bb.min().s[d];
+    header.bb_max[d] = bb.max().s[d];
+  }
+  uint64_t end = sizeof(header);
+  header.num_nodes = numNodes;
+  header.nodes_offset = Section(numNodes, nodeSize, end);
+  header.num_payloads = payload.count;
+  header.payload_size = payload.size;
+  header.payloads_offset = Section(payload.count, payload.size, end);
+  header.num_points = permutation.size();
+  header.points_offset = Section(permutation.size(), sizeof(int), end);
+
+  std::ofstream out(filename.c_str(), std::ios::binary);
+  if (!out)
+    throw logic_error("Can't open " + filename + " for writing");
+  out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  const char zeros[kAlignment] = { 0 };
+  uint64_t written = sizeof(header);
+  const struct {
+    uint64_t offset;
+    const void* data;
+    uint64_t length;
+  } sections[] = {
+    { header.nodes_offset, nodes, numNodes * nodeSize },
+    { header.payloads_offset, payload.data, payload.count * payload.size },
+    { header.points_offset, permutation.data(),
+      permutation.size() * sizeof(int) }
+  };
+  for (const auto& s : sections) {
+    if (s.length == 0) continue;
+    out.write(zeros, s.offset - written);
+    out.write(static_cast<const char*>(s.data), s.length);
+    written = s.offset + s.length;
+  }
+  if (!out)
+    throw logic_error("Failed writing " + filename);
+}
+
+MappedOctreeFile::MappedOctreeFile(const string& filename)
+    : file_(filename),
+      header_(reinterpret_cast<const OctreeFileHeader*>(file_.data())) {
+  const uint64_t length = file_.size();
+  if (length < sizeof(OctreeFileHeader)
+      || memcmp(header_->magic, kMagic, sizeof(kMagic)) != 0) {
+    throw logic_error(filename + " isn't an octree file");
+  }
+  if (header_->version != kVersion) {
+    throw logic_error(filename + " has an unsupported version");
+  }
+  // Each section must lie within the file
+  const struct {
+    uint64_t offset;
+    uint64_t count;
+    uint64_t size;
+  } sections[] = {
+    { header_->nodes_offset, header_->num_nodes, header_->node_size },
+    { header_->payloads_offset, header_->num_payloads, header_->payload_size },
+    { header_->points_offset, header_->num_points, sizeof(int) }
+  };
+  for (const auto& s : sections) {
+    if (s.count == 0) continue;
+    if (s.size == 0 || s.offset < sizeof(OctreeFileHeader)
+        || s.offset % kAlignment != 0 || s.offset > length
+        || (length - s.offset) / s.size < s.count) {
+      throw logic_error(filename + " is corrupt");
+    }
+  }
+}
+
+Resln MappedOctreeFile::resln() const {
+  Resln r;
+  r.width = header_->width;
+  r.volume = header_->volume;
+  r.bits = header_->bits;
+  r.mbits = header_->mbits;
+  return r;
+}
+
+BoundingBox<floatn> MappedOctreeFile::bounding_box() const {
+  floatn lo, hi;
+  for (int d = 0; d < DIM; ++d) {
+    lo.s[d] = (d < dim()) ? header_->bb_min[d] : 0;
+    hi.s[d] = (d < dim()) ? header_->bb_max[d] : 0;
+  }
+  return BoundingBox<floatn>(lo, hi);
+}
+
+void MappedOctreeFile::CheckNodes(
+    const OctreeFileFormat format, const size_t size) const {
+  if (header_->node_format != format || header_->node_size != size
+      || header_->dim != DIM) {
+    throw logic_error("Octree file doesn't hold nodes of this type");
+  }
+}
+
+void MappedOctreeFile::CheckPayloads(const size_t size) const {
+  if (header_->payload_size != size) {
+    throw logic_error("Octree file payloads are of another size");
+  }
+}
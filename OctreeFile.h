@@ -0,0 +1,156 @@
+#ifndef __OCTREE_FILE_H__
+#define __OCTREE_FILE_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "./opencl/vec.h"
+#include "./OctNode.h"
+#include "./CompactNode.h"
+extern "C" {
+  #include "./Resln.h"
+  #include "./LinearCell.h"
+}
+#include "./BoundingBox.h"
+#include "./MappedFile.h"
+
+// Binary octree files for passing octrees between pipeline stages and
+// processes. A 128 byte header is followed by up to three sections, each
+// starting on a 64 byte boundary: the raw node array, optional leaf
+// payloads and an optional sorted point permutation. Data is in native
+// (little endian) byte order, so a mapped file can be used in place.
+enum OctreeFileFormat {
+  kOctreeFileOctNode = 0,
+  kOctreeFileCompactNode = 1,
+  kOctreeFileLinearCell = 2
+};
+
+struct OctreeFileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t dim;
+  // OctreeFileFormat of the nodes and sizeof one node
+  uint32_t node_format;
+  uint32_t node_size;
+  // Resln
+  int32_t width;
+  int32_t volume;
+  int32_t bits;
+  int32_t mbits;
+  // Object space bounding box. Only the first dim coordinates are used.
+  float bb_min[3];
+  float bb_max[3];
+  // Sections. Offsets are from the start of the file; an empty section has
+  // a count and offset of 0.
+  uint64_t num_nodes;
+  uint64_t nodes_offset;
+  uint64_t num_payloads;
+  uint64_t payloads_offset;
+  uint32_t payload_size;
+  uint32_t reserved;
+  uint64_t num_points;
+  uint64_t points_offset;
+  uint8_t padding[8];
+};
+
+// The format of each node type
+template <typename Node> struct OctreeFileNode;
+template <> struct OctreeFileNode<OctNode> {
+  static const OctreeFileFormat format = kOctreeFileOctNode;
+};
+template <> struct OctreeFileNode<CompactNode> {
+  static const OctreeFileFormat format = kOctreeFileCompactNode;
+};
+template <> struct OctreeFileNode<LinearCell> {
+  static const OctreeFileFormat format = kOctreeFileLinearCell;
+};
+
+// Per-leaf data stored with an octree: count entries of size bytes each,
+// e.g., the point in each leaf cell from Karras::MapPointsToCells.
+struct OctreePayload {
+  OctreePayload() : data(0), count(0), size(0) {}
+  template <typename T>
+  OctreePayload(const std::vector<T>& v)
+      : data(v.data()), count(v.size()), size(sizeof(T)) {}
+
+  const void* data;
+  size_t count;
+  size_t size;
+};
+
+void WriteOctreeFile(
+    const std::string& filename, const OctreeFileFormat format,
+    const size_t nodeSize, const void* nodes, const size_t numNodes,
+    const Resln& resln, const BoundingBox<floatn>& bb,
+    const OctreePayload& payload, const std::vector<int>& permutation);
+
+// Writes an octree of any of the node types above. permutation is the
+// sorted order of the points the octree was built from, e.g., from
+// Karras::SortPermutation.
+template <typename Node>
+void WriteOctreeFile(
+    const std::string& filename, const std::vector<Node>& octree,
+    const Resln& resln, const BoundingBox<floatn>& bb,
+    const OctreePayload& payload = OctreePayload(),
+    const std::vector<int>& permutation = std::vector<int>()) {
+  WriteOctreeFile(filename, OctreeFileNode<Node>::format, sizeof(Node),
+                  octree.data(), octree.size(), resln, bb, payload,
+                  permutation);
+}
+
+// A read-only memory mapping of an octree file. The nodes are used in
+// place, e.g., with OctreeUtils::FindLeaf(p, file.nodes<OctNode>(), r).
+// Throws logic_error if the file can't be mapped, isn't an octree file or
+// was written with another version.
+class MappedOctreeFile {
+ public:
+  explicit MappedOctreeFile(const std::string& filename);
+
+  int dim() const { return header_->dim; }
+  OctreeFileFormat format() const {
+    return static_cast<OctreeFileFormat>(header_->node_format);
+  }
+  size_t size() const { return header_->num_nodes; }
+  const OctreeFileHeader& header() const { return *header_; }
+  Resln resln() const;
+  BoundingBox<floatn> bounding_box() const;
+
+  // The nodes, or null if there are none. Throws if the file holds another
+  // node type or dimension.
+  template <typename Node>
+  const Node* nodes() const {
+    if (header_->num_nodes == 0) return 0;
+    CheckNodes(OctreeFileNode<Node>::format, sizeof(Node));
+    return reinterpret_cast<const Node*>(
+        file_.data() + header_->nodes_offset);
+  }
+
+  // The leaf payloads, or null if there are none. Throws if T isn't the
+  // size of a payload entry.
+  size_t num_payloads() const { return header_->num_payloads; }
+  template <typename T>
+  const T* payloads() const {
+    if (header_->num_payloads == 0) return 0;
+    CheckPayloads(sizeof(T));
+    return reinterpret_cast<const T*>(
+        file_.data() + header_->payloads_offset);
+  }
+
+  // The sorted point permutation, or null if there is none
+  size_t num_points() const { return header_->num_points; }
+  const int* permutation() const {
+    if (header_->num_points == 0) return 0;
+    return reinterpret_cast<const int*>(file_.data() + header_->points_offset);
+  }
+
+ private:
+  void CheckNodes(const OctreeFileFormat format, const size_t size) const;
+  void CheckPayloads(const size_t size) const;
+
+  MappedFile file_;
+  const OctreeFileHeader* header_;
+};
+
+#endif
@@ -1,12 +1,17 @@
+#include "./Parallel.h"
 #include "./OctreeUtils.h"
 #include "C/z_order.h"
 
+#include <algorithm>
+#include <cmath>
 #include <iostream>
 #include <fstream>
-#include <set>
+#include <limits>
+#include <queue>
 
 #include "./BoundingBox.h"
 #include "./opencl/Geom.h"
+#include "./opencl/Kernels.h"
 
 using std::vector;
 using std::cout;
@@ -15,30 +20,18 @@ using std::logic_error;
 
 namespace OctreeUtils {
 
+// The octant at each level is read directly from the bits of p, as in the
+// compact version below.
 OctCell FindLeaf(
-    const intn& p, const vector<OctNode>& octree, const Resln& resln) {
-	BigUnsigned z;
-	initBlkBU(&z, 0);
-	xyz2z(&z, p, resln.bits);
-
-  // Set up mask
-  int mask = 0;
-  for (int i = 0; i < DIM; ++i) {
-    mask |= (0x1 << i);
-  }
-
+    const intn& p, const OctNode* octree, const Resln& resln) {
   intn origin = make_uni_intn(0);
   int width = resln.width;
-  OctNode const * node = &octree[0];
   int idx = 0;
-	BigUnsigned temp;
-
-	for (int i = resln.mbits-DIM; i >= 0; i-=DIM) {
-    //const int octant = (z >> i).getBlock(0) & mask;
-		initBUBU(&temp, &z);
-		shiftBURight(&temp, &temp, i);
-		const int octant = getBUBlock(&temp, 0);
-    //const int octant = (z >> i) & mask;
+  for (int i = resln.bits-1; i >= 0; --i) {
+    int octant = 0;
+    for (int k = 0; k < DIM; ++k) {
+      octant |= ((p.s[k] >> i) & 1) << k;
+    }
     width /= 2;
 
     if (octant % 2 == 1)
@@ -46,133 +39,887 @@ OctCell FindLeaf(
     if (octant / 2 == 1)
       origin += make_intn(0, width);
 
+    const OctNode* node = &octree[idx];
     if (is_leaf(node, octant)) {
       // Empty leaf node
       return OctCell(origin, width, idx, node, octant, 0,
                      (*node)[octant]);
     }
     idx = (*node)[octant];
-    node = &octree[idx];
   }
 
-  ofstream out("find.err");
-  out << p << endl;
-  //out << resln << endl;
-//  out << octree << endl;
-  out.close();
-
   cerr << "Didn't find leaf node" << endl;
   cerr << "p = " << p << endl;
-  //cerr << "resln = " << resln << endl;
-  // cerr << "octree = " << octree.size() << " " << octree.back() << endl;
-  //cerr << "octree = " << octree << endl;
+  throw logic_error("Didn't find leaf node");
+}
+
+OctCell FindLeaf(
+    const intn& p, const vector<OctNode>& octree, const Resln& resln) {
+  return FindLeaf(p, octree.data(), resln);
+}
+
+// Spreads the low 32 bits of x so that there is a zero bit between each
+// of them.
+static uint64_t Spread2(uint64_t x) {
+  x &= 0xffffffffull;
+  x = (x | (x << 16)) & 0x0000ffff0000ffffull;
+  x = (x | (x << 8)) & 0x00ff00ff00ff00ffull;
+  x = (x | (x << 4)) & 0x0f0f0f0f0f0f0f0full;
+  x = (x | (x << 2)) & 0x3333333333333333ull;
+  x = (x | (x << 1)) & 0x5555555555555555ull;
+  return x;
+}
+
+#if DIM == 3
+// Spreads the low 21 bits of x so that there are two zero bits between
+// each of them.
+static uint64_t Spread3(uint64_t x) {
+  x &= 0x1fffffull;
+  x = (x | (x << 32)) & 0x001f00000000ffffull;
+  x = (x | (x << 16)) & 0x001f0000ff0000ffull;
+  x = (x | (x << 8)) & 0x100f00f00f00f00full;
+  x = (x | (x << 4)) & 0x10c30c30c30c30c3ull;
+  x = (x | (x << 2)) & 0x1249249249249249ull;
+  return x;
+}
+#endif
+
+// Index of the highest set bit of x, which must be nonzero
+static int HighestBit(uint64_t x) {
+#if defined(__GNUC__)
+  return 63 - __builtin_clzll(x);
+#else
+  int i = 0;
+  while (x >>= 1) ++i;
+  return i;
+#endif
+}
+
+uint64_t MortonKey(const intn& p, const int bits) {
+  const uint64_t mask = (uint64_t(1) << bits) - 1;
+  uint64_t key = 0;
+  for (int d = 0; d < DIM; ++d) {
+#if DIM == 2
+    key |= Spread2(uint64_t(p.s[d]) & mask) << d;
+#else
+    key |= Spread3(uint64_t(p.s[d]) & mask) << d;
+#endif
+  }
+  return key;
+}
+
+// Morton code of a point and the point's index
+typedef std::pair<uint64_t, int> KeyIndex;
+
+// Morton codes of the points, sorted
+static void SortedKeys(
+    const vector<intn>& points, const Resln& resln, vector<KeyIndex>& keys) {
+  const int n = points.size();
+  keys.resize(n);
+  Parallel::For(0, n, [&](const int i) {
+    keys[i] = KeyIndex(MortonKey(points[i], resln.bits), i);
+  });
+  std::sort(keys.begin(), keys.end());
+}
+
+// FindLeaves for points whose sorted keys are already known
+static void FindSortedLeaves(
+    const vector<intn>& points, const vector<KeyIndex>& queries,
+    const vector<OctNode>& octree, const Resln& resln,
+    vector<OctCell>& cells) {
+  const int n = points.size();
+  cells.resize(n);
+  if (n == 0) return;
+
+  // Each chunk of sorted queries keeps the path of nodes from the root to
+  // its last leaf. path[l] is the node at level l.
+  Parallel::ForChunks(0, n, [&](const int begin, const int end, const int) {
+    int path[sizeof(uint64_t) * 8];
+    path[0] = 0;
+    int depth = 0;
+    for (int q = begin; q < end; ++q) {
+      const intn& p = points[queries[q].second];
+      // Number of leading octants shared with the previous query
+      int level = 0;
+      if (q > begin) {
+        const uint64_t diff = queries[q].first ^ queries[q-1].first;
+        level = (diff == 0) ? resln.bits
+            : resln.bits - 1 - HighestBit(diff) / DIM;
+      }
+      level = std::min(level, depth);
+      int idx = path[level];
+      for (int i = resln.bits-1-level; i >= 0; --i, ++level) {
+        int octant = 0;
+        for (int k = 0; k < DIM; ++k) {
+          octant |= ((p.s[k] >> i) & 1) << k;
+        }
+        const OctNode* node = &octree[idx];
+        if (is_leaf(node, octant)) {
+          const int width = 1 << i;
+          intn origin;
+          for (int k = 0; k < DIM; ++k) {
+            origin.s[k] = p.s[k] & ~(width-1);
+          }
+          cells[queries[q].second] = OctCell(origin, width, idx, node, octant,
+                                             0, (*node)[octant]);
+          break;
+        }
+        idx = (*node)[octant];
+        path[level+1] = idx;
+      }
+      if (level >= resln.bits) {
+        throw logic_error("Didn't find leaf node");
+      }
+      depth = level;
+    }
+  });
+}
+
+void FindLeaves(
+    const vector<intn>& points, const vector<OctNode>& octree,
+    const Resln& resln, vector<OctCell>& cells) {
+  vector<KeyIndex> queries;
+  SortedKeys(points, resln, queries);
+  FindSortedLeaves(points, queries, octree, resln, cells);
+}
+
+OctCell FindLeaf(
+    const intn& p, const CompactNode* octree, const Resln& resln) {
+  intn origin = make_uni_intn(0);
+  int width = resln.width;
+  int idx = 0;
+  for (int i = resln.bits-1; i >= 0; --i) {
+    int octant = 0;
+    for (int k = 0; k < DIM; ++k) {
+      octant |= ((p.s[k] >> i) & 1) << k;
+    }
+    width /= 2;
+
+    if (octant % 2 == 1)
+      origin += make_intn(width, 0);
+    if (octant / 2 == 1)
+      origin += make_intn(0, width);
 
+    const CompactNode& node = octree[idx];
+    if (compact_is_leaf(&node, octant)) {
+      return OctCell(origin, width, idx, node, octant);
+    }
+    idx = compact_child(&node, octant);
+  }
+
+  cerr << "Didn't find leaf node" << endl;
+  cerr << "p = " << p << endl;
   throw logic_error("Didn't find leaf node");
 }
 
-OctCell FindNeighbor(
-    const OctCell& cell, const int intersection,
-    const std::vector<OctNode>& octree, const Resln& resln) {
-  throw logic_error("Not implemented");
+OctCell FindLeaf(
+    const intn& p, const vector<CompactNode>& octree, const Resln& resln) {
+  return FindLeaf(p, octree.data(), resln);
 }
 
-// Find intersections of the line segment ab with an octree cell.
-std::vector<CellIntersection> FindIntersections(
-    const floatn& a, const floatn& b, const intn& origin, const int width,
+int FindLinearLeaf(
+    const intn& p, const LinearCell* cells, const int n, const Resln& resln) {
+  BigUnsigned z;
+  xyz2z(&z, p, resln.bits);
+  // First cell whose key is greater than z
+  int lo = 0, hi = n;
+  while (lo < hi) {
+    const int mid = (lo + hi) / 2;
+    if (compareBU(const_cast<BigUnsigned*>(&cells[mid].key), &z) <= 0) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  if (lo == 0) {
+    cerr << "p = " << p << endl;
+    throw logic_error("Didn't find leaf cell");
+  }
+  return lo - 1;
+}
+
+int FindLinearLeaf(
+    const intn& p, const vector<LinearCell>& cells, const Resln& resln) {
+  return FindLinearLeaf(p, cells.data(), cells.size(), resln);
+}
+
+static inline bool Overlaps(
+    const BoundingBox<intn>& box, const intn& origin, const int width) {
+  for (int i = 0; i < DIM; ++i) {
+    if (origin.s[i] >= box.max().s[i] || origin.s[i] + width <= box.min().s[i])
+      return false;
+  }
+  return true;
+}
+
+void FindLeavesInBox(
+    const BoundingBox<intn>& box, const vector<OctNode>& octree,
+    const Resln& resln, vector<OctCell>& leaves) {
+  leaves.clear();
+  if (octree.empty() || !Overlaps(box, make_uni_intn(0), resln.width))
+    return;
+
+  // Depth first over child slots. Children are pushed last octant first so
+  // that leaves come out in z-order. There are at most 2^DIM entries per
+  // level on the stack.
+  struct Slot {
+    int parent;
+    int octant;
+    intn origin;
+    int width;
+  };
+  Slot stack[(sizeof(int) * 8) << DIM];
+  int top = 0;
+  int idx = 0;
+  intn node_origin = make_uni_intn(0);
+  int node_width = resln.width;
+  while (true) {
+    const int width = node_width / 2;
+    for (int octant = (1 << DIM) - 1; octant >= 0; --octant) {
+      intn origin = node_origin;
+      for (int k = 0; k < DIM; ++k) {
+        if (octant & (1 << k))
+          origin.s[k] += width;
+      }
+      if (Overlaps(box, origin, width)) {
+        const Slot slot = { idx, octant, origin, width };
+        stack[top++] = slot;
+      }
+    }
+    // Pop leaves until an internal node is found
+    idx = -1;
+    while (top > 0 && idx == -1) {
+      const Slot slot = stack[--top];
+      const OctNode* node = &octree[slot.parent];
+      if (is_leaf(node, slot.octant)) {
+        leaves.push_back(OctCell(slot.origin, slot.width, slot.parent, node,
+                                 slot.octant, 0, (*node)[slot.octant]));
+      } else {
+        idx = (*node)[slot.octant];
+        node_origin = slot.origin;
+        node_width = slot.width;
+      }
+    }
+    if (idx == -1) break;
+  }
+}
+
+void FindLeavesInBoxes(
+    const vector<BoundingBox<intn> >& boxes, const vector<OctNode>& octree,
+    const Resln& resln, vector<vector<OctCell> >& leaves) {
+  leaves.resize(boxes.size());
+  Parallel::For(0, boxes.size(), [&](const int i) {
+    FindLeavesInBox(boxes[i], octree, resln, leaves[i]);
+  });
+}
+
+void FindLinearLeavesInBox(
+    const BoundingBox<intn>& box, const vector<LinearCell>& cells,
+    const Resln& resln, vector<int>& indices) {
+  indices.clear();
+  intn lo, hi;
+  for (int i = 0; i < DIM; ++i) {
+    lo.s[i] = std::max(box.min().s[i], 0);
+    hi.s[i] = std::min(box.max().s[i], resln.width) - 1;
+    if (hi.s[i] < lo.s[i]) return;
+  }
+  if (cells.empty()) return;
+  const int first = FindLinearLeaf(lo, cells, resln);
+  const int last = FindLinearLeaf(hi, cells, resln);
+  for (int i = first; i <= last; ++i) {
+    LinearCell cell = cells[i];
+    if (Overlaps(box, linear_cell_origin(&cell, resln.bits),
+                 linear_cell_width(&cell, resln.bits))) {
+      indices.push_back(i);
+    }
+  }
+}
+
+// Morton code one past the last point in the cell
+static BigUnsigned cellEnd(const LinearCell& cell, const Resln& resln) {
+  BigUnsigned one, size, end;
+  initBlkBU(&one, 1);
+  shiftBULeft(&size, &one, DIM*(resln.bits - cell.level));
+  addBU(&end, const_cast<BigUnsigned*>(&cell.key), &size);
+  return end;
+}
+
+vector<LinearCell> MergeLinearOctrees(
+    const vector<LinearCell>& a, const vector<LinearCell>& b,
     const Resln& resln) {
+  // Both trees tile the domain, so at any point the two current cells are
+  // nested. The finer one is emitted and every cell of the other tree that
+  // ends within it is skipped.
+  vector<LinearCell> ret;
+  ret.reserve(std::max(a.size(), b.size()));
+  size_t i = 0, j = 0;
+  while (i < a.size() && j < b.size()) {
+    const bool fromA = a[i].level >= b[j].level;
+    const LinearCell& fine = fromA ? a[i] : b[j];
+    const vector<LinearCell>& other = fromA ? b : a;
+    size_t& k = fromA ? j : i;
+    ret.push_back(fine);
+    BigUnsigned end = cellEnd(fine, resln);
+    fromA ? ++i : ++j;
+    while (k < other.size()) {
+      BigUnsigned otherEnd = cellEnd(other[k], resln);
+      if (compareBU(&otherEnd, &end) > 0) break;
+      ++k;
+    }
+  }
+  return ret;
+}
 
-  // static const float EPSILON = 1e-6;
-  floatn af = a;
-  floatn bf = b;
-  // v is normalized (3 lines down)
-  floatn v = bf - af;
-  float len = length(v);
-  v = v / len;
-
-  BoundingBox<floatn> bb;
-  bb(convert_floatn(origin));
-  bb(convert_floatn(origin) + make_uni_floatn(width));
-
-  vector<float> t_values;
-  vector<floatn> p_values;
-  {
-    // Bottom edge
-    const int y = origin.y;
-    const float t = (y - af.y) / v.y;
-    t_values.push_back(t);
-    const floatn p = make_floatn(af.x + v.x * t, y);
-    p_values.push_back(p);
-  } {
-    // Right edge
-    const int x = origin.x + width;
-    const float t = (x - af.x) / v.x;
-    t_values.push_back(t);
-    const floatn p = make_floatn(x, af.y + v.y * t);
-    p_values.push_back(p);
-  } {
-    // Top edge
-    const int y = origin.y + width;
-    const float t = (y - af.y) / v.y;
-    t_values.push_back(t);
-    const floatn p = make_floatn(af.x + v.x * t, y);
-    p_values.push_back(p);
-  } {
-    // Left edge
-    const int x = origin.x;
-    const float t = (x - af.x) / v.x;
-    t_values.push_back(t);
-    const floatn p = make_floatn(x, af.y + v.y * t);
-    p_values.push_back(p);
-  }
-
-  vector<CellIntersection> ret;
-  std::set<floatn> point_set;
-  for (int i = 0; i < t_values.size(); ++i) {
-    const float t = t_values[i];
-    const floatn p = p_values[i];
-    // const float x = p.s[0];
-    // const float y = p.s[1];
-    if (t >= -EPSILON && t < len+EPSILON) {
-      if (bb.in_closed(p, EPSILON)) {
-        ret.push_back(CellIntersection(t, p));
-        point_set.insert(p);
-      }
-    }
-  }
-  
-  if (ret.size() == 2) {
-    if (Geom::dist(ret[0].p, ret[1].p) < EPSILON) {
-      ret.resize(1);
-    }
-  }
-
-  if (ret.size() > 2) {
-    // If there are 3 or more intersections then choose the two that
-    // most closely match the direction v of the intersecting line
-    CellIntersection best[2];
-    float best_dot = 0;
-    for (int i = 0; i < ret.size(); ++i) {
-      for (int j = i+1; j < ret.size(); ++j) {
-        const floatn c = ret[i].p;
-        const floatn d = ret[j].p;
-        const floatn u = normalize(d-c);
-        const float cur_dot = fabs(dot(u, v));
-        if (cur_dot > best_dot) {
-          best_dot = cur_dot;
-          best[0] = ret[i];
-          best[1] = ret[j];
+void LevelWalk(
+    const vector<OctNode>& octree, const vector<int>& levelOffsets,
+    LevelVisitor v, void* data, const int maxLevel) {
+  const int numLevels = levelOffsets.size() - 1;
+  const int lastLevel = (maxLevel < 0) ? numLevels-1
+      : std::min(maxLevel, numLevels-1);
+  for (int level = 0; level <= lastLevel; ++level) {
+    if (!v(level, levelOffsets[level], levelOffsets[level+1], octree, data))
+      return;
+  }
+}
+
+OctCell FindNeighbor(
+    const OctCell& cell, const int face, const intn& p,
+    const vector<OctNode>& octree, const OctreeLinks& links,
+    const Resln& resln) {
+  const int axis = face_axis(face);
+  const intn origin = cell.get_origin();
+  const int width = cell.get_width();
+
+  // q is p moved just across the face and clamped to the face.
+  intn q;
+  for (int i = 0; i < DIM; ++i) {
+    q.s[i] = std::min(std::max(p.s[i], origin.s[i]), origin.s[i]+width-1);
+  }
+  q.s[axis] = face_high(face) ? origin.s[axis]+width : origin.s[axis]-1;
+  if (q.s[axis] < 0 || q.s[axis] >= resln.width) {
+    throw logic_error("No neighbor across a face on the domain boundary");
+  }
+
+  const int idx = make_cell_index(cell.get_parent_idx(), cell.get_octant());
+  const int neighbor = links.neighbors[idx*NUM_FACES + face];
+  int node = cell_node(neighbor);
+  int octant = cell_octant(neighbor);
+  int w = resln.width >> (links.levels[node]+1);
+  while (!is_leaf(&octree[node], octant)) {
+    node = octree[node][octant];
+    w /= 2;
+    octant = 0;
+    for (int i = 0; i < DIM; ++i) {
+      if (q.s[i] & w)
+        octant |= (1 << i);
+    }
+  }
+  intn n_origin;
+  for (int i = 0; i < DIM; ++i) {
+    n_origin.s[i] = q.s[i] & ~(w-1);
+  }
+  return OctCell(n_origin, w, node, &octree[node], octant, 0,
+                 octree[node][octant]);
+}
+
+void BuildLeafPoints(
+    const vector<intn>& points, const vector<OctNode>& octree,
+    const Resln& resln, LeafPoints& leaf_points) {
+  const int n = points.size();
+  vector<KeyIndex> keys;
+  SortedKeys(points, resln, keys);
+  // The points are located in the order they were just sorted in
+  vector<OctCell> cells;
+  FindSortedLeaves(points, keys, octree, resln, cells);
+
+  leaf_points.order.resize(n);
+  leaf_points.start.assign(octree.size() << DIM, 0);
+  leaf_points.count.assign(octree.size() << DIM, 0);
+  for (int i = 0; i < n; ++i) {
+    const int idx = keys[i].second;
+    const int c = make_cell_index(
+        cells[idx].get_parent_idx(), cells[idx].get_octant());
+    leaf_points.order[i] = idx;
+    if (leaf_points.count[c]++ == 0) {
+      leaf_points.start[c] = i;
+    }
+  }
+}
+
+// Squared distance from q to the nearest point of the cell
+static inline long long CellDist2(
+    const intn& q, const intn& origin, const int width) {
+  long long d2 = 0;
+  for (int i = 0; i < DIM; ++i) {
+    const long long lo = origin.s[i];
+    const long long hi = lo + width - 1;
+    const long long d = (q.s[i] < lo) ? lo - q.s[i]
+        : ((q.s[i] > hi) ? q.s[i] - hi : 0);
+    d2 += d * d;
+  }
+  return d2;
+}
+
+static inline long long PointDist2(const intn& q, const intn& p) {
+  long long d2 = 0;
+  for (int i = 0; i < DIM; ++i) {
+    const long long d = p.s[i] - q.s[i];
+    d2 += d * d;
+  }
+  return d2;
+}
+
+void FindNearestPoints(
+    const intn& q, const int k, const vector<intn>& points,
+    const vector<OctNode>& octree, const LeafPoints& leaf_points,
+    const Resln& resln, vector<int>& nearest) {
+  nearest.clear();
+  if (k <= 0 || octree.empty() || points.empty()) return;
+
+  // A child slot to visit, ordered nearest first
+  struct Slot {
+    long long d2;
+    int parent;
+    int octant;
+    intn origin;
+    int width;
+    bool operator<(const Slot& rhs) const { return d2 > rhs.d2; }
+  };
+  typedef std::pair<long long, int> Candidate;
+  std::priority_queue<Slot> cells;
+  // The k nearest points found so far, farthest on top
+  std::priority_queue<Candidate> best;
+
+  int idx = 0;
+  intn node_origin = make_uni_intn(0);
+  int node_width = resln.width;
+  while (idx != -1) {
+    const int width = node_width / 2;
+    for (int octant = 0; octant < (1 << DIM); ++octant) {
+      intn origin = node_origin;
+      for (int i = 0; i < DIM; ++i) {
+        if (octant & (1 << i))
+          origin.s[i] += width;
+      }
+      const Slot slot = { CellDist2(q, origin, width), idx, octant, origin,
+                          width };
+      cells.push(slot);
+    }
+
+    // Visit leaves until the nearest cell is internal
+    idx = -1;
+    while (!cells.empty() && idx == -1) {
+      const Slot slot = cells.top();
+      if (best.size() == static_cast<size_t>(k) && slot.d2 > best.top().first)
+        break;
+      cells.pop();
+      const OctNode* node = &octree[slot.parent];
+      if (!is_leaf(node, slot.octant)) {
+        idx = (*node)[slot.octant];
+        node_origin = slot.origin;
+        node_width = slot.width;
+        continue;
+      }
+      const int c = make_cell_index(slot.parent, slot.octant);
+      const int start = leaf_points.start[c];
+      for (int i = start; i < start + leaf_points.count[c]; ++i) {
+        const int p = leaf_points.order[i];
+        const Candidate candidate(PointDist2(q, points[p]), p);
+        if (best.size() < static_cast<size_t>(k)) {
+          best.push(candidate);
+        } else if (candidate < best.top()) {
+          best.pop();
+          best.push(candidate);
+        }
+      }
+    }
+  }
+
+  nearest.resize(best.size());
+  for (int i = nearest.size()-1; i >= 0; --i) {
+    nearest[i] = best.top().second;
+    best.pop();
+  }
+}
+
+void FindNearestPoints(
+    const vector<intn>& queries, const int k, const vector<intn>& points,
+    const vector<OctNode>& octree, const LeafPoints& leaf_points,
+    const Resln& resln, vector<vector<int> >& nearest) {
+  nearest.resize(queries.size());
+  Parallel::For(0, queries.size(), [&](const int i) {
+    FindNearestPoints(queries[i], k, points, octree, leaf_points, resln,
+                      nearest[i]);
+  });
+}
+
+void BuildLeafSegments(
+    const vector<floatn>& segments, const vector<int>& labels,
+    const vector<OctNode>& octree, const Resln& resln,
+    LeafSegments& leaf_segments) {
+  leaf_segments.segments = segments;
+  leaf_segments.labels = labels;
+  vector<SegmentCell> cells;
+  Kernels::SegmentCells_s(octree, segments, cells, resln.bits);
+
+  // Counting sort of the segment cells by cell
+  const int num_cells = octree.size() << DIM;
+  leaf_segments.count.assign(num_cells, 0);
+  leaf_segments.start.assign(num_cells, 0);
+  for (const SegmentCell& c : cells) {
+    ++leaf_segments.count[c.cell];
+  }
+  for (int c = 1; c < num_cells; ++c) {
+    leaf_segments.start[c] =
+        leaf_segments.start[c-1] + leaf_segments.count[c-1];
+  }
+  vector<int> next(leaf_segments.start);
+  leaf_segments.ids.resize(cells.size());
+  for (const SegmentCell& c : cells) {
+    leaf_segments.ids[next[c.cell]++] = c.segment;
+  }
+}
+
+NearestObject FindNearestObject(
+    const floatn& q, const vector<OctNode>& octree,
+    const LeafSegments& leaf_segments, const Resln& resln) {
+  NearestObject nearest;
+  nearest.label = -1;
+  nearest.segment = -1;
+  nearest.dist = std::numeric_limits<float>::max();
+  if (octree.empty() || leaf_segments.labels.empty()) return nearest;
+
+  intn qi;
+  for (int i = 0; i < DIM; ++i) {
+    qi.s[i] = std::min(std::max(static_cast<int>(floor(q.s[i])), 0),
+                       resln.width-1);
+  }
+  int radius = FindLeaf(qi, octree, resln).get_width();
+  vector<OctCell> leaves;
+  while (true) {
+    intn lo, hi;
+    for (int i = 0; i < DIM; ++i) {
+      lo.s[i] = static_cast<int>(floor(q.s[i])) - radius;
+      hi.s[i] = static_cast<int>(floor(q.s[i])) + radius + 1;
+    }
+    FindLeavesInBox(BoundingBox<intn>(lo, hi), octree, resln, leaves);
+    for (const OctCell& leaf : leaves) {
+      const int c = make_cell_index(leaf.get_parent_idx(), leaf.get_octant());
+      const int start = leaf_segments.start[c];
+      for (int i = start; i < start + leaf_segments.count[c]; ++i) {
+        const int s = leaf_segments.ids[i];
+        const FloatSegment seg(leaf_segments.segments[2*s],
+                               leaf_segments.segments[2*s+1]);
+        const floatn p = Geom::closest(q, seg);
+        const float d = Geom::dist(q, p);
+        if (d < nearest.dist || (d == nearest.dist && s < nearest.segment)) {
+          nearest.label = leaf_segments.labels[s];
+          nearest.segment = s;
+          nearest.dist = d;
+          nearest.p = p;
         }
       }
     }
-    ret.clear();
-    ret.push_back(best[0]);
-    ret.push_back(best[1]);
+    // A segment within radius of q passes through the box, so the nearest
+    // segment in the box is the nearest overall.
+    if (nearest.dist <= radius || radius >= resln.width) break;
+    radius *= 2;
+  }
+  return nearest;
+}
+
+void FindNearestObjects(
+    const vector<floatn>& queries, const vector<OctNode>& octree,
+    const LeafSegments& leaf_segments, const Resln& resln,
+    vector<NearestObject>& nearest) {
+  nearest.resize(queries.size());
+  Parallel::For(0, queries.size(), [&](const int i) {
+    nearest[i] = FindNearestObject(queries[i], octree, leaf_segments, resln);
+  });
+}
+
+void ComputeGVD(
+    const vector<OctNode>& octree, const LeafSegments& leaf_segments,
+    const Resln& resln, GVD& gvd, const bool gpu) {
+  vector<OctCell> cells;
+  FindLeavesInBox(
+      BoundingBox<intn>(make_uni_intn(0), make_uni_intn(resln.width)),
+      octree, resln, cells);
+  vector<GVDLeaf> leaves(cells.size());
+  Parallel::For(0, cells.size(), [&](const int i) {
+    leaves[i].origin = cells[i].get_origin();
+    leaves[i].width = cells[i].get_width();
+    leaves[i].cell =
+        make_cell_index(cells[i].get_parent_idx(), cells[i].get_octant());
+  });
+  const LeafSegments& s = leaf_segments;
+  if (gpu) {
+    Kernels::ComputeGVD_p(octree, leaves, s.segments, s.labels, s.start,
+                          s.count, s.ids, resln.bits, gvd.labels, gvd.dists,
+                          gvd.cells);
+  } else {
+    Kernels::ComputeGVD_s(octree, leaves, s.segments, s.labels, s.start,
+                          s.count, s.ids, resln.bits, gvd.labels, gvd.dists,
+                          gvd.cells);
+  }
+}
+
+// Width in points of the tiles of a sampled distance field
+static const int DISTANCE_TILE = 16;
+
+void SampleDistanceField(
+    const SampleGrid& grid, const vector<OctNode>& octree,
+    const LeafSegments& leaf_segments, const Resln& resln,
+    const bool signed_dist, float* dists, int* labels, const bool gpu) {
+  if (grid.nx <= 0 || grid.ny <= 0) return;
+  const int tiles_x = (grid.nx + DISTANCE_TILE - 1) / DISTANCE_TILE;
+  const int tiles_y = (grid.ny + DISTANCE_TILE - 1) / DISTANCE_TILE;
+  const int num_tiles = tiles_x * tiles_y;
+
+  // Tiles in Morton order
+  vector<uint64_t> keys(num_tiles);
+  Parallel::For(0, num_tiles, [&](const int t) {
+    keys[t] = Spread2(t % tiles_x) | (Spread2(t / tiles_x) << 1);
+  });
+  vector<int> order(num_tiles);
+  for (int t = 0; t < num_tiles; ++t) {
+    order[t] = t;
+  }
+  std::sort(order.begin(), order.end(), [&](const int a, const int b) {
+    return keys[a] < keys[b];
+  });
+
+  // Candidate segments of each tile. Every point of a tile is within h of
+  // its center c, so its nearest segment is within d + h of it, where d is
+  // the distance from c to any segment, and within d + 2h of c.
+  vector<vector<int> > candidates(num_tiles);
+  Parallel::For(0, num_tiles, [&](const int t) {
+    if (octree.empty() || leaf_segments.labels.empty()) return;
+    const int i0 = (t % tiles_x) * DISTANCE_TILE;
+    const int j0 = (t / tiles_x) * DISTANCE_TILE;
+    const int i1 = std::min(i0 + DISTANCE_TILE, grid.nx) - 1;
+    const int j1 = std::min(j0 + DISTANCE_TILE, grid.ny) - 1;
+    floatn c = grid.origin;
+    c.x = grid.origin.x + grid.spacing * (i0 + i1) / 2.0f;
+    c.y = grid.origin.y + grid.spacing * (j0 + j1) / 2.0f;
+    const float h = grid.spacing *
+        sqrt(float((i1 - i0) * (i1 - i0) + (j1 - j0) * (j1 - j0))) / 2;
+    const NearestObject nearest =
+        FindNearestObject(c, octree, leaf_segments, resln);
+    intn lo = make_uni_intn(0);
+    intn hi = make_uni_intn(resln.width);
+    if (nearest.segment != -1) {
+      const float reach = std::min(nearest.dist + 2 * h,
+                                   static_cast<float>(resln.width));
+      for (int k = 0; k < DIM; ++k) {
+        lo.s[k] = std::max(static_cast<int>(floor(c.s[k] - reach)), 0);
+        hi.s[k] = std::min(static_cast<int>(floor(c.s[k] + reach)) + 1,
+                           resln.width);
+      }
+    }
+    vector<OctCell> leaves;
+    FindLeavesInBox(BoundingBox<intn>(lo, hi), octree, resln, leaves);
+    vector<int>& ids = candidates[t];
+    for (const OctCell& leaf : leaves) {
+      const int cell =
+          make_cell_index(leaf.get_parent_idx(), leaf.get_octant());
+      const int start = leaf_segments.start[cell];
+      ids.insert(ids.end(), leaf_segments.ids.begin() + start,
+                 leaf_segments.ids.begin() + start +
+                 leaf_segments.count[cell]);
+    }
+    std::sort(ids.begin(), ids.end());
+    ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+  });
+
+  // The candidates are stored in compressed rows, in Morton order
+  vector<int> tile_start(num_tiles), tile_count(num_tiles);
+  int total = 0;
+  for (const int t : order) {
+    tile_start[t] = total;
+    tile_count[t] = candidates[t].size();
+    total += tile_count[t];
+  }
+  vector<int> tile_ids(total);
+  Parallel::For(0, num_tiles, [&](const int t) {
+    std::copy(candidates[t].begin(), candidates[t].end(),
+              tile_ids.begin() + tile_start[t]);
+  });
+
+  vector<int> temp;
+  if (!labels) {
+    temp.resize(grid.nx * grid.ny);
+    labels = temp.data();
+  }
+  const LeafSegments& s = leaf_segments;
+  if (gpu) {
+    Kernels::SampleDistanceField_p(
+        s.segments, s.labels, tile_start, tile_count, tile_ids, order,
+        grid.origin, grid.spacing, grid.nx, grid.ny, DISTANCE_TILE,
+        signed_dist, dists, labels);
+  } else {
+    Kernels::SampleDistanceField_s(
+        s.segments, s.labels, tile_start, tile_count, tile_ids, order,
+        grid.origin, grid.spacing, grid.nx, grid.ny, DISTANCE_TILE,
+        signed_dist, dists, labels);
+  }
+}
+
+void LocalFeatureSizes(
+    const vector<OctNode>& octree, const LeafSegments& leaf_segments,
+    const Resln& resln, vector<float>& sizes) {
+  const int n = leaf_segments.labels.size();
+  sizes.assign(n, resln.width);
+  if (octree.empty()) return;
+  Parallel::For(0, n, [&](const int s) {
+    const FloatSegment seg(leaf_segments.segments[2*s],
+                           leaf_segments.segments[2*s+1]);
+    const int label = leaf_segments.labels[s];
+    float nearest = resln.width;
+    int radius = 1;
+    vector<OctCell> leaves;
+    while (true) {
+      intn lo, hi;
+      for (int i = 0; i < DIM; ++i) {
+        const float a = seg.a().s[i];
+        const float b = seg.b().s[i];
+        lo.s[i] = static_cast<int>(floor(std::min(a, b))) - radius;
+        hi.s[i] = static_cast<int>(floor(std::max(a, b))) + radius + 1;
+      }
+      FindLeavesInBox(BoundingBox<intn>(lo, hi), octree, resln, leaves);
+      for (const OctCell& leaf : leaves) {
+        const int c =
+            make_cell_index(leaf.get_parent_idx(), leaf.get_octant());
+        const int start = leaf_segments.start[c];
+        for (int i = start; i < start + leaf_segments.count[c]; ++i) {
+          const int other = leaf_segments.ids[i];
+          if (leaf_segments.labels[other] == label) continue;
+          floatn ca, cb;
+          bool ca_end, cb_end;
+          Geom::closest(seg, FloatSegment(leaf_segments.segments[2*other],
+                                          leaf_segments.segments[2*other+1]),
+                        &ca, &cb, &ca_end, &cb_end);
+          nearest = std::min(nearest, Geom::dist(ca, cb));
+        }
+      }
+      // A segment within radius of seg passes through the box
+      if (nearest <= radius || radius >= resln.width) break;
+      radius *= 2;
+    }
+    sizes[s] = nearest;
+  });
+}
+
+void SampleSpacings(
+    const vector<floatn>& segments, const vector<int>& labels,
+    const Resln& resln, vector<float>& spacings) {
+  spacings.assign(labels.size(), resln.width);
+  if (labels.empty()) return;
+  vector<intn> points(segments.size());
+  Parallel::For(0, segments.size(), [&](const int i) {
+    for (int k = 0; k < DIM; ++k) {
+      points[i].s[k] = std::min(
+          std::max(static_cast<int>(floor(segments[i].s[k])), 0),
+          resln.width-1);
+    }
+  });
+  vector<OctNode> octree;
+  Kernels::BuildOctree_s(points, octree, resln.bits, resln.mbits);
+  if (!octree.empty()) {
+    LeafSegments leaf_segments;
+    BuildLeafSegments(segments, labels, octree, resln, leaf_segments);
+    LocalFeatureSizes(octree, leaf_segments, resln, spacings);
+  }
+  Parallel::For(0, spacings.size(), [&](const int i) {
+    spacings[i] = std::max(spacings[i] / 2, 1.0f);
+  });
+}
+
+// Slab method. The parameters along a + t*d at which the line enters and
+// leaves the closed cell, and the axes of the faces it crosses there. If
+// the line is parallel to an axis, the slab of that axis is either all of
+// the line or none of it.
+static inline void Slab(
+    const floatn& a, const floatn& d, const intn& origin, const int width,
+    float& t_enter, float& t_exit, int& enter_axis, int& exit_axis) {
+  static const float inf = std::numeric_limits<float>::infinity();
+  t_enter = -inf;
+  t_exit = inf;
+  enter_axis = 0;
+  exit_axis = 0;
+  for (int i = 0; i < DIM; ++i) {
+    const float lo = origin.s[i];
+    const float hi = lo + width;
+    // Dividing rather than multiplying by 1/d keeps t exactly 1 for b on a
+    // face.
+    const float t0 = (lo - a.s[i]) / d.s[i];
+    const float t1 = (hi - a.s[i]) / d.s[i];
+    const bool inside = (a.s[i] >= lo && a.s[i] <= hi);
+    const bool parallel = (d.s[i] == 0);
+    const float t_near = parallel ? (inside ? -inf : inf) : std::min(t0, t1);
+    const float t_far = parallel ? (inside ? inf : -inf) : std::max(t0, t1);
+    enter_axis = (t_near > t_enter) ? i : enter_axis;
+    exit_axis = (t_far < t_exit) ? i : exit_axis;
+    t_enter = std::max(t_enter, t_near);
+    t_exit = std::min(t_exit, t_far);
+  }
+}
+
+// The point at t, put exactly on the face of the given axis that the
+// segment crosses.
+static inline CellIntersection FacePoint(
+    const floatn& a, const floatn& d, const float t, const intn& origin,
+    const int width, const int axis, const bool entering) {
+  floatn p;
+  for (int i = 0; i < DIM; ++i) {
+    p.s[i] = a.s[i] + d.s[i] * t;
+  }
+  const bool high = ((d.s[axis] > 0) != entering);
+  p.s[axis] = origin.s[axis] + (high ? width : 0);
+  return CellIntersection(t, p);
+}
+
+// Find intersections of the line segment ab with an octree cell.
+CellIntersectionList FindIntersections(
+    const floatn& a, const floatn& b, const intn& origin, const int width,
+    const Resln& resln) {
+  CellIntersectionList ret;
+  floatn d;
+  float scale = 0;
+  float magnitude = 0;
+  for (int i = 0; i < DIM; ++i) {
+    d.s[i] = b.s[i] - a.s[i];
+    scale = std::max(scale, std::fabs(d.s[i]));
+    magnitude = std::max(magnitude, std::fabs(a.s[i]) + std::fabs(d.s[i]));
   }
+  if (scale == 0) return ret;
+  // The tolerance is a distance that covers the rounding of the float
+  // coordinates. It is converted to a parameter using the largest
+  // component of d in place of the length of d.
+  const float tol = std::max(
+      static_cast<float>(EPSILON),
+      4 * std::numeric_limits<float>::epsilon() * magnitude);
+  const float eps = tol / scale;
+
+  float t_enter, t_exit;
+  int enter_axis, exit_axis;
+  Slab(a, d, origin, width, t_enter, t_exit, enter_axis, exit_axis);
+  if (t_enter > t_exit + eps) return ret;
 
+  if (t_enter >= -eps && t_enter <= 1+eps) {
+    ret.push_back(FacePoint(a, d, t_enter, origin, width, enter_axis, true));
+  }
+  if (t_exit >= -eps && t_exit <= 1+eps) {
+    ret.push_back(FacePoint(a, d, t_exit, origin, width, exit_axis, false));
+  }
+  // A segment through a corner enters and leaves at the same point.
+  if (ret.size() == 2 && std::fabs(t_exit - t_enter) * scale < tol) {
+    ret.resize(1);
+  }
   return ret;
 }
 
-std::vector<CellIntersection> FindIntersections(
+CellIntersectionList FindIntersections(
     const floatn& a, const floatn& b, const OctCell& cell,
     const Resln& resln) {
   const intn& origin = cell.get_origin();
@@ -180,4 +927,332 @@ std::vector<CellIntersection> FindIntersections(
   return FindIntersections(a, b, origin, width, resln);
 }
 
+void SlabIntersect(
+    const floatn& a, const floatn& b, const intn* origins, const int* widths,
+    const int n, float* t_enter, float* t_exit) {
+  const floatn d = b - a;
+  for (int i = 0; i < n; ++i) {
+    int enter_axis, exit_axis;
+    Slab(a, d, origins[i], widths[i], t_enter[i], t_exit[i],
+         enter_axis, exit_axis);
+  }
+}
+
+void SlabIntersect(
+    const floatn* a, const floatn* b, const int n, const intn& origin,
+    const int width, float* t_enter, float* t_exit) {
+  for (int i = 0; i < n; ++i) {
+    int enter_axis, exit_axis;
+    Slab(a[i], b[i] - a[i], origin, width, t_enter[i], t_exit[i],
+         enter_axis, exit_axis);
+  }
+}
+
+void CellWalk(
+    const floatn& a, const floatn& b, const vector<OctNode>& octree,
+    const OctreeLinks& links, const Resln& resln, CellWalkVisitor v,
+    void* data) {
+  int dir[DIM];
+  for (int i = 0; i < DIM; ++i) {
+    if (b.s[i] > a.s[i]) dir[i] = 1;
+    else if (b.s[i] < a.s[i]) dir[i] = -1;
+    else dir[i] = 0;
+  }
+  CellIntersection cur(0, a);
+  const OctCell bcell = FindLeaf(convert_intn(b), octree, resln);
+  bool done = false;
+  int count = 0;
+  OctCell cell = FindLeaf(convert_intn(cur.p), octree, resln);
+  do {
+    ++count;
+    if (count > 10000)
+      throw logic_error("Infinite loop");
+    v(cell, a, b, octree, resln, data);
+
+    const CellIntersectionList local_intersections =
+        FindIntersections(a, b, cell, resln);
+    for (const CellIntersection& i : local_intersections) {
+      if (i.t > cur.t) {
+        cur = i;
+      }
+    }
+
+    // Find the face the segment exits through. Corners and the domain
+    // boundary fall back to a search from the root.
+    int face = -1;
+    int num_faces = 0;
+    for (int i = 0; i < DIM; ++i) {
+      const int lo = cell.get_origin().s[i];
+      const int hi = lo + cell.get_width();
+      if (cur.p.s[i] == lo && dir[i] == -1 && lo != 0) {
+        face = 2*i;
+        ++num_faces;
+      } else if (cur.p.s[i] == hi && dir[i] == 1 && hi != resln.width) {
+        face = 2*i+1;
+        ++num_faces;
+      }
+    }
+    const intn exit_p = convert_intn(cur.p);
+    for (int i = 0; i < DIM; ++i) {
+      const int end = cell.get_origin().s[i];
+      if (cur.p.s[i] == end && cur.p.s[i] != 0 && dir[i] == -1) {
+        --cur.p.s[i];
+      }
+    }
+
+    OctCell new_cell = (num_faces == 1) ?
+        FindNeighbor(cell, face, exit_p, octree, links, resln) :
+        FindLeaf(convert_intn(cur.p), octree, resln);
+    done = local_intersections.empty() ||
+        (cell.get_origin() == bcell.get_origin()) ||
+        (new_cell.get_origin() == cell.get_origin());
+    cell = new_cell;
+  } while (!done);
+}
+
+// Output of the multi-cell walk of one chunk of segments
+struct MultiCellData {
+  void add(const int node, const int octant, const FloatSegment& seg) {
+    records.push_back(CellLabel(make_cell_index(node, octant), cur_label, seg));
+  }
+  vector<CellLabel> records;
+  vector<floatn> intersections;
+  int cur_label;
+};
+
+// Records the piece of segment a-b inside cell, and the intersections of
+// the segment with the cell's boundary.
+static void MultiCellVisitor(
+    OctCell cell, const floatn& a, const floatn& b,
+    const vector<OctNode>& /*octree*/, const Resln& resln, void* data) {
+  MultiCellData* d = static_cast<MultiCellData*>(data);
+  const int octant = cell.get_octant();
+
+  const CellIntersectionList intersections =
+      FindIntersections(a, b, cell, resln);
+  for (const CellIntersection& ci : intersections) {
+    d->intersections.push_back(ci.p);
+  }
+  if (intersections.size() > 2) {
+    cerr << "a = " << a << ", b = " << b << ", cell = " << cell << endl;
+    throw logic_error("More than 2 intersections with a cell");
+  }
+  if (intersections.size() == 2) {
+    d->add(cell.get_parent_idx(), octant,
+           FloatSegment(intersections[0].p, intersections[1].p));
+  } else if (intersections.size() == 1) {
+    // Find which endpoint is in cell. A segment that only touches a corner
+    // of the cell, or that meets it in a single point, isn't recorded.
+    const BoundingBox<intn> bb = cell.bb();
+    const floatn p = intersections[0].p;
+    if (bb.in_half_open(convert_intn(a))) {
+      d->add(cell.get_parent_idx(), octant, FloatSegment(p, a));
+    } else if (bb.in_half_open(convert_intn(b))) {
+      d->add(cell.get_parent_idx(), octant, FloatSegment(p, b));
+    }
+  }
+}
+
+void FindMultiCells(
+    const vector<floatn>& segments, const vector<int>& labels,
+    const vector<OctNode>& octree, const OctreeLinks& links,
+    const Resln& resln, vector<CellLabel>& records,
+    vector<floatn>& intersections, const int numThreads) {
+  records.clear();
+  intersections.clear();
+  const int n = labels.size();
+  if (n == 0 || octree.empty()) return;
+
+  const int num_chunks = Parallel::NumChunks(n, numThreads);
+  vector<MultiCellData> chunks(num_chunks);
+  Parallel::ForChunks(0, n, [&](const int begin, const int end, const int c) {
+    MultiCellData& data = chunks[c];
+    for (int s = begin; s < end; ++s) {
+      data.cur_label = labels[s];
+      CellWalk(segments[2*s], segments[2*s+1], octree, links, resln,
+               MultiCellVisitor, &data);
+    }
+  }, num_chunks);
+
+  // Concatenating the chunks in order gives the records in the same order
+  // as a serial walk.
+  for (const MultiCellData& data : chunks) {
+    records.insert(records.end(), data.records.begin(), data.records.end());
+    intersections.insert(intersections.end(), data.intersections.begin(),
+                         data.intersections.end());
+  }
+}
+
+// The GVD edges and vertices in a leaf. Labels are indices into the
+// leaf's labels in cellLabels.
+struct LeafGVD {
+  vector<vector<floatn> > lines;
+  // The two labels of each line
+  vector<std::pair<int, int> > pairs;
+  vector<floatn> vertices;
+  // The three labels of each vertex
+  vector<int> vertex_labels;
+};
+
+// Smallest margin by which a label other than j and k is farther from p
+// than segment A is. nearest gets that label, or -1 if there is none.
+static float Margin(
+    const floatn& p, const FloatSegment& A, const int j, const int k,
+    const int cell, const CellLabels& cellLabels, const float tolerance,
+    int* nearest) {
+  const float d = Geom::dist(p, Geom::closest(p, A));
+  float margin = std::numeric_limits<float>::max();
+  *nearest = -1;
+  for (int l = 0; l < cellLabels.num_labels(cell); ++l) {
+    if (l == j || l == k) continue;
+    const FloatSegment& L = cellLabels.seg(l, cell);
+    const float m = Geom::dist(p, Geom::closest(p, L)) - d + tolerance;
+    if (m < margin) {
+      margin = m;
+      *nearest = l;
+    }
+  }
+  return margin;
+}
+
+static void LeafEdges(
+    const OctCell& leaf, const CellLabels& cellLabels, const int samples,
+    LeafGVD* gvd) {
+  const int cell = make_cell_index(leaf.get_parent_idx(), leaf.get_octant());
+  const int n = cellLabels.num_labels(cell);
+  const float tolerance = 1e-4f * leaf.get_width();
+  for (int j = 0; j < n; ++j) {
+    for (int k = j+1; k < n; ++k) {
+      const FloatSegment& A = cellLabels.seg(j, cell);
+      vector<vector<floatn> > bisector;
+      Geom::bisector(A, cellLabels.seg(k, cell),
+                     convert_floatn(leaf.get_origin()), leaf.get_width(),
+                     samples, &bisector);
+      for (const vector<floatn>& line : bisector) {
+        // Keep the runs of points that no other label is nearer to. A run
+        // starts or ends at the cut by the nearer label, which is a vertex.
+        vector<floatn> run;
+        bool prev_keep = true;
+        for (size_t i = 0; i < line.size(); ++i) {
+          int nearest;
+          const bool keep = Margin(line[i], A, j, k, cell, cellLabels,
+                                   tolerance, &nearest) >= 0;
+          if (i > 0 && keep != prev_keep) {
+            // Interpolate the zero of the cutting label's margin between
+            // the two points.
+            int l;
+            if (keep) {
+              Margin(line[i-1], A, j, k, cell, cellLabels, tolerance, &l);
+            } else {
+              l = nearest;
+            }
+            const FloatSegment& L = cellLabels.seg(l, cell);
+            const floatn& p = line[i-1];
+            const floatn& q = line[i];
+            const float gp = Geom::dist(p, Geom::closest(p, L))
+                - Geom::dist(p, Geom::closest(p, A));
+            const float gq = Geom::dist(q, Geom::closest(q, L))
+                - Geom::dist(q, Geom::closest(q, A));
+            const float t = (gp == gq) ? 0 :
+                std::min(std::max(gp / (gp - gq), 0.0f), 1.0f);
+            const floatn v = p + (q - p) * t;
+            run.push_back(v);
+            if (!keep) {
+              if (run.size() > 1) {
+                gvd->lines.push_back(run);
+                gvd->pairs.push_back(std::make_pair(j, k));
+              }
+              run.clear();
+            }
+            // The bisectors of all three pairs meet at the vertex. Only
+            // the bisector of the two lowest labels reports it.
+            if (l > k) {
+              gvd->vertices.push_back(v);
+              gvd->vertex_labels.push_back(j);
+              gvd->vertex_labels.push_back(k);
+              gvd->vertex_labels.push_back(l);
+            }
+          }
+          if (keep) {
+            run.push_back(line[i]);
+          }
+          prev_keep = keep;
+        }
+        if (run.size() > 1) {
+          gvd->lines.push_back(run);
+          gvd->pairs.push_back(std::make_pair(j, k));
+        }
+      }
+    }
+  }
+}
+
+void ExtractGVDEdges(
+    const vector<OctNode>& octree, const CellLabels& cellLabels,
+    const Resln& resln, const int samples, GVDEdges& edges) {
+  edges = GVDEdges();
+  vector<OctCell> leaves;
+  FindLeavesInBox(
+      BoundingBox<intn>(make_uni_intn(0), make_uni_intn(resln.width)),
+      octree, resln, leaves);
+  vector<OctCell> multi;
+  for (const OctCell& leaf : leaves) {
+    const int cell = make_cell_index(leaf.get_parent_idx(), leaf.get_octant());
+    if (cell < cellLabels.size() && cellLabels.is_multi(cell)) {
+      multi.push_back(leaf);
+    }
+  }
+  const int n = multi.size();
+  if (n == 0) return;
+
+  // Each leaf's edges are kept from the counting pass for the writing pass
+  vector<LeafGVD> gvds(n);
+  vector<int> numPoints(n), numLines(n), numVertices(n);
+  Parallel::For(0, n, [&](const int i) {
+    LeafEdges(multi[i], cellLabels, samples, &gvds[i]);
+    numPoints[i] = 0;
+    for (const vector<floatn>& line : gvds[i].lines) {
+      numPoints[i] += line.size();
+    }
+    numLines[i] = gvds[i].lines.size();
+    numVertices[i] = gvds[i].vertices.size();
+  });
+  Parallel::InclusiveScan(numPoints.data(), numPoints.data(), n);
+  Parallel::InclusiveScan(numLines.data(), numLines.data(), n);
+  Parallel::InclusiveScan(numVertices.data(), numVertices.data(), n);
+
+  edges.points.resize(numPoints[n-1]);
+  edges.lasts.resize(numLines[n-1]);
+  edges.cells.resize(numLines[n-1]);
+  edges.labels.resize(2*numLines[n-1]);
+  edges.vertices.resize(numVertices[n-1]);
+  edges.vertex_cells.resize(numVertices[n-1]);
+  edges.vertex_labels.resize(3*numVertices[n-1]);
+  Parallel::For(0, n, [&](const int i) {
+    const OctCell& leaf = multi[i];
+    const int cell = make_cell_index(leaf.get_parent_idx(), leaf.get_octant());
+    const LeafGVD& gvd = gvds[i];
+    int p = (i == 0) ? 0 : numPoints[i-1];
+    int l = (i == 0) ? 0 : numLines[i-1];
+    for (size_t j = 0; j < gvd.lines.size(); ++j, ++l) {
+      const vector<floatn>& line = gvd.lines[j];
+      std::copy(line.begin(), line.end(), edges.points.begin() + p);
+      p += line.size();
+      edges.lasts[l] = p;
+      edges.cells[l] = cell;
+      edges.labels[2*l] = cellLabels.label(gvd.pairs[j].first, cell);
+      edges.labels[2*l+1] = cellLabels.label(gvd.pairs[j].second, cell);
+    }
+    int v = (i == 0) ? 0 : numVertices[i-1];
+    for (size_t j = 0; j < gvd.vertices.size(); ++j, ++v) {
+      edges.vertices[v] = gvd.vertices[j];
+      edges.vertex_cells[v] = cell;
+      for (int k = 0; k < 3; ++k) {
+        edges.vertex_labels[3*v+k] =
+            cellLabels.label(gvd.vertex_labels[3*j+k], cell);
+      }
+    }
+  });
+}
+
 } // namespace
@@ -1,47 +1,435 @@
 #ifndef __OCTREE_UTILS_H__
 #define __OCTREE_UTILS_H__
 
-#include <vector>
+#include <algorithm>
 #include <iostream>
+#include <stdexcept>
+#include <vector>
 
+#include "./Parallel.h"
 #include "./opencl/defs.h"
 #include "./opencl/vec.h"
 #include "./OctNode.h"
+#include "./CompactNode.h"
 #include "./OctCell.h"
 extern "C" {
   #include "./Resln.h"
+  #include "./LinearCell.h"
 }
+#include "./OctreeLinks.h"
+#include "./CellLabels.h"
+#include "./opencl/Geom.h"
 
 namespace OctreeUtils {
 
 // using namespace Karras;
 
+// 64 bit morton code of the low bits bits of each coordinate of p. The
+// bits of each coordinate are interleaved with the x bit lowest.
+uint64_t MortonKey(const intn& p, const int bits);
+
 OctCell FindLeaf(
     const intn& p, const std::vector<OctNode>& octree, const Resln& resln);
 
+// Locates many points at once. The points are sorted by morton code and
+// located in that order on a few threads, so each one starts from the
+// deepest node it shares with the point before it. cells[i] is the leaf
+// that contains points[i].
+void FindLeaves(
+    const std::vector<intn>& points, const std::vector<OctNode>& octree,
+    const Resln& resln, std::vector<OctCell>& cells);
+
+// Same as above for a compact octree. The octant at each level is read
+// directly from the bits of p rather than from a morton code.
+OctCell FindLeaf(
+    const intn& p, const std::vector<CompactNode>& octree,
+    const Resln& resln);
+
+// Index of the cell of a linear octree that contains p. The cells are
+// binary searched for the last cell whose key is not greater than the
+// morton code of p.
+int FindLinearLeaf(
+    const intn& p, const std::vector<LinearCell>& cells, const Resln& resln);
+
+// Same as the above, for nodes that aren't held in a vector, e.g., the
+// nodes of a MappedOctreeFile.
+OctCell FindLeaf(
+    const intn& p, const OctNode* octree, const Resln& resln);
+OctCell FindLeaf(
+    const intn& p, const CompactNode* octree, const Resln& resln);
+int FindLinearLeaf(
+    const intn& p, const LinearCell* cells, const int n, const Resln& resln);
+
+// Leaves that overlap the half-open box [box.min(), box.max()), in z-order.
+// Subtrees whose cells miss the box aren't visited.
+void FindLeavesInBox(
+    const BoundingBox<intn>& box, const std::vector<OctNode>& octree,
+    const Resln& resln, std::vector<OctCell>& leaves);
+
+// Same as above for each of many boxes, in parallel.
+void FindLeavesInBoxes(
+    const std::vector<BoundingBox<intn> >& boxes,
+    const std::vector<OctNode>& octree, const Resln& resln,
+    std::vector<std::vector<OctCell> >& leaves);
+
+// Indices of the cells of a linear octree that overlap the half-open box.
+// Every point of the box has a morton code between those of its lowest
+// and highest corners, so only the cells in that range are tested.
+void FindLinearLeavesInBox(
+    const BoundingBox<intn>& box, const std::vector<LinearCell>& cells,
+    const Resln& resln, std::vector<int>& indices);
+
+// Merges two linear octrees of the same domain by a sort-merge of their
+// cells. Where the two trees disagree the finer cells are kept, so the
+// result is the coarsest octree that refines both.
+std::vector<LinearCell> MergeLinearOctrees(
+    const std::vector<LinearCell>& a, const std::vector<LinearCell>& b,
+    const Resln& resln);
+
+// Level-synchronous traversal of a breadth-first octree (see
+// Karras::ReorderBreadthFirst). The visitor is called once per level, from
+// the root down, with the range [begin, end) of the nodes on that level.
+// The walk stops after maxLevel, or when the visitor returns false.
+typedef bool (*LevelVisitor)(const int level, const int begin, const int end,
+                             const std::vector<OctNode>& octree, void* data);
+
+void LevelWalk(
+    const std::vector<OctNode>& octree, const std::vector<int>& levelOffsets,
+    LevelVisitor v, void* data, const int maxLevel = -1);
+
+// Parent and face-neighbor links of an octree, with cells addressed as in
+// OctreeLinks.h. See Karras::BuildOctreeLinks.
+struct OctreeLinks {
+  // Cell that each node occupies in its parent. -1 for the root.
+  std::vector<int> parents;
+  // Level of each node. The root is level 0.
+  std::vector<int> levels;
+  // Same size or larger neighbor of each cell, NUM_FACES per cell.
+  std::vector<int> neighbors;
+};
+
+// Finds the leaf across the given face of cell (see OctreeLinks.h for face
+// numbering). The same size or larger neighbor is read from the links, so
+// no root-to-leaf descent is needed. If the neighbor is subdivided, the
+// leaf containing p is found by descending from the neighbor only. p is
+// expected to lie on the face. Throws if the face is on the boundary of
+// the domain.
 OctCell FindNeighbor(
-    const OctCell& cell, const int intersection,
-    const std::vector<OctNode>& octree, const Resln& resln);
+    const OctCell& cell, const int face, const intn& p,
+    const std::vector<OctNode>& octree, const OctreeLinks& links,
+    const Resln& resln);
+
+// The points of an octree grouped by leaf. order sorts the points by morton
+// code, which puts the points of each leaf next to each other: the points
+// in cell c (see OctreeLinks.h) are order[start[c]], ...,
+// order[start[c]+count[c]-1].
+struct LeafPoints {
+  std::vector<int> order;
+  std::vector<int> start;
+  std::vector<int> count;
+};
+
+void BuildLeafPoints(
+    const std::vector<intn>& points, const std::vector<OctNode>& octree,
+    const Resln& resln, LeafPoints& leaf_points);
+
+// Indices of the k points nearest to q, nearest first. Cells are visited
+// best first by their distance to q, and the search stops once no
+// unvisited cell can hold a point nearer than the k'th found so far. Fewer
+// than k indices are returned if there are fewer than k points.
+void FindNearestPoints(
+    const intn& q, const int k, const std::vector<intn>& points,
+    const std::vector<OctNode>& octree, const LeafPoints& leaf_points,
+    const Resln& resln, std::vector<int>& nearest);
+
+// Same as above for each of many queries, in parallel.
+void FindNearestPoints(
+    const std::vector<intn>& queries, const int k,
+    const std::vector<intn>& points, const std::vector<OctNode>& octree,
+    const LeafPoints& leaf_points, const Resln& resln,
+    std::vector<std::vector<int> >& nearest);
+
+// Labeled segments grouped by the leaves they pass through. segments holds
+// the two endpoints of each segment in octree space. The segments that
+// pass through cell c (see OctreeLinks.h) are ids[start[c]], ...,
+// ids[start[c]+count[c]-1].
+struct LeafSegments {
+  std::vector<floatn> segments;
+  std::vector<int> labels;
+  std::vector<int> ids;
+  std::vector<int> start;
+  std::vector<int> count;
+};
+
+// The leaves of each segment are found with Kernels::SegmentCells_s.
+void BuildLeafSegments(
+    const std::vector<floatn>& segments, const std::vector<int>& labels,
+    const std::vector<OctNode>& octree, const Resln& resln,
+    LeafSegments& leaf_segments);
+
+// The segment nearest to a point, the point on it nearest to the query and
+// their distance. label and segment are -1 if there are no segments.
+struct NearestObject {
+  int label;
+  int segment;
+  float dist;
+  floatn p;
+};
+
+// Finds the labeled segment nearest to q, i.e., the generalized Voronoi
+// label of q, by an expanding ring search. The segments in the leaves that
+// overlap a box around q are tested with Geom::closest, and the box is
+// doubled until it holds the nearest segment found so far.
+NearestObject FindNearestObject(
+    const floatn& q, const std::vector<OctNode>& octree,
+    const LeafSegments& leaf_segments, const Resln& resln);
+
+// Same as above for each of many queries, in parallel.
+void FindNearestObjects(
+    const std::vector<floatn>& queries, const std::vector<OctNode>& octree,
+    const LeafSegments& leaf_segments, const Resln& resln,
+    std::vector<NearestObject>& nearest);
+
+// The generalized Voronoi diagram of labeled segments over the leaves of
+// an octree. Each leaf is labeled with the segment nearest to its center,
+// and GVD cells are the leaves whose label differs from a face neighbor's.
+// All three are indexed by cell (see OctreeLinks.h). Internal cells have
+// label -1, distance -1 and are not GVD cells.
+struct GVD {
+  std::vector<int> labels;
+  std::vector<float> dists;
+  std::vector<int> cells;
+};
+
+// Computes the GVD by jump flooding from the leaves that the segments pass
+// through, on the device or on host threads. See C/GVD.c.
+void ComputeGVD(
+    const std::vector<OctNode>& octree, const LeafSegments& leaf_segments,
+    const Resln& resln, GVD& gvd, const bool gpu);
+
+// A uniform grid of points in octree space. Point (i, j) is at
+// origin + spacing * (i, j) and is sample j * nx + i.
+struct SampleGrid {
+  floatn origin;
+  float spacing;
+  int nx;
+  int ny;
+};
+
+// Samples the distance to the nearest segment, and the segment's label, at
+// every point of grid into caller-provided buffers of nx * ny entries.
+// labels may be null. If signed_dist, the distance is negative to the left
+// of the nearest segment, i.e., inside counterclockwise closed polylines.
+// Points get distance -1 and label -1 if there are no segments. The grid
+// is split into square tiles whose candidate segments are those in the
+// leaves within reach of the segment nearest to the tile's center (see
+// FindNearestObject). The tiles are sampled in Morton order, each by one
+// host task or by one OpenCL work group.
+void SampleDistanceField(
+    const SampleGrid& grid, const std::vector<OctNode>& octree,
+    const LeafSegments& leaf_segments, const Resln& resln,
+    const bool signed_dist, float* dists, int* labels, const bool gpu);
+
+// The local feature size of each segment: the distance to the nearest
+// segment of a different label, or resln.width if there is none. Found in
+// parallel by an expanding ring search around each segment's bounding box,
+// as in FindNearestObject.
+void LocalFeatureSizes(
+    const std::vector<OctNode>& octree, const LeafSegments& leaf_segments,
+    const Resln& resln, std::vector<float>& sizes);
+
+// The spacing of samples along each segment for octree input (see
+// Kernels::SampleSegments_p): half the segment's local feature size, so
+// that polylines of different labels end up in different leaves of a
+// single build, but no less than one quantized unit. segments holds the
+// endpoints in octree space. The feature sizes are found with an octree of
+// the endpoints.
+void SampleSpacings(
+    const std::vector<floatn>& segments, const std::vector<int>& labels,
+    const Resln& resln, std::vector<float>& spacings);
 
 struct CellIntersection {
   CellIntersection() {}
   CellIntersection(const float t_, const floatn p_)
       : t(t_), p(p_) {}
+  // Parameter along the segment: 0 at a and 1 at b.
   float t;
   floatn p;
 };
 
+// Intersections of a segment with the boundary of a cell, in order along
+// the segment. Fixed capacity so that finding them doesn't allocate. A
+// segment enters and leaves a cell at most once, but there is room for one
+// intersection per face.
+class CellIntersectionList {
+ public:
+  static const int kCapacity = 2*DIM;
+
+  CellIntersectionList() : n(0) {}
+  int size() const { return n; }
+  bool empty() const { return n == 0; }
+  void push_back(const CellIntersection& ci) { values[n++] = ci; }
+  void resize(const int size) { n = size; }
+  const CellIntersection& operator[](const int i) const { return values[i]; }
+  const CellIntersection* begin() const { return values; }
+  const CellIntersection* end() const { return values + n; }
+
+ private:
+  CellIntersection values[kCapacity];
+  int n;
+};
+
 // Find intersections of the line segment ab with an octree cell.
-std::vector<CellIntersection> FindIntersections(
+CellIntersectionList FindIntersections(
     const floatn& a, const floatn& b, const intn& origin, const int width,
     const Resln& resln);
 
 // Find intersections of the line segment ab with an octree cell.
-std::vector<CellIntersection> FindIntersections(
+CellIntersectionList FindIntersections(
     // const intn& a, const intn& b, const OctCell& cell,
     const floatn& a, const floatn& b, const OctCell& cell,
     const Resln& resln);
 
+// Batched slab tests. Write the parameters along each segment at which it
+// enters and leaves each closed cell. A segment misses a cell if
+// t_enter > t_exit or if [t_enter, t_exit] misses [0, 1]. The loops have no
+// branches, so the compiler can vectorize them.
+
+// One segment against n cells.
+void SlabIntersect(
+    const floatn& a, const floatn& b, const intn* origins, const int* widths,
+    const int n, float* t_enter, float* t_exit);
+
+// n segments against one cell.
+void SlabIntersect(
+    const floatn* a, const floatn* b, const int n, const intn& origin,
+    const int width, float* t_enter, float* t_exit);
+
+// Visitor of CellWalk. data is passed through from CellWalk.
+typedef void (*CellWalkVisitor)(
+    OctCell cell, const floatn& a, const floatn& b,
+    const std::vector<OctNode>& octree, const Resln& resln, void* data);
+
+// Given a segment a-b in octree space, visits each leaf that it intersects,
+// in order from a to b. The walk steps from each cell to the next through
+// the face-neighbor links.
+void CellWalk(
+    const floatn& a, const floatn& b, const std::vector<OctNode>& octree,
+    const OctreeLinks& links, const Resln& resln, CellWalkVisitor v,
+    void* data);
+
+// Walks labeled segments through the leaves they pass through. segments
+// holds the two endpoints of each segment in octree space and labels one
+// label per segment. The piece of a segment inside each leaf is recorded
+// as a CellLabel, and the intersections of the segments with the leaf
+// boundaries are appended to intersections in walk order. Each chunk of
+// segments is walked on its own thread into its own records, and the
+// chunks are concatenated in order, so the output is the same for any
+// numThreads. numThreads of 0 uses all hardware threads.
+void FindMultiCells(
+    const std::vector<floatn>& segments, const std::vector<int>& labels,
+    const std::vector<OctNode>& octree, const OctreeLinks& links,
+    const Resln& resln, std::vector<CellLabel>& records,
+    std::vector<floatn>& intersections, const int numThreads = 0);
+
+// Piecewise-linear GVD edges, stored as polylines the way Polylines stores
+// them: line i is points[lasts[i-1]], ..., points[lasts[i]-1], with
+// lasts[-1] taken as 0. Line i lies in leaf cells[i] (see OctreeLinks.h)
+// and separates labels[2*i] and labels[2*i+1]. Vertex i is where the
+// edges of three labels meet: it lies in leaf vertex_cells[i] and is
+// equidistant to vertex_labels[3*i], vertex_labels[3*i+1] and
+// vertex_labels[3*i+2].
+struct GVDEdges {
+  std::vector<floatn> points;
+  std::vector<int> lasts;
+  std::vector<int> cells;
+  std::vector<int> labels;
+  std::vector<floatn> vertices;
+  std::vector<int> vertex_cells;
+  std::vector<int> vertex_labels;
+};
+
+// Extracts the GVD edges and vertices in the leaves that hold segments of
+// two or more labels (see CellLabels::is_multi). The bisector of each pair
+// of labels is traced in each leaf with Geom::bisector on a samples x
+// samples grid, and is cut where a third label is nearer. Edges end at the
+// cuts, and each cut is a GVD vertex, reported once for its three labels.
+// Each leaf's edges and vertices are found in one parallel pass and, after
+// a scan of their counts, written to the compacted output in z-order.
+void ExtractGVDEdges(
+    const std::vector<OctNode>& octree, const CellLabels& cellLabels,
+    const Resln& resln, const int samples, GVDEdges& edges);
+
+// Appends the leaves under node, whose cell has the given origin and
+// width, that tri overlaps. Bit octant of a node's leaf mask is set if the
+// octant is a leaf. See TriangleCells.
+template <typename Node>
+void WalkTriangle(
+    const Geom::Triangle& tri, const int label, const int triangle,
+    const std::vector<Node>& octree, const int node, const int3& origin,
+    const int width, std::vector<TriangleLabel>& cells) {
+  const int half = width / 2;
+  for (int octant = 0; octant < 8; ++octant) {
+    int3 o = origin;
+    float3 center, h;
+    for (int d = 0; d < 3; ++d) {
+      if (octant & (1 << d)) o.s[d] += half;
+      center.s[d] = o.s[d] + half / 2.0f;
+      h.s[d] = half / 2.0f;
+    }
+    if (!Geom::TriangleBoxOverlap(tri, center, h)) continue;
+    if (octree[node].leaf & (1 << octant)) {
+      cells.push_back(TriangleLabel((node << 3) | octant, label, triangle));
+    } else {
+      WalkTriangle(tri, label, triangle, octree, octree[node].children[octant],
+                   o, half, cells);
+    }
+  }
+}
+
+// Finds the leaves of a 3D octree that each triangle overlaps, in parallel
+// over chunks of triangles. Each triangle walks down from the root into the
+// children that it overlaps. Node must have OctNode's layout in 3D: eight
+// children and a leaf mask with one bit per octant. The builders only make
+// DIM 2 octrees (C/vec_cl.h defines OCT2D), so the 3D octree comes from
+// the caller, and this is a template rather than a function of OctNode.
+// Cells are (node << 3) | octant, as in OctreeLinks.h for 3D. cells are
+// grouped by triangle in the order of triangles, and each triangle's
+// leaves are in z-order. See TriangleLabels in CellLabels.h for the labels
+// of each leaf.
+template <typename Node>
+void TriangleCells(
+    const std::vector<Geom::Triangle>& triangles,
+    const std::vector<int>& labels, const std::vector<Node>& octree,
+    const int bits, std::vector<TriangleLabel>& cells) {
+  if (labels.size() != triangles.size())
+    throw std::logic_error("Each triangle needs one label");
+  cells.clear();
+  const int n = triangles.size();
+  if (n == 0 || octree.empty()) return;
+
+  // Each chunk walks its triangles into its own list, and the lists are
+  // concatenated in chunk order.
+  const int num_chunks = Parallel::NumChunks(n);
+  std::vector<std::vector<TriangleLabel> > chunks(num_chunks);
+  Parallel::ForChunks(0, n, [&](const int begin, const int end, const int c) {
+    int3 origin;
+    origin.s[0] = origin.s[1] = origin.s[2] = 0;
+    for (int t = begin; t < end; ++t) {
+      WalkTriangle(triangles[t], labels[t], t, octree, 0, origin, 1 << bits,
+                   chunks[c]);
+    }
+  }, num_chunks);
+  std::vector<int> offsets(num_chunks+1, 0);
+  for (int c = 0; c < num_chunks; ++c) {
+    offsets[c+1] = offsets[c] + chunks[c].size();
+  }
+  cells.resize(offsets[num_chunks]);
+  Parallel::For(0, num_chunks, [&](const int c) {
+    std::copy(chunks[c].begin(), chunks[c].end(), cells.begin() + offsets[c]);
+  });
+}
+
 } // namespace
 
 #endif
@@ -91,6 +91,12 @@ bool Options::ProcessArg(int& i, char** argv) {
     ++i;
     o.karras_iterations = atoi(argv[i]);
     ++i;
+  } else if (strcmp(argv[i], "--sample") == 0) {
+    o.sample_segments = true;
+    ++i;
+  } else if (strcmp(argv[i], "--balance") == 0) {
+    o.balance = true;
+    ++i;
   } else if (strcmp(argv[i], "--test") == 0) {
     ++i;
     o.test = atoi(argv[i]);
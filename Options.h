@@ -46,6 +46,8 @@ struct Options {
   bool restricted_surface;
   int verts_alloc_factor;
   int karras_iterations;
+  bool sample_segments;
+  bool balance;
   int test;
   int test_num;
   int test_axis;
@@ -63,7 +65,8 @@ struct Options {
   Options()
       : max_level(kMaxLevel),
       tri_threshold(1), simple_dist(true), timings(true),
-        ambiguous_max_level(0), test(-1), showObjectVertices(true),
+        ambiguous_max_level(0), sample_segments(false), balance(false), test(-1),
+        showObjectVertices(true),
         showObjects(false), jitter(false),
         showOctree(true), test_num(0), test_axis(0) {
     ReadOptionsFile();
@@ -81,7 +84,8 @@ struct Options {
         opencl_log(false), cell_of_interest(-1), level_of_interest(-1),
     bb_scale(1), center(-1),
     restricted_surface(false),
-    verts_alloc_factor(3), karras_iterations(1), test(-1),
+    verts_alloc_factor(3), karras_iterations(1), sample_segments(false),
+    balance(false), test(-1),
     help(false), test_num(2), test_axis(0) {
     ReadOptionsFile();
   }
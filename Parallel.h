@@ -0,0 +1,104 @@
+#ifndef __PARALLEL_H__
+#define __PARALLEL_H__
+
+#include <algorithm>
+#include <exception>
+#include <thread>
+#include <vector>
+
+// Host multithreading helpers. A range is split into one contiguous chunk
+// per thread, so within a chunk the order of work is the same as in a
+// serial loop. Small ranges are run on the calling thread.
+namespace Parallel {
+
+// Ranges smaller than this aren't worth starting threads for
+static const int kMinChunk = 1024;
+
+inline int NumThreads() {
+  const int n = std::thread::hardware_concurrency();
+  return (n > 0) ? n : 1;
+}
+
+// Number of chunks ForChunks will split n items into
+inline int NumChunks(const int n, const int numThreads = 0) {
+  const int t = (numThreads > 0) ? numThreads : NumThreads();
+  return std::max(1, std::min(t, n / kMinChunk));
+}
+
+// Calls f(begin, end, chunk) for each chunk of [first, last). If f throws,
+// the exception of the first chunk that threw is rethrown once all chunks
+// are done.
+template <typename F>
+void ForChunks(const int first, const int last, const F& f,
+               const int numThreads = 0) {
+  const int n = last - first;
+  if (n <= 0) return;
+  const int numChunks = NumChunks(n, numThreads);
+  if (numChunks == 1) {
+    f(first, last, 0);
+    return;
+  }
+  const int chunkSize = (n + numChunks - 1) / numChunks;
+  std::vector<std::thread> threads;
+  std::vector<std::exception_ptr> errors(numChunks);
+  for (int c = 0; c < numChunks; ++c) {
+    const int begin = first + c * chunkSize;
+    const int end = std::min(last, begin + chunkSize);
+    if (begin >= end) break;
+    threads.push_back(std::thread([&f, &errors, begin, end, c]() {
+      try {
+        f(begin, end, c);
+      } catch (...) {
+        errors[c] = std::current_exception();
+      }
+    }));
+  }
+  for (std::thread& t : threads) {
+    t.join();
+  }
+  for (const std::exception_ptr& e : errors) {
+    if (e) std::rethrow_exception(e);
+  }
+}
+
+// Calls f(i) for each i in [first, last).
+template <typename F>
+void For(const int first, const int last, const F& f,
+         const int numThreads = 0) {
+  ForChunks(first, last, [&f](const int begin, const int end, const int) {
+    for (int i = begin; i < end; ++i) {
+      f(i);
+    }
+  }, numThreads);
+}
+
+// Inclusive prefix sum. Each chunk is summed, the chunk totals are scanned
+// serially and then each chunk is scanned with its offset. in and out may
+// be the same array.
+template <typename T>
+void InclusiveScan(const T* in, T* out, const int n,
+                   const int numThreads = 0) {
+  const int numChunks = NumChunks(n, numThreads);
+  std::vector<T> offsets(numChunks+1, 0);
+  ForChunks(0, n, [&](const int begin, const int end, const int c) {
+    T sum = 0;
+    for (int i = begin; i < end; ++i) {
+      sum += in[i];
+    }
+    offsets[c+1] = sum;
+  }, numChunks);
+  for (int c = 0; c < numChunks; ++c) {
+    offsets[c+1] += offsets[c];
+  }
+  ForChunks(0, n, [&](const int begin, const int end, const int c) {
+    T sum = offsets[c];
+    for (int i = begin; i < end; ++i) {
+      sum += in[i];
+      out[i] = sum;
+    }
+  }, numChunks);
+}
+
+} // namespace
+
+#endif
@@ -0,0 +1,150 @@
+#include "./PointFile.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+#include "./ObjFile.h"
+
+using std::string;
+using std::vector;
+using std::logic_error;
+
+static const char kMagic[8] = { 'P', 'G', 'V', 'D', 'P', 'T', 'S', 0 };
+static const uint32_t kVersion = 1;
+
+template <typename T>
+static void WritePoints(
+    const string& filename, const T* coords, const size_t count,
+    const int dim, const PointFileType type) {
+  if (dim != 2 && dim != 3)
+    throw logic_error("Point files must be 2D or 3D");
+  PointFileHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.version = kVersion;
+  header.dim = dim;
+  header.type = type;
+  header.count = count;
+  for (size_t i = 0; i < count; ++i) {
+    for (int d = 0; d < dim; ++d) {
+      const float c = coords[i*dim + d];
+      header.bb_min[d] = (i == 0) ? c : std::min(header.bb_min[d], c);
+      header.bb_max[d] = (i == 0) ? c : std::max(header.bb_max[d], c);
+    }
+  }
+
+  std::ofstream out(filename.c_str(), std::ios::binary);
+  if (!out)
+    throw logic_error("Can't open " + filename + " for writing");
+  out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  out.write(reinterpret_cast<const char*>(coords), sizeof(T) * count * dim);
+  if (!out)
+    throw logic_error("Failed writing " + filename);
+}
+
+void WritePointFile(
+    const string& filename, const float* coords, const size_t count,
+    const int dim) {
+  WritePoints(filename, coords, count, dim, kPointFileFloat);
+}
+
+void WritePointFile(
+    const string& filename, const int* coords, const size_t count,
+    const int dim) {
+  WritePoints(filename, coords, count, dim, kPointFileInt);
+}
+
+size_t ConvertToPointFile(const string& in, const string& out) {
+  if (in.size() >= 4 && in.compare(in.size() - 4, 4, ".obj") == 0) {
+    ObjFile::Mesh mesh;
+    ObjFile::Read(in, mesh);
+    const size_t n = mesh.vertices.size();
+    vector<float> coords(3 * n);
+    for (size_t i = 0; i < n; ++i) {
+      for (int d = 0; d < 3; ++d) {
+        coords[i*3 + d] = mesh.vertices[i].s[d];
+      }
+    }
+    WritePointFile(out, coords.data(), n, 3);
+    return n;
+  }
+
+  std::ifstream file(in.c_str());
+  if (!file)
+    throw logic_error("Can't open " + in);
+  vector<float> coords;
+  int dim = 0;
+  string line;
+  while (std::getline(file, line)) {
+    std::istringstream ss(line);
+    float c;
+    int count = 0;
+    while (ss >> c) {
+      coords.push_back(c);
+      ++count;
+    }
+    if (count == 0) continue;
+    if (dim == 0) {
+      dim = count;
+    } else if (count != dim) {
+      throw logic_error("Points have different dimensions in " + in);
+    }
+  }
+  if (dim == 0) {
+    dim = 2;
+  }
+  const size_t n = coords.size() / dim;
+  WritePointFile(out, coords.data(), n, dim);
+  return n;
+}
+
+MappedPointFile::MappedPointFile(const string& filename)
+    : file_(filename),
+      header_(reinterpret_cast<const PointFileHeader*>(file_.data())) {
+  const size_t length = file_.size();
+  if (length < sizeof(PointFileHeader)
+      || memcmp(header_->magic, kMagic, sizeof(kMagic)) != 0) {
+    throw logic_error(filename + " isn't a point file");
+  } else if (header_->version != kVersion) {
+    throw logic_error(filename + " has an unsupported version");
+  } else if ((header_->dim != 2 && header_->dim != 3)
+             || (header_->type != kPointFileFloat
+                 && header_->type != kPointFileInt)
+             || (length - sizeof(PointFileHeader)) / (4 * header_->dim)
+                 < header_->count) {
+    throw logic_error(filename + " is corrupt");
+  }
+}
+
+const float* MappedPointFile::floats() const {
+  return quantized() ? 0 : static_cast<const float*>(data());
+}
+
+const int* MappedPointFile::ints() const {
+  return quantized() ? static_cast<const int*>(data()) : 0;
+}
+
+const floatn* MappedPointFile::floatn_points() const {
+  if (dim() != DIM || quantized() || sizeof(floatn) != DIM * sizeof(float))
+    throw logic_error("Point file doesn't hold packed floatn points");
+  return static_cast<const floatn*>(data());
+}
+
+const intn* MappedPointFile::intn_points() const {
+  if (dim() != DIM || !quantized() || sizeof(intn) != DIM * sizeof(int))
+    throw logic_error("Point file doesn't hold packed intn points");
+  return static_cast<const intn*>(data());
+}
+
+BoundingBox<floatn> MappedPointFile::bounding_box() const {
+  floatn lo, hi;
+  for (int d = 0; d < DIM; ++d) {
+    lo.s[d] = (d < dim()) ? header_->bb_min[d] : 0;
+    hi.s[d] = (d < dim()) ? header_->bb_max[d] : 0;
+  }
+  return BoundingBox<floatn>(lo, hi);
+}
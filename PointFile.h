@@ -0,0 +1,82 @@
+#ifndef __POINT_FILE_H__
+#define __POINT_FILE_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "./C/dim.h"
+#include "./MappedFile.h"
+#include "./opencl/vec.h"
+#include "./BoundingBox.h"
+
+// Binary point set files. A 64 byte header is followed by count points of
+// dim packed coordinates each, either 32 bit floats or pre-quantized 32 bit
+// integers, in native (little endian) byte order. The points start on a
+// 64 byte boundary, so a mapped file can be used in place.
+enum PointFileType {
+  kPointFileFloat = 0,
+  kPointFileInt = 1
+};
+
+struct PointFileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t dim;
+  uint32_t type;
+  uint32_t reserved;
+  uint64_t count;
+  // Bounding box of the points. Only the first dim coordinates are used.
+  float bb_min[3];
+  float bb_max[3];
+  uint8_t padding[8];
+};
+
+// Writes count points of dim coordinates each. The bounding box is
+// computed on the way.
+void WritePointFile(
+    const std::string& filename, const float* coords, const size_t count,
+    const int dim);
+void WritePointFile(
+    const std::string& filename, const int* coords, const size_t count,
+    const int dim);
+
+// Converts whitespace separated points, one per line as in data2/*.dat, or
+// the vertices of an OBJ file to a point file of floats. Files ending in
+// .obj are read with ObjFile::Read. Returns the number of points.
+size_t ConvertToPointFile(const std::string& in, const std::string& out);
+
+// A read-only memory mapping of a point file. Nothing is parsed or copied:
+// the points are read straight from the mapping, e.g., with
+//   Karras::Quantize(file.floatn_points(), file.size(), r, &bb)
+// or Kernels::UploadPoints(file.intn_points(), file.size(), buffer).
+// Throws logic_error if the file can't be mapped or isn't a point file.
+class MappedPointFile {
+ public:
+  explicit MappedPointFile(const std::string& filename);
+
+  int dim() const { return header_->dim; }
+  size_t size() const { return header_->count; }
+  bool quantized() const { return header_->type == kPointFileInt; }
+  const PointFileHeader& header() const { return *header_; }
+
+  // Coordinates, dim per point. Null if the file holds the other type.
+  const float* floats() const;
+  const int* ints() const;
+
+  // The points as DIM vectors. Throws if the file's dimension or type
+  // doesn't match, or if the vector type is padded, e.g., cl_float3.
+  const floatn* floatn_points() const;
+  const intn* intn_points() const;
+  BoundingBox<floatn> bounding_box() const;
+
+ private:
+  const void* data() const {
+    return file_.data() + sizeof(PointFileHeader);
+  }
+
+  MappedFile file_;
+  const PointFileHeader* header_;
+};
+
+#endif
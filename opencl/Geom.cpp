@@ -1,5 +1,9 @@
+#include "../Parallel.h"
 #include "./Geom.h"
 
+#include <algorithm>
+#include <cmath>
+
 using std::vector;
 using std::logic_error;
 using std::swap;
@@ -698,7 +702,8 @@ void FitBoxes(FloatSegment A, FloatSegment B, const float& min_d,
     FloatSegment A1_orig(ca, A.b());
     FloatSegment B0_orig(cb, B.a());
     FloatSegment B1_orig(cb, B.b());
-    FloatSegment A0, A1, B0, B1;
+    // Segments that can't be clipped keep their original direction
+    FloatSegment A0(A0_orig), A1(A1_orig), B0(B0_orig), B1(B1_orig);
     bool A0_valid = clip_to_box(A0_orig, min_d, &A0);
     bool A1_valid = clip_to_box(A1_orig, min_d, &A1);
     bool B0_valid = clip_to_box(B0_orig, min_d, &B0);
@@ -717,4 +722,254 @@ void FitBoxes(FloatSegment A, FloatSegment B, const float& min_d,
   }
 }
 
+void FitBoxes(const vector<FloatSegment>& pairs, const float& min_d,
+              vector<floatn>* samples,
+              vector<floatn>* origins, vector<float>* lengths,
+              const int numThreads) {
+  struct Fit {
+    vector<floatn> samples;
+    vector<floatn> origins;
+    vector<float> lengths;
+  };
+  const int n = pairs.size() / 2;
+  const int num_chunks = Parallel::NumChunks(n, numThreads);
+  vector<Fit> fits(num_chunks);
+  vector<int> num_samples(n), num_boxes(n);
+  Parallel::ForChunks(0, n, [&](const int begin, const int end, const int c) {
+    Fit& fit = fits[c];
+    for (int i = begin; i < end; ++i) {
+      const int s = fit.samples.size();
+      const int b = fit.origins.size();
+      if (!multi_intersection(pairs[2*i], pairs[2*i+1])) {
+        FitBoxes(pairs[2*i], pairs[2*i+1], min_d,
+                 &fit.samples, &fit.origins, &fit.lengths);
+      }
+      num_samples[i] = fit.samples.size() - s;
+      num_boxes[i] = fit.origins.size() - b;
+    }
+  }, num_chunks);
+  Parallel::InclusiveScan(num_samples.data(), num_samples.data(), n);
+  Parallel::InclusiveScan(num_boxes.data(), num_boxes.data(), n);
+
+  const int s0 = samples->size();
+  const int b0 = origins->size();
+  samples->resize(s0 + ((n > 0) ? num_samples[n-1] : 0));
+  origins->resize(b0 + ((n > 0) ? num_boxes[n-1] : 0));
+  lengths->resize(origins->size());
+  Parallel::ForChunks(0, n, [&](const int begin, const int, const int c) {
+    const Fit& fit = fits[c];
+    const int s = s0 + ((begin == 0) ? 0 : num_samples[begin-1]);
+    const int b = b0 + ((begin == 0) ? 0 : num_boxes[begin-1]);
+    std::copy(fit.samples.begin(), fit.samples.end(), samples->begin() + s);
+    std::copy(fit.origins.begin(), fit.origins.end(), origins->begin() + b);
+    std::copy(fit.lengths.begin(), fit.lengths.end(), lengths->begin() + b);
+  }, num_chunks);
+}
+
+// The corners of a grid square are numbered counterclockwise from its low
+// corner, and edge e of the square joins corners e and (e+1)%4. Grid edges
+// are numbered 2*(j*m+i) for the edge from grid point (i, j) to (i+1, j)
+// and 2*(j*m+i)+1 for the edge from (i, j) to (i, j+1).
+void bisector(const FloatSegment& A, const FloatSegment& B,
+              const floatn& origin, const float& width, const int n,
+              vector<vector<floatn> >* lines) {
+  if (n < 1) {
+    throw logic_error("bisector needs at least one grid square");
+  }
+  const int m = n + 1;
+  const float h = width / n;
+  auto grid_point = [&](const int i, const int j) {
+    return make_floatn(origin.x + i * h, origin.y + j * h);
+  };
+  auto value = [&](const floatn& p) {
+    return dist(p, closest(p, A)) - dist(p, closest(p, B));
+  };
+  vector<float> f(m*m);
+  for (int j = 0; j < m; ++j) {
+    for (int i = 0; i < m; ++i) {
+      f[j*m+i] = value(grid_point(i, j));
+    }
+  }
+
+  // Pieces of the bisector, as pairs of grid edges
+  vector<int> ends;
+  for (int j = 0; j < n; ++j) {
+    for (int i = 0; i < n; ++i) {
+      const int c[4] = { j*m+i, j*m+i+1, (j+1)*m+i+1, (j+1)*m+i };
+      const int e[4] = { 2*c[0], 2*c[1]+1, 2*c[3], 2*c[0]+1 };
+      int cuts[4];
+      int k = 0;
+      for (int s = 0; s < 4; ++s) {
+        if ((f[c[s]] > 0) != (f[c[(s+1)%4]] > 0)) {
+          cuts[k++] = s;
+        }
+      }
+      if (k == 2) {
+        ends.push_back(e[cuts[0]]);
+        ends.push_back(e[cuts[1]]);
+      } else if (k == 4) {
+        // Saddle. The value at the center decides which pair of opposite
+        // corners is connected.
+        const float fc = value(grid_point(i, j) + make_floatn(h/2, h/2));
+        if ((fc > 0) == (f[c[0]] > 0)) {
+          // Cut off corners 1 and 3
+          const int pieces[4] = { e[0], e[1], e[2], e[3] };
+          ends.insert(ends.end(), pieces, pieces+4);
+        } else {
+          // Cut off corners 0 and 2
+          const int pieces[4] = { e[3], e[0], e[1], e[2] };
+          ends.insert(ends.end(), pieces, pieces+4);
+        }
+      }
+    }
+  }
+
+  // Where the bisector crosses a grid edge. Computed from the low end of
+  // the edge so that both squares that share it get the same point.
+  auto crossing = [&](const int edge) {
+    const int c0 = edge / 2;
+    const int c1 = (edge % 2 == 0) ? c0 + 1 : c0 + m;
+    const float t = f[c0] / (f[c0] - f[c1]);
+    const floatn p0 = grid_point(c0 % m, c0 / m);
+    const floatn p1 = grid_point(c1 % m, c1 / m);
+    return p0 + (p1 - p0) * t;
+  };
+
+  // A grid edge is shared by at most two pieces
+  const int num_pieces = ends.size() / 2;
+  vector<int> edge_pieces(4*m*m, -1);
+  for (int i = 0; i < 2*num_pieces; ++i) {
+    const int slot = 2*ends[i];
+    edge_pieces[(edge_pieces[slot] == -1) ? slot : slot+1] = i / 2;
+  }
+  vector<bool> used(num_pieces, false);
+  auto trace = [&](int piece, int edge) {
+    vector<floatn> line(1, crossing(edge));
+    while (piece != -1 && !used[piece]) {
+      used[piece] = true;
+      edge = (ends[2*piece] == edge) ? ends[2*piece+1] : ends[2*piece];
+      line.push_back(crossing(edge));
+      const int* shared = &edge_pieces[2*edge];
+      piece = (shared[0] == piece) ? shared[1] : shared[0];
+    }
+    lines->push_back(line);
+  };
+  // Open lines start at an edge with one piece
+  for (int edge = 0; edge < 2*m*m; ++edge) {
+    const int piece = edge_pieces[2*edge];
+    if (piece != -1 && edge_pieces[2*edge+1] == -1 && !used[piece]) {
+      trace(piece, edge);
+    }
+  }
+  for (int piece = 0; piece < num_pieces; ++piece) {
+    if (!used[piece]) {
+      trace(piece, ends[2*piece]);
+    }
+  }
+}
+
+//------------------------------------------------------------
+// Triangles
+//------------------------------------------------------------
+
+// True if the projections onto axis of the triangle v, relative to the box
+// center, and of the box are disjoint. A zero axis never separates.
+static bool Separates(
+    const float v[3][3], const float half[3], const float axis[3]) {
+  float lo = 0, hi = 0;
+  for (int i = 0; i < 3; ++i) {
+    const float p = v[i][0] * axis[0] + v[i][1] * axis[1] + v[i][2] * axis[2];
+    lo = (i == 0) ? p : std::min(lo, p);
+    hi = (i == 0) ? p : std::max(hi, p);
+  }
+  const float r = half[0] * fabs(axis[0]) + half[1] * fabs(axis[1])
+      + half[2] * fabs(axis[2]);
+  return lo > r || hi < -r;
+}
+
+static void Cross(const float a[3], const float b[3], float c[3]) {
+  c[0] = a[1] * b[2] - a[2] * b[1];
+  c[1] = a[2] * b[0] - a[0] * b[2];
+  c[2] = a[0] * b[1] - a[1] * b[0];
+}
+
+bool TriangleBoxOverlap(
+    const Triangle& tri, const float3& center, const float3& half) {
+  float v[3][3], e[3][3], h[3];
+  for (int d = 0; d < 3; ++d) {
+    h[d] = half.s[d];
+    for (int i = 0; i < 3; ++i) {
+      v[i][d] = tri.v[i].s[d] - center.s[d];
+    }
+  }
+  for (int i = 0; i < 3; ++i) {
+    for (int d = 0; d < 3; ++d) {
+      e[i][d] = v[(i+1)%3][d] - v[i][d];
+    }
+  }
+
+  float axis[3];
+  // Box face normals
+  for (int d = 0; d < 3; ++d) {
+    const float unit[3] = { d == 0 ? 1.0f : 0.0f, d == 1 ? 1.0f : 0.0f,
+                            d == 2 ? 1.0f : 0.0f };
+    if (Separates(v, h, unit)) return false;
+    // Edge cross products
+    for (int i = 0; i < 3; ++i) {
+      Cross(unit, e[i], axis);
+      if (Separates(v, h, axis)) return false;
+    }
+  }
+  // Triangle normal
+  Cross(e[0], e[1], axis);
+  return !Separates(v, h, axis);
+}
+
+// Number of intervals per edge of the sampling grid of tri
+static int NumIntervals(const Triangle& tri, const float spacing) {
+  float l2 = 0;
+  for (int i = 0; i < 3; ++i) {
+    float e2 = 0;
+    for (int d = 0; d < 3; ++d) {
+      const float e = tri.v[(i+1)%3].s[d] - tri.v[i].s[d];
+      e2 += e * e;
+    }
+    l2 = std::max(l2, e2);
+  }
+  if (spacing <= 0) return 1;
+  return std::max(static_cast<int>(ceil(sqrt(l2) / spacing)), 1);
+}
+
+void SampleTriangles(
+    const vector<Triangle>& triangles, const vector<float>& spacings,
+    vector<float3>& samples) {
+  const int n = triangles.size();
+  samples.clear();
+  if (n == 0) return;
+
+  vector<int> counts(n);
+  Parallel::For(0, n, [&](const int t) {
+    const int m = NumIntervals(triangles[t], spacings[t]);
+    counts[t] = (m+1) * (m+2) / 2;
+  });
+  Parallel::InclusiveScan(counts.data(), counts.data(), n);
+  samples.resize(counts[n-1]);
+  Parallel::For(0, n, [&](const int t) {
+    const Triangle& tri = triangles[t];
+    const int m = NumIntervals(tri, spacings[t]);
+    int k = (t == 0) ? 0 : counts[t-1];
+    for (int i = 0; i <= m; ++i) {
+      for (int j = 0; i + j <= m; ++j) {
+        const float u = i / static_cast<float>(m);
+        const float v = j / static_cast<float>(m);
+        for (int d = 0; d < 3; ++d) {
+          samples[k].s[d] = tri.v[0].s[d] * (1 - u - v) + tri.v[1].s[d] * u
+              + tri.v[2].s[d] * v;
+        }
+        ++k;
+      }
+    }
+  });
+}
+
 } // namespace
@@ -48,6 +48,18 @@ void FitBoxes(FloatSegment A, FloatSegment B, const float& min_d,
               std::vector<floatn>* samples,
               std::vector<floatn>* origins, std::vector<float>* lengths);
 
+// Fits boxes between each pair of segments in parallel. pairs holds the
+// segments A and B of each pair. Pairs that overlap along a line are
+// skipped. Each chunk of pairs is fit into its own buffers, and the
+// per-pair counts are scanned to place them in the output, so the output
+// is the same as calling FitBoxes on each pair in order. If a pair fails,
+// the error of the first failing chunk is thrown. numThreads of 0 uses all
+// hardware threads.
+void FitBoxes(const std::vector<FloatSegment>& pairs, const float& min_d,
+              std::vector<floatn>* samples,
+              std::vector<floatn>* origins, std::vector<float>* lengths,
+              const int numThreads = 0);
+
 void FitBoxesNoIntersection(
     FloatSegment A, FloatSegment B, const float& min_d,
     std::vector<floatn>* samples,
@@ -59,6 +71,39 @@ floatn line_intersection(
     const floatn& p1, const floatn& p2, const floatn& p3, const floatn& p4,
     bool* lines_intersect, bool* segs_intersect);
 
+// Piecewise-linear bisector of segments A and B inside the square
+// [origin, origin+width]. The difference of the distances to A and B is
+// sampled on an n x n grid over the square and its zero set is traced by
+// marching squares. Pieces that share a grid edge are joined, and each
+// resulting polyline is appended to lines. Lines that start and end on the
+// boundary of the square come first; closed lines repeat their first point.
+void bisector(const FloatSegment& A, const FloatSegment& B,
+              const floatn& origin, const float& width, const int n,
+              std::vector<std::vector<floatn> >* lines);
+
+// A triangle in the space of a 3D octree
+struct Triangle {
+  float3 v[3];
+};
+
+// True if the triangle overlaps the closed box with the given center and
+// half widths. This is the separating axis test of Akenine-Moller: the
+// triangle and box are disjoint if and only if their projections are
+// disjoint on one of the box's face normals, the triangle's normal or the
+// cross products of their edges.
+bool TriangleBoxOverlap(
+    const Triangle& tri, const float3& center, const float3& half);
+
+// Samples points over each triangle for octree input, the 3D counterpart
+// of Kernels::SampleSegments_p. Triangle t is covered by a barycentric grid
+// with n = ceil(l / spacings[t]) intervals per edge, where l is its longest
+// edge, so that neighboring samples are at most spacings[t] apart. It gets
+// (n+1)(n+2)/2 samples, vertices included. Samples are counted, scanned
+// and written in parallel, in triangle order.
+void SampleTriangles(
+    const std::vector<Triangle>& triangles, const std::vector<float>& spacings,
+    std::vector<float3>& samples);
+
 } // namespace
 
 #endif
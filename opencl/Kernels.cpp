@@ -35,11 +35,17 @@ namespace Kernels {
   }
 
   cl_int UploadPoints(const vector<intn> &points, cl::Buffer &pointsBuffer) {
+    return UploadPoints(points.data(), points.size(), pointsBuffer);
+  }
+
+  // points needn't be in a vector, e.g., the points of a MappedPointFile
+  // are written to the device straight from the mapping.
+  cl_int UploadPoints(const intn *points, cl_int numPoints, cl::Buffer &pointsBuffer) {
     startBenchmark("Uploading points");
     cl_int error = 0;
-    cl_int roundSize = nextPow2(points.size());
+    cl_int roundSize = nextPow2(numPoints);
     error |= CLFW::get(pointsBuffer, "pointsBuffer", sizeof(intn)*roundSize);
-    error |= CLFW::DefaultQueue.enqueueWriteBuffer(pointsBuffer, CL_TRUE, 0, sizeof(cl_int2) * points.size(), points.data());
+    error |= CLFW::DefaultQueue.enqueueWriteBuffer(pointsBuffer, CL_TRUE, 0, sizeof(intn) * numPoints, points);
     stopBenchmark();
     return error;
   }
@@ -330,20 +336,18 @@ namespace Kernels {
     return error;
   }
 
-  cl_int BinaryRadixToOctree_p(cl::Buffer &internalBRTNodes, vector<OctNode> &octree_vec, cl_int size) {
+  cl_int BinaryRadixToOctree_p(cl::Buffer &internalBRTNodes, cl::Buffer &localSplits, cl::Buffer &scannedSplits, cl::Buffer &octree, cl_int size, cl_int &octreeSize) {
     startBenchmark("BinaryRadixToOctree_p");
     int globalSize = nextPow2(size);
     cl::Kernel &kernel = CLFW::Kernels["BRT2OctreeKernel"];
     cl::CommandQueue &queue = CLFW::DefaultQueue;
 
-    cl::Buffer localSplits, scannedSplits, octree;
     cl_int error = CLFW::get(scannedSplits, "scannedSplits", sizeof(cl_int) * globalSize);
 
     error |= ComputeLocalSplits_p(internalBRTNodes, localSplits, size);
     error |= StreamScan_p(localSplits, scannedSplits, globalSize);
 
     //Read in the required octree size
-    cl_int octreeSize;
     error |= CLFW::DefaultQueue.enqueueReadBuffer(scannedSplits, CL_TRUE, sizeof(int)*(size - 2), sizeof(int), &octreeSize);
     cl_int roundOctreeSize = nextPow2(octreeSize);
 
@@ -360,25 +364,38 @@ namespace Kernels {
     error |= kernel.setArg(4, size);
 
     error |= queue.enqueueNDRangeKernel(kernel, cl::NullRange, cl::NDRange(globalSize), cl::NullRange);
+    stopBenchmark();
+    return error;
+  }
+
+  cl_int BinaryRadixToOctree_p(cl::Buffer &internalBRTNodes, vector<OctNode> &octree_vec, cl_int size) {
+    cl::Buffer localSplits, scannedSplits, octree;
+    cl_int octreeSize;
+    cl_int error = BinaryRadixToOctree_p(internalBRTNodes, localSplits, scannedSplits, octree, size, octreeSize);
 
     octree_vec.resize(octreeSize);
-    error |= queue.enqueueReadBuffer(octree, CL_TRUE, 0, sizeof(OctNode)*octreeSize, octree_vec.data());
-    stopBenchmark();
+    error |= CLFW::DefaultQueue.enqueueReadBuffer(octree, CL_TRUE, 0, sizeof(OctNode)*octreeSize, octree_vec.data());
     return error;
   }
 
   cl_int BinaryRadixToOctree_s(vector<BrtNode> &internalBRTNodes, vector<OctNode> &octree, cl_int size) {
+    vector<unsigned int> localSplits, prefixSums;
+    return BinaryRadixToOctree_s(internalBRTNodes, localSplits, prefixSums, octree, size);
+  }
+
+  cl_int BinaryRadixToOctree_s(vector<BrtNode> &internalBRTNodes, vector<unsigned int> &localSplits, vector<unsigned int> &prefixSums, vector<OctNode> &octree, cl_int size) {
     startBenchmark("BinaryRadixToOctree_s");
-    vector<unsigned int> localSplits(size);
+    localSplits.assign(size, 0);
     ComputeLocalSplits_s(internalBRTNodes, localSplits, size);
 
-    vector<unsigned int> prefixSums(size);
+    prefixSums.resize(size);
     StreamScan_s(localSplits.data(), prefixSums.data(), size);
 
     const int octreeSize = prefixSums[size - 1];
     octree.resize(octreeSize);
     for (int i = 0; i < octreeSize; ++i)
       brt2octree_init(i, octree.data());
+    brt2octree_root(internalBRTNodes.data(), octree.data(), localSplits.data());
     for (int brt_i = 1; brt_i < size - 1; ++brt_i)
       brt2octree(brt_i, internalBRTNodes.data(), octree.data(), localSplits.data(), prefixSums.data(), size, octreeSize);
     stopBenchmark();
@@ -427,4 +444,1253 @@ namespace Kernels {
     error |= Kernels::BinaryRadixToOctree_p(internalBRTNodes, octree, size);
     return error;
   }
-}
\ No newline at end of file
+
+  // Same as above, except the octree is reordered breadth first on the
+  // device before it is read back.
+  cl_int BuildOctree_p(const vector<intn>& points, vector<OctNode> &octree, vector<int> &levelOffsets, int bits, int mbits) {
+    if (points.empty())
+      throw logic_error("Zero points not supported");
+
+    int size = points.size();
+    cl_int error = 0;
+    cl_int octreeSize;
+    cl::Buffer pointsBuffer, zpoints, internalBRTNodes, localSplits, scannedSplits, octreeBuffer, bfsOctree;
+    error |= Kernels::UploadPoints(points, pointsBuffer);
+    error |= Kernels::PointsToMorton_p(pointsBuffer, zpoints, size, bits);
+    error |= Kernels::RadixSortBigUnsigned(zpoints, size, mbits);
+    error |= Kernels::UniqueSorted(zpoints, size);
+    error |= Kernels::BuildBinaryRadixTree_p(zpoints, internalBRTNodes, size, mbits);
+    error |= Kernels::BinaryRadixToOctree_p(internalBRTNodes, localSplits, scannedSplits, octreeBuffer, size, octreeSize);
+    error |= Kernels::ReorderBreadthFirst_p(octreeBuffer, octreeSize, bfsOctree, levelOffsets);
+
+    octree.resize(levelOffsets.back());
+    error |= CLFW::DefaultQueue.enqueueReadBuffer(bfsOctree, CL_TRUE, 0, sizeof(OctNode)*octree.size(), octree.data());
+    return error;
+  }
+
+  cl_int OctreeToCompact_p(cl::Buffer &octree, cl::Buffer &compact, cl_int octreeSize, cl_int &compactSize) {
+    startBenchmark("OctreeToCompact_p");
+    cl_int globalSize = nextPow2(octreeSize);
+    cl::CommandQueue &queue = CLFW::DefaultQueue;
+    cl::Kernel &countKernel = CLFW::Kernels["CountInternalChildrenKernel"];
+    cl::Kernel &indexKernel = CLFW::Kernels["ComputeCompactIndicesKernel"];
+    cl::Kernel &compactKernel = CLFW::Kernels["OctreeToCompactKernel"];
+
+    cl::Buffer childCounts, scannedCounts, compactIndex;
+    cl_int error = CLFW::get(childCounts, "childCounts", sizeof(cl_int) * globalSize);
+    error |= CLFW::get(scannedCounts, "scannedCounts", sizeof(cl_int) * globalSize);
+    error |= CLFW::get(compactIndex, "compactIndex", sizeof(cl_int) * globalSize);
+    error |= queue.enqueueFillBuffer<cl_int>(childCounts, { 0 }, 0, sizeof(cl_int) * globalSize);
+    error |= queue.enqueueFillBuffer<cl_int>(compactIndex, { -1 }, 0, sizeof(cl_int) * globalSize);
+
+    //Count the internal children of each node, then scan to get the
+    //location of each node's child block.
+    error |= countKernel.setArg(0, octree);
+    error |= countKernel.setArg(1, childCounts);
+    error |= countKernel.setArg(2, octreeSize);
+    error |= queue.enqueueNDRangeKernel(countKernel, cl::NullRange, cl::NDRange(globalSize), cl::NullRange);
+    error |= StreamScan_p(childCounts, scannedCounts, globalSize);
+
+    cl_uint numChildren;
+    error |= queue.enqueueReadBuffer(scannedCounts, CL_TRUE, sizeof(cl_int)*(octreeSize - 1), sizeof(cl_int), &numChildren);
+    compactSize = numChildren + 1;
+    error |= CLFW::get(compact, "compact", sizeof(CompactNode) * nextPow2(compactSize));
+
+    error |= indexKernel.setArg(0, octree);
+    error |= indexKernel.setArg(1, scannedCounts);
+    error |= indexKernel.setArg(2, compactIndex);
+    error |= indexKernel.setArg(3, octreeSize);
+    error |= queue.enqueueNDRangeKernel(indexKernel, cl::NullRange, cl::NDRange(globalSize), cl::NullRange);
+
+    error |= compactKernel.setArg(0, octree);
+    error |= compactKernel.setArg(1, scannedCounts);
+    error |= compactKernel.setArg(2, compactIndex);
+    error |= compactKernel.setArg(3, compact);
+    error |= compactKernel.setArg(4, octreeSize);
+    error |= queue.enqueueNDRangeKernel(compactKernel, cl::NullRange, cl::NDRange(globalSize), cl::NullRange);
+    stopBenchmark();
+    return error;
+  }
+
+  cl_int OctreeToCompact_s(const vector<OctNode> &octree, vector<CompactNode> &compact) {
+    startBenchmark("OctreeToCompact_s");
+    const int octreeSize = octree.size();
+    OctNode* nodes = const_cast<OctNode*>(octree.data());
+    vector<unsigned int> childCounts(octreeSize);
+    for (int i = 0; i < octreeSize; ++i)
+      CountInternalChildren(nodes, childCounts.data(), i);
+
+    vector<unsigned int> scannedCounts(octreeSize);
+    StreamScan_s(childCounts.data(), scannedCounts.data(), octreeSize);
+
+    vector<int> compactIndex(octreeSize, -1);
+    for (int i = 0; i < octreeSize; ++i)
+      ComputeCompactIndices(nodes, scannedCounts.data(), compactIndex.data(), i);
+
+    compact.resize(scannedCounts[octreeSize - 1] + 1);
+    for (int i = 0; i < octreeSize; ++i)
+      octree2compact(nodes, scannedCounts.data(), compactIndex.data(), compact.data(), i);
+    stopBenchmark();
+    return CL_SUCCESS;
+  }
+
+  cl_int BuildCompactOctree_s(const vector<intn>& points, vector<CompactNode> &compact, int bits, int mbits) {
+    vector<OctNode> octree;
+    cl_int error = BuildOctree_s(points, octree, bits, mbits);
+    error |= OctreeToCompact_s(octree, compact);
+    return error;
+  }
+
+  // Same as BuildOctree_p, except the pointer-based octree never leaves the
+  // device. Only the compact octree is read back.
+  cl_int BuildCompactOctree_p(const vector<intn>& points, vector<CompactNode> &compact, int bits, int mbits) {
+    if (points.empty())
+      throw logic_error("Zero points not supported");
+
+    int size = points.size();
+    cl_int error = 0;
+    cl_int octreeSize, compactSize;
+    cl::Buffer pointsBuffer, zpoints, internalBRTNodes, localSplits, scannedSplits, octree, compactBuffer;
+    error |= Kernels::UploadPoints(points, pointsBuffer);
+    error |= Kernels::PointsToMorton_p(pointsBuffer, zpoints, size, bits);
+    error |= Kernels::RadixSortBigUnsigned(zpoints, size, mbits);
+    error |= Kernels::UniqueSorted(zpoints, size);
+    error |= Kernels::BuildBinaryRadixTree_p(zpoints, internalBRTNodes, size, mbits);
+    error |= Kernels::BinaryRadixToOctree_p(internalBRTNodes, localSplits, scannedSplits, octree, size, octreeSize);
+    error |= Kernels::OctreeToCompact_p(octree, compactBuffer, octreeSize, compactSize);
+
+    compact.resize(compactSize);
+    error |= CLFW::DefaultQueue.enqueueReadBuffer(compactBuffer, CL_TRUE, 0, sizeof(CompactNode)*compactSize, compact.data());
+    return error;
+  }
+
+  cl_int OctreeToLinear_p(cl::Buffer &internalBRTNodes, cl::Buffer &localSplits, cl::Buffer &scannedSplits, cl::Buffer &octree, cl_int size, cl_int octreeSize, cl::Buffer &cells, cl_int &numCells, cl_int mbits) {
+    startBenchmark("OctreeToLinear_p");
+    cl_int globalSize = nextPow2(size);
+    cl_int globalOctreeSize = nextPow2(octreeSize);
+    cl::CommandQueue &queue = CLFW::DefaultQueue;
+    cl::Kernel &keysKernel = CLFW::Kernels["ComputeNodeKeysKernel"];
+    cl::Kernel &countKernel = CLFW::Kernels["CountLeavesKernel"];
+    cl::Kernel &linearKernel = CLFW::Kernels["OctreeToLinearKernel"];
+    cl::Kernel &levelsKernel = CLFW::Kernels["ComputeLinearLevelsKernel"];
+
+    cl::Buffer nodeKeys, nodeLevels, leafCounts, scannedLeafCounts, keys;
+    cl_int error = CLFW::get(nodeKeys, "nodeKeys", sizeof(BigUnsigned) * globalOctreeSize);
+    error |= CLFW::get(nodeLevels, "nodeLevels", sizeof(cl_int) * globalOctreeSize);
+    error |= CLFW::get(leafCounts, "leafCounts", sizeof(cl_int) * globalOctreeSize);
+    error |= CLFW::get(scannedLeafCounts, "scannedLeafCounts", sizeof(cl_int) * globalOctreeSize);
+    error |= queue.enqueueFillBuffer<cl_int>(nodeLevels, { -1 }, 0, sizeof(cl_int) * globalOctreeSize);
+    error |= queue.enqueueFillBuffer<cl_int>(leafCounts, { 0 }, 0, sizeof(cl_int) * globalOctreeSize);
+
+    //Key and level of each octree node, from the BRT node that made it
+    error |= keysKernel.setArg(0, internalBRTNodes);
+    error |= keysKernel.setArg(1, localSplits);
+    error |= keysKernel.setArg(2, scannedSplits);
+    error |= keysKernel.setArg(3, nodeKeys);
+    error |= keysKernel.setArg(4, nodeLevels);
+    error |= keysKernel.setArg(5, size);
+    error |= queue.enqueueNDRangeKernel(keysKernel, cl::NullRange, cl::NDRange(globalSize), cl::NullRange);
+
+    //Count and scan the leaves of each node
+    error |= countKernel.setArg(0, octree);
+    error |= countKernel.setArg(1, nodeLevels);
+    error |= countKernel.setArg(2, leafCounts);
+    error |= countKernel.setArg(3, octreeSize);
+    error |= queue.enqueueNDRangeKernel(countKernel, cl::NullRange, cl::NDRange(globalOctreeSize), cl::NullRange);
+    error |= StreamScan_p(leafCounts, scannedLeafCounts, globalOctreeSize);
+    error |= queue.enqueueReadBuffer(scannedLeafCounts, CL_TRUE, sizeof(cl_int)*(octreeSize - 1), sizeof(cl_int), &numCells);
+
+    //Write the leaf keys. The padding is filled with the largest key so that
+    //it stays at the end after sorting.
+    cl_int globalNumCells = nextPow2(numCells);
+    error |= CLFW::get(keys, "linearKeys", sizeof(BigUnsigned) * globalNumCells);
+    BigUnsigned one, largest;
+    initBlkBU(&one, 1);
+    shiftBULeft(&largest, &one, mbits);
+    subtractIBU(&largest, &largest, 1);
+    error |= queue.enqueueFillBuffer<BigUnsigned>(keys, { largest }, 0, sizeof(BigUnsigned) * globalNumCells);
+
+    error |= linearKernel.setArg(0, octree);
+    error |= linearKernel.setArg(1, nodeKeys);
+    error |= linearKernel.setArg(2, nodeLevels);
+    error |= linearKernel.setArg(3, scannedLeafCounts);
+    error |= linearKernel.setArg(4, keys);
+    error |= linearKernel.setArg(5, mbits);
+    error |= linearKernel.setArg(6, octreeSize);
+    error |= queue.enqueueNDRangeKernel(linearKernel, cl::NullRange, cl::NDRange(globalOctreeSize), cl::NullRange);
+
+    error |= RadixSortBigUnsigned(keys, numCells, mbits);
+
+    error |= CLFW::get(cells, "linearCells", sizeof(LinearCell) * globalNumCells);
+    error |= levelsKernel.setArg(0, keys);
+    error |= levelsKernel.setArg(1, cells);
+    error |= levelsKernel.setArg(2, numCells);
+    error |= levelsKernel.setArg(3, mbits);
+    error |= queue.enqueueNDRangeKernel(levelsKernel, cl::NullRange, cl::NDRange(globalNumCells), cl::NullRange);
+    stopBenchmark();
+    return error;
+  }
+
+  cl_int OctreeToLinear_s(vector<BrtNode> &internalBRTNodes, vector<unsigned int> &localSplits, vector<unsigned int> &prefixSums, vector<OctNode> &octree, vector<LinearCell> &cells, cl_int size, cl_int mbits) {
+    startBenchmark("OctreeToLinear_s");
+    const int octreeSize = octree.size();
+    vector<BigUnsigned> nodeKeys(octreeSize);
+    vector<int> nodeLevels(octreeSize, -1);
+    for (int i = 0; i < size - 1; ++i)
+      ComputeNodeKeys(internalBRTNodes.data(), localSplits.data(), prefixSums.data(), nodeKeys.data(), nodeLevels.data(), i);
+
+    vector<unsigned int> leafCounts(octreeSize);
+    for (int i = 0; i < octreeSize; ++i)
+      CountLeaves(octree.data(), nodeLevels.data(), leafCounts.data(), i);
+    vector<unsigned int> scannedLeafCounts(octreeSize);
+    StreamScan_s(leafCounts.data(), scannedLeafCounts.data(), octreeSize);
+
+    const int numCells = scannedLeafCounts[octreeSize - 1];
+    vector<BigUnsigned> keys(numCells);
+    for (int i = 0; i < octreeSize; ++i)
+      octree2linear(octree.data(), nodeKeys.data(), nodeLevels.data(), scannedLeafCounts.data(), keys.data(), mbits, i);
+    sort(keys.rbegin(), keys.rend(), weakCompareBU);
+
+    cells.resize(numCells);
+    for (int i = 0; i < numCells; ++i)
+      ComputeLinearLevels(keys.data(), cells.data(), numCells, mbits, i);
+    stopBenchmark();
+    return CL_SUCCESS;
+  }
+
+  cl_int BuildLinearOctree_s(const vector<intn>& points, vector<LinearCell> &cells, int bits, int mbits) {
+    if (points.empty())
+      throw logic_error("Zero points not supported");
+    int roundNumPoints = Kernels::nextPow2(points.size());
+    vector<BigUnsigned> zpoints(roundNumPoints);
+
+    Kernels::PointsToMorton_s(points.size(), bits, (cl_int2*)points.data(), zpoints.data());
+    sort(zpoints.rbegin(), zpoints.rend(), weakCompareBU);
+    int numPoints = unique(zpoints.begin(), zpoints.end(), weakEqualsBU) - zpoints.begin();
+
+    vector<BrtNode> I(numPoints - 1);
+    Kernels::BuildBinaryRadixTree_s(zpoints.data(), I.data(), numPoints, mbits);
+
+    vector<unsigned int> localSplits, prefixSums;
+    vector<OctNode> octree;
+    Kernels::BinaryRadixToOctree_s(I, localSplits, prefixSums, octree, numPoints);
+    return Kernels::OctreeToLinear_s(I, localSplits, prefixSums, octree, cells, numPoints, mbits);
+  }
+
+  cl_int BuildLinearOctree_p(const vector<intn>& points, vector<LinearCell> &cells, int bits, int mbits) {
+    if (points.empty())
+      throw logic_error("Zero points not supported");
+
+    int size = points.size();
+    cl_int error = 0;
+    cl_int octreeSize, numCells;
+    cl::Buffer pointsBuffer, zpoints, internalBRTNodes, localSplits, scannedSplits, octree, cellsBuffer;
+    error |= Kernels::UploadPoints(points, pointsBuffer);
+    error |= Kernels::PointsToMorton_p(pointsBuffer, zpoints, size, bits);
+    error |= Kernels::RadixSortBigUnsigned(zpoints, size, mbits);
+    error |= Kernels::UniqueSorted(zpoints, size);
+    error |= Kernels::BuildBinaryRadixTree_p(zpoints, internalBRTNodes, size, mbits);
+    error |= Kernels::BinaryRadixToOctree_p(internalBRTNodes, localSplits, scannedSplits, octree, size, octreeSize);
+    error |= Kernels::OctreeToLinear_p(internalBRTNodes, localSplits, scannedSplits, octree, size, octreeSize, cellsBuffer, numCells, mbits);
+
+    cells.resize(numCells);
+    error |= CLFW::DefaultQueue.enqueueReadBuffer(cellsBuffer, CL_TRUE, 0, sizeof(LinearCell)*numCells, cells.data());
+    return error;
+  }
+
+  // levelOffsets[l] is the index of the first node on level l and
+  // levelOffsets.back() is the number of nodes reachable from the root.
+  cl_int ReorderBreadthFirst_p(cl::Buffer &octree, cl_int octreeSize, cl::Buffer &result, vector<int> &levelOffsets) {
+    startBenchmark("ReorderBreadthFirst_p");
+    cl_int globalSize = nextPow2(octreeSize);
+    cl::CommandQueue &queue = CLFW::DefaultQueue;
+    cl::Kernel &countKernel = CLFW::Kernels["BFSCountChildrenKernel"];
+    cl::Kernel &scatterKernel = CLFW::Kernels["BFSScatterChildrenKernel"];
+    cl::Kernel &inverseKernel = CLFW::Kernels["BFSInverseKernel"];
+    cl::Kernel &remapKernel = CLFW::Kernels["BFSRemapKernel"];
+
+    cl::Buffer order, newIndex, childCounts, scannedCounts;
+    cl_int error = CLFW::get(order, "bfsOrder", sizeof(cl_int) * globalSize);
+    error |= CLFW::get(newIndex, "bfsNewIndex", sizeof(cl_int) * globalSize);
+    error |= CLFW::get(childCounts, "bfsChildCounts", sizeof(cl_int) * globalSize);
+    error |= CLFW::get(scannedCounts, "bfsScannedCounts", sizeof(cl_int) * globalSize);
+    error |= queue.enqueueFillBuffer<cl_int>(order, { 0 }, 0, sizeof(cl_int));
+
+    //One launch per level. Only the size of each new level is read back.
+    levelOffsets.clear();
+    levelOffsets.push_back(0);
+    levelOffsets.push_back(1);
+    while (true) {
+      const cl_int levelBegin = levelOffsets[levelOffsets.size() - 2];
+      const cl_int levelEnd = levelOffsets.back();
+      const cl_int levelSize = levelEnd - levelBegin;
+      const cl_int levelGlobalSize = nextPow2(levelSize);
+
+      error |= queue.enqueueFillBuffer<cl_int>(childCounts, { 0 }, 0, sizeof(cl_int) * levelGlobalSize);
+      error |= countKernel.setArg(0, octree);
+      error |= countKernel.setArg(1, order);
+      error |= countKernel.setArg(2, childCounts);
+      error |= countKernel.setArg(3, levelBegin);
+      error |= countKernel.setArg(4, levelSize);
+      error |= queue.enqueueNDRangeKernel(countKernel, cl::NullRange, cl::NDRange(levelGlobalSize), cl::NullRange);
+      error |= StreamScan_p(childCounts, scannedCounts, levelGlobalSize);
+
+      cl_int numChildren;
+      error |= queue.enqueueReadBuffer(scannedCounts, CL_TRUE, sizeof(cl_int)*(levelSize - 1), sizeof(cl_int), &numChildren);
+      if (numChildren == 0 || error != CL_SUCCESS) break;
+
+      error |= scatterKernel.setArg(0, octree);
+      error |= scatterKernel.setArg(1, order);
+      error |= scatterKernel.setArg(2, scannedCounts);
+      error |= scatterKernel.setArg(3, levelBegin);
+      error |= scatterKernel.setArg(4, levelEnd);
+      error |= queue.enqueueNDRangeKernel(scatterKernel, cl::NullRange, cl::NDRange(levelGlobalSize), cl::NullRange);
+      levelOffsets.push_back(levelEnd + numChildren);
+    }
+
+    const cl_int size = levelOffsets.back();
+    error |= inverseKernel.setArg(0, order);
+    error |= inverseKernel.setArg(1, newIndex);
+    error |= inverseKernel.setArg(2, size);
+    error |= queue.enqueueNDRangeKernel(inverseKernel, cl::NullRange, cl::NDRange(nextPow2(size)), cl::NullRange);
+
+    error |= CLFW::get(result, "bfsOctree", sizeof(OctNode) * nextPow2(size));
+    error |= remapKernel.setArg(0, octree);
+    error |= remapKernel.setArg(1, order);
+    error |= remapKernel.setArg(2, newIndex);
+    error |= remapKernel.setArg(3, result);
+    error |= remapKernel.setArg(4, size);
+    error |= queue.enqueueNDRangeKernel(remapKernel, cl::NullRange, cl::NDRange(nextPow2(size)), cl::NullRange);
+    stopBenchmark();
+    return error;
+  }
+
+  // Runs the same passes as ReorderBreadthFirst_p, split across host
+  // threads.
+  cl_int ReorderBreadthFirst_s(const vector<OctNode> &octree, vector<OctNode> &result, vector<int> &levelOffsets) {
+    startBenchmark("ReorderBreadthFirst_s");
+    OctNode* nodes = const_cast<OctNode*>(octree.data());
+    vector<int> order(octree.size());
+    vector<unsigned int> childCounts(octree.size());
+    order[0] = 0;
+
+    levelOffsets.clear();
+    levelOffsets.push_back(0);
+    levelOffsets.push_back(1);
+    while (true) {
+      const int levelBegin = levelOffsets[levelOffsets.size() - 2];
+      const int levelEnd = levelOffsets.back();
+      const int levelSize = levelEnd - levelBegin;
+
+      Parallel::For(0, levelSize, [&](const int i) {
+        BFSCountChildren(nodes, order.data(), childCounts.data(), levelBegin, i);
+      });
+      Parallel::InclusiveScan(childCounts.data(), childCounts.data(), levelSize);
+      const int numChildren = childCounts[levelSize - 1];
+      if (numChildren == 0) break;
+
+      Parallel::For(0, levelSize, [&](const int i) {
+        BFSScatterChildren(nodes, order.data(), childCounts.data(), levelBegin, levelEnd, i);
+      });
+      levelOffsets.push_back(levelEnd + numChildren);
+    }
+
+    const int size = levelOffsets.back();
+    vector<int> newIndex(octree.size(), -1);
+    Parallel::For(0, size, [&](const int i) {
+      BFSInverse(order.data(), newIndex.data(), i);
+    });
+    result.resize(size);
+    Parallel::For(0, size, [&](const int i) {
+      BFSRemap(nodes, order.data(), newIndex.data(), result.data(), i);
+    });
+    stopBenchmark();
+    return CL_SUCCESS;
+  }
+
+  // parents holds the cell of each node in its parent, levels the depth of
+  // each node and neighbors NUM_FACES neighbor cells for each of the
+  // octreeSize << DIM cells. See OctreeLinks.h.
+  cl_int ComputeOctreeLinks_p(cl::Buffer &octree, cl_int octreeSize, cl::Buffer &parents, cl::Buffer &levels, cl::Buffer &neighbors) {
+    startBenchmark("ComputeOctreeLinks_p");
+    const cl_int numCells = octreeSize << DIM;
+    cl_int globalSize = nextPow2(octreeSize);
+    cl::CommandQueue &queue = CLFW::DefaultQueue;
+    cl::Kernel &parentsKernel = CLFW::Kernels["ComputeParentsKernel"];
+    cl::Kernel &levelsKernel = CLFW::Kernels["ComputeNodeLevelsKernel"];
+    cl::Kernel &neighborsKernel = CLFW::Kernels["ComputeFaceNeighborsKernel"];
+
+    cl_int error = CLFW::get(parents, "octreeParents", sizeof(cl_int) * globalSize);
+    error |= CLFW::get(levels, "octreeLevels", sizeof(cl_int) * globalSize);
+    error |= CLFW::get(neighbors, "octreeNeighbors", sizeof(cl_int) * NUM_FACES * nextPow2(numCells));
+    error |= queue.enqueueFillBuffer<cl_int>(parents, { -1 }, 0, sizeof(cl_int) * globalSize);
+
+    error |= parentsKernel.setArg(0, octree);
+    error |= parentsKernel.setArg(1, parents);
+    error |= parentsKernel.setArg(2, octreeSize);
+    error |= queue.enqueueNDRangeKernel(parentsKernel, cl::NullRange, cl::NDRange(globalSize), cl::NullRange);
+
+    error |= levelsKernel.setArg(0, parents);
+    error |= levelsKernel.setArg(1, levels);
+    error |= levelsKernel.setArg(2, octreeSize);
+    error |= queue.enqueueNDRangeKernel(levelsKernel, cl::NullRange, cl::NDRange(globalSize), cl::NullRange);
+
+    error |= neighborsKernel.setArg(0, octree);
+    error |= neighborsKernel.setArg(1, parents);
+    error |= neighborsKernel.setArg(2, neighbors);
+    error |= neighborsKernel.setArg(3, numCells);
+    error |= queue.enqueueNDRangeKernel(neighborsKernel, cl::NullRange, cl::NDRange(nextPow2(numCells)), cl::NullRange);
+    stopBenchmark();
+    return error;
+  }
+
+  cl_int ComputeOctreeLinks_p(const vector<OctNode> &octree, vector<int> &parents, vector<int> &levels, vector<int> &neighbors) {
+    const cl_int octreeSize = octree.size();
+    cl::Buffer octreeBuffer, parentsBuffer, levelsBuffer, neighborsBuffer;
+    cl_int error = CLFW::get(octreeBuffer, "linksOctree", sizeof(OctNode) * nextPow2(octreeSize));
+    error |= CLFW::DefaultQueue.enqueueWriteBuffer(octreeBuffer, CL_TRUE, 0, sizeof(OctNode) * octreeSize, octree.data());
+    error |= ComputeOctreeLinks_p(octreeBuffer, octreeSize, parentsBuffer, levelsBuffer, neighborsBuffer);
+
+    parents.resize(octreeSize);
+    levels.resize(octreeSize);
+    neighbors.resize(NUM_FACES * (octreeSize << DIM));
+    error |= CLFW::DefaultQueue.enqueueReadBuffer(parentsBuffer, CL_TRUE, 0, sizeof(cl_int) * parents.size(), parents.data());
+    error |= CLFW::DefaultQueue.enqueueReadBuffer(levelsBuffer, CL_TRUE, 0, sizeof(cl_int) * levels.size(), levels.data());
+    error |= CLFW::DefaultQueue.enqueueReadBuffer(neighborsBuffer, CL_TRUE, 0, sizeof(cl_int) * neighbors.size(), neighbors.data());
+    return error;
+  }
+
+  cl_int ComputeOctreeLinks_s(const vector<OctNode> &octree, vector<int> &parents, vector<int> &levels, vector<int> &neighbors) {
+    startBenchmark("ComputeOctreeLinks_s");
+    const int octreeSize = octree.size();
+    const int numCells = octreeSize << DIM;
+    OctNode* nodes = const_cast<OctNode*>(octree.data());
+    parents.assign(octreeSize, -1);
+    levels.resize(octreeSize);
+    neighbors.resize(NUM_FACES * numCells);
+    Parallel::For(0, octreeSize, [&](const int i) {
+      ComputeParents(nodes, parents.data(), i);
+    });
+    Parallel::For(0, octreeSize, [&](const int i) {
+      ComputeNodeLevels(parents.data(), levels.data(), i);
+    });
+    Parallel::For(0, numCells, [&](const int i) {
+      ComputeFaceNeighbors(nodes, parents.data(), neighbors.data(), i);
+    });
+    stopBenchmark();
+    return CL_SUCCESS;
+  }
+
+  // Writes pointsPerCell points for each of the numCells linear cells using
+  // either LeafPointsKernel or BalancePointsKernel.
+  cl_int CellPoints_p(cl::Buffer &cells, cl_int numCells, cl::Buffer &points, cl_int bits, const string &kernelName, cl_int pointsPerCell) {
+    startBenchmark(kernelName);
+    const cl_int numPoints = numCells * pointsPerCell;
+    cl::Kernel &kernel = CLFW::Kernels[kernelName];
+    cl_int error = CLFW::get(points, "cellPoints", sizeof(intn) * nextPow2(numPoints));
+    error |= kernel.setArg(0, cells);
+    error |= kernel.setArg(1, points);
+    error |= kernel.setArg(2, bits);
+    error |= kernel.setArg(3, numCells);
+    error |= CLFW::DefaultQueue.enqueueNDRangeKernel(kernel, cl::NullRange, cl::NDRange(nextPow2(numCells)), cl::NullRange);
+    stopBenchmark();
+    return error;
+  }
+
+  // Rebuilds the linear octree in cells until it is 2:1 balanced across
+  // faces. Everything stays on the device; only the number of cells is
+  // read back after each rebuild.
+  cl_int BalanceLinearOctree_p(cl::Buffer &cells, cl_int &numCells, cl_int bits, cl_int mbits) {
+    cl_int error = 0;
+    while (true) {
+      cl_int size = numCells * BALANCE_POINTS_PER_CELL;
+      cl_int octreeSize, newNumCells;
+      cl::Buffer points, zpoints, internalBRTNodes, localSplits, scannedSplits, octree;
+      error |= CellPoints_p(cells, numCells, points, bits, "BalancePointsKernel", BALANCE_POINTS_PER_CELL);
+      error |= PointsToMorton_p(points, zpoints, size, bits);
+      error |= RadixSortBigUnsigned(zpoints, size, mbits);
+      error |= UniqueSorted(zpoints, size);
+      error |= BuildBinaryRadixTree_p(zpoints, internalBRTNodes, size, mbits);
+      error |= BinaryRadixToOctree_p(internalBRTNodes, localSplits, scannedSplits, octree, size, octreeSize);
+      error |= OctreeToLinear_p(internalBRTNodes, localSplits, scannedSplits, octree, size, octreeSize, cells, newNumCells, mbits);
+      // Balancing only ever splits cells, so the same number of cells means
+      // the same octree.
+      const bool done = (newNumCells == numCells);
+      numCells = newNumCells;
+      if (done || error != CL_SUCCESS) break;
+    }
+    return error;
+  }
+
+  cl_int BalanceLinearOctree_s(vector<LinearCell> &cells, int bits, int mbits) {
+    cl_int error = CL_SUCCESS;
+    while (true) {
+      const int numCells = cells.size();
+      vector<intn> points(numCells * BALANCE_POINTS_PER_CELL);
+      Parallel::For(0, numCells, [&](const int i) {
+        BalancePoints(cells.data(), points.data(), bits, i);
+      });
+      error |= BuildLinearOctree_s(points, cells, bits, mbits);
+      if (cells.size() == static_cast<size_t>(numCells) || error != CL_SUCCESS) break;
+    }
+    return error;
+  }
+
+  cl_int BuildBalancedLinearOctree_s(const vector<intn>& points, vector<LinearCell> &cells, int bits, int mbits) {
+    cl_int error = BuildLinearOctree_s(points, cells, bits, mbits);
+    error |= BalanceLinearOctree_s(cells, bits, mbits);
+    return error;
+  }
+
+  cl_int BuildBalancedLinearOctree_p(const vector<intn>& points, vector<LinearCell> &cells, int bits, int mbits) {
+    if (points.empty())
+      throw logic_error("Zero points not supported");
+
+    int size = points.size();
+    cl_int error = 0;
+    cl_int octreeSize, numCells;
+    cl::Buffer pointsBuffer, zpoints, internalBRTNodes, localSplits, scannedSplits, octree, cellsBuffer;
+    error |= Kernels::UploadPoints(points, pointsBuffer);
+    error |= Kernels::PointsToMorton_p(pointsBuffer, zpoints, size, bits);
+    error |= Kernels::RadixSortBigUnsigned(zpoints, size, mbits);
+    error |= Kernels::UniqueSorted(zpoints, size);
+    error |= Kernels::BuildBinaryRadixTree_p(zpoints, internalBRTNodes, size, mbits);
+    error |= Kernels::BinaryRadixToOctree_p(internalBRTNodes, localSplits, scannedSplits, octree, size, octreeSize);
+    error |= Kernels::OctreeToLinear_p(internalBRTNodes, localSplits, scannedSplits, octree, size, octreeSize, cellsBuffer, numCells, mbits);
+    error |= Kernels::BalanceLinearOctree_p(cellsBuffer, numCells, bits, mbits);
+
+    cells.resize(numCells);
+    error |= CLFW::DefaultQueue.enqueueReadBuffer(cellsBuffer, CL_TRUE, 0, sizeof(LinearCell)*numCells, cells.data());
+    return error;
+  }
+
+  // Builds a balanced octree, reordered breadth first. The balanced linear
+  // octree is turned back into an OctNode array by building from the
+  // points that recreate each of its leaves.
+  cl_int BuildBalancedOctree_p(const vector<intn>& points, vector<OctNode> &octree, vector<int> &levelOffsets, int bits, int mbits) {
+    if (points.empty())
+      throw logic_error("Zero points not supported");
+
+    int size = points.size();
+    cl_int error = 0;
+    cl_int octreeSize, numCells;
+    cl::Buffer pointsBuffer, zpoints, internalBRTNodes, localSplits, scannedSplits, octreeBuffer, cellsBuffer, bfsOctree;
+    error |= Kernels::UploadPoints(points, pointsBuffer);
+    error |= Kernels::PointsToMorton_p(pointsBuffer, zpoints, size, bits);
+    error |= Kernels::RadixSortBigUnsigned(zpoints, size, mbits);
+    error |= Kernels::UniqueSorted(zpoints, size);
+    error |= Kernels::BuildBinaryRadixTree_p(zpoints, internalBRTNodes, size, mbits);
+    error |= Kernels::BinaryRadixToOctree_p(internalBRTNodes, localSplits, scannedSplits, octreeBuffer, size, octreeSize);
+    error |= Kernels::OctreeToLinear_p(internalBRTNodes, localSplits, scannedSplits, octreeBuffer, size, octreeSize, cellsBuffer, numCells, mbits);
+    error |= Kernels::BalanceLinearOctree_p(cellsBuffer, numCells, bits, mbits);
+
+    size = numCells * LEAF_POINTS_PER_CELL;
+    error |= Kernels::CellPoints_p(cellsBuffer, numCells, pointsBuffer, bits, "LeafPointsKernel", LEAF_POINTS_PER_CELL);
+    error |= Kernels::PointsToMorton_p(pointsBuffer, zpoints, size, bits);
+    error |= Kernels::RadixSortBigUnsigned(zpoints, size, mbits);
+    error |= Kernels::UniqueSorted(zpoints, size);
+    error |= Kernels::BuildBinaryRadixTree_p(zpoints, internalBRTNodes, size, mbits);
+    error |= Kernels::BinaryRadixToOctree_p(internalBRTNodes, localSplits, scannedSplits, octreeBuffer, size, octreeSize);
+    error |= Kernels::ReorderBreadthFirst_p(octreeBuffer, octreeSize, bfsOctree, levelOffsets);
+
+    octree.resize(levelOffsets.back());
+    error |= CLFW::DefaultQueue.enqueueReadBuffer(bfsOctree, CL_TRUE, 0, sizeof(OctNode)*octree.size(), octree.data());
+    return error;
+  }
+
+  cl_int BuildBalancedOctree_s(const vector<intn>& points, vector<OctNode> &octree, int bits, int mbits) {
+    vector<LinearCell> cells;
+    cl_int error = BuildBalancedLinearOctree_s(points, cells, bits, mbits);
+    vector<intn> leafPoints(cells.size() * LEAF_POINTS_PER_CELL);
+    Parallel::For(0, cells.size(), [&](const int i) {
+      LeafPoints(cells.data(), leafPoints.data(), bits, i);
+    });
+    error |= BuildOctree_s(leafPoints, octree, bits, mbits);
+    return error;
+  }
+
+  // Finds the leaf cell (see OctreeLinks.h) that holds each point and its
+  // width. The points are located in the order given, so queries that are
+  // sorted by morton code keep neighboring work items on the same paths.
+  cl_int FindLeaves_p(cl::Buffer &octree, cl::Buffer &points, cl_int numPoints, cl::Buffer &cells, cl::Buffer &widths, cl_int bits) {
+    cl::CommandQueue &queue = CLFW::DefaultQueue;
+    cl::Kernel &kernel = CLFW::Kernels["FindLeafCellsKernel"];
+    const cl_int globalSize = nextPow2(numPoints);
+    cl_int error = 0;
+    if (numPoints == 0) return error;
+
+    startBenchmark("FindLeaves_p");
+    error |= CLFW::get(cells, "leafCells", sizeof(cl_int) * globalSize);
+    error |= CLFW::get(widths, "leafWidths", sizeof(cl_int) * globalSize);
+    error |= kernel.setArg(0, octree);
+    error |= kernel.setArg(1, points);
+    error |= kernel.setArg(2, cells);
+    error |= kernel.setArg(3, widths);
+    error |= kernel.setArg(4, bits);
+    error |= kernel.setArg(5, numPoints);
+    error |= queue.enqueueNDRangeKernel(kernel, cl::NullRange, cl::NDRange(globalSize), cl::NullRange);
+    stopBenchmark();
+    return error;
+  }
+
+  cl_int FindLeaves_p(const vector<OctNode> &octree, const vector<intn> &points, vector<int> &cells, vector<int> &widths, int bits) {
+    const cl_int numPoints = points.size();
+    cells.resize(numPoints);
+    widths.resize(numPoints);
+    if (numPoints == 0 || octree.empty()) return CL_SUCCESS;
+
+    cl_int error = 0;
+    cl::Buffer octreeBuffer, pointsBuffer, cellsBuffer, widthsBuffer;
+    error |= CLFW::get(octreeBuffer, "leafOctree", sizeof(OctNode) * octree.size());
+    error |= CLFW::DefaultQueue.enqueueWriteBuffer(octreeBuffer, CL_TRUE, 0, sizeof(OctNode) * octree.size(), octree.data());
+    error |= UploadPoints(points, pointsBuffer);
+    error |= FindLeaves_p(octreeBuffer, pointsBuffer, numPoints, cellsBuffer, widthsBuffer, bits);
+    error |= CLFW::DefaultQueue.enqueueReadBuffer(cellsBuffer, CL_TRUE, 0, sizeof(cl_int) * numPoints, cells.data());
+    error |= CLFW::DefaultQueue.enqueueReadBuffer(widthsBuffer, CL_TRUE, 0, sizeof(cl_int) * numPoints, widths.data());
+    return error;
+  }
+
+  // Finds the leaves that each segment passes through, in order along the
+  // segment, with the points at which it enters and leaves them. segments
+  // holds the two endpoints of each segment in octree space. The leaves of
+  // all segments are compacted into cells, grouped by segment, so only
+  // numCells is read back.
+  cl_int SegmentCells_p(cl::Buffer &octree, cl::Buffer &segments, cl_int numSegments, cl::Buffer &cells, cl_int &numCells, cl_int bits) {
+    cl::CommandQueue &queue = CLFW::DefaultQueue;
+    cl::Kernel &countKernel = CLFW::Kernels["CountSegmentCellsKernel"];
+    cl::Kernel &writeKernel = CLFW::Kernels["WriteSegmentCellsKernel"];
+    const cl_int globalSize = nextPow2(numSegments);
+    cl::Buffer counts, scannedCounts;
+    cl_int error = 0;
+    numCells = 0;
+    if (numSegments == 0) return error;
+
+    startBenchmark("SegmentCells_p");
+    error |= CLFW::get(counts, "segmentCellCounts", sizeof(cl_uint) * globalSize);
+    error |= CLFW::get(scannedCounts, "scannedSegmentCellCounts", sizeof(cl_uint) * globalSize);
+    error |= queue.enqueueFillBuffer<cl_uint>(counts, { 0 }, 0, sizeof(cl_uint) * globalSize);
+
+    error |= countKernel.setArg(0, octree);
+    error |= countKernel.setArg(1, segments);
+    error |= countKernel.setArg(2, counts);
+    error |= countKernel.setArg(3, bits);
+    error |= countKernel.setArg(4, numSegments);
+    error |= queue.enqueueNDRangeKernel(countKernel, cl::NullRange, cl::NDRange(globalSize), cl::NullRange);
+
+    error |= StreamScan_p(counts, scannedCounts, globalSize);
+    error |= queue.enqueueReadBuffer(scannedCounts, CL_TRUE, sizeof(cl_uint)*(numSegments-1), sizeof(cl_int), &numCells);
+
+    error |= CLFW::get(cells, "segmentCells", sizeof(SegmentCell) * nextPow2(numCells));
+    error |= writeKernel.setArg(0, octree);
+    error |= writeKernel.setArg(1, segments);
+    error |= writeKernel.setArg(2, scannedCounts);
+    error |= writeKernel.setArg(3, cells);
+    error |= writeKernel.setArg(4, bits);
+    error |= writeKernel.setArg(5, numSegments);
+    error |= queue.enqueueNDRangeKernel(writeKernel, cl::NullRange, cl::NDRange(globalSize), cl::NullRange);
+    stopBenchmark();
+    return error;
+  }
+
+  cl_int SegmentCells_p(const vector<OctNode> &octree, const vector<floatn> &segments, vector<SegmentCell> &cells, int bits) {
+    const cl_int numSegments = segments.size() / 2;
+    cells.clear();
+    if (numSegments == 0 || octree.empty()) return CL_SUCCESS;
+
+    cl_int error = 0;
+    cl_int numCells;
+    cl::Buffer octreeBuffer, segmentsBuffer, cellsBuffer;
+    error |= CLFW::get(octreeBuffer, "segmentOctree", sizeof(OctNode) * octree.size());
+    error |= CLFW::get(segmentsBuffer, "segments", sizeof(floatn) * 2 * nextPow2(numSegments));
+    error |= CLFW::DefaultQueue.enqueueWriteBuffer(octreeBuffer, CL_TRUE, 0, sizeof(OctNode) * octree.size(), octree.data());
+    error |= CLFW::DefaultQueue.enqueueWriteBuffer(segmentsBuffer, CL_TRUE, 0, sizeof(floatn) * 2 * numSegments, segments.data());
+    error |= SegmentCells_p(octreeBuffer, segmentsBuffer, numSegments, cellsBuffer, numCells, bits);
+    cells.resize(numCells);
+    if (numCells > 0)
+      error |= CLFW::DefaultQueue.enqueueReadBuffer(cellsBuffer, CL_TRUE, 0, sizeof(SegmentCell) * numCells, cells.data());
+    return error;
+  }
+
+  cl_int SegmentCells_s(const vector<OctNode> &octree, const vector<floatn> &segments, vector<SegmentCell> &cells, int bits) {
+    const int numSegments = segments.size() / 2;
+    cells.clear();
+    if (numSegments == 0 || octree.empty()) return CL_SUCCESS;
+
+    OctNode* nodes = const_cast<OctNode*>(octree.data());
+    floatn* segs = const_cast<floatn*>(segments.data());
+    vector<unsigned int> counts(numSegments), scannedCounts(numSegments);
+    Parallel::For(0, numSegments, [&](const int i) {
+      CountSegmentCells(nodes, segs, counts.data(), bits, i);
+    });
+    Parallel::InclusiveScan(counts.data(), scannedCounts.data(), numSegments);
+    cells.resize(scannedCounts[numSegments-1]);
+    Parallel::For(0, numSegments, [&](const int i) {
+      WriteSegmentCells(nodes, segs, scannedCounts.data(), cells.data(), bits, i);
+    });
+    return CL_SUCCESS;
+  }
+
+  // Jump flooding steps: from half the domain down to 1, then 1 again
+  static vector<int> GVDSteps(const int bits) {
+    vector<int> steps;
+    for (int step = 1 << (bits-1); step >= 1; step /= 2) {
+      steps.push_back(step);
+    }
+    steps.push_back(1);
+    return steps;
+  }
+
+  // Labels every leaf with the segment nearest to its center and flags the
+  // leaves that are GVD cells (see GVD.c). The segments that pass through
+  // each cell are given in segStart, segCount and segIds. cellLabels,
+  // cellDists and gvd are indexed by cell; the entries of cells that aren't
+  // leaves are -1, -1 and 0.
+  cl_int ComputeGVD_p(const vector<OctNode> &octree, const vector<GVDLeaf> &leaves, const vector<floatn> &segments, const vector<int> &labels, const vector<int> &segStart, const vector<int> &segCount, const vector<int> &segIds, int bits, vector<int> &cellLabels, vector<float> &cellDists, vector<int> &gvd) {
+    const cl_int numCells = octree.size() << DIM;
+    const cl_int numLeaves = leaves.size();
+    cellLabels.assign(numCells, -1);
+    cellDists.assign(numCells, -1);
+    gvd.assign(numCells, 0);
+    if (numLeaves == 0) return CL_SUCCESS;
+
+    cl::CommandQueue &queue = CLFW::DefaultQueue;
+    cl::Kernel &seedKernel = CLFW::Kernels["SeedGVDLeavesKernel"];
+    cl::Kernel &floodKernel = CLFW::Kernels["JumpFloodGVDKernel"];
+    cl::Kernel &labelKernel = CLFW::Kernels["LabelGVDLeavesKernel"];
+    const cl_int globalLeaves = nextPow2(numLeaves);
+    cl_int error = 0;
+    cl::Buffer octreeBuffer, leavesBuffer, segmentsBuffer, labelsBuffer, startBuffer, countBuffer, idsBuffer;
+    cl::Buffer seeds, seedsTemp, labelsOut, distsOut, gvdOut;
+    error |= CLFW::get(octreeBuffer, "gvdOctree", sizeof(OctNode) * octree.size());
+    error |= CLFW::get(leavesBuffer, "gvdLeaves", sizeof(GVDLeaf) * globalLeaves);
+    error |= CLFW::get(segmentsBuffer, "gvdSegments", sizeof(floatn) * nextPow2(segments.size()));
+    error |= CLFW::get(labelsBuffer, "gvdSegmentLabels", sizeof(cl_int) * nextPow2(labels.size()));
+    error |= CLFW::get(startBuffer, "gvdSegStart", sizeof(cl_int) * numCells);
+    error |= CLFW::get(countBuffer, "gvdSegCount", sizeof(cl_int) * numCells);
+    error |= CLFW::get(idsBuffer, "gvdSegIds", sizeof(cl_int) * nextPow2(segIds.size()));
+    error |= CLFW::get(seeds, "gvdSeeds", sizeof(cl_int) * numCells);
+    error |= CLFW::get(seedsTemp, "gvdSeedsTemp", sizeof(cl_int) * numCells);
+    error |= CLFW::get(labelsOut, "gvdCellLabels", sizeof(cl_int) * numCells);
+    error |= CLFW::get(distsOut, "gvdCellDists", sizeof(cl_float) * numCells);
+    error |= CLFW::get(gvdOut, "gvdCells", sizeof(cl_int) * numCells);
+    error |= queue.enqueueWriteBuffer(octreeBuffer, CL_TRUE, 0, sizeof(OctNode) * octree.size(), octree.data());
+    error |= queue.enqueueWriteBuffer(leavesBuffer, CL_TRUE, 0, sizeof(GVDLeaf) * numLeaves, leaves.data());
+    if (!segments.empty())
+      error |= queue.enqueueWriteBuffer(segmentsBuffer, CL_TRUE, 0, sizeof(floatn) * segments.size(), segments.data());
+    if (!labels.empty())
+      error |= queue.enqueueWriteBuffer(labelsBuffer, CL_TRUE, 0, sizeof(cl_int) * labels.size(), labels.data());
+    error |= queue.enqueueWriteBuffer(startBuffer, CL_TRUE, 0, sizeof(cl_int) * numCells, segStart.data());
+    error |= queue.enqueueWriteBuffer(countBuffer, CL_TRUE, 0, sizeof(cl_int) * numCells, segCount.data());
+    if (!segIds.empty())
+      error |= queue.enqueueWriteBuffer(idsBuffer, CL_TRUE, 0, sizeof(cl_int) * segIds.size(), segIds.data());
+    error |= queue.enqueueFillBuffer<cl_int>(seeds, { -1 }, 0, sizeof(cl_int) * numCells);
+    error |= queue.enqueueFillBuffer<cl_int>(seedsTemp, { -1 }, 0, sizeof(cl_int) * numCells);
+    error |= queue.enqueueWriteBuffer(labelsOut, CL_TRUE, 0, sizeof(cl_int) * numCells, cellLabels.data());
+    error |= queue.enqueueWriteBuffer(distsOut, CL_TRUE, 0, sizeof(cl_float) * numCells, cellDists.data());
+    error |= queue.enqueueWriteBuffer(gvdOut, CL_TRUE, 0, sizeof(cl_int) * numCells, gvd.data());
+
+    startBenchmark("ComputeGVD_p");
+    error |= seedKernel.setArg(0, leavesBuffer);
+    error |= seedKernel.setArg(1, segmentsBuffer);
+    error |= seedKernel.setArg(2, startBuffer);
+    error |= seedKernel.setArg(3, countBuffer);
+    error |= seedKernel.setArg(4, idsBuffer);
+    error |= seedKernel.setArg(5, seeds);
+    error |= seedKernel.setArg(6, numLeaves);
+    error |= queue.enqueueNDRangeKernel(seedKernel, cl::NullRange, cl::NDRange(globalLeaves), cl::NullRange);
+
+    for (const int step : GVDSteps(bits)) {
+      error |= floodKernel.setArg(0, octreeBuffer);
+      error |= floodKernel.setArg(1, leavesBuffer);
+      error |= floodKernel.setArg(2, segmentsBuffer);
+      error |= floodKernel.setArg(3, seeds);
+      error |= floodKernel.setArg(4, seedsTemp);
+      error |= floodKernel.setArg(5, step);
+      error |= floodKernel.setArg(6, bits);
+      error |= floodKernel.setArg(7, numLeaves);
+      error |= queue.enqueueNDRangeKernel(floodKernel, cl::NullRange, cl::NDRange(globalLeaves), cl::NullRange);
+      std::swap(seeds, seedsTemp);
+    }
+
+    error |= labelKernel.setArg(0, octreeBuffer);
+    error |= labelKernel.setArg(1, leavesBuffer);
+    error |= labelKernel.setArg(2, segmentsBuffer);
+    error |= labelKernel.setArg(3, labelsBuffer);
+    error |= labelKernel.setArg(4, seeds);
+    error |= labelKernel.setArg(5, labelsOut);
+    error |= labelKernel.setArg(6, distsOut);
+    error |= labelKernel.setArg(7, gvdOut);
+    error |= labelKernel.setArg(8, bits);
+    error |= labelKernel.setArg(9, numLeaves);
+    error |= queue.enqueueNDRangeKernel(labelKernel, cl::NullRange, cl::NDRange(globalLeaves), cl::NullRange);
+    stopBenchmark();
+
+    error |= queue.enqueueReadBuffer(labelsOut, CL_TRUE, 0, sizeof(cl_int) * numCells, cellLabels.data());
+    error |= queue.enqueueReadBuffer(distsOut, CL_TRUE, 0, sizeof(cl_float) * numCells, cellDists.data());
+    error |= queue.enqueueReadBuffer(gvdOut, CL_TRUE, 0, sizeof(cl_int) * numCells, gvd.data());
+    return error;
+  }
+
+  cl_int ComputeGVD_s(const vector<OctNode> &octree, const vector<GVDLeaf> &leaves, const vector<floatn> &segments, const vector<int> &labels, const vector<int> &segStart, const vector<int> &segCount, const vector<int> &segIds, int bits, vector<int> &cellLabels, vector<float> &cellDists, vector<int> &gvd) {
+    const int numCells = octree.size() << DIM;
+    const int numLeaves = leaves.size();
+    cellLabels.assign(numCells, -1);
+    cellDists.assign(numCells, -1);
+    gvd.assign(numCells, 0);
+    if (numLeaves == 0) return CL_SUCCESS;
+
+    OctNode* nodes = const_cast<OctNode*>(octree.data());
+    GVDLeaf* leafs = const_cast<GVDLeaf*>(leaves.data());
+    floatn* segs = const_cast<floatn*>(segments.data());
+    int* labs = const_cast<int*>(labels.data());
+    vector<int> seeds(numCells, -1), seedsTemp(numCells, -1);
+    Parallel::For(0, numLeaves, [&](const int i) {
+      SeedGVDLeaves(leafs, segs, const_cast<int*>(segStart.data()), const_cast<int*>(segCount.data()), const_cast<int*>(segIds.data()), seeds.data(), i);
+    });
+    for (const int step : GVDSteps(bits)) {
+      Parallel::For(0, numLeaves, [&](const int i) {
+        JumpFloodGVD(nodes, leafs, segs, seeds.data(), seedsTemp.data(), step, bits, i);
+      });
+      seeds.swap(seedsTemp);
+    }
+    Parallel::For(0, numLeaves, [&](const int i) {
+      LabelGVDLeaves(nodes, leafs, segs, labs, seeds.data(), cellLabels.data(), cellDists.data(), gvd.data(), bits, i);
+    });
+    return CL_SUCCESS;
+  }
+
+  // Samples the distance to the nearest segment, and its label, at each of
+  // the nx * ny points of a grid (see SampleDistanceField in GVD.c). The
+  // candidate segments of tile t are tileIds[tileStart[t]], ... Each work
+  // group samples one tile, and the tiles are taken in tileOrder, e.g., in
+  // Morton order, so that neighboring groups read nearby segments.
+  cl_int SampleDistanceField_p(const vector<floatn> &segments, const vector<int> &labels, const vector<int> &tileStart, const vector<int> &tileCount, const vector<int> &tileIds, const vector<int> &tileOrder, floatn origin, float spacing, int nx, int ny, int tile, bool signedDist, float *dists, int *pointLabels) {
+    const cl_int numPoints = nx * ny;
+    const cl_int numTiles = tileStart.size();
+    if (numPoints == 0) return CL_SUCCESS;
+
+    cl::CommandQueue &queue = CLFW::DefaultQueue;
+    cl::Kernel &kernel = CLFW::Kernels["SampleDistanceFieldKernel"];
+    const cl_int area = tile * tile;
+    const cl_int numItems = numTiles * area;
+    const cl_int tilesX = (nx + tile - 1) / tile;
+    cl_int error = 0;
+    cl::Buffer segmentsBuffer, labelsBuffer, startBuffer, countBuffer, idsBuffer, orderBuffer, distsOut, labelsOut;
+    error |= CLFW::get(segmentsBuffer, "dfSegments", sizeof(floatn) * nextPow2(segments.size()));
+    error |= CLFW::get(labelsBuffer, "dfSegmentLabels", sizeof(cl_int) * nextPow2(labels.size()));
+    error |= CLFW::get(startBuffer, "dfTileStart", sizeof(cl_int) * nextPow2(numTiles));
+    error |= CLFW::get(countBuffer, "dfTileCount", sizeof(cl_int) * nextPow2(numTiles));
+    error |= CLFW::get(idsBuffer, "dfTileIds", sizeof(cl_int) * nextPow2(tileIds.size()));
+    error |= CLFW::get(orderBuffer, "dfTileOrder", sizeof(cl_int) * nextPow2(numTiles));
+    error |= CLFW::get(distsOut, "dfDists", sizeof(cl_float) * nextPow2(numPoints));
+    error |= CLFW::get(labelsOut, "dfLabels", sizeof(cl_int) * nextPow2(numPoints));
+    if (!segments.empty())
+      error |= queue.enqueueWriteBuffer(segmentsBuffer, CL_TRUE, 0, sizeof(floatn) * segments.size(), segments.data());
+    if (!labels.empty())
+      error |= queue.enqueueWriteBuffer(labelsBuffer, CL_TRUE, 0, sizeof(cl_int) * labels.size(), labels.data());
+    error |= queue.enqueueWriteBuffer(startBuffer, CL_TRUE, 0, sizeof(cl_int) * numTiles, tileStart.data());
+    error |= queue.enqueueWriteBuffer(countBuffer, CL_TRUE, 0, sizeof(cl_int) * numTiles, tileCount.data());
+    if (!tileIds.empty())
+      error |= queue.enqueueWriteBuffer(idsBuffer, CL_TRUE, 0, sizeof(cl_int) * tileIds.size(), tileIds.data());
+    error |= queue.enqueueWriteBuffer(orderBuffer, CL_TRUE, 0, sizeof(cl_int) * numTiles, tileOrder.data());
+
+    startBenchmark("SampleDistanceField_p");
+    error |= kernel.setArg(0, segmentsBuffer);
+    error |= kernel.setArg(1, labelsBuffer);
+    error |= kernel.setArg(2, startBuffer);
+    error |= kernel.setArg(3, countBuffer);
+    error |= kernel.setArg(4, idsBuffer);
+    error |= kernel.setArg(5, orderBuffer);
+    error |= kernel.setArg(6, origin);
+    error |= kernel.setArg(7, spacing);
+    error |= kernel.setArg(8, nx);
+    error |= kernel.setArg(9, ny);
+    error |= kernel.setArg(10, tile);
+    error |= kernel.setArg(11, tilesX);
+    error |= kernel.setArg(12, signedDist ? 1 : 0);
+    error |= kernel.setArg(13, distsOut);
+    error |= kernel.setArg(14, labelsOut);
+    error |= kernel.setArg(15, numItems);
+    // One work group per tile where the device allows groups that large
+    const int maxLocal = kernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(CLFW::DefaultDevice);
+    const cl::NDRange local = (area <= maxLocal) ? cl::NDRange(area) : cl::NullRange;
+    error |= queue.enqueueNDRangeKernel(kernel, cl::NullRange, cl::NDRange(numItems), local);
+    stopBenchmark();
+
+    error |= queue.enqueueReadBuffer(distsOut, CL_TRUE, 0, sizeof(cl_float) * numPoints, dists);
+    error |= queue.enqueueReadBuffer(labelsOut, CL_TRUE, 0, sizeof(cl_int) * numPoints, pointLabels);
+    return error;
+  }
+
+  // Same as above on host threads, with a run of tiles per thread
+  cl_int SampleDistanceField_s(const vector<floatn> &segments, const vector<int> &labels, const vector<int> &tileStart, const vector<int> &tileCount, const vector<int> &tileIds, const vector<int> &tileOrder, floatn origin, float spacing, int nx, int ny, int tile, bool signedDist, float *dists, int *pointLabels) {
+    const int tilesX = (nx + tile - 1) / tile;
+    const int area = tile * tile;
+    floatn* segs = const_cast<floatn*>(segments.data());
+    int* labs = const_cast<int*>(labels.data());
+    int* start = const_cast<int*>(tileStart.data());
+    int* count = const_cast<int*>(tileCount.data());
+    int* ids = const_cast<int*>(tileIds.data());
+    int* order = const_cast<int*>(tileOrder.data());
+    Parallel::For(0, tileOrder.size(), [&](const int k) {
+      for (int r = 0; r < area; ++r) {
+        SampleDistanceFieldTiles(segs, labs, start, count, ids, order, origin, spacing, nx, ny, tile, tilesX, signedDist ? 1 : 0, dists, pointLabels, k * area + r);
+      }
+    });
+    return CL_SUCCESS;
+  }
+
+  // Fits boxes between each pair of segments (see FitBoxes.c). pairs holds
+  // the four endpoints of each pair. Pairs that can't be fit get no boxes
+  // and are flagged in errors.
+  cl_int FitBoxes_p(cl::Buffer &pairs, cl_int numPairs, cl::Buffer &boxes, cl_int &numBoxes, cl::Buffer &errors, cl_float minD) {
+    cl::CommandQueue &queue = CLFW::DefaultQueue;
+    cl::Kernel &countKernel = CLFW::Kernels["CountFitBoxesKernel"];
+    cl::Kernel &writeKernel = CLFW::Kernels["WriteFitBoxesKernel"];
+    const cl_int globalSize = nextPow2(numPairs);
+    cl::Buffer counts, scannedCounts;
+    cl_int error = 0;
+    numBoxes = 0;
+    if (numPairs == 0) return error;
+
+    startBenchmark("FitBoxes_p");
+    error |= CLFW::get(counts, "fitBoxCounts", sizeof(cl_uint) * globalSize);
+    error |= CLFW::get(scannedCounts, "scannedFitBoxCounts", sizeof(cl_uint) * globalSize);
+    error |= CLFW::get(errors, "fitBoxErrors", sizeof(cl_int) * globalSize);
+    error |= queue.enqueueFillBuffer<cl_uint>(counts, { 0 }, 0, sizeof(cl_uint) * globalSize);
+
+    error |= countKernel.setArg(0, pairs);
+    error |= countKernel.setArg(1, counts);
+    error |= countKernel.setArg(2, errors);
+    error |= countKernel.setArg(3, minD);
+    error |= countKernel.setArg(4, numPairs);
+    error |= queue.enqueueNDRangeKernel(countKernel, cl::NullRange, cl::NDRange(globalSize), cl::NullRange);
+
+    error |= StreamScan_p(counts, scannedCounts, globalSize);
+    error |= queue.enqueueReadBuffer(scannedCounts, CL_TRUE, sizeof(cl_uint)*(numPairs-1), sizeof(cl_int), &numBoxes);
+
+    error |= CLFW::get(boxes, "fitBoxes", sizeof(FitBox) * nextPow2(numBoxes));
+    error |= writeKernel.setArg(0, pairs);
+    error |= writeKernel.setArg(1, scannedCounts);
+    error |= writeKernel.setArg(2, boxes);
+    error |= writeKernel.setArg(3, minD);
+    error |= writeKernel.setArg(4, numPairs);
+    error |= queue.enqueueNDRangeKernel(writeKernel, cl::NullRange, cl::NDRange(globalSize), cl::NullRange);
+    stopBenchmark();
+    return error;
+  }
+
+  // Throws if a pair can't be fit, as Geom::FitBoxes does.
+  cl_int FitBoxes_p(const vector<floatn> &pairs, vector<FitBox> &boxes, float minD) {
+    const cl_int numPairs = pairs.size() / 4;
+    boxes.clear();
+    if (numPairs == 0) return CL_SUCCESS;
+
+    cl_int error = 0;
+    cl_int numBoxes;
+    cl::Buffer pairsBuffer, boxesBuffer, errorsBuffer;
+    error |= CLFW::get(pairsBuffer, "fitBoxPairs", sizeof(floatn) * 4 * nextPow2(numPairs));
+    error |= CLFW::DefaultQueue.enqueueWriteBuffer(pairsBuffer, CL_TRUE, 0, sizeof(floatn) * 4 * numPairs, pairs.data());
+    error |= FitBoxes_p(pairsBuffer, numPairs, boxesBuffer, numBoxes, errorsBuffer, minD);
+
+    vector<cl_int> failed(numPairs);
+    error |= CLFW::DefaultQueue.enqueueReadBuffer(errorsBuffer, CL_TRUE, 0, sizeof(cl_int) * numPairs, failed.data());
+    if (std::find(failed.begin(), failed.end(), 1) != failed.end())
+      throw logic_error("Boxes can't be fit between a pair of segments");
+    boxes.resize(numBoxes);
+    if (numBoxes > 0)
+      error |= CLFW::DefaultQueue.enqueueReadBuffer(boxesBuffer, CL_TRUE, 0, sizeof(FitBox) * numBoxes, boxes.data());
+    return error;
+  }
+
+  cl_int FitBoxes_s(const vector<floatn> &pairs, vector<FitBox> &boxes, float minD) {
+    const int numPairs = pairs.size() / 4;
+    boxes.clear();
+    if (numPairs == 0) return CL_SUCCESS;
+
+    floatn* p = const_cast<floatn*>(pairs.data());
+    vector<unsigned int> counts(numPairs), scannedCounts(numPairs);
+    vector<int> errors(numPairs);
+    Parallel::For(0, numPairs, [&](const int i) {
+      CountFitBoxes(p, counts.data(), errors.data(), minD, i);
+    });
+    if (std::find(errors.begin(), errors.end(), 1) != errors.end())
+      throw logic_error("Boxes can't be fit between a pair of segments");
+    Parallel::InclusiveScan(counts.data(), scannedCounts.data(), numPairs);
+    boxes.resize(scannedCounts[numPairs-1]);
+    Parallel::For(0, numPairs, [&](const int i) {
+      WriteFitBoxes(p, scannedCounts.data(), boxes.data(), minD, i);
+    });
+    return CL_SUCCESS;
+  }
+
+  // Samples points evenly along each segment, both endpoints included, with
+  // no more than spacings[i] between consecutive samples of segment i (see
+  // Sampling.c). Samples are in segment order.
+  cl_int SampleSegments_p(cl::Buffer &segments, cl::Buffer &spacings, cl_int numSegments, cl::Buffer &samples, cl_int &numSamples) {
+    cl::CommandQueue &queue = CLFW::DefaultQueue;
+    cl::Kernel &countKernel = CLFW::Kernels["CountSegmentSamplesKernel"];
+    cl::Kernel &writeKernel = CLFW::Kernels["WriteSegmentSamplesKernel"];
+    const cl_int globalSize = nextPow2(numSegments);
+    cl::Buffer counts, scannedCounts;
+    cl_int error = 0;
+    numSamples = 0;
+    if (numSegments == 0) return error;
+
+    startBenchmark("SampleSegments_p");
+    error |= CLFW::get(counts, "segmentSampleCounts", sizeof(cl_uint) * globalSize);
+    error |= CLFW::get(scannedCounts, "scannedSegmentSampleCounts", sizeof(cl_uint) * globalSize);
+    error |= queue.enqueueFillBuffer<cl_uint>(counts, { 0 }, 0, sizeof(cl_uint) * globalSize);
+
+    error |= countKernel.setArg(0, segments);
+    error |= countKernel.setArg(1, spacings);
+    error |= countKernel.setArg(2, counts);
+    error |= countKernel.setArg(3, numSegments);
+    error |= queue.enqueueNDRangeKernel(countKernel, cl::NullRange, cl::NDRange(globalSize), cl::NullRange);
+
+    error |= StreamScan_p(counts, scannedCounts, globalSize);
+    error |= queue.enqueueReadBuffer(scannedCounts, CL_TRUE, sizeof(cl_uint)*(numSegments-1), sizeof(cl_int), &numSamples);
+
+    error |= CLFW::get(samples, "segmentSamples", sizeof(floatn) * nextPow2(numSamples));
+    error |= writeKernel.setArg(0, segments);
+    error |= writeKernel.setArg(1, spacings);
+    error |= writeKernel.setArg(2, scannedCounts);
+    error |= writeKernel.setArg(3, samples);
+    error |= writeKernel.setArg(4, numSegments);
+    error |= queue.enqueueNDRangeKernel(writeKernel, cl::NullRange, cl::NDRange(globalSize), cl::NullRange);
+    stopBenchmark();
+    return error;
+  }
+
+  cl_int SampleSegments_p(const vector<floatn> &segments, const vector<float> &spacings, vector<floatn> &samples) {
+    const cl_int numSegments = segments.size() / 2;
+    samples.clear();
+    if (numSegments == 0) return CL_SUCCESS;
+
+    cl_int error = 0;
+    cl_int numSamples;
+    cl::Buffer segmentsBuffer, spacingsBuffer, samplesBuffer;
+    error |= CLFW::get(segmentsBuffer, "sampledSegments", sizeof(floatn) * 2 * nextPow2(numSegments));
+    error |= CLFW::get(spacingsBuffer, "segmentSpacings", sizeof(cl_float) * nextPow2(numSegments));
+    error |= CLFW::DefaultQueue.enqueueWriteBuffer(segmentsBuffer, CL_TRUE, 0, sizeof(floatn) * 2 * numSegments, segments.data());
+    error |= CLFW::DefaultQueue.enqueueWriteBuffer(spacingsBuffer, CL_TRUE, 0, sizeof(cl_float) * numSegments, spacings.data());
+    error |= SampleSegments_p(segmentsBuffer, spacingsBuffer, numSegments, samplesBuffer, numSamples);
+    samples.resize(numSamples);
+    if (numSamples > 0)
+      error |= CLFW::DefaultQueue.enqueueReadBuffer(samplesBuffer, CL_TRUE, 0, sizeof(floatn) * numSamples, samples.data());
+    return error;
+  }
+
+  cl_int SampleSegments_s(const vector<floatn> &segments, const vector<float> &spacings, vector<floatn> &samples) {
+    const int numSegments = segments.size() / 2;
+    samples.clear();
+    if (numSegments == 0) return CL_SUCCESS;
+
+    floatn* segs = const_cast<floatn*>(segments.data());
+    float* s = const_cast<float*>(spacings.data());
+    vector<unsigned int> counts(numSegments), scannedCounts(numSegments);
+    Parallel::For(0, numSegments, [&](const int i) {
+      CountSegmentSamples(segs, s, counts.data(), i);
+    });
+    Parallel::InclusiveScan(counts.data(), scannedCounts.data(), numSegments);
+    samples.resize(scannedCounts[numSegments-1]);
+    Parallel::For(0, numSegments, [&](const int i) {
+      WriteSegmentSamples(segs, s, scannedCounts.data(), samples.data(), i);
+    });
+    return CL_SUCCESS;
+  }
+
+  // Buffers are sized to the next power of two, so the points only move
+  // when that grows.
+  static cl_int GrowPoints(cl::Buffer &points, cl_int numPoints, cl_int newNumPoints) {
+    cl_int error = 0;
+    if (nextPow2(newNumPoints) != nextPow2(numPoints)) {
+      cl::Buffer grown;
+      error |= CLFW::get(grown, "refinePoints", sizeof(intn) * nextPow2(newNumPoints));
+      error |= CLFW::DefaultQueue.enqueueCopyBuffer(points, grown, 0, 0, sizeof(intn) * numPoints);
+      points = grown;
+    }
+    return error;
+  }
+
+  // Rebuilds the octree of points until no leaf that can still be split is
+  // crossed by segments of two different labels, or until maxIterations
+  // octrees have been built. segments holds the two endpoints of each
+  // segment in octree space. Each conflicting leaf adds two points that
+  // split it, and the samples of the boxes fit between its two segments,
+  // which separate them (see CellWalk.c). Points, keys, octree, cell labels
+  // and boxes stay on the device; only the numbers of conflicts and boxes
+  // are read back per iteration.
+  cl_int RefineOctree_p(cl::Buffer &points, cl_int &numPoints, cl::Buffer &segments, cl::Buffer &labels, cl_int numSegments, cl::Buffer &octree, cl_int &octreeSize, cl_int bits, cl_int mbits, cl_int maxIterations) {
+    cl::CommandQueue &queue = CLFW::DefaultQueue;
+    cl::Kernel &initKernel = CLFW::Kernels["InitCellLabelsKernel"];
+    cl::Kernel &markKernel = CLFW::Kernels["MarkSegmentCellsKernel"];
+    cl::Kernel &samplesKernel = CLFW::Kernels["RefineSamplesKernel"];
+    cl::Kernel &boxSamplesKernel = CLFW::Kernels["FitBoxSamplesKernel"];
+    cl_int error = 0;
+    for (int iteration = 0; ; ++iteration) {
+      cl_int size = numPoints;
+      cl::Buffer zpoints, internalBRTNodes, localSplits, scannedSplits;
+      error |= PointsToMorton_p(points, zpoints, size, bits);
+      error |= RadixSortBigUnsigned(zpoints, size, mbits);
+      error |= UniqueSorted(zpoints, size);
+      error |= BuildBinaryRadixTree_p(zpoints, internalBRTNodes, size, mbits);
+      error |= BinaryRadixToOctree_p(internalBRTNodes, localSplits, scannedSplits, octree, size, octreeSize);
+      if (iteration+1 >= maxIterations || numSegments == 0 || error != CL_SUCCESS) break;
+
+      startBenchmark("RefineOctree_p");
+      const cl_int numCells = octreeSize << DIM;
+      const cl_int globalCells = nextPow2(numCells);
+      cl::Buffer cellLabels, conflicts, scannedConflicts, cellOrigins, cellWidths, cellSegments;
+      error |= CLFW::get(cellLabels, "cellLabels", sizeof(cl_int) * globalCells);
+      error |= CLFW::get(conflicts, "conflicts", sizeof(cl_uint) * globalCells);
+      error |= CLFW::get(scannedConflicts, "scannedConflicts", sizeof(cl_uint) * globalCells);
+      error |= CLFW::get(cellOrigins, "cellOrigins", sizeof(intn) * globalCells);
+      error |= CLFW::get(cellWidths, "cellWidths", sizeof(cl_int) * globalCells);
+      error |= CLFW::get(cellSegments, "cellSegments", sizeof(cl_int) * 2 * globalCells);
+
+      // The whole rounded range is cleared so that the scan sees zeros
+      // past the last cell.
+      error |= initKernel.setArg(0, cellLabels);
+      error |= initKernel.setArg(1, conflicts);
+      error |= initKernel.setArg(2, globalCells);
+      error |= queue.enqueueNDRangeKernel(initKernel, cl::NullRange, cl::NDRange(globalCells), cl::NullRange);
+
+      error |= markKernel.setArg(0, octree);
+      error |= markKernel.setArg(1, segments);
+      error |= markKernel.setArg(2, labels);
+      error |= markKernel.setArg(3, cellLabels);
+      error |= markKernel.setArg(4, conflicts);
+      error |= markKernel.setArg(5, cellOrigins);
+      error |= markKernel.setArg(6, cellWidths);
+      error |= markKernel.setArg(7, cellSegments);
+      error |= markKernel.setArg(8, bits);
+      error |= markKernel.setArg(9, numSegments);
+      error |= queue.enqueueNDRangeKernel(markKernel, cl::NullRange, cl::NDRange(nextPow2(numSegments)), cl::NullRange);
+
+      error |= StreamScan_p(conflicts, scannedConflicts, globalCells);
+      cl_uint numConflicts;
+      error |= queue.enqueueReadBuffer(scannedConflicts, CL_TRUE, sizeof(cl_uint)*(numCells-1), sizeof(cl_uint), &numConflicts);
+      if (numConflicts == 0 || error != CL_SUCCESS) {
+        stopBenchmark();
+        break;
+      }
+
+      // The split samples go after the points, and the conflicting pairs
+      // to their own buffer.
+      cl::Buffer pairs;
+      error |= CLFW::get(pairs, "refinePairs", sizeof(floatn) * 4 * nextPow2(numConflicts));
+      error |= GrowPoints(points, numPoints, numPoints + 2 * numConflicts);
+      error |= samplesKernel.setArg(0, conflicts);
+      error |= samplesKernel.setArg(1, scannedConflicts);
+      error |= samplesKernel.setArg(2, cellOrigins);
+      error |= samplesKernel.setArg(3, cellWidths);
+      error |= samplesKernel.setArg(4, cellSegments);
+      error |= samplesKernel.setArg(5, segments);
+      error |= samplesKernel.setArg(6, points);
+      error |= samplesKernel.setArg(7, pairs);
+      error |= samplesKernel.setArg(8, numPoints);
+      error |= samplesKernel.setArg(9, numCells);
+      error |= queue.enqueueNDRangeKernel(samplesKernel, cl::NullRange, cl::NDRange(globalCells), cl::NullRange);
+      numPoints += 2 * numConflicts;
+
+      // Boxes between the two segments of each conflicting cell. Pairs
+      // that can't be fit only get the split samples.
+      cl::Buffer boxes, boxErrors;
+      cl_int numBoxes;
+      error |= FitBoxes_p(pairs, numConflicts, boxes, numBoxes, boxErrors, 1);
+      if (numBoxes > 0) {
+        error |= GrowPoints(points, numPoints, numPoints + 2 * numBoxes);
+        error |= boxSamplesKernel.setArg(0, boxes);
+        error |= boxSamplesKernel.setArg(1, points);
+        error |= boxSamplesKernel.setArg(2, numPoints);
+        error |= boxSamplesKernel.setArg(3, bits);
+        error |= boxSamplesKernel.setArg(4, numBoxes);
+        error |= queue.enqueueNDRangeKernel(boxSamplesKernel, cl::NullRange, cl::NDRange(nextPow2(numBoxes)), cl::NullRange);
+        numPoints += 2 * numBoxes;
+      }
+      stopBenchmark();
+    }
+    return error;
+  }
+
+  // Refines the octree on the device and reads back only the final octree,
+  // reordered breadth first. labels holds one label per segment.
+  cl_int BuildRefinedOctree_p(const vector<intn>& points, const vector<floatn>& segments, const vector<int>& labels, vector<OctNode> &octree, vector<int> &levelOffsets, int bits, int mbits, int maxIterations) {
+    if (points.empty())
+      throw logic_error("Zero points not supported");
+
+    cl_int numPoints = points.size();
+    const cl_int numSegments = labels.size();
+    cl_int error = 0;
+    cl_int octreeSize;
+    cl::Buffer pointsBuffer, segmentsBuffer, labelsBuffer, octreeBuffer, bfsOctree;
+    error |= Kernels::UploadPoints(points, pointsBuffer);
+    if (numSegments > 0) {
+      error |= CLFW::get(segmentsBuffer, "refineSegments", sizeof(floatn) * 2 * nextPow2(numSegments));
+      error |= CLFW::get(labelsBuffer, "refineLabels", sizeof(cl_int) * nextPow2(numSegments));
+      error |= CLFW::DefaultQueue.enqueueWriteBuffer(segmentsBuffer, CL_TRUE, 0, sizeof(floatn) * segments.size(), segments.data());
+      error |= CLFW::DefaultQueue.enqueueWriteBuffer(labelsBuffer, CL_TRUE, 0, sizeof(cl_int) * numSegments, labels.data());
+    }
+    error |= Kernels::RefineOctree_p(pointsBuffer, numPoints, segmentsBuffer, labelsBuffer, numSegments, octreeBuffer, octreeSize, bits, mbits, maxIterations);
+    error |= Kernels::ReorderBreadthFirst_p(octreeBuffer, octreeSize, bfsOctree, levelOffsets);
+
+    octree.resize(levelOffsets.back());
+    error |= CLFW::DefaultQueue.enqueueReadBuffer(bfsOctree, CL_TRUE, 0, sizeof(OctNode)*octree.size(), octree.data());
+    return error;
+  }
+
+  cl_int BuildRefinedOctree_s(const vector<intn>& points, const vector<floatn>& segments, const vector<int>& labels, vector<OctNode> &octree, int bits, int mbits, int maxIterations) {
+    vector<intn> refined(points);
+    floatn* segs = const_cast<floatn*>(segments.data());
+    int* labs = const_cast<int*>(labels.data());
+    const int numSegments = labels.size();
+    cl_int error = CL_SUCCESS;
+    for (int iteration = 0; ; ++iteration) {
+      error |= BuildOctree_s(refined, octree, bits, mbits);
+      if (iteration+1 >= maxIterations || numSegments == 0 || error != CL_SUCCESS) break;
+
+      const int numCells = octree.size() << DIM;
+      vector<int> cellLabels(numCells), cellWidths(numCells), cellSegments(2 * numCells);
+      vector<unsigned int> conflicts(numCells), scannedConflicts(numCells);
+      vector<intn> cellOrigins(numCells);
+      Parallel::For(0, numCells, [&](const int i) {
+        InitCellLabels(cellLabels.data(), conflicts.data(), i);
+      });
+      // Cell labels are claimed without atomics on the host, so the
+      // segments are walked serially.
+      for (int i = 0; i < numSegments; ++i) {
+        MarkSegmentCells(octree.data(), segs, labs, cellLabels.data(), conflicts.data(), cellOrigins.data(), cellWidths.data(), cellSegments.data(), bits, i);
+      }
+      Parallel::InclusiveScan(conflicts.data(), scannedConflicts.data(), numCells);
+      const int numConflicts = scannedConflicts[numCells-1];
+      if (numConflicts == 0) break;
+
+      int numPoints = refined.size();
+      vector<floatn> pairs(4 * numConflicts);
+      refined.resize(numPoints + 2 * numConflicts);
+      Parallel::For(0, numCells, [&](const int i) {
+        RefineSamples(conflicts.data(), scannedConflicts.data(), cellOrigins.data(), cellWidths.data(), cellSegments.data(), segs, refined.data(), pairs.data(), numPoints, i);
+      });
+      numPoints = refined.size();
+
+      // Pairs that can't be fit get no boxes
+      vector<unsigned int> counts(numConflicts), scannedCounts(numConflicts);
+      vector<int> errors(numConflicts);
+      Parallel::For(0, numConflicts, [&](const int i) {
+        CountFitBoxes(pairs.data(), counts.data(), errors.data(), 1, i);
+      });
+      Parallel::InclusiveScan(counts.data(), scannedCounts.data(), numConflicts);
+      const int numBoxes = scannedCounts[numConflicts-1];
+      vector<FitBox> boxes(numBoxes);
+      Parallel::For(0, numConflicts, [&](const int i) {
+        WriteFitBoxes(pairs.data(), scannedCounts.data(), boxes.data(), 1, i);
+      });
+      refined.resize(numPoints + 2 * numBoxes);
+      Parallel::For(0, numBoxes, [&](const int i) {
+        FitBoxSamples(boxes.data(), refined.data(), numPoints, bits, i);
+      });
+    }
+    return error;
+  }
+}
@@ -11,13 +11,21 @@
 #include <unordered_map>
 #include <algorithm>
 #include "timer.h"
+#include "Parallel.h"
 
 extern "C" {
   #include "z_order.h"
   #include "BrtNode.h"
   #include "BuildBRT.h"
   #include "OctNode.h"
+  #include "CompactNode.h"
+  #include "LinearCell.h"
+  #include "OctreeLinks.h"
   #include "BuildOctree.h"
+  #include "CellWalk.h"
+  #include "GVD.h"
+  #include "FitBoxes.h"
+  #include "Sampling.h"
   #include "ParallelAlgorithms.h"
   #include "./Resln.h"
 }
@@ -29,6 +37,7 @@ namespace Kernels {
 
   int nextPow2(int num);
   cl_int UploadPoints(const vector<intn> &points, cl::Buffer &pointsBuffer);
+  cl_int UploadPoints(const intn *points, cl_int numPoints, cl::Buffer &pointsBuffer);
   cl_int PointsToMorton_p(cl::Buffer &points, cl::Buffer &zpoints, cl_int size, cl_int bits);
   cl_int PointsToMorton_s(cl_int size, cl_int bits, cl_int2* points, BigUnsigned* result);
   cl_int BitPredicate(cl::Buffer &input, cl::Buffer &predicate, unsigned int &index, unsigned char compared, cl_int globalSize);
@@ -44,8 +53,49 @@ namespace Kernels {
   cl_int ComputeLocalSplits_p(cl::Buffer &internalBRTNodes, cl::Buffer &localSplits, cl_int size);
   cl_int ComputeLocalSplits_s(vector<BrtNode> &I, vector<unsigned int> &local_splits, const cl_int size);
   cl_int InitOctree(cl::Buffer &internalBRTNodes, cl::Buffer &octree, cl::Buffer &localSplits, cl::Buffer &scannedSplits, cl_int size, cl_int octreeSize);
+  cl_int BinaryRadixToOctree_p(cl::Buffer &internalBRTNodes, cl::Buffer &localSplits, cl::Buffer &scannedSplits, cl::Buffer &octree, cl_int size, cl_int &octreeSize);
   cl_int BinaryRadixToOctree_p(cl::Buffer &internalBRTNodes, vector<OctNode> &octree_vec, cl_int size);
   cl_int BinaryRadixToOctree_s(vector<BrtNode> &internalBRTNodes, vector<OctNode> &octree, cl_int size);
+  cl_int BinaryRadixToOctree_s(vector<BrtNode> &internalBRTNodes, vector<unsigned int> &localSplits, vector<unsigned int> &prefixSums, vector<OctNode> &octree, cl_int size);
   cl_int BuildOctree_s(const vector<intn>& points, vector<OctNode> &octree, int bits, int mbits);
   cl_int BuildOctree_p(const vector<intn>& points, vector<OctNode> &octree, int bits, int mbits);
+  cl_int BuildOctree_p(const vector<intn>& points, vector<OctNode> &octree, vector<int> &levelOffsets, int bits, int mbits);
+  cl_int OctreeToCompact_p(cl::Buffer &octree, cl::Buffer &compact, cl_int octreeSize, cl_int &compactSize);
+  cl_int OctreeToCompact_s(const vector<OctNode> &octree, vector<CompactNode> &compact);
+  cl_int BuildCompactOctree_s(const vector<intn>& points, vector<CompactNode> &compact, int bits, int mbits);
+  cl_int BuildCompactOctree_p(const vector<intn>& points, vector<CompactNode> &compact, int bits, int mbits);
+  cl_int OctreeToLinear_p(cl::Buffer &internalBRTNodes, cl::Buffer &localSplits, cl::Buffer &scannedSplits, cl::Buffer &octree, cl_int size, cl_int octreeSize, cl::Buffer &cells, cl_int &numCells, cl_int mbits);
+  cl_int OctreeToLinear_s(vector<BrtNode> &internalBRTNodes, vector<unsigned int> &localSplits, vector<unsigned int> &prefixSums, vector<OctNode> &octree, vector<LinearCell> &cells, cl_int size, cl_int mbits);
+  cl_int BuildLinearOctree_s(const vector<intn>& points, vector<LinearCell> &cells, int bits, int mbits);
+  cl_int BuildLinearOctree_p(const vector<intn>& points, vector<LinearCell> &cells, int bits, int mbits);
+  cl_int ReorderBreadthFirst_p(cl::Buffer &octree, cl_int octreeSize, cl::Buffer &result, vector<int> &levelOffsets);
+  cl_int ReorderBreadthFirst_s(const vector<OctNode> &octree, vector<OctNode> &result, vector<int> &levelOffsets);
+  cl_int ComputeOctreeLinks_p(cl::Buffer &octree, cl_int octreeSize, cl::Buffer &parents, cl::Buffer &levels, cl::Buffer &neighbors);
+  cl_int ComputeOctreeLinks_p(const vector<OctNode> &octree, vector<int> &parents, vector<int> &levels, vector<int> &neighbors);
+  cl_int ComputeOctreeLinks_s(const vector<OctNode> &octree, vector<int> &parents, vector<int> &levels, vector<int> &neighbors);
+  cl_int CellPoints_p(cl::Buffer &cells, cl_int numCells, cl::Buffer &points, cl_int bits, const string &kernelName, cl_int pointsPerCell);
+  cl_int BalanceLinearOctree_p(cl::Buffer &cells, cl_int &numCells, cl_int bits, cl_int mbits);
+  cl_int BalanceLinearOctree_s(vector<LinearCell> &cells, int bits, int mbits);
+  cl_int BuildBalancedLinearOctree_s(const vector<intn>& points, vector<LinearCell> &cells, int bits, int mbits);
+  cl_int BuildBalancedLinearOctree_p(const vector<intn>& points, vector<LinearCell> &cells, int bits, int mbits);
+  cl_int BuildBalancedOctree_s(const vector<intn>& points, vector<OctNode> &octree, int bits, int mbits);
+  cl_int BuildBalancedOctree_p(const vector<intn>& points, vector<OctNode> &octree, vector<int> &levelOffsets, int bits, int mbits);
+  cl_int FindLeaves_p(cl::Buffer &octree, cl::Buffer &points, cl_int numPoints, cl::Buffer &cells, cl::Buffer &widths, cl_int bits);
+  cl_int FindLeaves_p(const vector<OctNode> &octree, const vector<intn> &points, vector<int> &cells, vector<int> &widths, int bits);
+  cl_int SegmentCells_p(cl::Buffer &octree, cl::Buffer &segments, cl_int numSegments, cl::Buffer &cells, cl_int &numCells, cl_int bits);
+  cl_int SegmentCells_p(const vector<OctNode> &octree, const vector<floatn> &segments, vector<SegmentCell> &cells, int bits);
+  cl_int SegmentCells_s(const vector<OctNode> &octree, const vector<floatn> &segments, vector<SegmentCell> &cells, int bits);
+  cl_int ComputeGVD_p(const vector<OctNode> &octree, const vector<GVDLeaf> &leaves, const vector<floatn> &segments, const vector<int> &labels, const vector<int> &segStart, const vector<int> &segCount, const vector<int> &segIds, int bits, vector<int> &cellLabels, vector<float> &cellDists, vector<int> &gvd);
+  cl_int ComputeGVD_s(const vector<OctNode> &octree, const vector<GVDLeaf> &leaves, const vector<floatn> &segments, const vector<int> &labels, const vector<int> &segStart, const vector<int> &segCount, const vector<int> &segIds, int bits, vector<int> &cellLabels, vector<float> &cellDists, vector<int> &gvd);
+  cl_int SampleDistanceField_p(const vector<floatn> &segments, const vector<int> &labels, const vector<int> &tileStart, const vector<int> &tileCount, const vector<int> &tileIds, const vector<int> &tileOrder, floatn origin, float spacing, int nx, int ny, int tile, bool signedDist, float *dists, int *pointLabels);
+  cl_int SampleDistanceField_s(const vector<floatn> &segments, const vector<int> &labels, const vector<int> &tileStart, const vector<int> &tileCount, const vector<int> &tileIds, const vector<int> &tileOrder, floatn origin, float spacing, int nx, int ny, int tile, bool signedDist, float *dists, int *pointLabels);
+  cl_int FitBoxes_p(cl::Buffer &pairs, cl_int numPairs, cl::Buffer &boxes, cl_int &numBoxes, cl::Buffer &errors, cl_float minD);
+  cl_int FitBoxes_p(const vector<floatn> &pairs, vector<FitBox> &boxes, float minD);
+  cl_int FitBoxes_s(const vector<floatn> &pairs, vector<FitBox> &boxes, float minD);
+  cl_int SampleSegments_p(cl::Buffer &segments, cl::Buffer &spacings, cl_int numSegments, cl::Buffer &samples, cl_int &numSamples);
+  cl_int SampleSegments_p(const vector<floatn> &segments, const vector<float> &spacings, vector<floatn> &samples);
+  cl_int SampleSegments_s(const vector<floatn> &segments, const vector<float> &spacings, vector<floatn> &samples);
+  cl_int RefineOctree_p(cl::Buffer &points, cl_int &numPoints, cl::Buffer &segments, cl::Buffer &labels, cl_int numSegments, cl::Buffer &octree, cl_int &octreeSize, cl_int bits, cl_int mbits, cl_int maxIterations);
+  cl_int BuildRefinedOctree_p(const vector<intn>& points, const vector<floatn>& segments, const vector<int>& labels, vector<OctNode> &octree, vector<int> &levelOffsets, int bits, int mbits, int maxIterations);
+  cl_int BuildRefinedOctree_s(const vector<intn>& points, const vector<floatn>& segments, const vector<int>& labels, vector<OctNode> &octree, int bits, int mbits, int maxIterations);
 }
\ No newline at end of file
@@ -156,6 +156,399 @@ __kernel void BRT2OctreeKernel(
 ) {
   const int gid = get_global_id(0);
   const int octreeSize = prefixSums[size-1];
+  if (gid == 0)
+    brt2octree_root(I, octree, localSplits);
   if (gid > 0 && gid < size - 1)
     brt2octree(gid, I, octree, localSplits, prefixSums, size, octreeSize);
 }
+
+__kernel void CountInternalChildrenKernel(
+  __global OctNode *octree,
+  __global unsigned int *counts,
+  const int octreeSize
+) {
+  const int gid = get_global_id(0);
+  if (gid < octreeSize)
+    CountInternalChildren(octree, counts, gid);
+}
+
+__kernel void ComputeCompactIndicesKernel(
+  __global OctNode *octree,
+  __global unsigned int *scannedCounts,
+  __global int *compactIndex,
+  const int octreeSize
+) {
+  const int gid = get_global_id(0);
+  if (gid < octreeSize)
+    ComputeCompactIndices(octree, scannedCounts, compactIndex, gid);
+}
+
+__kernel void OctreeToCompactKernel(
+  __global OctNode *octree,
+  __global unsigned int *scannedCounts,
+  __global int *compactIndex,
+  __global CompactNode *compact,
+  const int octreeSize
+) {
+  const int gid = get_global_id(0);
+  if (gid < octreeSize)
+    octree2compact(octree, scannedCounts, compactIndex, compact, gid);
+}
+
+__kernel void ComputeNodeKeysKernel(
+  __global BrtNode *I,
+  __global unsigned int *localSplits,
+  __global unsigned int *prefixSums,
+  __global BigUnsigned *nodeKeys,
+  __global int *nodeLevels,
+  const int size
+) {
+  const int gid = get_global_id(0);
+  if (gid < size - 1)
+    ComputeNodeKeys(I, localSplits, prefixSums, nodeKeys, nodeLevels, gid);
+}
+
+__kernel void CountLeavesKernel(
+  __global OctNode *octree,
+  __global int *nodeLevels,
+  __global unsigned int *counts,
+  const int octreeSize
+) {
+  const int gid = get_global_id(0);
+  if (gid < octreeSize)
+    CountLeaves(octree, nodeLevels, counts, gid);
+}
+
+__kernel void OctreeToLinearKernel(
+  __global OctNode *octree,
+  __global BigUnsigned *nodeKeys,
+  __global int *nodeLevels,
+  __global unsigned int *scannedCounts,
+  __global BigUnsigned *keys,
+  const int mbits,
+  const int octreeSize
+) {
+  const int gid = get_global_id(0);
+  if (gid < octreeSize)
+    octree2linear(octree, nodeKeys, nodeLevels, scannedCounts, keys, mbits, gid);
+}
+
+__kernel void ComputeLinearLevelsKernel(
+  __global BigUnsigned *keys,
+  __global LinearCell *cells,
+  const int size,
+  const int mbits
+) {
+  const int gid = get_global_id(0);
+  if (gid < size)
+    ComputeLinearLevels(keys, cells, size, mbits, gid);
+}
+
+__kernel void BFSCountChildrenKernel(
+  __global OctNode *octree,
+  __global int *order,
+  __global unsigned int *counts,
+  const int levelBegin,
+  const int levelSize
+) {
+  const int gid = get_global_id(0);
+  if (gid < levelSize)
+    BFSCountChildren(octree, order, counts, levelBegin, gid);
+}
+
+__kernel void BFSScatterChildrenKernel(
+  __global OctNode *octree,
+  __global int *order,
+  __global unsigned int *scannedCounts,
+  const int levelBegin,
+  const int levelEnd
+) {
+  const int gid = get_global_id(0);
+  if (gid < levelEnd - levelBegin)
+    BFSScatterChildren(octree, order, scannedCounts, levelBegin, levelEnd, gid);
+}
+
+__kernel void BFSInverseKernel(
+  __global int *order,
+  __global int *newIndex,
+  const int size
+) {
+  const int gid = get_global_id(0);
+  if (gid < size)
+    BFSInverse(order, newIndex, gid);
+}
+
+__kernel void BFSRemapKernel(
+  __global OctNode *octree,
+  __global int *order,
+  __global int *newIndex,
+  __global OctNode *result,
+  const int size
+) {
+  const int gid = get_global_id(0);
+  if (gid < size)
+    BFSRemap(octree, order, newIndex, result, gid);
+}
+
+__kernel void ComputeParentsKernel(
+  __global OctNode *octree,
+  __global int *parents,
+  const int octreeSize
+) {
+  const int gid = get_global_id(0);
+  if (gid < octreeSize)
+    ComputeParents(octree, parents, gid);
+}
+
+__kernel void ComputeNodeLevelsKernel(
+  __global int *parents,
+  __global int *levels,
+  const int octreeSize
+) {
+  const int gid = get_global_id(0);
+  if (gid < octreeSize)
+    ComputeNodeLevels(parents, levels, gid);
+}
+
+__kernel void ComputeFaceNeighborsKernel(
+  __global OctNode *octree,
+  __global int *parents,
+  __global int *neighbors,
+  const int numCells
+) {
+  const int gid = get_global_id(0);
+  if (gid < numCells)
+    ComputeFaceNeighbors(octree, parents, neighbors, gid);
+}
+
+__kernel void LeafPointsKernel(
+  __global LinearCell *cells,
+  __global intn *points,
+  const int bits,
+  const int numCells
+) {
+  const int gid = get_global_id(0);
+  if (gid < numCells)
+    LeafPoints(cells, points, bits, gid);
+}
+
+__kernel void BalancePointsKernel(
+  __global LinearCell *cells,
+  __global intn *points,
+  const int bits,
+  const int numCells
+) {
+  const int gid = get_global_id(0);
+  if (gid < numCells)
+    BalancePoints(cells, points, bits, gid);
+}
+
+__kernel void FindLeafCellsKernel(
+  __global OctNode *octree,
+  __global intn *points,
+  __global int *cells,
+  __global int *widths,
+  const int bits,
+  const int numPoints
+) {
+  const int gid = get_global_id(0);
+  if (gid < numPoints)
+    FindLeafCells(octree, points, cells, widths, bits, gid);
+}
+
+__kernel void CountSegmentCellsKernel(
+  __global OctNode *octree,
+  __global floatn *segments,
+  __global unsigned int *counts,
+  const int bits,
+  const int numSegments
+) {
+  const int gid = get_global_id(0);
+  if (gid < numSegments)
+    CountSegmentCells(octree, segments, counts, bits, gid);
+}
+
+__kernel void WriteSegmentCellsKernel(
+  __global OctNode *octree,
+  __global floatn *segments,
+  __global unsigned int *scannedCounts,
+  __global SegmentCell *cells,
+  const int bits,
+  const int numSegments
+) {
+  const int gid = get_global_id(0);
+  if (gid < numSegments)
+    WriteSegmentCells(octree, segments, scannedCounts, cells, bits, gid);
+}
+
+__kernel void InitCellLabelsKernel(
+  __global int *cellLabels,
+  __global unsigned int *conflicts,
+  const int numCells
+) {
+  const int gid = get_global_id(0);
+  if (gid < numCells)
+    InitCellLabels(cellLabels, conflicts, gid);
+}
+
+__kernel void MarkSegmentCellsKernel(
+  __global OctNode *octree,
+  __global floatn *segments,
+  __global int *labels,
+  __global int *cellLabels,
+  __global unsigned int *conflicts,
+  __global intn *cellOrigins,
+  __global int *cellWidths,
+  __global int *cellSegments,
+  const int bits,
+  const int numSegments
+) {
+  const int gid = get_global_id(0);
+  if (gid < numSegments)
+    MarkSegmentCells(octree, segments, labels, cellLabels, conflicts, cellOrigins, cellWidths, cellSegments, bits, gid);
+}
+
+__kernel void RefineSamplesKernel(
+  __global unsigned int *conflicts,
+  __global unsigned int *scannedConflicts,
+  __global intn *cellOrigins,
+  __global int *cellWidths,
+  __global int *cellSegments,
+  __global floatn *segments,
+  __global intn *points,
+  __global floatn *pairs,
+  const int numPoints,
+  const int numCells
+) {
+  const int gid = get_global_id(0);
+  if (gid < numCells)
+    RefineSamples(conflicts, scannedConflicts, cellOrigins, cellWidths, cellSegments, segments, points, pairs, numPoints, gid);
+}
+
+__kernel void FitBoxSamplesKernel(
+  __global FitBox *boxes,
+  __global intn *points,
+  const int numPoints,
+  const int bits,
+  const int numBoxes
+) {
+  const int gid = get_global_id(0);
+  if (gid < numBoxes)
+    FitBoxSamples(boxes, points, numPoints, bits, gid);
+}
+
+__kernel void SeedGVDLeavesKernel(
+  __global GVDLeaf *leaves,
+  __global floatn *segments,
+  __global int *segStart,
+  __global int *segCount,
+  __global int *segIds,
+  __global int *seeds,
+  const int numLeaves
+) {
+  const int gid = get_global_id(0);
+  if (gid < numLeaves)
+    SeedGVDLeaves(leaves, segments, segStart, segCount, segIds, seeds, gid);
+}
+
+__kernel void JumpFloodGVDKernel(
+  __global OctNode *octree,
+  __global GVDLeaf *leaves,
+  __global floatn *segments,
+  __global int *seedsIn,
+  __global int *seedsOut,
+  const int step,
+  const int bits,
+  const int numLeaves
+) {
+  const int gid = get_global_id(0);
+  if (gid < numLeaves)
+    JumpFloodGVD(octree, leaves, segments, seedsIn, seedsOut, step, bits, gid);
+}
+
+__kernel void LabelGVDLeavesKernel(
+  __global OctNode *octree,
+  __global GVDLeaf *leaves,
+  __global floatn *segments,
+  __global int *labels,
+  __global int *seeds,
+  __global int *cellLabels,
+  __global float *cellDists,
+  __global int *gvd,
+  const int bits,
+  const int numLeaves
+) {
+  const int gid = get_global_id(0);
+  if (gid < numLeaves)
+    LabelGVDLeaves(octree, leaves, segments, labels, seeds, cellLabels, cellDists, gvd, bits, gid);
+}
+
+__kernel void SampleDistanceFieldKernel(
+  __global floatn *segments,
+  __global int *labels,
+  __global int *tileStart,
+  __global int *tileCount,
+  __global int *tileIds,
+  __global int *tileOrder,
+  const floatn origin,
+  const float spacing,
+  const int nx,
+  const int ny,
+  const int tile,
+  const int tilesX,
+  const int signedDist,
+  __global float *dists,
+  __global int *pointLabels,
+  const int numItems
+) {
+  const int gid = get_global_id(0);
+  if (gid < numItems)
+    SampleDistanceFieldTiles(segments, labels, tileStart, tileCount, tileIds, tileOrder, origin, spacing, nx, ny, tile, tilesX, signedDist, dists, pointLabels, gid);
+}
+
+__kernel void CountFitBoxesKernel(
+  __global floatn *pairs,
+  __global unsigned int *counts,
+  __global int *errors,
+  const float minD,
+  const int numPairs
+) {
+  const int gid = get_global_id(0);
+  if (gid < numPairs)
+    CountFitBoxes(pairs, counts, errors, minD, gid);
+}
+
+__kernel void WriteFitBoxesKernel(
+  __global floatn *pairs,
+  __global unsigned int *scannedCounts,
+  __global FitBox *boxes,
+  const float minD,
+  const int numPairs
+) {
+  const int gid = get_global_id(0);
+  if (gid < numPairs)
+    WriteFitBoxes(pairs, scannedCounts, boxes, minD, gid);
+}
+
+__kernel void CountSegmentSamplesKernel(
+  __global floatn *segments,
+  __global float *spacings,
+  __global unsigned int *counts,
+  const int numSegments
+) {
+  const int gid = get_global_id(0);
+  if (gid < numSegments)
+    CountSegmentSamples(segments, spacings, counts, gid);
+}
+
+__kernel void WriteSegmentSamplesKernel(
+  __global floatn *segments,
+  __global float *spacings,
+  __global unsigned int *scannedCounts,
+  __global floatn *samples,
+  const int numSegments
+) {
+  const int gid = get_global_id(0);
+  if (gid < numSegments)
+    WriteSegmentSamples(segments, spacings, scannedCounts, samples, gid);
+}
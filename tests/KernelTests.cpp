@@ -1,7 +1,19 @@
 #include "catch.hpp"
 #include "clfw.hpp"
 #include "Kernels.h"
+#include "Karras.h"
+#include "ObjFile.h"
+#include "OctreeFile.h"
+#include "OctreeUtils.h"
+#include "PointFile.h"
+#include "opencl/Geom.h"
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
 #include <iostream>
+#include <limits>
+#include <set>
+#include <sstream>
 
 #define OneMillion 1000000
 #define OneThousand 1000
@@ -28,6 +40,122 @@ inline std::string buToString(BigUnsigned bu) {
   return representation;
 }
 
+// Appends numPoints random points with coordinates in [0, 2^pointBits).
+static void AddRandomPoints(
+    const int numPoints, const int pointBits, vector<intn>& points) {
+  for (int i = 0; i < numPoints; ++i) {
+    intn p;
+    p.x = rand() % (1 << pointBits);
+    p.y = rand() % (1 << pointBits);
+    points.push_back(p);
+  }
+}
+
+// A random point in [0, 2^pointBits) with coordinates in tenths
+static floatn RandomFloatPoint(const int pointBits) {
+  floatn p;
+  p.x = (rand() % (10 << pointBits)) / 10.0f;
+  p.y = (rand() % (10 << pointBits)) / 10.0f;
+  return p;
+}
+
+// The octree of points with pointBits bits per axis, built on the host
+static vector<OctNode> BuildHostOctree(
+    const vector<intn>& points, const int pointBits) {
+  vector<OctNode> octree;
+  REQUIRE(Kernels::BuildOctree_s(
+      points, octree, pointBits, pointBits*DIM) == CL_SUCCESS);
+  return octree;
+}
+
+// Whether each point is in leaves of a and b with the same origin and
+// width. Prints the first point that isn't.
+static bool SameLeaves(
+    const vector<intn>& points, const vector<OctNode>& a,
+    const vector<OctNode>& b, const Resln& resln) {
+  for (int i = 0; i < points.size(); ++i) {
+    const OctCell ca = OctreeUtils::FindLeaf(points[i], a, resln);
+    const OctCell cb = OctreeUtils::FindLeaf(points[i], b, resln);
+    if (!(ca.get_origin() == cb.get_origin())
+        || ca.get_width() != cb.get_width()) {
+      cout << "point i " << i << endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+// Appends random polylines of numVertices vertices each, labeled firstLabel
+// to lastLabel-1, with their vertices as octree points, and then numPoints
+// random points. Coordinates are in [0, 2^polyBits).
+static void AddRandomPolylines(
+    const int firstLabel, const int lastLabel, const int numVertices,
+    const int numPoints, const int polyBits, vector<floatn>& segments,
+    vector<int>& labels, vector<intn>& points) {
+  for (int label = firstLabel; label < lastLabel; ++label) {
+    floatn prev;
+    for (int i = 0; i < numVertices; ++i) {
+      const floatn p = RandomFloatPoint(polyBits);
+      if (i > 0) {
+        segments.push_back(prev);
+        segments.push_back(p);
+        labels.push_back(label);
+      }
+      prev = p;
+      intn q;
+      q.x = p.x;
+      q.y = p.y;
+      points.push_back(q);
+    }
+  }
+  AddRandomPoints(numPoints, polyBits, points);
+}
+
+// A 3D octree node for OctreeUtils::TriangleCells, which the DIM 2
+// builders can't make. Bit octant of leaf is set if the octant is a leaf.
+struct TestNode3 {
+  int children[8];
+  int leaf;
+};
+
+// Splits the cell of node, with the given origin and width, until each
+// leaf holds at most one distinct point.
+static void Subdivide3(
+    const vector<int3>& points, const int node, const int3& origin,
+    const int width, vector<TestNode3>& octree) {
+  const int half = width / 2;
+  octree[node].leaf = 0;
+  for (int octant = 0; octant < 8; ++octant) {
+    int3 o = origin;
+    for (int d = 0; d < 3; ++d) {
+      if (octant & (1 << d)) o.s[d] += half;
+    }
+    vector<int3> inside;
+    for (int i = 0; i < points.size(); ++i) {
+      bool in = true;
+      for (int d = 0; d < 3; ++d) {
+        in = in && points[i].s[d] >= o.s[d] && points[i].s[d] < o.s[d] + half;
+      }
+      if (in) inside.push_back(points[i]);
+    }
+    bool distinct = false;
+    for (int i = 1; i < inside.size(); ++i) {
+      for (int d = 0; d < 3; ++d) {
+        distinct = distinct || inside[i].s[d] != inside[0].s[d];
+      }
+    }
+    octree[node].children[octant] = -1;
+    if (!distinct || half == 1) {
+      octree[node].leaf |= 1 << octant;
+      continue;
+    }
+    const int child = octree.size();
+    octree[node].children[octant] = child;
+    octree.push_back(TestNode3());
+    Subdivide3(inside, child, o, half, octree);
+  }
+}
+
 SCENARIO("Points can be uploaded to the GPU.") {
   cout << "Testing PointsToMorton kernel" << endl;
   GIVEN("a fully initialized CLFW environment") {
@@ -445,6 +573,1803 @@ SCENARIO("An octree can be build using a bunch of points. ") {
   }
 }
 
+SCENARIO("An octree can be converted to a compact octree") {
+  cout << "Testing compact octree construction" << endl;
+  GIVEN("a fully initialized CLFW environment") {
+    if (CLFW::IsNotInitialized()) REQUIRE(CLFW::Initialize() == CL_SUCCESS);
+
+    GIVEN("an octree built from a couple random points") {
+      using namespace Kernels;
+      vector<intn> points;
+      AddRandomPoints(OneThousand, bits, points);
+      vector<OctNode> octree = BuildHostOctree(points, bits);
+
+      THEN("the compact octree has the same structure as the octree.") {
+        vector<CompactNode> hostCompact;
+        REQUIRE(OctreeToCompact_s(octree, hostCompact) == CL_SUCCESS);
+
+        bool compareResult = true;
+        vector<pair<int, int>> stack;
+        stack.push_back(make_pair(0, 0));
+        int visited = 0;
+        while (!stack.empty() && compareResult) {
+          const OctNode node = octree[stack.back().first];
+          const CompactNode cnode = hostCompact[stack.back().second];
+          stack.pop_back();
+          ++visited;
+          for (int i = 0; i < (1 << DIM); ++i) {
+            if (is_leaf(&node, i) != compact_is_leaf(&cnode, i)) {
+              compareResult = false;
+            } else if (!is_leaf(&node, i)) {
+              stack.push_back(make_pair(node.children[i], compact_child(&cnode, i)));
+            }
+          }
+        }
+        REQUIRE(compareResult == true);
+        REQUIRE(visited == hostCompact.size());
+
+        AND_THEN("the compact octree built in parallel matches the one built in serial.") {
+          vector<CompactNode> gpuCompact;
+          REQUIRE(BuildCompactOctree_p(points, gpuCompact, bits, mbits) == CL_SUCCESS);
+          REQUIRE(gpuCompact.size() == hostCompact.size());
+          for (int i = 0; i < hostCompact.size(); ++i) {
+            compareResult = compareCompactNode(&gpuCompact[i], &hostCompact[i]);
+            if (compareResult == false) {
+              cout << "compact node i " << i << endl;
+              break;
+            }
+          }
+          REQUIRE(compareResult == true);
+        }
+      }
+    }
+  }
+}
+
+SCENARIO("A linear octree can be built from a bunch of points") {
+  cout << "Testing linear octree construction" << endl;
+  GIVEN("a fully initialized CLFW environment") {
+    if (CLFW::IsNotInitialized()) REQUIRE(CLFW::Initialize() == CL_SUCCESS);
+
+    GIVEN("a couple random points") {
+      using namespace Kernels;
+      vector<intn> points;
+      AddRandomPoints(OneThousand, bits, points);
+
+      THEN("the leaf cells are sorted and tile the domain.") {
+        vector<LinearCell> hostCells;
+        REQUIRE(BuildLinearOctree_s(points, hostCells, bits, mbits) == CL_SUCCESS);
+
+        BigUnsigned zero;
+        initBlkBU(&zero, 0);
+        REQUIRE(compareBU(&hostCells[0].key, &zero) == 0);
+        bool compareResult = true;
+        for (int i = 1; i < hostCells.size(); ++i) {
+          BigUnsigned one, size, end;
+          initBlkBU(&one, 1);
+          shiftBULeft(&size, &one, DIM*(bits - hostCells[i-1].level));
+          addBU(&end, &hostCells[i-1].key, &size);
+          if (compareBU(&end, &hostCells[i].key) != 0) {
+            cout << "linear cell i " << i << endl;
+            compareResult = false;
+            break;
+          }
+        }
+        REQUIRE(compareResult == true);
+
+        AND_THEN("the linear octree built in parallel matches the one built in serial.") {
+          vector<LinearCell> gpuCells;
+          REQUIRE(BuildLinearOctree_p(points, gpuCells, bits, mbits) == CL_SUCCESS);
+          REQUIRE(gpuCells.size() == hostCells.size());
+          for (int i = 0; i < hostCells.size(); ++i) {
+            compareResult = weakEqualsBU(gpuCells[i].key, hostCells[i].key)
+                && gpuCells[i].level == hostCells[i].level;
+            if (compareResult == false) {
+              cout << "linear cell i " << i << endl;
+              break;
+            }
+          }
+          REQUIRE(compareResult == true);
+        }
+      }
+    }
+  }
+}
+
+SCENARIO("An octree can be reordered breadth first") {
+  cout << "Testing breadth first octree reordering" << endl;
+  GIVEN("a fully initialized CLFW environment") {
+    if (CLFW::IsNotInitialized()) REQUIRE(CLFW::Initialize() == CL_SUCCESS);
+
+    GIVEN("an octree built from a couple random points") {
+      using namespace Kernels;
+      vector<intn> points;
+      AddRandomPoints(OneThousand, bits, points);
+      vector<OctNode> octree = BuildHostOctree(points, bits);
+
+      THEN("the children of every node are contiguous and on the next level.") {
+        vector<OctNode> hostBFS;
+        vector<int> hostOffsets;
+        REQUIRE(ReorderBreadthFirst_s(octree, hostBFS, hostOffsets) == CL_SUCCESS);
+        REQUIRE(hostOffsets.front() == 0);
+        REQUIRE(hostOffsets.back() == hostBFS.size());
+
+        bool compareResult = true;
+        int next = 1;
+        for (int level = 0; level < hostOffsets.size() - 1 && compareResult; ++level) {
+          for (int n = hostOffsets[level]; n < hostOffsets[level+1]; ++n) {
+            for (int i = 0; i < (1 << DIM); ++i) {
+              if (is_leaf(&hostBFS[n], i)) continue;
+              if (hostBFS[n].children[i] != next++
+                  || hostBFS[n].children[i] < hostOffsets[level+1]
+                  || hostBFS[n].children[i] >= hostOffsets[level+2]) {
+                cout << "bfs node n " << n << endl;
+                compareResult = false;
+              }
+            }
+          }
+        }
+        REQUIRE(compareResult == true);
+        REQUIRE(next == hostBFS.size());
+
+        AND_THEN("the octree reordered in parallel matches the one reordered in serial.") {
+          vector<OctNode> gpuBFS;
+          vector<int> gpuOffsets;
+          REQUIRE(BuildOctree_p(points, gpuBFS, gpuOffsets, bits, mbits) == CL_SUCCESS);
+          REQUIRE(gpuOffsets == hostOffsets);
+          for (int i = 0; i < hostBFS.size(); ++i) {
+            compareResult = compareOctNode(&gpuBFS[i], &hostBFS[i]);
+            if (compareResult == false) {
+              cout << "bfs node i " << i << endl;
+              break;
+            }
+          }
+          REQUIRE(compareResult == true);
+        }
+      }
+    }
+  }
+}
+
+SCENARIO("Parent and face-neighbor links can be computed for an octree") {
+  cout << "Testing octree links" << endl;
+  GIVEN("a fully initialized CLFW environment") {
+    if (CLFW::IsNotInitialized()) REQUIRE(CLFW::Initialize() == CL_SUCCESS);
+
+    GIVEN("an octree built from a couple random points") {
+      using namespace Kernels;
+      vector<intn> points;
+      AddRandomPoints(OneThousand, bits, points);
+      vector<OctNode> octree = BuildHostOctree(points, bits);
+
+      THEN("every neighbor link points to the same size or larger cell across the face.") {
+        vector<int> hostParents, hostLevels, hostNeighbors;
+        REQUIRE(ComputeOctreeLinks_s(octree, hostParents, hostLevels, hostNeighbors) == CL_SUCCESS);
+        REQUIRE(hostParents[0] == -1);
+        REQUIRE(hostLevels[0] == 0);
+
+        bool compareResult = true;
+        for (int cell = 0; cell < (octree.size() << DIM) && compareResult; ++cell) {
+          const int node = cell_node(cell);
+          if (hostLevels[node] < 0) continue;
+          for (int face = 0; face < NUM_FACES; ++face) {
+            const int neighbor = hostNeighbors[cell * NUM_FACES + face];
+            if (neighbor == -1) continue;
+            const int nnode = cell_node(neighbor);
+            // Siblings differ only in the face's axis
+            if (nnode == node && (cell ^ neighbor) != (1 << face_axis(face))) {
+              compareResult = false;
+            }
+            if (hostLevels[nnode] > hostLevels[node] || hostLevels[nnode] < 0) {
+              compareResult = false;
+            }
+            // The neighbor's neighbor across the opposite face contains the cell
+            const int back = hostNeighbors[neighbor * NUM_FACES + (face ^ 1)];
+            if (hostLevels[nnode] == hostLevels[node] && back != cell) {
+              compareResult = false;
+            }
+            if (!compareResult) {
+              cout << "cell " << cell << " face " << face << endl;
+              break;
+            }
+          }
+        }
+        REQUIRE(compareResult == true);
+
+        AND_THEN("the links computed in parallel match the ones computed in serial.") {
+          vector<int> gpuParents, gpuLevels, gpuNeighbors;
+          REQUIRE(ComputeOctreeLinks_p(octree, gpuParents, gpuLevels, gpuNeighbors) == CL_SUCCESS);
+          REQUIRE(gpuParents == hostParents);
+          REQUIRE(gpuLevels == hostLevels);
+          REQUIRE(gpuNeighbors == hostNeighbors);
+        }
+      }
+    }
+  }
+}
+
+SCENARIO("A linear octree can be 2:1 balanced") {
+  cout << "Testing 2:1 balance" << endl;
+  GIVEN("a fully initialized CLFW environment") {
+    if (CLFW::IsNotInitialized()) REQUIRE(CLFW::Initialize() == CL_SUCCESS);
+
+    GIVEN("a couple random points") {
+      using namespace Kernels;
+      vector<intn> points;
+      AddRandomPoints(OneThousand, bits, points);
+
+      THEN("leaves that share a face differ by at most one level.") {
+        vector<LinearCell> hostCells;
+        REQUIRE(BuildBalancedLinearOctree_s(points, hostCells, bits, mbits) == CL_SUCCESS);
+
+        // Compare the level of each cell against the leaf just across each
+        // of its faces. The coarser of two unbalanced leaves is always found
+        // from the finer one.
+        bool compareResult = true;
+        for (int i = 0; i < hostCells.size() && compareResult; ++i) {
+          const intn origin = linear_cell_origin(&hostCells[i], bits);
+          const int width = linear_cell_width(&hostCells[i], bits);
+          for (int face = 0; face < NUM_FACES; ++face) {
+            intn q = origin;
+            const int axis = face_axis(face);
+            q.s[axis] = face_high(face) ? origin.s[axis] + width : origin.s[axis] - 1;
+            if (q.s[axis] < 0 || q.s[axis] >= (1 << bits)) continue;
+            LinearCell target;
+            xyz2z(&target.key, q, bits);
+            const int j = upper_bound(hostCells.begin(), hostCells.end(), target,
+                [](const LinearCell& a, const LinearCell& b) {
+                  return compareBU(const_cast<BigUnsigned*>(&a.key),
+                                   const_cast<BigUnsigned*>(&b.key)) < 0;
+                }) - hostCells.begin() - 1;
+            if (hostCells[j].level < hostCells[i].level - 1) {
+              cout << "linear cell i " << i << " face " << face << endl;
+              compareResult = false;
+              break;
+            }
+          }
+        }
+        REQUIRE(compareResult == true);
+
+        AND_THEN("the octree balanced in parallel matches the one balanced in serial.") {
+          vector<LinearCell> gpuCells;
+          REQUIRE(BuildBalancedLinearOctree_p(points, gpuCells, bits, mbits) == CL_SUCCESS);
+          REQUIRE(gpuCells.size() == hostCells.size());
+          for (int i = 0; i < hostCells.size(); ++i) {
+            compareResult = weakEqualsBU(gpuCells[i].key, hostCells[i].key)
+                && gpuCells[i].level == hostCells[i].level;
+            if (compareResult == false) {
+              cout << "linear cell i " << i << endl;
+              break;
+            }
+          }
+          REQUIRE(compareResult == true);
+        }
+      }
+    }
+  }
+}
+
+SCENARIO("Points can be inserted into an octree incrementally") {
+  cout << "Testing incremental octree insertion" << endl;
+  GIVEN("an octree built from half of a couple random points") {
+    using namespace Kernels;
+    const Resln resln = make_resln(1 << bits);
+    vector<intn> points(1, make_intn(0, 0));
+    AddRandomPoints(OneThousand - 1, bits, points);
+    // A few repeats of points on either side of the split
+    for (int i = 0; i < 10; ++i) {
+      points.push_back(points[rand() % points.size()]);
+    }
+    const int half = OneThousand / 2;
+    const vector<intn> built(points.begin(), points.begin() + half);
+    const vector<intn> rest(points.begin() + half, points.end());
+    vector<OctNode> octree = BuildHostOctree(built, bits);
+    OctreeUtils::OctreeLinks links;
+    Karras::BuildOctreeLinks(octree, links);
+    Karras::OctreePoints octreePoints;
+    Karras::MapOctreePoints(built, BoundingBox<floatn>(), octree, resln, octreePoints);
+    const vector<OctNode> hostOctree = BuildHostOctree(points, bits);
+
+    THEN("inserting the rest one at a time gives the octree built from all of the points.") {
+      for (int i = 0; i < rest.size(); ++i) {
+        Karras::InsertPoints(vector<intn>(1, rest[i]), octreePoints, octree, links, resln);
+      }
+      REQUIRE(octree.size() == hostOctree.size());
+      REQUIRE(octreePoints.qpoints.size() == points.size());
+      bool compareResult = SameLeaves(points, octree, hostOctree, resln);
+      REQUIRE(compareResult == true);
+
+      AND_THEN("the links find the same leaves as a search from the root.") {
+        for (int i = 0; i < points.size() && compareResult; ++i) {
+          const OctCell cell = OctreeUtils::FindLeaf(points[i], octree, resln);
+          const intn origin = cell.get_origin();
+          for (int face = 0; face < NUM_FACES; ++face) {
+            intn q = points[i];
+            const int axis = face_axis(face);
+            q.s[axis] = face_high(face) ? origin.s[axis] + cell.get_width() : origin.s[axis] - 1;
+            if (q.s[axis] < 0 || q.s[axis] >= resln.width) continue;
+            const OctCell a = OctreeUtils::FindNeighbor(cell, face, points[i], octree, links, resln);
+            const OctCell b = OctreeUtils::FindLeaf(q, octree, resln);
+            compareResult = a.get_origin() == b.get_origin()
+                && a.get_width() == b.get_width();
+            if (compareResult == false) {
+              cout << "point i " << i << " face " << face << endl;
+              break;
+            }
+          }
+        }
+        REQUIRE(compareResult == true);
+      }
+
+      AND_THEN("each leaf holds the first of the points in it.") {
+        for (int i = 0; i < points.size() && compareResult; ++i) {
+          const OctCell cell = OctreeUtils::FindLeaf(points[i], octree, resln);
+          const int index = make_cell_index(cell.get_parent_idx(), cell.get_octant());
+          const int p = octreePoints.cellPoints[index];
+          compareResult = p != -1 && p <= i && points[p] == points[i];
+        }
+        REQUIRE(compareResult == true);
+      }
+    }
+
+    THEN("inserting the rest at once gives the octree built from all of the points.") {
+      Karras::InsertPoints(rest, octreePoints, octree, links, resln);
+      REQUIRE(octree.size() == hostOctree.size());
+      REQUIRE(SameLeaves(points, octree, hostOctree, resln) == true);
+    }
+  }
+
+  GIVEN("an octree of a few drawn points in a padded frame, including its origin") {
+    using namespace Kernels;
+    const Resln resln = make_resln(1 << bits);
+    vector<floatn> points;
+    BoundingBox<floatn> bb;
+    for (int i = 0; i < 100; ++i) {
+      const floatn p = make_floatn(rand() / (float)RAND_MAX, rand() / (float)RAND_MAX);
+      points.push_back(p);
+      bb(p);
+    }
+    const BoundingBox<floatn> frame = Karras::PaddedFrame(bb);
+    points.push_back(frame.min());
+    const vector<intn> qpoints = Karras::Quantize(points, resln, &frame);
+    vector<OctNode> octree = BuildHostOctree(qpoints, bits);
+    OctreeUtils::OctreeLinks links;
+    Karras::BuildOctreeLinks(octree, links);
+    Karras::OctreePoints octreePoints;
+    Karras::MapOctreePoints(qpoints, frame, octree, resln, octreePoints);
+
+    THEN("points drawn beyond the first points are inserted in the same frame.") {
+      for (int i = 0; i < 100; ++i) {
+        const floatn p = make_floatn(1.4f * rand() / RAND_MAX - 0.2f, 1.4f * rand() / RAND_MAX - 0.2f);
+        points.push_back(p);
+        REQUIRE(Karras::InsertPoints(vector<floatn>(1, p), octreePoints, octree, links, resln) == true);
+      }
+      const vector<intn> all = Karras::Quantize(points, resln, &frame);
+      const vector<OctNode> hostOctree = BuildHostOctree(all, bits);
+      REQUIRE(octree.size() == hostOctree.size());
+      REQUIRE((octreePoints.qpoints == all) == true);
+      REQUIRE(SameLeaves(all, octree, hostOctree, resln) == true);
+    }
+
+    THEN("points outside the frame are rejected without changing the octree.") {
+      vector<floatn> drawn;
+      drawn.push_back(make_floatn(0.5f, 0.5f));
+      drawn.push_back(make_floatn(0.5f, 5));
+      const int size = octree.size();
+      const int numPoints = octreePoints.qpoints.size();
+      REQUIRE(Karras::InsertPoints(drawn, octreePoints, octree, links, resln) == false);
+      REQUIRE(octree.size() == size);
+      REQUIRE(octreePoints.qpoints.size() == numPoints);
+    }
+  }
+
+  GIVEN("an octree too small to have a root") {
+    const Resln resln = make_resln(1 << bits);
+    vector<OctNode> octree;
+    OctreeUtils::OctreeLinks links;
+    Karras::OctreePoints octreePoints;
+    Karras::MapOctreePoints(vector<intn>(1, make_intn(5, 7)), BoundingBox<floatn>(), octree, resln, octreePoints);
+
+    THEN("inserting a second point builds the root.") {
+      Karras::InsertPoints(vector<intn>(1, make_intn(5, 7)), octreePoints, octree, links, resln);
+      REQUIRE(octree.empty() == true);
+      Karras::InsertPoints(vector<intn>(1, make_intn(9, 7)), octreePoints, octree, links, resln);
+      REQUIRE(octree.empty() == false);
+      const OctCell a = OctreeUtils::FindLeaf(make_intn(5, 7), octree, resln);
+      const OctCell b = OctreeUtils::FindLeaf(make_intn(9, 7), octree, resln);
+      REQUIRE(a.get_origin() != b.get_origin());
+      REQUIRE(links.levels.size() == octree.size());
+    }
+  }
+}
+
+SCENARIO("An octree can be refined until polylines are in different leaves") {
+  cout << "Testing octree refinement" << endl;
+  GIVEN("a fully initialized CLFW environment") {
+    if (CLFW::IsNotInitialized()) REQUIRE(CLFW::Initialize() == CL_SUCCESS);
+
+    GIVEN("a few random polylines that run close to each other") {
+      using namespace Kernels;
+      const int refineBits = 10;
+      vector<intn> points;
+      vector<floatn> segments;
+      vector<int> labels;
+      for (int label = 0; label < 3; ++label) {
+        floatn prev;
+        for (int i = 0; i < 30; ++i) {
+          floatn p;
+          p.x = 20 + i * 30 + rand() % 7;
+          p.y = 300 + label * 9 + rand() % 5;
+          if (i > 0) {
+            segments.push_back(prev);
+            segments.push_back(p);
+            labels.push_back(label);
+          }
+          prev = p;
+          intn q;
+          q.x = p.x;
+          q.y = p.y;
+          points.push_back(q);
+        }
+      }
+
+      THEN("no leaf that can be split is crossed by two polylines.") {
+        vector<OctNode> hostOctree;
+        REQUIRE(BuildRefinedOctree_s(points, segments, labels, hostOctree, refineBits, refineBits*DIM, 30) == CL_SUCCESS);
+
+        vector<int> cellLabels(hostOctree.size() << DIM, -1);
+        bool compareResult = true;
+        for (int i = 0; i < labels.size() && compareResult; ++i) {
+          const floatn a = segments[2*i];
+          const floatn b = segments[2*i+1];
+          intn p;
+          p.x = a.x;
+          p.y = a.y;
+          intn origin;
+          int width;
+          do {
+            const int cell = FindLeafCell(hostOctree.data(), p, refineBits, &origin, &width);
+            if (cellLabels[cell] != -1 && cellLabels[cell] != labels[i] && width > 1) {
+              cout << "segment i " << i << " cell " << cell << endl;
+              compareResult = false;
+            }
+            cellLabels[cell] = labels[i];
+          } while (NextCellPoint(a, b, origin, width, refineBits, &p));
+        }
+        REQUIRE(compareResult == true);
+
+        AND_THEN("the octree refined in parallel is the same size as the one refined in serial.") {
+          vector<OctNode> gpuOctree;
+          vector<int> gpuOffsets;
+          REQUIRE(BuildRefinedOctree_p(points, segments, labels, gpuOctree, gpuOffsets, refineBits, refineBits*DIM, 30) == CL_SUCCESS);
+          REQUIRE(gpuOctree.size() == hostOctree.size());
+        }
+      }
+    }
+  }
+}
+
+SCENARIO("The cells of many labeled segments can be found in chunks") {
+  cout << "Testing chunked multi-cell walks" << endl;
+  GIVEN("an octree of random points and several thousand short labeled segments") {
+    using namespace Kernels;
+    const int walkBits = 10;
+    const Resln resln = make_resln(1 << walkBits);
+    vector<intn> points;
+    AddRandomPoints(OneThousand, walkBits, points);
+    vector<OctNode> octree = BuildHostOctree(points, walkBits);
+    OctreeUtils::OctreeLinks links;
+    Karras::BuildOctreeLinks(octree, links);
+    // Enough segments that the walk is split into several chunks
+    const int numSegments = 5000;
+    vector<floatn> segments;
+    vector<int> labels;
+    for (int i = 0; i < numSegments; ++i) {
+      const floatn a = RandomFloatPoint(walkBits);
+      floatn b;
+      b.x = std::min(std::max(a.x + (rand() % 1000 - 500) / 10.0f, 0.0f), resln.width - 1.0f);
+      b.y = std::min(std::max(a.y + (rand() % 1000 - 500) / 10.0f, 0.0f), resln.width - 1.0f);
+      segments.push_back(a);
+      segments.push_back(b);
+      labels.push_back(i % 7);
+    }
+    REQUIRE(Parallel::NumChunks(numSegments, 4) > 1);
+
+    THEN("walking the segments in several chunks gives the same records and intersections as walking them in one.") {
+      vector<CellLabel> serialRecords, chunkedRecords;
+      vector<floatn> serialIntersections, chunkedIntersections;
+      OctreeUtils::FindMultiCells(segments, labels, octree, links, resln,
+                                  serialRecords, serialIntersections, 1);
+      OctreeUtils::FindMultiCells(segments, labels, octree, links, resln,
+                                  chunkedRecords, chunkedIntersections, 4);
+      REQUIRE(serialRecords.size() > numSegments);
+      REQUIRE(chunkedRecords.size() == serialRecords.size());
+      REQUIRE(chunkedIntersections.size() == serialIntersections.size());
+      bool compareResult = true;
+      for (int i = 0; i < serialRecords.size() && compareResult; ++i) {
+        const CellLabel& a = serialRecords[i];
+        const CellLabel& b = chunkedRecords[i];
+        compareResult = a.cell == b.cell && a.label == b.label
+            && a.seg.a().x == b.seg.a().x && a.seg.a().y == b.seg.a().y
+            && a.seg.b().x == b.seg.b().x && a.seg.b().y == b.seg.b().y;
+        if (compareResult == false) cout << "record " << i << endl;
+      }
+      for (int i = 0; i < serialIntersections.size() && compareResult; ++i) {
+        compareResult = serialIntersections[i].x == chunkedIntersections[i].x
+            && serialIntersections[i].y == chunkedIntersections[i].y;
+        if (compareResult == false) cout << "intersection " << i << endl;
+      }
+      REQUIRE(compareResult == true);
+
+      AND_THEN("each record is of a leaf and has the label of its segment.") {
+        std::set<int> segmentLabels(labels.begin(), labels.end());
+        for (int i = 0; i < serialRecords.size() && compareResult; ++i) {
+          const CellLabel& r = serialRecords[i];
+          compareResult = is_leaf(&octree[cell_node(r.cell)], cell_octant(r.cell))
+              && segmentLabels.count(r.label) == 1;
+          if (compareResult == false) cout << "record " << i << endl;
+        }
+        REQUIRE(compareResult == true);
+      }
+    }
+  }
+}
+
+SCENARIO("The leaves that segments pass through can be found in parallel") {
+  cout << "Testing segment cell walks" << endl;
+  GIVEN("a fully initialized CLFW environment") {
+    if (CLFW::IsNotInitialized()) REQUIRE(CLFW::Initialize() == CL_SUCCESS);
+
+    GIVEN("an octree of random points and some random segments") {
+      using namespace Kernels;
+      const int walkBits = 10;
+      vector<intn> points;
+      AddRandomPoints(300, walkBits, points);
+      vector<OctNode> octree = BuildHostOctree(points, walkBits);
+      vector<floatn> segments;
+      for (int i = 0; i < 200; ++i) {
+        segments.push_back(RandomFloatPoint(walkBits));
+        segments.push_back(RandomFloatPoint(walkBits));
+      }
+
+      THEN("the cells of each segment are contiguous, in order, and contain the part of the segment between their entry and exit points.") {
+        vector<SegmentCell> hostCells;
+        REQUIRE(SegmentCells_s(octree, segments, hostCells, walkBits) == CL_SUCCESS);
+        bool compareResult = true;
+        for (int i = 0; i < hostCells.size() && compareResult; ++i) {
+          const SegmentCell& c = hostCells[i];
+          const bool first = (i == 0 || hostCells[i-1].segment != c.segment);
+          const bool last = (i+1 == hostCells.size() || hostCells[i+1].segment != c.segment);
+          const floatn a = segments[2*c.segment];
+          const floatn b = segments[2*c.segment+1];
+          if (first && (c.segment != (i == 0 ? 0 : hostCells[i-1].segment+1) || c.entry.x != a.x || c.entry.y != a.y))
+            compareResult = false;
+          if (!first && (c.entry.x != hostCells[i-1].exit.x || c.entry.y != hostCells[i-1].exit.y))
+            compareResult = false;
+          if (last && (c.exit.x != b.x || c.exit.y != b.y))
+            compareResult = false;
+          intn mid, origin;
+          int width;
+          mid.x = floor((c.entry.x + c.exit.x) / 2);
+          mid.y = floor((c.entry.y + c.exit.y) / 2);
+          if (FindLeafCell(octree.data(), mid, walkBits, &origin, &width) != c.cell)
+            compareResult = false;
+          if (!compareResult) cout << "segment cell " << i << " segment " << c.segment << endl;
+        }
+        REQUIRE(compareResult == true);
+
+        AND_THEN("the cells found in parallel match the cells found in serial.") {
+          vector<SegmentCell> gpuCells;
+          REQUIRE(SegmentCells_p(octree, segments, gpuCells, walkBits) == CL_SUCCESS);
+          REQUIRE(gpuCells.size() == hostCells.size());
+          for (int i = 0; i < gpuCells.size() && compareResult; ++i) {
+            if (gpuCells[i].cell != hostCells[i].cell || gpuCells[i].segment != hostCells[i].segment)
+              compareResult = false;
+          }
+          REQUIRE(compareResult == true);
+        }
+      }
+    }
+  }
+}
+
+SCENARIO("Segments can be intersected with cells using the slab method") {
+  cout << "Testing cell intersections" << endl;
+  GIVEN("a row of cells and some random segments") {
+    const Resln resln = make_resln(1 << 8);
+    const int numCells = 16;
+    vector<intn> origins(numCells);
+    vector<int> widths(numCells, 16);
+    for (int i = 0; i < numCells; ++i) {
+      origins[i].x = 16 * i;
+      origins[i].y = 128;
+    }
+    vector<floatn> segments;
+    for (int i = 0; i < 100; ++i) {
+      floatn a, b;
+      a.x = (rand() % 2560) / 10.0f;
+      a.y = 96 + (rand() % 800) / 10.0f;
+      b.x = (rand() % 2560) / 10.0f;
+      b.y = 96 + (rand() % 800) / 10.0f;
+      segments.push_back(a);
+      segments.push_back(b);
+    }
+
+    THEN("the intersections are on the segment and the cell's boundary, and the batched test finds the same cells.") {
+      bool compareResult = true;
+      vector<float> tEnter(numCells), tExit(numCells);
+      for (int i = 0; i < segments.size(); i += 2) {
+        const floatn a = segments[i];
+        const floatn b = segments[i+1];
+        OctreeUtils::SlabIntersect(a, b, origins.data(), widths.data(), numCells, tEnter.data(), tExit.data());
+        for (int j = 0; j < numCells; ++j) {
+          const OctreeUtils::CellIntersectionList intersections =
+              OctreeUtils::FindIntersections(a, b, origins[j], widths[j], resln);
+          for (const OctreeUtils::CellIntersection& ci : intersections) {
+            const float x = a.x + (b.x - a.x) * ci.t;
+            const float y = a.y + (b.y - a.y) * ci.t;
+            const bool onX = (ci.p.x == origins[j].x || ci.p.x == origins[j].x + widths[j]);
+            const bool onY = (ci.p.y == origins[j].y || ci.p.y == origins[j].y + widths[j]);
+            if (fabs(x - ci.p.x) > 1e-3 || fabs(y - ci.p.y) > 1e-3 || !(onX || onY))
+              compareResult = false;
+          }
+          const bool crosses = (tEnter[j] <= tExit[j] && tExit[j] >= 0 && tEnter[j] <= 1)
+              && (tEnter[j] >= 0 || tExit[j] <= 1);
+          if (crosses != !intersections.empty()) {
+            cout << "segment " << i/2 << " cell " << j << endl;
+            compareResult = false;
+          }
+        }
+      }
+      REQUIRE(compareResult == true);
+    }
+  }
+}
+
+SCENARIO("Many points can be located in an octree at once") {
+  cout << "Testing batched point location" << endl;
+  GIVEN("a fully initialized CLFW environment") {
+    if (CLFW::IsNotInitialized()) REQUIRE(CLFW::Initialize() == CL_SUCCESS);
+
+    GIVEN("an octree of random points and some random queries") {
+      using namespace Kernels;
+      const int locateBits = 16;
+      const Resln resln = make_resln(1 << locateBits);
+      vector<intn> points, queries;
+      AddRandomPoints(2000, locateBits, points);
+      vector<OctNode> octree = BuildHostOctree(points, locateBits);
+      AddRandomPoints(10000, locateBits, queries);
+      queries.push_back(queries[0]);
+
+      THEN("the batched host search finds the same leaves as FindLeaf.") {
+        vector<OctCell> cells;
+        OctreeUtils::FindLeaves(queries, octree, resln, cells);
+        REQUIRE(cells.size() == queries.size());
+        bool compareResult = true;
+        for (int i = 0; i < queries.size(); ++i) {
+          if (!(cells[i] == OctreeUtils::FindLeaf(queries[i], octree, resln))) {
+            cout << "query " << i << endl;
+            compareResult = false;
+            break;
+          }
+        }
+        REQUIRE(compareResult == true);
+
+        AND_THEN("the leaves found in parallel are the same.") {
+          vector<int> gpuCells, gpuWidths;
+          REQUIRE(FindLeaves_p(octree, queries, gpuCells, gpuWidths, locateBits) == CL_SUCCESS);
+          for (int i = 0; i < queries.size() && compareResult; ++i) {
+            if (gpuCells[i] != make_cell_index(cells[i].get_parent_idx(), cells[i].get_octant())
+                || gpuWidths[i] != cells[i].get_width())
+              compareResult = false;
+          }
+          REQUIRE(compareResult == true);
+        }
+      }
+    }
+  }
+}
+
+SCENARIO("The leaves that overlap a box can be found") {
+  cout << "Testing box queries" << endl;
+  GIVEN("an octree and a linear octree of random points, and some random boxes") {
+    using namespace Kernels;
+    const int boxBits = 12;
+    const Resln resln = make_resln(1 << boxBits);
+    vector<intn> points;
+    AddRandomPoints(2000, boxBits, points);
+    vector<OctNode> octree = BuildHostOctree(points, boxBits);
+    vector<LinearCell> cells;
+    REQUIRE(BuildLinearOctree_s(points, cells, boxBits, boxBits*DIM) == CL_SUCCESS);
+    vector<BoundingBox<intn> > boxes;
+    for (int i = 0; i < 100; ++i) {
+      const intn a = make_intn(rand() % (1 << boxBits) - 100, rand() % (1 << boxBits) - 100);
+      boxes.push_back(BoundingBox<intn>(a, a + make_intn(rand() % 600, rand() % 600)));
+    }
+
+    THEN("the leaves found are exactly the leaves that overlap each box.") {
+      const BoundingBox<intn> domain(make_uni_intn(0), make_uni_intn(resln.width));
+      vector<OctCell> allLeaves;
+      OctreeUtils::FindLeavesInBox(domain, octree, resln, allLeaves);
+      int numLeaves = 0;
+      for (int i = 0; i < octree.size() << DIM; ++i) {
+        if (is_leaf(&octree[cell_node(i)], cell_octant(i))) ++numLeaves;
+      }
+      REQUIRE(allLeaves.size() == numLeaves);
+
+      vector<vector<OctCell> > leaves;
+      OctreeUtils::FindLeavesInBoxes(boxes, octree, resln, leaves);
+      bool compareResult = true;
+      for (int k = 0; k < boxes.size() && compareResult; ++k) {
+        std::set<int> expected, found;
+        for (const OctCell& cell : allLeaves) {
+          const intn origin = cell.get_origin();
+          const int width = cell.get_width();
+          if (origin.x < boxes[k].max().x && origin.x + width > boxes[k].min().x
+              && origin.y < boxes[k].max().y && origin.y + width > boxes[k].min().y)
+            expected.insert(make_cell_index(cell.get_parent_idx(), cell.get_octant()));
+        }
+        for (const OctCell& cell : leaves[k]) {
+          found.insert(make_cell_index(cell.get_parent_idx(), cell.get_octant()));
+        }
+        if (expected != found) {
+          cout << "box " << k << endl;
+          compareResult = false;
+        }
+
+        vector<int> indices;
+        OctreeUtils::FindLinearLeavesInBox(boxes[k], cells, resln, indices);
+        std::set<int> linearExpected;
+        for (int i = 0; i < cells.size(); ++i) {
+          LinearCell cell = cells[i];
+          const intn origin = linear_cell_origin(&cell, boxBits);
+          const int width = linear_cell_width(&cell, boxBits);
+          if (origin.x < boxes[k].max().x && origin.x + width > boxes[k].min().x
+              && origin.y < boxes[k].max().y && origin.y + width > boxes[k].min().y)
+            linearExpected.insert(i);
+        }
+        if (linearExpected != std::set<int>(indices.begin(), indices.end())) {
+          cout << "linear box " << k << endl;
+          compareResult = false;
+        }
+      }
+      REQUIRE(compareResult == true);
+    }
+  }
+}
+
+SCENARIO("The nearest points to a query can be found with the octree") {
+  cout << "Testing nearest point queries" << endl;
+  GIVEN("an octree of random points and some random queries") {
+    using namespace Kernels;
+    const int knnBits = 12;
+    const Resln resln = make_resln(1 << knnBits);
+    vector<intn> points, queries;
+    AddRandomPoints(2000, knnBits, points);
+    points.push_back(points[0]);
+    AddRandomPoints(200, knnBits, queries);
+    vector<OctNode> octree = BuildHostOctree(points, knnBits);
+    OctreeUtils::LeafPoints leafPoints;
+    OctreeUtils::BuildLeafPoints(points, octree, resln, leafPoints);
+
+    THEN("the k nearest points match a brute force search.") {
+      const int k = 8;
+      vector<vector<int> > nearest;
+      OctreeUtils::FindNearestPoints(queries, k, points, octree, leafPoints, resln, nearest);
+      bool compareResult = true;
+      for (int i = 0; i < queries.size() && compareResult; ++i) {
+        vector<std::pair<long long, int> > expected;
+        for (int j = 0; j < points.size(); ++j) {
+          const long long dx = points[j].x - queries[i].x;
+          const long long dy = points[j].y - queries[i].y;
+          expected.push_back(std::make_pair(dx*dx + dy*dy, j));
+        }
+        std::sort(expected.begin(), expected.end());
+        if (nearest[i].size() != k) compareResult = false;
+        for (int j = 0; j < nearest[i].size() && compareResult; ++j) {
+          if (nearest[i][j] != expected[j].second) {
+            cout << "query " << i << " neighbor " << j << endl;
+            compareResult = false;
+          }
+        }
+      }
+      REQUIRE(compareResult == true);
+    }
+  }
+}
+
+SCENARIO("The nearest polyline to a point can be found with the octree") {
+  cout << "Testing nearest object queries" << endl;
+  GIVEN("an octree of a few random polylines and some random queries") {
+    using namespace Kernels;
+    const int objectBits = 10;
+    const Resln resln = make_resln(1 << objectBits);
+    vector<intn> points;
+    vector<floatn> segments, queries;
+    vector<int> labels;
+    AddRandomPolylines(0, 5, 10, 0, objectBits, segments, labels, points);
+    for (int i = 0; i < 500; ++i) {
+      queries.push_back(RandomFloatPoint(objectBits));
+    }
+    vector<OctNode> octree = BuildHostOctree(points, objectBits);
+    OctreeUtils::LeafSegments leafSegments;
+    OctreeUtils::BuildLeafSegments(segments, labels, octree, resln, leafSegments);
+
+    THEN("the nearest label and distance match a brute force search.") {
+      vector<OctreeUtils::NearestObject> nearest;
+      OctreeUtils::FindNearestObjects(queries, octree, leafSegments, resln, nearest);
+      bool compareResult = true;
+      for (int i = 0; i < queries.size() && compareResult; ++i) {
+        float dist = std::numeric_limits<float>::max();
+        int label = -1;
+        for (int j = 0; j < labels.size(); ++j) {
+          const FloatSegment seg(segments[2*j], segments[2*j+1]);
+          const float d = Geom::dist(queries[i], Geom::closest(queries[i], seg));
+          if (d < dist) {
+            dist = d;
+            label = labels[j];
+          }
+        }
+        if (nearest[i].label != label || fabs(nearest[i].dist - dist) > 1e-4) {
+          cout << "query " << i << endl;
+          compareResult = false;
+        }
+      }
+      REQUIRE(compareResult == true);
+    }
+  }
+}
+
+SCENARIO("A generalized Voronoi diagram can be computed over the leaves of an octree") {
+  cout << "Testing GVD propagation" << endl;
+  GIVEN("a fully initialized CLFW environment") {
+    if (CLFW::IsNotInitialized()) REQUIRE(CLFW::Initialize() == CL_SUCCESS);
+
+    GIVEN("an octree of a few random polylines and random points") {
+      using namespace Kernels;
+      const int gvdBits = 10;
+      const Resln resln = make_resln(1 << gvdBits);
+      vector<intn> points;
+      vector<floatn> segments;
+      vector<int> labels;
+      AddRandomPolylines(0, 5, 8, 300, gvdBits, segments, labels, points);
+      vector<OctNode> octree = BuildHostOctree(points, gvdBits);
+      OctreeUtils::LeafSegments leafSegments;
+      OctreeUtils::BuildLeafSegments(segments, labels, octree, resln, leafSegments);
+
+      THEN("nearly every leaf is labeled with the polyline nearest to its center.") {
+        OctreeUtils::GVD gvd;
+        OctreeUtils::ComputeGVD(octree, leafSegments, resln, gvd, false);
+        vector<OctCell> leaves;
+        OctreeUtils::FindLeavesInBox(BoundingBox<intn>(make_uni_intn(0), make_uni_intn(resln.width)), octree, resln, leaves);
+        int numWrong = 0;
+        for (const OctCell& leaf : leaves) {
+          floatn center;
+          center.x = leaf.get_origin().x + leaf.get_width() / 2.0f;
+          center.y = leaf.get_origin().y + leaf.get_width() / 2.0f;
+          float dist = std::numeric_limits<float>::max();
+          int label = -1;
+          for (int j = 0; j < labels.size(); ++j) {
+            const FloatSegment seg(segments[2*j], segments[2*j+1]);
+            const float d = Geom::dist(center, Geom::closest(center, seg));
+            if (d < dist) {
+              dist = d;
+              label = labels[j];
+            }
+          }
+          if (gvd.labels[make_cell_index(leaf.get_parent_idx(), leaf.get_octant())] != label)
+            ++numWrong;
+        }
+        // Jump flooding is approximate
+        REQUIRE(numWrong * 100 <= leaves.size());
+
+        AND_THEN("the GVD computed in parallel is the same as the one computed in serial.") {
+          OctreeUtils::GVD gpuGVD;
+          OctreeUtils::ComputeGVD(octree, leafSegments, resln, gpuGVD, true);
+          REQUIRE(gpuGVD.labels == gvd.labels);
+          REQUIRE(gpuGVD.cells == gvd.cells);
+        }
+      }
+    }
+  }
+}
+
+SCENARIO("GVD edges can be extracted from cells with two labels") {
+  cout << "Testing GVD edge extraction" << endl;
+  GIVEN("an octree with two horizontal segments of different labels in every leaf") {
+    using namespace Kernels;
+    const int edgeBits = 10;
+    const int samples = 4;
+    const Resln resln = make_resln(1 << edgeBits);
+    vector<intn> points;
+    AddRandomPoints(1000, edgeBits, points);
+    vector<OctNode> octree = BuildHostOctree(points, edgeBits);
+    vector<OctCell> leaves;
+    OctreeUtils::FindLeavesInBox(BoundingBox<intn>(make_uni_intn(0), make_uni_intn(resln.width)), octree, resln, leaves);
+    vector<CellLabel> records;
+    for (const OctCell& leaf : leaves) {
+      const int cell = make_cell_index(leaf.get_parent_idx(), leaf.get_octant());
+      const float x = leaf.get_origin().x;
+      const float y = leaf.get_origin().y;
+      const float w = leaf.get_width();
+      records.push_back(CellLabel(cell, 0,
+          FloatSegment(make_floatn(x, y + w/4), make_floatn(x + w, y + w/4))));
+      records.push_back(CellLabel(cell, 1,
+          FloatSegment(make_floatn(x, y + 3*w/4), make_floatn(x + w, y + 3*w/4))));
+    }
+    const CellLabels cellLabels(records, octree.size() << DIM);
+
+    THEN("each leaf has one edge along the line halfway between the segments.") {
+      OctreeUtils::GVDEdges edges;
+      OctreeUtils::ExtractGVDEdges(octree, cellLabels, resln, samples, edges);
+      REQUIRE(edges.lasts.size() == leaves.size());
+      REQUIRE(edges.vertices.empty());
+      int first = 0;
+      for (int i = 0; i < leaves.size(); ++i) {
+        const OctCell& leaf = leaves[i];
+        REQUIRE(edges.cells[i] == make_cell_index(leaf.get_parent_idx(), leaf.get_octant()));
+        REQUIRE(edges.labels[2*i] == 0);
+        REQUIRE(edges.labels[2*i+1] == 1);
+        REQUIRE(edges.lasts[i] - first == samples + 1);
+        const float mid = leaf.get_origin().y + leaf.get_width() / 2.0f;
+        for (int j = first; j < edges.lasts[i]; ++j) {
+          REQUIRE(fabs(edges.points[j].y - mid) <= 1e-3 * leaf.get_width());
+        }
+        first = edges.lasts[i];
+      }
+    }
+  }
+}
+
+SCENARIO("GVD vertices can be found where three labels meet in a cell") {
+  cout << "Testing GVD vertex extraction" << endl;
+  GIVEN("an octree with three short segments of different labels in every leaf") {
+    using namespace Kernels;
+    const int vertexBits = 10;
+    const int samples = 16;
+    const Resln resln = make_resln(1 << vertexBits);
+    vector<intn> points;
+    AddRandomPoints(200, vertexBits, points);
+    vector<OctNode> octree = BuildHostOctree(points, vertexBits);
+    vector<OctCell> leaves;
+    OctreeUtils::FindLeavesInBox(BoundingBox<intn>(make_uni_intn(0), make_uni_intn(resln.width)), octree, resln, leaves);
+    // Short segments centered at (w/4, w/4), (3w/4, w/4) and (w/2, 3w/4)
+    // in each leaf. The point equidistant to them is (w/2, 7w/16).
+    const float centers[3][2] = {{0.25f, 0.25f}, {0.75f, 0.25f}, {0.5f, 0.75f}};
+    vector<CellLabel> records;
+    for (const OctCell& leaf : leaves) {
+      const int cell = make_cell_index(leaf.get_parent_idx(), leaf.get_octant());
+      const float w = leaf.get_width();
+      for (int label = 0; label < 3; ++label) {
+        const float x = leaf.get_origin().x + centers[label][0] * w;
+        const float y = leaf.get_origin().y + centers[label][1] * w;
+        records.push_back(CellLabel(cell, label,
+            FloatSegment(make_floatn(x - w/128, y), make_floatn(x + w/128, y))));
+      }
+    }
+    const CellLabels cellLabels(records, octree.size() << DIM);
+
+    THEN("each leaf has one vertex of the three labels, where its three edges end.") {
+      OctreeUtils::GVDEdges edges;
+      OctreeUtils::ExtractGVDEdges(octree, cellLabels, resln, samples, edges);
+      REQUIRE(edges.vertices.size() == leaves.size());
+      REQUIRE(edges.lasts.size() == 3 * leaves.size());
+      bool compareResult = true;
+      for (int i = 0; i < leaves.size() && compareResult; ++i) {
+        const OctCell& leaf = leaves[i];
+        const int cell = make_cell_index(leaf.get_parent_idx(), leaf.get_octant());
+        const float w = leaf.get_width();
+        const floatn v = edges.vertices[i];
+        std::set<int> vertexLabels(edges.vertex_labels.begin() + 3*i,
+                                   edges.vertex_labels.begin() + 3*i + 3);
+        compareResult = edges.vertex_cells[i] == cell
+            && vertexLabels.size() == 3 && *vertexLabels.rbegin() == 2
+            && fabs(v.x - (leaf.get_origin().x + w/2)) <= 0.02f * w
+            && fabs(v.y - (leaf.get_origin().y + 7*w/16)) <= 0.02f * w;
+        // Each edge of the leaf has the vertex as one of its ends
+        for (int l = 3*i; l < 3*i+3 && compareResult; ++l) {
+          const floatn a = edges.points[(l == 0) ? 0 : edges.lasts[l-1]];
+          const floatn b = edges.points[edges.lasts[l]-1];
+          compareResult = edges.cells[l] == cell
+              && ((a.x == v.x && a.y == v.y) || (b.x == v.x && b.y == v.y));
+        }
+        if (compareResult == false) cout << "leaf " << i << " " << v << endl;
+      }
+      REQUIRE(compareResult == true);
+    }
+  }
+}
+
+SCENARIO("The labels of the segments in each cell can be stored in compressed rows") {
+  cout << "Testing CellLabels" << endl;
+  GIVEN("many labeled segments in a few cells, with repeated labels") {
+    const int numCells = 100;
+    vector<CellLabel> records;
+    for (int i = 0; i < 50000; ++i) {
+      const float length = rand() % 1000;
+      records.push_back(CellLabel(rand() % numCells, rand() % 5,
+          FloatSegment(make_floatn(0, 0), make_floatn(length, 0))));
+    }
+
+    THEN("each cell has each of its labels once, in order of first appearance, with its longest segment.") {
+      const CellLabels cellLabels(records, numCells + 1);
+      REQUIRE(cellLabels.size() == numCells + 1);
+      REQUIRE(cellLabels.num_labels(numCells) == 0);
+      for (int cell = 0; cell < numCells; ++cell) {
+        vector<int> labels;
+        vector<float> lengths;
+        for (const CellLabel& r : records) {
+          if (r.cell != cell) continue;
+          const int j = std::find(labels.begin(), labels.end(), r.label) - labels.begin();
+          if (j == labels.size()) {
+            labels.push_back(r.label);
+            lengths.push_back(r.seg.length());
+          } else {
+            lengths[j] = std::max(lengths[j], r.seg.length());
+          }
+        }
+        REQUIRE(cellLabels.num_labels(cell) == labels.size());
+        REQUIRE(cellLabels.is_multi(cell) == (labels.size() > 1));
+        for (int j = 0; j < labels.size(); ++j) {
+          REQUIRE(cellLabels.label(j, cell) == labels[j]);
+          REQUIRE(cellLabels.seg(j, cell).length() == lengths[j]);
+        }
+      }
+    }
+  }
+}
+
+SCENARIO("Boxes can be fit between many pairs of segments at once") {
+  cout << "Testing batched FitBoxes" << endl;
+  GIVEN("a fully initialized CLFW environment") {
+    if (CLFW::IsNotInitialized()) REQUIRE(CLFW::Initialize() == CL_SUCCESS);
+
+    GIVEN("random pairs of segments that boxes can be fit between") {
+      using namespace Kernels;
+      // Enough pairs that the batch is fit in several chunks
+      const int numPairs = 4096;
+      const int numThreads = 4;
+      REQUIRE(Parallel::NumChunks(numPairs, numThreads) > 1);
+      vector<FloatSegment> pairs;
+      vector<floatn> endpoints;
+      while (pairs.size() < 2 * numPairs) {
+        floatn p[4];
+        for (int i = 0; i < 4; ++i) {
+          p[i] = make_floatn((rand() % 1600) / 100.0f, (rand() % 1600) / 100.0f);
+        }
+        const FloatSegment A(p[0], p[1]), B(p[2], p[3]);
+        if (A.is_degenerate() || B.is_degenerate()) continue;
+        vector<floatn> samples, origins;
+        vector<float> lengths;
+        vector<FitBox> boxes;
+        try {
+          Geom::FitBoxes(A, B, 1, &samples, &origins, &lengths);
+          FitBoxes_s(vector<floatn>(p, p+4), boxes, 1);
+        } catch (logic_error&) {
+          continue;
+        }
+        pairs.push_back(A);
+        pairs.push_back(B);
+        endpoints.insert(endpoints.end(), p, p+4);
+      }
+
+      THEN("the batch gives the same boxes as fitting each pair in turn.") {
+        vector<floatn> samples, origins, batchSamples, batchOrigins;
+        vector<float> lengths, batchLengths;
+        for (int i = 0; i < pairs.size(); i += 2) {
+          if (!Geom::multi_intersection(pairs[i], pairs[i+1]))
+            Geom::FitBoxes(pairs[i], pairs[i+1], 1, &samples, &origins, &lengths);
+        }
+        Geom::FitBoxes(pairs, 1, &batchSamples, &batchOrigins, &batchLengths, numThreads);
+        REQUIRE(batchSamples == samples);
+        REQUIRE(batchOrigins == origins);
+        REQUIRE(batchLengths == lengths);
+
+        AND_THEN("the device port fits the same boxes for nearly every pair.") {
+          // The device port works in single precision, which can change the
+          // outcome for nearly degenerate pairs.
+          int numSame = 0;
+          for (int i = 0; i < pairs.size(); i += 2) {
+            vector<floatn> pairSamples, pairOrigins;
+            vector<float> pairLengths;
+            if (!Geom::multi_intersection(pairs[i], pairs[i+1]))
+              Geom::FitBoxes(pairs[i], pairs[i+1], 1, &pairSamples, &pairOrigins, &pairLengths);
+            vector<FitBox> pairBoxes;
+            REQUIRE(FitBoxes_s(vector<floatn>(endpoints.begin() + 2*i, endpoints.begin() + 2*i + 4), pairBoxes, 1) == CL_SUCCESS);
+            bool same = (pairBoxes.size() == pairOrigins.size());
+            for (int j = 0; same && j < pairBoxes.size(); ++j) {
+              same = fabs(pairBoxes[j].origin.x - pairOrigins[j].x) < 1e-3 &&
+                     fabs(pairBoxes[j].origin.y - pairOrigins[j].y) < 1e-3 &&
+                     fabs(pairBoxes[j].length - pairLengths[j]) < 1e-3;
+            }
+            if (same) ++numSame;
+          }
+          REQUIRE(numSame * 100 >= 99 * (pairs.size() / 2));
+
+          vector<FitBox> boxes;
+          REQUIRE(FitBoxes_s(endpoints, boxes, 1) == CL_SUCCESS);
+          vector<FitBox> gpuBoxes;
+          REQUIRE(FitBoxes_p(endpoints, gpuBoxes, 1) == CL_SUCCESS);
+          REQUIRE(gpuBoxes.size() == boxes.size());
+          for (int i = 0; i < boxes.size(); ++i) {
+            REQUIRE(gpuBoxes[i].num_samples == boxes[i].num_samples);
+            REQUIRE(fabs(gpuBoxes[i].length - boxes[i].length) < 1e-3);
+          }
+        }
+      }
+    }
+  }
+}
+
+SCENARIO("The device port fits the same boxes as Geom::FitBoxes near degenerate pairs") {
+  cout << "Testing FitBoxes near degenerate pairs" << endl;
+  GIVEN("a fully initialized CLFW environment") {
+    if (CLFW::IsNotInitialized()) REQUIRE(CLFW::Initialize() == CL_SUCCESS);
+
+    GIVEN("pairs that are nearly parallel, nearly touching or barely crossing") {
+      using namespace Kernels;
+      // The cases are built along the x axis and then rotated, so that
+      // they aren't axis aligned.
+      vector<floatn> endpoints;
+      for (float angle : {0.3f, 0.7f, 1.1f, 2.5f}) {
+        const float c = cos(angle), s = sin(angle);
+        auto addPair = [&](float ax, float ay, float bx, float by,
+                           float cx, float cy, float dx, float dy) {
+          const float p[8] = { ax, ay, bx, by, cx, cy, dx, dy };
+          for (int i = 0; i < 8; i += 2) {
+            endpoints.push_back(make_floatn(3.3f + c*p[i] - s*p[i+1],
+                                            1.7f + s*p[i] + c*p[i+1]));
+          }
+        };
+        for (float e : {1e-1f, 1e-2f, 1e-3f, 1e-4f}) {
+          addPair(0, 0, 10, 0, 0, 1, 10, 1+e);    // Nearly parallel
+          addPair(0, 0, 10, 0, 0, e, 10, e);      // Parallel and close
+          addPair(0, 0, 10, 0, 5, e, 5, 10);      // Nearly touching A
+          addPair(0, 0, 10, 0, 10+e, 0, 12, 5);   // Nearly touching an end
+          addPair(0, 0, 10, 0, 10, 0, 12, e);     // Nearly collinear ends
+          addPair(0, 0, 10, 0, 10, 0, 0, e);      // Folding back
+          // Barely crossing. A right angle crossing is a tie between the
+          // two sides of the crossing, which either port may break.
+          addPair(0, 0, 10, 0, 5, -e, 0.5f, 10);
+          addPair(0, 0, 10, 0, 5, -e, 9.5f, 10);
+        }
+      }
+      const int numPairs = endpoints.size() / 4;
+
+      THEN("the single precision port matches the double precision fit.") {
+        for (int i = 0; i < numPairs; ++i) {
+          const FloatSegment A(endpoints[4*i], endpoints[4*i+1]);
+          const FloatSegment B(endpoints[4*i+2], endpoints[4*i+3]);
+          vector<floatn> samples, origins;
+          vector<float> lengths;
+          if (!Geom::multi_intersection(A, B))
+            Geom::FitBoxes(A, B, 1, &samples, &origins, &lengths);
+          vector<FitBox> boxes;
+          REQUIRE(FitBoxes_s(vector<floatn>(endpoints.begin() + 4*i, endpoints.begin() + 4*i + 4), boxes, 1) == CL_SUCCESS);
+          REQUIRE(boxes.size() == origins.size());
+          for (size_t j = 0; j < boxes.size(); ++j) {
+            REQUIRE(fabs(boxes[j].origin.x - origins[j].x) < 1e-3);
+            REQUIRE(fabs(boxes[j].origin.y - origins[j].y) < 1e-3);
+            REQUIRE(fabs(boxes[j].length - lengths[j]) < 1e-3);
+          }
+        }
+
+        AND_THEN("the device fits the same boxes.") {
+          vector<FitBox> boxes, gpuBoxes;
+          REQUIRE(FitBoxes_s(endpoints, boxes, 1) == CL_SUCCESS);
+          REQUIRE(FitBoxes_p(endpoints, gpuBoxes, 1) == CL_SUCCESS);
+          REQUIRE(gpuBoxes.size() == boxes.size());
+          for (size_t i = 0; i < boxes.size(); ++i) {
+            REQUIRE(gpuBoxes[i].num_samples == boxes[i].num_samples);
+            REQUIRE(fabs(gpuBoxes[i].origin.x - boxes[i].origin.x) < 1e-3);
+            REQUIRE(fabs(gpuBoxes[i].origin.y - boxes[i].origin.y) < 1e-3);
+            REQUIRE(fabs(gpuBoxes[i].length - boxes[i].length) < 1e-3);
+          }
+        }
+      }
+    }
+  }
+}
+
+SCENARIO("A distance field can be sampled on a grid with the octree") {
+  cout << "Testing distance field sampling" << endl;
+  GIVEN("a fully initialized CLFW environment") {
+    if (CLFW::IsNotInitialized()) REQUIRE(CLFW::Initialize() == CL_SUCCESS);
+
+    GIVEN("an octree of a counterclockwise square and a few random polylines") {
+      using namespace Kernels;
+      const int dfBits = 10;
+      const Resln resln = make_resln(1 << dfBits);
+      vector<intn> points;
+      vector<floatn> segments;
+      vector<int> labels;
+      const float corners[5][2] = {{300, 300}, {700, 300}, {700, 700}, {300, 700}, {300, 300}};
+      for (int i = 0; i < 4; ++i) {
+        floatn a, b;
+        a.x = corners[i][0];
+        a.y = corners[i][1];
+        b.x = corners[i+1][0];
+        b.y = corners[i+1][1];
+        segments.push_back(a);
+        segments.push_back(b);
+        labels.push_back(0);
+        points.push_back(make_intn(a.x, a.y));
+      }
+      AddRandomPolylines(1, 5, 8, 300, dfBits, segments, labels, points);
+      vector<OctNode> octree = BuildHostOctree(points, dfBits);
+      OctreeUtils::LeafSegments leafSegments;
+      OctreeUtils::BuildLeafSegments(segments, labels, octree, resln, leafSegments);
+
+      // Overhangs the domain and doesn't end on a tile boundary
+      OctreeUtils::SampleGrid grid;
+      grid.origin.x = -20;
+      grid.origin.y = 3.5;
+      grid.spacing = 7.3f;
+      grid.nx = 150;
+      grid.ny = 137;
+      const int n = grid.nx * grid.ny;
+
+      THEN("every point has the distance to the nearest segment.") {
+        vector<float> dists(n);
+        vector<int> nearestLabels(n);
+        OctreeUtils::SampleDistanceField(grid, octree, leafSegments, resln, false, dists.data(), nearestLabels.data(), false);
+        for (int j = 0; j < grid.ny; ++j) {
+          for (int i = 0; i < grid.nx; ++i) {
+            floatn q;
+            q.x = grid.origin.x + grid.spacing * i;
+            q.y = grid.origin.y + grid.spacing * j;
+            float dist = std::numeric_limits<float>::max();
+            for (int k = 0; k < labels.size(); ++k) {
+              const FloatSegment seg(segments[2*k], segments[2*k+1]);
+              dist = std::min(dist, Geom::dist(q, Geom::closest(q, seg)));
+            }
+            REQUIRE(fabs(dists[j*grid.nx+i] - dist) < 1e-2);
+          }
+        }
+
+        AND_THEN("the signed distance is negative inside the square.") {
+          vector<float> signedDists(n);
+          OctreeUtils::SampleDistanceField(grid, octree, leafSegments, resln, true, signedDists.data(), nullptr, false);
+          for (int j = 0; j < grid.ny; ++j) {
+            for (int i = 0; i < grid.nx; ++i) {
+              const int k = j * grid.nx + i;
+              REQUIRE(fabs(signedDists[k]) == dists[k]);
+              if (nearestLabels[k] != 0) continue;
+              const float x = grid.origin.x + grid.spacing * i;
+              const float y = grid.origin.y + grid.spacing * j;
+              const bool inside = x > 300 && x < 700 && y > 300 && y < 700;
+              REQUIRE(inside == (signedDists[k] < 0));
+            }
+          }
+        }
+
+        AND_THEN("the field sampled in parallel is the same as the one sampled in serial.") {
+          vector<float> gpuDists(n);
+          vector<int> gpuLabels(n);
+          OctreeUtils::SampleDistanceField(grid, octree, leafSegments, resln, false, gpuDists.data(), gpuLabels.data(), true);
+          REQUIRE(gpuLabels == nearestLabels);
+          for (int k = 0; k < n; ++k) {
+            REQUIRE(fabs(gpuDists[k] - dists[k]) < 1e-3);
+          }
+        }
+      }
+    }
+  }
+}
+
+SCENARIO("Triangles can be intersected with the leaves of a 3D octree") {
+  cout << "Testing triangle-cell intersection" << endl;
+  GIVEN("the triangle cutting the corner x + y + z = 3") {
+    Geom::Triangle tri;
+    for (int i = 0; i < 3; ++i) {
+      for (int d = 0; d < 3; ++d) {
+        tri.v[i].s[d] = (i == d) ? 3 : 0;
+      }
+    }
+    float3 center, half;
+    for (int d = 0; d < 3; ++d) {
+      center.s[d] = 0;
+      half.s[d] = 0.9f;
+    }
+
+    THEN("it misses a box whose bounding boxes it overlaps.") {
+      REQUIRE(Geom::TriangleBoxOverlap(tri, center, half) == false);
+    }
+
+    THEN("it overlaps a slightly larger box and a box around its center.") {
+      for (int d = 0; d < 3; ++d) {
+        half.s[d] = 1.1f;
+      }
+      REQUIRE(Geom::TriangleBoxOverlap(tri, center, half) == true);
+      for (int d = 0; d < 3; ++d) {
+        center.s[d] = 1;
+        half.s[d] = 0.1f;
+      }
+      REQUIRE(Geom::TriangleBoxOverlap(tri, center, half) == true);
+    }
+  }
+
+  GIVEN("a 3D octree of random points and a few hundred small labeled triangles") {
+    const int triBits = 8;
+    const int width = 1 << triBits;
+    vector<int3> points;
+    for (int i = 0; i < 2000; ++i) {
+      int3 p;
+      for (int d = 0; d < 3; ++d) {
+        p.s[d] = rand() % width;
+      }
+      points.push_back(p);
+    }
+    vector<TestNode3> octree(1);
+    Subdivide3(points, 0, make_int3(0, 0, 0), width, octree);
+    vector<Geom::Triangle> triangles(300);
+    vector<int> labels;
+    for (int t = 0; t < triangles.size(); ++t) {
+      int c[3];
+      for (int d = 0; d < 3; ++d) {
+        c[d] = rand() % width;
+      }
+      for (int i = 0; i < 3; ++i) {
+        for (int d = 0; d < 3; ++d) {
+          triangles[t].v[i].s[d] = c[d] + (rand() % 600) / 10.0f - 30;
+        }
+      }
+      labels.push_back(t % 7);
+    }
+    vector<TriangleLabel> cells;
+    OctreeUtils::TriangleCells(triangles, labels, octree, triBits, cells);
+
+    THEN("each triangle has exactly the leaves it overlaps, in z-order.") {
+      // Every leaf in z-order. Leaves are pushed as -1 - cell.
+      vector<int> leaves;
+      vector<int3> origins;
+      vector<int> widths;
+      vector<int> stack(1, 0);
+      vector<int3> stackOrigins(1, make_int3(0, 0, 0));
+      vector<int> stackWidths(1, width);
+      while (!stack.empty()) {
+        const int top = stack.back();
+        const int3 origin = stackOrigins.back();
+        const int w = stackWidths.back();
+        stack.pop_back();
+        stackOrigins.pop_back();
+        stackWidths.pop_back();
+        if (top < 0) {
+          leaves.push_back(-1 - top);
+          origins.push_back(origin);
+          widths.push_back(w);
+          continue;
+        }
+        // Pushed in reverse so that they're popped in z-order
+        for (int octant = 7; octant >= 0; --octant) {
+          int3 o = origin;
+          for (int d = 0; d < 3; ++d) {
+            if (octant & (1 << d)) o.s[d] += w / 2;
+          }
+          const bool leaf = octree[top].leaf & (1 << octant);
+          stack.push_back(leaf ? -1 - ((top << 3) | octant) : octree[top].children[octant]);
+          stackOrigins.push_back(o);
+          stackWidths.push_back(w / 2);
+        }
+      }
+
+      vector<TriangleLabel> expected;
+      for (int t = 0; t < triangles.size(); ++t) {
+        for (int i = 0; i < leaves.size(); ++i) {
+          float3 center, half;
+          for (int d = 0; d < 3; ++d) {
+            half.s[d] = widths[i] / 2.0f;
+            center.s[d] = origins[i].s[d] + half.s[d];
+          }
+          if (Geom::TriangleBoxOverlap(triangles[t], center, half))
+            expected.push_back(TriangleLabel(leaves[i], labels[t], t));
+        }
+      }
+      REQUIRE(cells.size() == expected.size());
+      for (int i = 0; i < cells.size(); ++i) {
+        REQUIRE(cells[i].cell == expected[i].cell);
+        REQUIRE(cells[i].label == expected[i].label);
+        REQUIRE(cells[i].triangle == expected[i].triangle);
+      }
+    }
+
+    THEN("each triangle can be sampled on a grid that includes its vertices.") {
+      vector<float> spacings(triangles.size(), 4);
+      vector<float3> samples;
+      Geom::SampleTriangles(triangles, spacings, samples);
+      int k = 0;
+      for (const Geom::Triangle& tri : triangles) {
+        float longest = 0;
+        for (int i = 0; i < 3; ++i) {
+          float e2 = 0;
+          for (int d = 0; d < 3; ++d) {
+            e2 += pow(tri.v[(i+1)%3].s[d] - tri.v[i].s[d], 2);
+          }
+          longest = std::max(longest, sqrt(e2));
+        }
+        const int n = std::max(static_cast<int>(ceil(longest / 4)), 1);
+        const int count = (n+1) * (n+2) / 2;
+        for (int i = 0; i < 3; ++i) {
+          bool found = false;
+          for (int j = k; j < k + count; ++j) {
+            float d2 = 0;
+            for (int d = 0; d < 3; ++d) {
+              d2 += pow(samples[j].s[d] - tri.v[i].s[d], 2);
+            }
+            found = found || d2 < 1e-6;
+          }
+          REQUIRE(found == true);
+        }
+        k += count;
+      }
+      REQUIRE(k == samples.size());
+    }
+
+    THEN("the labels of each leaf can be stored in compressed rows.") {
+      const int numCells = octree.size() << 3;
+      const TriangleLabels triangleLabels(cells, numCells);
+      vector<std::set<int> > expected(numCells);
+      for (const TriangleLabel& r : cells) {
+        expected[r.cell].insert(r.label);
+      }
+      for (int c = 0; c < numCells; ++c) {
+        std::set<int> found;
+        for (int i = 0; i < triangleLabels.num_labels(c); ++i) {
+          found.insert(triangleLabels.label(i, c));
+          REQUIRE(labels[triangleLabels.triangle(i, c)] == triangleLabels.label(i, c));
+        }
+        REQUIRE(found == expected[c]);
+        REQUIRE(triangleLabels.num_labels(c) == expected[c].size());
+      }
+    }
+  }
+}
+
+SCENARIO("Segments can be sampled densely enough to separate polylines in one build") {
+  cout << "Testing adaptive segment sampling" << endl;
+  GIVEN("a fully initialized CLFW environment") {
+    if (CLFW::IsNotInitialized()) REQUIRE(CLFW::Initialize() == CL_SUCCESS);
+
+    GIVEN("two long close lines and nested squares, all with different labels") {
+      using namespace Kernels;
+      const int sampleBits = 10;
+      const Resln resln = make_resln(1 << sampleBits);
+      vector<floatn> segments;
+      vector<int> labels;
+      auto addSegment = [&](float x0, float y0, float x1, float y1, int label) {
+        segments.push_back(make_floatn(x0, y0));
+        segments.push_back(make_floatn(x1, y1));
+        labels.push_back(label);
+      };
+      addSegment(100, 500, 900, 500, 0);
+      addSegment(100, 506, 900, 506, 1);
+      addSegment(100, 100, 900, 300, 2);
+      addSegment(900, 300, 950, 900, 2);
+      for (int i = 0; i < 4; ++i) {
+        const float lo = 150 + i * 9.0f;
+        const float hi = 400 - i * 9.0f;
+        addSegment(lo, lo + 450, hi, lo + 450, 3 + i);
+        addSegment(hi, lo + 450, hi, hi + 450, 3 + i);
+        addSegment(hi, hi + 450, lo, hi + 450, 3 + i);
+        addSegment(lo, hi + 450, lo, lo + 450, 3 + i);
+      }
+      vector<float> spacings;
+      OctreeUtils::SampleSpacings(segments, labels, resln, spacings);
+
+      THEN("each spacing is half the distance to the nearest segment of another label.") {
+        for (int s = 0; s < labels.size(); ++s) {
+          float dist = resln.width;
+          for (int t = 0; t < labels.size(); ++t) {
+            if (labels[t] == labels[s]) continue;
+            floatn ca, cb;
+            bool caEnd, cbEnd;
+            Geom::closest(FloatSegment(segments[2*s], segments[2*s+1]), FloatSegment(segments[2*t], segments[2*t+1]), &ca, &cb, &caEnd, &cbEnd);
+            dist = std::min(dist, Geom::dist(ca, cb));
+          }
+          REQUIRE(fabs(spacings[s] - std::max(dist / 2, 1.0f)) < 1e-3);
+        }
+      }
+
+      THEN("the samples span each segment at no more than its spacing.") {
+        vector<floatn> samples;
+        REQUIRE(SampleSegments_s(segments, spacings, samples) == CL_SUCCESS);
+        int k = 0;
+        for (int s = 0; s < labels.size(); ++s) {
+          REQUIRE(Geom::dist(samples[k], segments[2*s]) < 1e-3);
+          while (Geom::dist(samples[k], segments[2*s+1]) > 1e-3) {
+            REQUIRE(Geom::dist(samples[k], samples[k+1]) <= spacings[s] + 1e-3);
+            ++k;
+          }
+          ++k;
+        }
+        REQUIRE(k == samples.size());
+
+        AND_THEN("a single octree of the samples has no leaf crossed by two labels.") {
+          vector<intn> points;
+          for (const floatn& p : samples) {
+            points.push_back(make_intn(p.x, p.y));
+          }
+          vector<OctNode> octree = BuildHostOctree(points, sampleBits);
+          vector<SegmentCell> cells;
+          REQUIRE(SegmentCells_s(octree, segments, cells, sampleBits) == CL_SUCCESS);
+          vector<int> cellLabels(octree.size() << DIM, -1);
+          int numConflicts = 0;
+          for (const SegmentCell& c : cells) {
+            const int label = labels[c.segment];
+            if (cellLabels[c.cell] != -1 && cellLabels[c.cell] != label)
+              ++numConflicts;
+            cellLabels[c.cell] = label;
+          }
+          REQUIRE(numConflicts == 0);
+        }
+
+        AND_THEN("the samples found in parallel are the same as the ones found in serial.") {
+          vector<floatn> gpuSamples;
+          REQUIRE(SampleSegments_p(segments, spacings, gpuSamples) == CL_SUCCESS);
+          REQUIRE(gpuSamples.size() == samples.size());
+          for (int i = 0; i < samples.size(); ++i) {
+            REQUIRE(Geom::dist(gpuSamples[i], samples[i]) < 1e-3);
+          }
+        }
+      }
+    }
+  }
+}
+
+SCENARIO("Point sets can be stored in binary files and mapped without parsing") {
+  cout << "Testing binary point files" << endl;
+  GIVEN("a few random 2D points") {
+    const int fileBits = 10;
+    const Resln resln = make_resln(1 << fileBits);
+    vector<floatn> points;
+    for (int i = 0; i < OneThousand; ++i) {
+      points.push_back(make_floatn((rand() % 2000) / 100.0f - 10, (rand() % 1000) / 100.0f));
+    }
+    const std::string filename = "points_test.pts";
+    WritePointFile(filename, &points[0].s[0], points.size(), 2);
+
+    THEN("the mapped points and their bounding box are the ones written.") {
+      const MappedPointFile file(filename);
+      REQUIRE(file.dim() == 2);
+      REQUIRE(file.size() == points.size());
+      REQUIRE(file.quantized() == false);
+      REQUIRE(file.ints() == nullptr);
+      BoundingBox<floatn> bb;
+      for (int i = 0; i < points.size(); ++i) {
+        REQUIRE(file.floatn_points()[i].x == points[i].x);
+        REQUIRE(file.floatn_points()[i].y == points[i].y);
+        bb(points[i]);
+      }
+      REQUIRE(file.bounding_box().min().x == bb.min().x);
+      REQUIRE(file.bounding_box().max().y == bb.max().y);
+      REQUIRE_THROWS(file.intn_points());
+
+      AND_THEN("they quantize as the points in memory do.") {
+        const BoundingBox<floatn> fileBB = file.bounding_box();
+        const vector<intn> mapped = Karras::Quantize(file.floatn_points(), file.size(), resln, &fileBB);
+        const vector<intn> expected = Karras::Quantize(points, resln);
+        REQUIRE(mapped.size() == expected.size());
+        for (int i = 0; i < mapped.size(); ++i) {
+          REQUIRE(mapped[i].x == expected[i].x);
+          REQUIRE(mapped[i].y == expected[i].y);
+        }
+      }
+    }
+
+    THEN("pre-quantized points can be mapped as intn.") {
+      const vector<intn> qpoints = Karras::Quantize(points, resln);
+      WritePointFile(filename, &qpoints[0].s[0], qpoints.size(), 2);
+      const MappedPointFile file(filename);
+      REQUIRE(file.quantized() == true);
+      for (int i = 0; i < qpoints.size(); ++i) {
+        REQUIRE(file.intn_points()[i].x == qpoints[i].x);
+        REQUIRE(file.intn_points()[i].y == qpoints[i].y);
+      }
+    }
+    std::remove(filename.c_str());
+  }
+
+  GIVEN("a text point set and an OBJ file") {
+    const std::string dat = "points_test.dat";
+    const std::string obj = "points_test.obj";
+    const std::string out = "points_test.pts";
+    {
+      std::ofstream d(dat.c_str());
+      d << "-0.4 -0.8\n0.2 0\n\n-0.8 0.8\n";
+      std::ofstream o(obj.c_str());
+      o << "# cube corner\nv 0 0 0\nv 1 0 0\nvn 0 0 1\nv 1 1 0.5\nf 1 2 3\n";
+    }
+
+    THEN("each converts to a point file of its vertices.") {
+      REQUIRE(ConvertToPointFile(dat, out) == 3);
+      {
+        const MappedPointFile file(out);
+        REQUIRE(file.dim() == 2);
+        REQUIRE(file.floats()[4] == -0.8f);
+        REQUIRE(file.floats()[5] == 0.8f);
+      }
+      REQUIRE(ConvertToPointFile(obj, out) == 3);
+      {
+        const MappedPointFile file(out);
+        REQUIRE(file.dim() == 3);
+        REQUIRE(file.floats()[8] == 0.5f);
+        REQUIRE(file.header().bb_max[0] == 1);
+      }
+    }
+
+    THEN("a file that isn't a point file is rejected.") {
+      REQUIRE_THROWS(MappedPointFile(dat.c_str()));
+    }
+    std::remove(dat.c_str());
+    std::remove(obj.c_str());
+    std::remove(out.c_str());
+  }
+}
+
+SCENARIO("OBJ meshes can be parsed in parallel chunks") {
+  cout << "Testing the OBJ parser" << endl;
+  GIVEN("an OBJ text with quads, polylines, relative indices and comments") {
+    // Each block of four vertices gets a quad with texture and normal
+    // indices, a triangle with relative indices and a polyline
+    std::stringstream ss;
+    vector<float> coords;
+    const int numBlocks = 20 * OneThousand;
+    ss << "# test mesh\r\nmtllib test.mtl\r\n";
+    for (int b = 0; b < numBlocks; ++b) {
+      for (int i = 0; i < 4; ++i) {
+        char c[3][32];
+        for (int d = 0; d < 3; ++d) {
+          const float x = (rand() % 2000000 - 1000000) / 1000.0f;
+          sprintf(c[d], (d == 2) ? "%.6e" : "%g", x);
+          coords.push_back(strtof(c[d], 0));
+        }
+        ss << "v " << c[0] << " " << c[1] << "\t" << c[2] << "\r\n";
+        ss << "vn 0 0 1\r\n";
+      }
+      const int v = 4 * b + 1;
+      ss << "f " << v << "/1/" << v << " " << v+1 << "//1 " << v+2 << "/2 " << v+3 << "\r\n";
+      ss << "f -4 -3 -1 # relative\r\n";
+      ss << "l " << v << " " << v+1 << " " << v+3 << "\r\n";
+    }
+    const std::string text = ss.str();
+
+    THEN("one thread and many threads give the same contiguous arrays.") {
+      ObjFile::Mesh serial, parallel;
+      ObjFile::Parse(text.data(), text.data() + text.size(), serial, 1);
+      ObjFile::Parse(text.data(), text.data() + text.size(), parallel, 8);
+      REQUIRE(serial.vertices.size() == 4 * numBlocks);
+      REQUIRE(serial.numTriangles() == 3 * numBlocks);
+      REQUIRE(serial.numSegments() == 2 * numBlocks);
+      REQUIRE(parallel.vertices.size() == serial.vertices.size());
+      REQUIRE(parallel.triangles == serial.triangles);
+      REQUIRE(parallel.segments == serial.segments);
+      for (int i = 0; i < serial.vertices.size(); ++i) {
+        for (int d = 0; d < 3; ++d) {
+          REQUIRE(serial.vertices[i].s[d] == coords[i*3 + d]);
+          REQUIRE(parallel.vertices[i].s[d] == coords[i*3 + d]);
+        }
+      }
+      for (int b = 0; b < numBlocks; ++b) {
+        const int v = 4 * b;
+        const int* t = &parallel.triangles[9 * b];
+        REQUIRE(t[0] == v); REQUIRE(t[1] == v+1); REQUIRE(t[2] == v+2);
+        REQUIRE(t[3] == v); REQUIRE(t[4] == v+2); REQUIRE(t[5] == v+3);
+        REQUIRE(t[6] == v); REQUIRE(t[7] == v+1); REQUIRE(t[8] == v+3);
+        const int* s = &parallel.segments[4 * b];
+        REQUIRE(s[0] == v); REQUIRE(s[1] == v+1);
+        REQUIRE(s[2] == v+1); REQUIRE(s[3] == v+3);
+      }
+    }
+  }
+
+  GIVEN("malformed OBJ records") {
+    const std::string badIndex = "v 0 0 0\nv 1 0 0\nv 0 1 0\nf 1 2 4\n";
+    const std::string badRelative = "v 0 0 0\nf -1 -2 -3\nv 1 0 0\nv 0 1 0\n";
+    const std::string badNumber = "v 0 0 0\nv 1 x 0\n";
+    THEN("parsing throws.") {
+      ObjFile::Mesh mesh;
+      REQUIRE_THROWS(ObjFile::Parse(badIndex.data(), badIndex.data() + badIndex.size(), mesh));
+      REQUIRE_THROWS(ObjFile::Parse(badRelative.data(), badRelative.data() + badRelative.size(), mesh));
+      REQUIRE_THROWS(ObjFile::Parse(badNumber.data(), badNumber.data() + badNumber.size(), mesh));
+    }
+  }
+}
+
+SCENARIO("Octrees can be stored in binary files and used in place") {
+  cout << "Testing binary octree files" << endl;
+  GIVEN("an octree of random points with its cell points and point order") {
+    using namespace Kernels;
+    const int fileBits = 16;
+    const Resln resln = make_resln(1 << fileBits);
+    vector<intn> points;
+    AddRandomPoints(2000, fileBits, points);
+    vector<OctNode> octree = BuildHostOctree(points, fileBits);
+    vector<int> cellPoints, permutation;
+    Karras::MapPointsToCells(points, octree, resln, cellPoints);
+    Karras::SortPermutation(points, resln, permutation);
+    const BoundingBox<floatn> bb(make_floatn(-1, -2), make_floatn(3, 4));
+    const std::string filename = "octree_test.oct";
+    WriteOctreeFile(filename, octree, resln, bb, cellPoints, permutation);
+
+    THEN("the mapped file holds the same octree, payloads and permutation.") {
+      const MappedOctreeFile file(filename);
+      REQUIRE(file.dim() == DIM);
+      REQUIRE(file.format() == kOctreeFileOctNode);
+      REQUIRE(file.size() == octree.size());
+      REQUIRE(file.resln().width == resln.width);
+      REQUIRE(file.resln().volume == resln.volume);
+      REQUIRE(file.bounding_box().min().y == -2);
+      REQUIRE(file.bounding_box().max().x == 3);
+      const OctNode* nodes = file.nodes<OctNode>();
+      REQUIRE(reinterpret_cast<uintptr_t>(nodes) % 64 == 0);
+      for (int i = 0; i < octree.size(); ++i) {
+        REQUIRE(compareOctNode(const_cast<OctNode*>(&nodes[i]), &octree[i]));
+      }
+      REQUIRE(file.num_payloads() == cellPoints.size());
+      REQUIRE(std::equal(cellPoints.begin(), cellPoints.end(), file.payloads<int>()));
+      REQUIRE(file.num_points() == points.size());
+      REQUIRE(std::equal(permutation.begin(), permutation.end(), file.permutation()));
+      REQUIRE_THROWS(file.nodes<CompactNode>());
+      REQUIRE_THROWS(file.payloads<intn>());
+
+      AND_THEN("points are located in the mapped nodes as in memory.") {
+        for (int i = 0; i < points.size(); ++i) {
+          const OctCell a = OctreeUtils::FindLeaf(points[i], nodes, resln);
+          const OctCell b = OctreeUtils::FindLeaf(points[i], octree, resln);
+          REQUIRE(a.get_parent_idx() == b.get_parent_idx());
+          REQUIRE(a.get_octant() == b.get_octant());
+          REQUIRE(file.payloads<int>()[make_cell_index(a.get_parent_idx(), a.get_octant())] == cellPoints[make_cell_index(b.get_parent_idx(), b.get_octant())]);
+        }
+      }
+    }
+
+    THEN("the permutation sorts the points in z-order.") {
+      REQUIRE(permutation.size() == points.size());
+      vector<int> seen(points.size(), 0);
+      for (int i = 0; i < permutation.size(); ++i) {
+        ++seen[permutation[i]];
+        if (i > 0) {
+          BigUnsigned a, b;
+          xyz2z(&a, points[permutation[i-1]], fileBits);
+          xyz2z(&b, points[permutation[i]], fileBits);
+          REQUIRE(compareBU(&a, &b) <= 0);
+        }
+      }
+      REQUIRE(std::count(seen.begin(), seen.end(), 1) == points.size());
+    }
+
+    THEN("a compact octree without extra sections can be stored as well.") {
+      vector<CompactNode> compact;
+      REQUIRE(OctreeToCompact_s(octree, compact) == CL_SUCCESS);
+      WriteOctreeFile(filename, compact, resln, bb);
+      const MappedOctreeFile file(filename);
+      REQUIRE(file.format() == kOctreeFileCompactNode);
+      REQUIRE(file.payloads<int>() == nullptr);
+      REQUIRE(file.permutation() == nullptr);
+      for (int i = 0; i < points.size(); i += 10) {
+        const OctCell a = OctreeUtils::FindLeaf(points[i], file.nodes<CompactNode>(), resln);
+        const OctCell b = OctreeUtils::FindLeaf(points[i], compact, resln);
+        REQUIRE(a.get_parent_idx() == b.get_parent_idx());
+        REQUIRE(a.get_octant() == b.get_octant());
+      }
+    }
+
+    THEN("files of another version or type are rejected.") {
+      {
+        std::fstream f(filename.c_str(), std::ios::in | std::ios::out | std::ios::binary);
+        const uint32_t version = 2;
+        f.seekp(8);
+        f.write(reinterpret_cast<const char*>(&version), sizeof(version));
+      }
+      REQUIRE_THROWS(MappedOctreeFile(filename.c_str()));
+      vector<floatn> fpoints(1, make_floatn(0, 0));
+      WritePointFile(filename, &fpoints[0].s[0], fpoints.size(), 2);
+      REQUIRE_THROWS(MappedOctreeFile(filename.c_str()));
+    }
+    std::remove(filename.c_str());
+  }
+}
+
 TEST_CASE("Parallel octree generation stress test.") {
   cout << "Octree stress test" << endl;
   GIVEN("a fully initialized CLFW environment") {
@@ -57,6 +57,10 @@ TEST_CASE("Using a vector of filenames, CLFW can create an OpenCL Program") {
       "./opencl/C/ParallelAlgorithms.c",
       "./opencl/C/BuildBRT.c",
       "./opencl/C/BuildOctree.c",
+      "./opencl/C/CellWalk.c",
+      "./opencl/C/GVD.c",
+      "./opencl/C/FitBoxes.c",
+      "./opencl/C/Sampling.c",
       "./opencl/Kernels/kernels.cl"
     };
     THEN("We can use that vector of filenames to create a vector of sources ") {
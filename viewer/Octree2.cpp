@@ -1,14 +1,17 @@
 #include <iostream>
 #include <fstream>
 #include <sstream>
+#include <algorithm>
 
+#include "../Parallel.h"
 #include "./Octree2.h"
 #include "../Karras.h"
+#include "../opencl/Kernels.h"
 #include "../opencl/Geom.h"
 
 OctCell fnode;
 
-Octree2::Octree2() {
+Octree2::Octree2() : insert_spacing(0) {
   const int n = 4;
   glm::vec3 drawVertices[n];
   drawVertices[0] = glm::vec3(-0.5, -0.5, 0);
@@ -97,6 +100,9 @@ void Octree2::build(const vector<float2>& points,
   bb = BoundingBox<float2>();
   extra_qpoints.clear();
   octree.clear();
+  octree_points = Karras::OctreePoints();
+  line_points.clear();
+  line_segments.clear();
 
   karras_points = points;
 
@@ -111,9 +117,13 @@ void Octree2::build(const vector<float2>& points,
 
   vector<intn> qpoints = Karras::Quantize(karras_points, resln, &bb);
   if (qpoints.size() > 1) {
-    octree = Karras::BuildOctreeInParallel(qpoints, resln, false);
+    octree = options.balance ?
+        Karras::BuildBalancedOctreeInParallel(qpoints, resln, level_offsets) :
+        Karras::BuildOctreeInParallel(qpoints, resln, level_offsets, false);
+    Karras::BuildOctreeLinks(octree, links);
   } else {
     octree.clear();
+    level_offsets.clear();
   }
 
   for (int i = 0; i < qpoints.size(); ++i) {
@@ -124,6 +134,39 @@ void Octree2::build(const vector<float2>& points,
  // buildOctVertices();
 }
 
+// Inserts the points appended since the last build, and samples of the
+// segments appended, into the octree. Returns false if the octree has to be
+// rebuilt instead: it is balanced or has no points, an existing point
+// changed, or a new point is outside the padded frame that the points are
+// quantized in.
+bool Octree2::insertPoints(const vector<float2>& points,
+                           const vector<floatn>& segments) {
+  if (octree_points.qpoints.empty() || points.size() <= line_points.size()
+      || segments.size() < line_segments.size())
+    return false;
+  if (!std::equal(line_points.begin(), line_points.end(), points.begin())
+      || !std::equal(line_segments.begin(), line_segments.end(),
+                     segments.begin()))
+    return false;
+
+  vector<floatn> added(points.begin() + line_points.size(), points.end());
+  if (insert_spacing > 0 && segments.size() > line_segments.size()) {
+    const vector<floatn> drawn(
+        segments.begin() + line_segments.size(), segments.end());
+    const vector<float> spacings(drawn.size() / 2, insert_spacing);
+    vector<floatn> samples;
+    Kernels::SampleSegments_s(drawn, spacings, samples);
+    added.insert(added.end(), samples.begin(), samples.end());
+  }
+  if (!Karras::InsertPoints(added, octree_points, octree, links, resln))
+    return false;
+  karras_points.insert(karras_points.end(), added.begin(), added.end());
+  line_points = points;
+  line_segments = segments;
+  level_offsets.clear();
+  return true;
+}
+
 void Octree2::build(const Polylines& lines,
                     const BoundingBox<float2>* customBB) {
   using namespace std;
@@ -139,63 +182,138 @@ void Octree2::build(const Polylines& lines,
 //   }
 // #endif
 
+  // Get all vertices into a 1D array, and the segments between them.
+  const vector<vector<float2>>& polygons = lines.getPolygons();
+  vector<float2> points;
+  vector<floatn> objSegments;
+  for (int i = 0; i < polygons.size(); ++i) {
+    const vector<float2>& polygon = polygons[i];
+    for (int j = 0; j < polygon.size()-1; ++j) {
+      points.push_back(polygon[j]);
+      objSegments.push_back(polygon[j]);
+      objSegments.push_back(polygon[j+1]);
+    }
+    points.push_back(polygon.back());
+  }
+
+  // Points drawn with the mouse are appended one at a time, so usually the
+  // octree only needs the new points inserted.
+  if (!customBB && insertPoints(points, objSegments)) {
+    buildOctVertices();
+    return;
+  }
+
   karras_points.clear();
   bb = BoundingBox<float2>();
   extra_qpoints.clear();
   octree.clear();
+  octree_points = Karras::OctreePoints();
+  line_points.clear();
+  line_segments.clear();
+  insert_spacing = 0;
 
-  const vector<vector<float2>>& polygons = lines.getPolygons();
   if (polygons.empty()) {
     buildOctVertices();
     return;
   }
+  karras_points = points;
 
-  // Get all vertices into a 1D array (karras_points).
-  for (int i = 0; i < polygons.size(); ++i) {
-    const vector<float2>& polygon = polygons[i];
-    for (int j = 0; j < polygon.size()-1; ++j) {
-      karras_points.push_back(polygon[j]);
-    }
-    karras_points.push_back(polygon.back());
-  }
-
-  // Compute bounding box
+  // Compute bounding box. The points are quantized in a frame padded around
+  // them, so that points drawn nearby can be inserted in the same frame.
   if (customBB) {
     bb = *customBB;
   } else {
     for (int i = 0; i < karras_points.size(); ++i) {
       bb(karras_points[i]);
     }
+    bb = Karras::PaddedFrame(bb);
   }
   
-  // Karras iterations
-  vector<intn> qpoints = Karras::Quantize(karras_points, resln);
-  int iterations = 0;
-  do {
-    qpoints.insert(qpoints.end(), extra_qpoints.begin(), extra_qpoints.end());
-    for (const intn& qp : extra_qpoints) {
-      karras_points.push_back(oct2Obj(qp));
+  vector<floatn> segments;
+  vector<int> labels;
+  for (int j = 0; j < polygons.size(); ++j) {
+    const vector<float2>& polygon = polygons[j];
+    for (int i = 0; i < polygon.size() - 1; ++i) {
+      segments.push_back(obj2Oct(polygon[i]));
+      segments.push_back(obj2Oct(polygon[i+1]));
+      labels.push_back(j);
     }
-    extra_qpoints.clear();
-    if (qpoints.size() > 1) {
-      octree = Karras::BuildOctreeInParallel(qpoints, resln, true);
+  }
+
+  // Sample the segments densely enough that polygons end up in different
+  // leaves without refinement iterations. Segments drawn later are sampled
+  // at the smallest of these spacings.
+  if (options.sample_segments && !segments.empty()) {
+    vector<float> spacings;
+    OctreeUtils::SampleSpacings(segments, labels, resln, spacings);
+    const float scale = bb.max_size() / resln.width;
+    for (float& s : spacings) {
+      s *= scale;
     }
-    else {
-      octree.clear();
+    insert_spacing = *std::min_element(spacings.begin(), spacings.end());
+    vector<floatn> samples;
+    if (options.gpu) {
+      Kernels::SampleSegments_p(objSegments, spacings, samples);
+    } else {
+      Kernels::SampleSegments_s(objSegments, spacings, samples);
     }
-    //FindMultiCells(lines);
+    karras_points.insert(karras_points.end(), samples.begin(), samples.end());
+  }
+
+  // Karras iterations
+  vector<intn> qpoints = Karras::Quantize(karras_points, resln, &bb);
+  if (options.karras_iterations > 1 && !options.balance && qpoints.size() > 1) {
+    // Refine on the device until the segments of different polygons are
+    // in different leaves.
+    octree = Karras::BuildRefinedOctreeInParallel(
+        qpoints, segments, labels, resln, options.karras_iterations,
+        level_offsets, true);
+    Karras::BuildOctreeLinks(octree, links);
+    // Refinement can't be repeated for each insert, so segments drawn later
+    // are sampled at the width of the smallest leaf instead.
+    const int depth =
+        *std::max_element(links.levels.begin(), links.levels.end()) + 1;
+    const float leaf_width = oct2Obj(resln.width >> depth);
+    if (insert_spacing == 0 || leaf_width < insert_spacing)
+      insert_spacing = leaf_width;
+  } else {
+    int iterations = 0;
+    do {
+      qpoints.insert(qpoints.end(), extra_qpoints.begin(), extra_qpoints.end());
+      for (const intn& qp : extra_qpoints) {
+        karras_points.push_back(oct2Obj(qp));
+      }
+      extra_qpoints.clear();
+      if (qpoints.size() > 1) {
+        octree = options.balance ?
+            Karras::BuildBalancedOctreeInParallel(qpoints, resln, level_offsets, true) :
+            Karras::BuildOctreeInParallel(qpoints, resln, level_offsets, true);
+        Karras::BuildOctreeLinks(octree, links);
+      }
+      else {
+        octree.clear();
+        level_offsets.clear();
+      }
+      //FindMultiCells(lines);
+
+      ++iterations;
+    } while (iterations < options.karras_iterations && !extra_qpoints.empty());
+  }
 
-    ++iterations;
-  } while (iterations < options.karras_iterations && !extra_qpoints.empty());
+  // Balancing adds cells that no point needs, so a balanced octree is
+  // rebuilt rather than inserted into.
+  if (!options.balance) {
+    Karras::MapOctreePoints(qpoints, bb, octree, resln, octree_points);
+    line_points = points;
+    line_segments = objSegments;
+  }
   //cout << "Karras iterations: " << iterations << endl;
 
   // Count the number of cells with multiple intersections
   int count = 0;
-  for (int i = 0; i < cell_intersections.size(); ++i) {
-    for (int j = 0; j < 4; ++j) {
-      if (cell_intersections[i].is_multi(j)) {
-        ++count;
-      }
+  for (int i = 0; i < cell_labels.size(); ++i) {
+    if (cell_labels.is_multi(i)) {
+      ++count;
     }
   }
   //cout << "Number of multi-intersection cells: " << count << endl;
@@ -256,68 +374,6 @@ void Octree2::Find(const float2& p) {
   // glutPostRedisplay();
 }
 
-// Cell walk visitor
-// typedef void (*cwv)(Karras::OctCell, const intn& a, const intn& b,
-typedef void (*cwv)(OctCell, const floatn& a, const floatn& b,
-    const vector<OctNode>& octree, const Resln& resln, void* data);
-
-// Given a segment a-b, visit each octree cell that it intersects.
-void CellWalk(
-    const floatn& a, const floatn& b,
-    const vector<OctNode>& octree, const Resln& resln,
-    cwv v, void* data) {
-  using namespace Karras;
-
-  int dir[DIM];
-  for (int i = 0; i < DIM; ++i) {
-    if (b.s[i] > a.s[i]) dir[i] = 1;
-    else if (b.s[i] < a.s[i]) dir[i] = -1;
-    else dir[i] = 0;
-  }
-  OctreeUtils::CellIntersection cur(0, a);
-  const OctCell bcell = OctreeUtils::FindLeaf(convert_intn(b),
-                                                 octree, resln);
-  vector<OctreeUtils::CellIntersection> local_intersections;
-  vector<OctreeUtils::CellIntersection> all_intersections;
-  bool done = false;
-  int count = 0;
-  OctCell cell =
-      OctreeUtils::FindLeaf(convert_intn(cur.p), octree, resln);
-  do {
-    ++count;
-    if (count > 10000)
-      throw logic_error("Infinite loop");
-    v(cell, a, b, octree, resln, data);
-
-    const vector<OctreeUtils::CellIntersection> local_intersections =
-        OctreeUtils::FindIntersections(a, b, cell, /*octree,*/ resln);
-    for (const OctreeUtils::CellIntersection& i : local_intersections) {
-      if (i.t > cur.t) {
-        cur = i;
-      }
-    }
-    for (int i = 0; i < DIM; ++i) {
-      const int end = cell.get_origin().s[i];
-      if (cur.p.s[i] == end && cur.p.s[i] != 0 && dir[i] == -1) {
-        --cur.p.s[i];
-      }
-    }
-
-    OctCell new_cell = OctreeUtils::FindLeaf(
-        convert_intn(cur.p), octree, resln);
-    done = local_intersections.empty() ||
-        (cell.get_origin() == bcell.get_origin()) ||
-        (new_cell.get_origin() == cell.get_origin());
-    cell = new_cell;
-  } while (!done);
-}
-
-struct MCData {
-  MCData(vector<CellIntersections>& labels_) : labels(labels_) {}
-  vector<CellIntersections>& labels;
-  int cur_label;
-};
-
 void write_seg(const floatn& a, const floatn& b, const string& fn) {
   using namespace std;
   ofstream out(fn);
@@ -329,180 +385,78 @@ void write_seg(const FloatSegment& s, const string& fn) {
   write_seg(s.a(), s.b(), fn);
 }
 
-void write_cell(const intn& o, const int& w, const string& fn) {
-  ofstream out(fn);
-  out << o << endl;
-  out << o+make_intn(w, 0) << endl;
-  out << o+make_intn(w, w) << endl;
-  out << o+make_intn(0, w) << endl;
-  out << o << endl;
-  out.close();
-}
-
-void error_log(OctCell cell, const floatn& a, const floatn& b,
-               const vector<OctNode>& octree, const Resln& resln) {
-  cerr << "a = " << std::fixed << a << endl;
-  cerr << "b = " << std::fixed << b << endl;
-  cerr << "cell = " << cell << endl;
-  //cerr << "resln = " << resln << endl;
-  ofstream out("mccallback.err");
-  //out << cell << " " << a << " " << b << " " << octree << " " << resln << endl;
-  out.close();
-  write_seg(a, b, "data1.dat");
-  const intn o = cell.get_origin();
-  const int w = cell.get_width();
-  write_cell(o, w, "data2.dat");
-  const int w2 = w/2;
-  // Boundary
-  write_cell(o-make_intn(w2, w2), 2*w, "data3.dat");
-}
-
-inline bool within(const float& a, const float& b, const float& epsilon) {
-  return fabs(a-b) < epsilon;
-}
-
-// Multi-cell callback. Finds intersections with the current cell and
-// stores results in data.
-void MCCallback(OctCell cell, const floatn& a, const floatn& b,
-                  const vector<OctNode>& octree, const Resln& resln,
-                  void* data) {
-  // const static float EPSILON = 1e-6;
-
-  using namespace Karras;
-  MCData* d = static_cast<MCData*>(data);
-  const int octant = cell.get_octant();
-
-  // // debug
-  // OctCell test_cell;
-  // stringstream ss("8796416 6561024 256 22009 3 -1");
-  // ss >> test_cell;
-  // if (cell == test_cell || cell == fnode) {
-  //   cout << "here in MCCallback" << endl;
-  // }
-
-  // Get the intersections between the segment and octree cell.
-  const vector<OctreeUtils::CellIntersection> intersections =
-      OctreeUtils::FindIntersections(a, b, cell, /*octree,*/ resln);
-  if (intersections.size() > 2) {
-    error_log(cell, a, b, octree, resln);
-    cerr << "More than 2 intersections with a cell" << endl;
-    for (const OctreeUtils::CellIntersection& ci : intersections) {
-      cerr << "  " << ci.p << endl;
-    }
-    throw logic_error("More than 2 intersections with a cell");
-  }
-  if (intersections.size() == 2) {
-    FloatSegment seg(intersections[0].p,
-                  intersections[1].p);
-    CellIntersections& cell_intersections = d->labels[cell.get_parent_idx()];
-    cell_intersections.set(octant, d->cur_label, seg);
-  } else if (intersections.size() == 1) {
-    // Find which endpoint is in cell
-    const BoundingBox<intn> bb = cell.bb();
-    const floatn p = intersections[0].p;
-    floatn q;
-    bool degenerate = false;
-    // if (bb.in_half_open(convert_intn(a), EPSILON)) {
-    if (bb.in_half_open(convert_intn(a))) {
-      q = a;
-    // } else if (bb.in_half_open(convert_intn(b), EPSILON)) {
-    } else if (bb.in_half_open(convert_intn(b))) {
-      q = b;
-    } else if ((within(p.x, bb.min().x, EPSILON) ||
-                within(p.x, bb.max().x, EPSILON)) &&
-               (within(p.y, bb.min().y, EPSILON) ||
-                within(p.y, bb.max().y, EPSILON))) {
-      degenerate = true;
-    } else {
-      degenerate = true;
-      // error_log(cell, a, b, octree, resln);
-      // throw logic_error("Only one intersection but neither endpoint is"
-      //                   " in bounding box");
-    }
-    if (!degenerate) {
-      FloatSegment seg(p, q);
-      CellIntersections& cell_intersections = d->labels[cell.get_parent_idx()];
-      cell_intersections.set(octant, d->cur_label, seg);
-    }
-  }
-}
-
 void Octree2::FindMultiCells(const Polylines& lines) {
   using namespace Karras;
 
-  cell_intersections.clear();
-  cell_intersections.resize(octree.size(), CellIntersections());
-  MCData data(cell_intersections);
+  cell_labels = CellLabels();
+  intersections.clear();
 
   const vector<vector<float2>>& polygons = lines.getPolygons();;
 
-  // For each line segment in each polygon do a cell walk, updating
-  // the cell_intersections structure.
-  intersections.clear();
+  // Endpoints and label of every segment
+  vector<floatn> segments;
+  vector<int> labels;
   for (int j = 0; j < polygons.size(); ++j) {
-    const std::vector<float2>& polygon = polygons[j];
-    data.cur_label = j;
-    for (int i = 0; i < polygon.size() - 1; ++i) {
-      const floatn a = obj2Oct(polygon[i]);
-      const floatn b = obj2Oct(polygon[i+1]);
-      // Visit each octree cell intersected by segment a-b. The visitor
-      // is MCCallback.
-      CellWalk(a, b, octree, resln, MCCallback, &data);
-      vector<OctreeUtils::CellIntersection> local = Walk(a, b);
-      for (const OctreeUtils::CellIntersection& ci : local) {
-        intersections.push_back(ci.p);
-      }
+    for (int i = 0; i < polygons[j].size() - 1; ++i) {
+      segments.push_back(obj2Oct(polygons[j][i]));
+      segments.push_back(obj2Oct(polygons[j][i+1]));
+      labels.push_back(j);
     }
   }
+  if (labels.empty() || octree.empty()) return;
+
+  // Do a cell walk for each line segment
+  vector<CellLabel> records;
+  OctreeUtils::FindMultiCells(segments, labels, octree, links, resln,
+                              records, intersections);
+  cell_labels = CellLabels(records, octree.size() << DIM);
 
   // Find points that we want to add in order to run a more effective
-  // Karras octree construction.
+  // Karras octree construction. Boxes are fit between every pair of labels
+  // of every cell at once.
   extra_qpoints.clear();
   _origins.clear();
   _lengths.clear();
-  for (int i = 0; i < octree.size(); ++i) {
-    const CellIntersections& intersection = cell_intersections[i];
-    for (int octant = 0; octant < (1<<DIM); ++octant) {
-      const int num_labels = intersection.num_labels(octant);
-      // cout << "cell = " << i << "/" << octant << ": " << num_labels << endl;
-      // if (intersection.is_multi(octant)) {
-      //   {
-      for (int j = 0; j < num_labels; ++j) {
-      // for (int j = 0; j < 1; ++j) {
-        for (int k = j+1; k < num_labels; ++k) {
-        // for (int k = j+1; k < std::min(2, num_labels); ++k) {
-          // We'll compare segments at j and k.
-          FloatSegment segs[2] = { intersection.seg(j, octant),
-                                intersection.seg(k, octant) };
-          vector<floatn> samples;
-          vector<floatn> origins;
-          vector<float> lengths;
-          if (!Geom::multi_intersection(segs[0], segs[1])) {
-            try {
-              if (i == fnode.get_parent_idx() && octant == fnode.get_octant()) {
-                cout << "here in FitBoxes" << endl;
-                write_seg(segs[0], "seg0.dat");
-                write_seg(segs[1], "seg1.dat");
-              }
-              Geom::FitBoxes(segs[0], segs[1], 1, &samples, &origins, &lengths);
-            } catch(logic_error& e) {
-              cerr << "segments: " << segs[0] << " " << segs[1] << endl;
-              cerr << "labels: " << intersection.label(0, octant)
-                   << " " << intersection.label(1, octant) << endl;
-              write_seg(segs[0], "seg0.dat");
-              write_seg(segs[1], "seg1.dat");
-              throw e;
-            }
-          }
-          _origins.insert(_origins.end(), origins.begin(), origins.end());
-          _lengths.insert(_lengths.end(), lengths.begin(), lengths.end());
-          for (const floatn& sample : samples) {
-            extra_qpoints.push_back(convert_intn(sample));
-          }
+  vector<FloatSegment> pairs;
+  for (int i = 0; i < cell_labels.size(); ++i) {
+    const int num_labels = cell_labels.num_labels(i);
+    for (int j = 0; j < num_labels; ++j) {
+      for (int k = j+1; k < num_labels; ++k) {
+        // We'll compare segments at j and k.
+        pairs.push_back(cell_labels.seg(j, i));
+        pairs.push_back(cell_labels.seg(k, i));
+        if (cell_node(i) == fnode.get_parent_idx() &&
+            cell_octant(i) == fnode.get_octant()) {
+          cout << "here in FitBoxes" << endl;
+          write_seg(pairs[pairs.size()-2], "seg0.dat");
+          write_seg(pairs[pairs.size()-1], "seg1.dat");
         }
       }
     }
   }
+  vector<floatn> samples;
+  try {
+    Geom::FitBoxes(pairs, 1, &samples, &_origins, &_lengths);
+  } catch(logic_error& e) {
+    // Find the first pair that fails
+    for (int i = 0; i < pairs.size(); i += 2) {
+      vector<floatn> s, o;
+      vector<float> l;
+      try {
+        if (!Geom::multi_intersection(pairs[i], pairs[i+1]))
+          Geom::FitBoxes(pairs[i], pairs[i+1], 1, &s, &o, &l);
+      } catch(logic_error&) {
+        cerr << "segments: " << pairs[i] << " " << pairs[i+1] << endl;
+        write_seg(pairs[i], "seg0.dat");
+        write_seg(pairs[i+1], "seg1.dat");
+        break;
+      }
+    }
+    throw e;
+  }
+  for (const floatn& sample : samples) {
+    extra_qpoints.push_back(convert_intn(sample));
+  }
 }
 
 // void WalkCallback(Karras::OctCell cell, const intn& a, const intn& b,
@@ -517,7 +471,7 @@ void WalkCallback(OctCell cell, const floatn& a, const floatn& b,
   vector<CellIntersection>& all_intersections =
       *static_cast<vector<CellIntersection>*>(data);
 
-  const vector<CellIntersection> local_intersections =
+  const OctreeUtils::CellIntersectionList local_intersections =
       FindIntersections(a, b, cell, /*octree,*/ resln);
   for (const CellIntersection& i : local_intersections) {
     // const intn p = i.p;
@@ -531,7 +485,8 @@ vector<OctreeUtils::CellIntersection> Octree2::Walk(
   using namespace Karras;
 
   vector<OctreeUtils::CellIntersection> all_intersections;
-  CellWalk(a, b, octree, resln, WalkCallback, &all_intersections);
+  OctreeUtils::CellWalk(a, b, octree, links, resln, WalkCallback,
+                        &all_intersections);
 
   return all_intersections;
 }
@@ -602,7 +557,7 @@ void Octree2::drawNode(
       //   // glColor3d(0.5, 0, 0.5);
       //   // glSquare(oct2Obj(o), oct2Obj(length/2));
       // }
-//      if (cell_intersections[parent_idx].is_multi(i)) {
+//      if (cell_labels.is_multi(make_cell_index(parent_idx, i))) {
 //        // glLineWidth(5);
 //        // glColor3d(1, 0, 0);
 //      } else {
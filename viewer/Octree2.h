@@ -4,17 +4,31 @@
 #include "LinesProgram.h"
 #include "Polylines.h"
 #include "gl_utils.h"
-#include "CellIntersections.h"
+#include "CellLabels.h"
 #include "OctreeUtils.h"
 #include "BoundingBox.h"
 #include "Options.h"
 #include "Resln.h"
 #include "OctNode.h"
+#include "Karras.h"
 
 class Octree2 {
  private:
   std::vector<OctNode> octree;
-  std::vector<CellIntersections> cell_intersections;
+  // The octree is stored breadth first. See Karras::ReorderBreadthFirst.
+  // Empty once points have been inserted incrementally.
+  std::vector<int> level_offsets;
+  OctreeUtils::OctreeLinks links;
+  // The quantized karras_points. See Karras::InsertPoints. Its qpoints are
+  // empty if the octree can't be updated incrementally.
+  Karras::OctreePoints octree_points;
+  // Polyline vertices and segments, in object space, that the octree was
+  // built or updated from, and the spacing of the samples of segments drawn
+  // since. insert_spacing is 0 if drawn segments aren't sampled.
+  std::vector<float2> line_points;
+  std::vector<floatn> line_segments;
+  float insert_spacing;
+  CellLabels cell_labels;
   std::vector<floatn> intersections;
   std::vector<floatn> karras_points;
   std::vector<intn> extra_qpoints;
@@ -52,6 +66,9 @@ class Octree2 {
   GLfloat oct2Obj(int dist) const;
   glm::vec3 toVec3(float2 p) const;
 
+  bool insertPoints(const std::vector<float2>& points,
+                    const std::vector<floatn>& segments);
+
   void Find(const float2& p);
   void FindMultiCells(const Polylines& lines);
 
@@ -0,0 +1,28 @@
+#include <cstdlib>
+#include <iostream>
+#include <stdexcept>
+
+#include "../PointFile.h"
+
+using std::cerr;
+using std::cout;
+using std::endl;
+
+// Converts a text point set (data2/*.dat) or the vertices of an OBJ file
+// (data3/*.obj) to a binary point file. See PointFile.h.
+int main(int argc, char** argv) {
+  if (argc != 3) {
+    cerr << "Usage: " << argv[0] << " in.dat|in.obj out.pts" << endl;
+    return EXIT_FAILURE;
+  }
+  try {
+    const size_t n = ConvertToPointFile(argv[1], argv[2]);
+    const MappedPointFile file(argv[2]);
+    cout << "Wrote " << n << " " << file.dim() << "D points to " << argv[2]
+         << endl;
+  } catch (std::logic_error& e) {
+    cerr << e.what() << endl;
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}